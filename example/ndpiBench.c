@@ -0,0 +1,1100 @@
+/*
+ * ndpiBench.c
+ *
+ * Copyright (C) 2011-18 - ntop.org
+ *
+ * nDPI is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * nDPI is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with nDPI.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * Micro benchmarks of the nDPI hot paths.
+ *
+ * Packets are loaded in memory before the measurement, so that only the
+ * library code is timed. Every benchmark also checks that the compared
+ * code paths return the same results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <netinet/in.h>
+#endif
+#include <pcap.h>
+#include "ndpi_api.h"
+#include "../src/lib/third_party/include/ndpi_patricia.h"
+
+/*
+  The IP-based protocol list, as compiled in the library. The string
+  match tables are not used here and are renamed to avoid clashing with
+  the library symbols.
+*/
+#define host_match     bench_host_match
+#define content_match  bench_content_match
+#pragma GCC diagnostic ignored "-Wunused-variable"
+#include "../src/lib/ndpi_content_match.c.inc"
+#pragma GCC diagnostic warning "-Wunused-variable"
+#undef host_match
+#undef content_match
+
+#define MAX_BURST_SIZE   1024
+
+struct bench_packet {
+  u_int8_t *l3;
+  u_int16_t l3_len;
+  u_int64_t tick;
+};
+
+static struct bench_packet *packets = NULL;
+static struct ndpi_flow_table *flow_table = NULL; /* flow index + 1 */
+static u_int32_t num_packets = 0, num_flows = 0;
+static char *pcap_path = NULL, *protos_path = NULL, *snapshot_path = NULL;
+static u_int8_t use_snapshot = 0; /* init_module() loads snapshot_path */
+static u_int32_t burst_size = 32, num_loops = 5, num_addresses = 1000000;
+
+/* ********************************** */
+
+static void help() {
+  printf("ndpiBench burst -i <file.pcap> [-b <burst size>] [-l <loops>] [-p <protos>]\n"
+	 "ndpiBench lines -i <file.pcap> [-l <loops>]\n"
+	 "ndpiBench lpm [-n <addresses>] [-l <loops>]\n"
+	 "ndpiBench snapshot [-i <file.pcap>] [-l <loops>] [-p <protos>] [-S <file>]\n"
+	 "ndpiBench ssl -i <file.pcap> [-l <loops>]\n\n"
+	 "Benchmarks:\n"
+	 "  burst                     | ndpi_detection_process_packet_burst() vs\n"
+	 "                            | ndpi_detection_process_packet()\n"
+	 "  lines                     | ndpi_parse_packet_line_info() vs a byte by\n"
+	 "                            | byte parser on the TCP/UDP payloads\n"
+	 "  lpm                       | IP-based protocol lookups vs a patricia tree\n"
+	 "                            | holding the same networks\n"
+	 "  snapshot                  | Module initialization from a snapshot vs from\n"
+	 "                            | scratch (detection results compared with -i)\n"
+	 "  ssl                       | getSSLcertificate() vs the previous OID scan\n"
+	 "                            | on the TLS handshake payloads\n\n"
+	 "Options:\n"
+	 "  -i <file.pcap>            | Packets to process (comma separated list of files)\n"
+	 "  -b <burst size>           | Packets per burst (default %u, max %u)\n"
+	 "  -l <loops>                | Runs of each variant, the best one is reported (default %u)\n"
+	 "  -n <addresses>            | Addresses to look up (default %u)\n"
+	 "  -p <file>.protos          | Specify a protocol file (eg. protos.txt)\n"
+	 "  -S <file>                 | Snapshot file (default: temporary file)\n",
+	 burst_size, MAX_BURST_SIZE, num_loops, num_addresses);
+  exit(-1);
+}
+
+/* ********************************** */
+
+static u_int64_t usec_now() {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return((u_int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+/* ********************************** */
+
+static struct ndpi_detection_module_struct* init_module() {
+  struct ndpi_detection_module_struct *ndpi_struct = ndpi_init_detection_module();
+  NDPI_PROTOCOL_BITMASK all;
+
+  if(ndpi_struct == NULL) {
+    printf("Unable to initialize the detection module\n");
+    exit(-1);
+  }
+
+  NDPI_BITMASK_SET_ALL(all);
+  ndpi_set_protocol_detection_bitmask2(ndpi_struct, &all);
+
+  if(use_snapshot) {
+    if(ndpi_load_snapshot(ndpi_struct, snapshot_path) != 0) {
+      printf("Unable to load snapshot %s\n", snapshot_path);
+      exit(-1);
+    }
+
+    return(ndpi_struct);
+  }
+
+  if(protos_path != NULL)
+    ndpi_load_protocols_file(ndpi_struct, protos_path);
+
+  ndpi_finalize_initialization(ndpi_struct);
+  return(ndpi_struct);
+}
+
+/* ********************************** */
+
+/* Returns the offset of the IP header, or -1 to skip the packet */
+static int l3_offset(int datalink, const u_char *p, u_int32_t caplen) {
+  int offset;
+  u_int16_t type;
+
+  switch(datalink) {
+  case DLT_NULL:
+    return(4);
+
+  case DLT_RAW:
+    return(0);
+
+  case DLT_LINUX_SLL:
+    return(16);
+
+  case DLT_EN10MB:
+    if(caplen < 14) return(-1);
+    offset = 14, type = (p[12] << 8) | p[13];
+
+    while((type == 0x8100) && (caplen >= (u_int32_t)offset + 4)) /* VLAN */
+      type = (p[offset + 2] << 8) | p[offset + 3], offset += 4;
+
+    return(((type == 0x0800) || (type == 0x86DD)) ? offset : -1);
+  }
+
+  return(-1);
+}
+
+/* ********************************** */
+
+static int packet_key(const u_int8_t *l3, u_int32_t l3_len, struct ndpi_flow_key *key) {
+  u_int32_t l4_offset;
+
+  memset(key, 0, sizeof(struct ndpi_flow_key));
+
+  if((l3_len >= 20) && ((l3[0] >> 4) == 4)) {
+    key->ip_version = 4, key->protocol = l3[9], l4_offset = (l3[0] & 0x0F) * 4;
+    memcpy(&key->src_ip[0], &l3[12], 4), memcpy(&key->dst_ip[0], &l3[16], 4);
+  } else if((l3_len >= 40) && ((l3[0] >> 4) == 6)) {
+    key->ip_version = 6, key->protocol = l3[6], l4_offset = 40;
+    memcpy(key->src_ip, &l3[8], 16), memcpy(key->dst_ip, &l3[24], 16);
+  } else
+    return(-1);
+
+  if(((key->protocol == IPPROTO_TCP) || (key->protocol == IPPROTO_UDP)) && (l3_len >= l4_offset + 4))
+    memcpy(&key->src_port, &l3[l4_offset], 2), memcpy(&key->dst_port, &l3[l4_offset + 2], 2);
+
+  return(0);
+}
+
+/* ********************************** */
+
+/* As an application does: find the flow of the packet and its direction */
+static inline u_int32_t packet_flow(const struct bench_packet *pkt, u_int8_t *reverse) {
+  struct ndpi_flow_key key;
+
+  packet_key(pkt->l3, pkt->l3_len, &key);
+  return((u_int32_t)(uintptr_t)ndpi_flow_table_find(flow_table, &key, reverse) - 1);
+}
+
+/* ********************************** */
+
+static void load_pcap(const char *path) {
+  char errbuf[PCAP_ERRBUF_SIZE];
+  struct pcap_pkthdr *h;
+  const u_char *data;
+  static u_int32_t max_packets = 0;
+  u_int32_t loaded = num_packets;
+  pcap_t *pcap;
+  int datalink;
+
+  if((pcap = pcap_open_offline(path, errbuf)) == NULL) {
+    printf("Unable to open %s: %s\n", path, errbuf);
+    exit(-1);
+  }
+
+  datalink = pcap_datalink(pcap);
+
+  while(pcap_next_ex(pcap, &h, &data) == 1) {
+    struct ndpi_flow_key key;
+    struct bench_packet *pkt;
+    int offset = l3_offset(datalink, data, h->caplen);
+
+    if((offset < 0) || (packet_key(&data[offset], h->caplen - offset, &key) != 0))
+      continue;
+
+    if(num_packets == max_packets) {
+      max_packets = max_packets ? 2 * max_packets : 4096;
+      if((packets = realloc(packets, max_packets * sizeof(struct bench_packet))) == NULL) {
+	printf("Not enough memory\n");
+	exit(-1);
+      }
+    }
+
+    pkt = &packets[num_packets];
+    pkt->l3_len = ndpi_min(h->caplen - offset, 0xFFFF);
+    pkt->tick = (u_int64_t)h->ts.tv_sec * 1000 + h->ts.tv_usec / 1000;
+    if((pkt->l3 = malloc(pkt->l3_len)) == NULL) {
+      printf("Not enough memory\n");
+      exit(-1);
+    }
+    memcpy(pkt->l3, &data[offset], pkt->l3_len);
+
+    /* Flow indexes are stored +1 as the table does not accept NULL values */
+    if(ndpi_flow_table_find(flow_table, &key, NULL) == NULL)
+      ndpi_flow_table_add(flow_table, &key, (void*)(uintptr_t)(++num_flows));
+
+    num_packets++;
+  }
+
+  pcap_close(pcap);
+
+  printf("Loaded %u packets from %s\n", num_packets - loaded, path);
+}
+
+/* ********************************** */
+
+/* pcap_path is a comma separated list of files */
+static void load_packets() {
+  char *paths = strdup(pcap_path), *path, *tmp;
+
+  flow_table = ndpi_flow_table_init(0);
+
+  for(path = strtok_r(paths, ",", &tmp); path != NULL; path = strtok_r(NULL, ",", &tmp))
+    load_pcap(path);
+
+  free(paths);
+
+  printf("Loaded %u packets, %u flows\n", num_packets, num_flows);
+}
+
+/* ********************************** */
+
+/* Returns the processing time (usec) of all packets with fresh flows */
+static u_int64_t run_detection(u_int32_t burst, ndpi_protocol *results) {
+  struct ndpi_detection_module_struct *ndpi_struct = init_module();
+  struct ndpi_flow_struct **flows = calloc(num_flows, sizeof(struct ndpi_flow_struct*));
+  struct ndpi_id_struct **ids = calloc(2 * num_flows, sizeof(struct ndpi_id_struct*));
+  struct ndpi_packet_burst_entry entries[MAX_BURST_SIZE];
+  u_int64_t begin, elapsed;
+  u_int32_t i, j;
+
+  if((flows == NULL) || (ids == NULL)) {
+    printf("Not enough memory\n");
+    exit(-1);
+  }
+
+  for(i = 0; i < num_flows; i++) {
+    flows[i] = calloc(1, ndpi_detection_get_sizeof_ndpi_flow_struct());
+    ids[2 * i] = calloc(1, ndpi_detection_get_sizeof_ndpi_id_struct());
+    ids[2 * i + 1] = calloc(1, ndpi_detection_get_sizeof_ndpi_id_struct());
+
+    if((flows[i] == NULL) || (ids[2 * i] == NULL) || (ids[2 * i + 1] == NULL)) {
+      printf("Not enough memory\n");
+      exit(-1);
+    }
+  }
+
+  /* The flow lookup is timed too, as it warms up the packet headers */
+  begin = usec_now();
+
+  if(burst <= 1) {
+    for(i = 0; i < num_packets; i++) {
+      struct bench_packet *pkt = &packets[i];
+      u_int8_t reverse;
+      u_int32_t idx = packet_flow(pkt, &reverse);
+
+      results[i] = ndpi_detection_process_packet(ndpi_struct, flows[idx], pkt->l3, pkt->l3_len, pkt->tick,
+						 ids[2 * idx + reverse], ids[2 * idx + !reverse]);
+    }
+  } else {
+    for(i = 0; i < num_packets; i += burst) {
+      u_int32_t n = ndpi_min(burst, num_packets - i);
+
+      for(j = 0; j < n; j++) {
+	struct bench_packet *pkt = &packets[i + j];
+	u_int8_t reverse;
+	u_int32_t idx = packet_flow(pkt, &reverse);
+
+	entries[j].flow = flows[idx];
+	entries[j].packet = pkt->l3, entries[j].packetlen = pkt->l3_len;
+	entries[j].current_tick = pkt->tick;
+	entries[j].src = ids[2 * idx + reverse], entries[j].dst = ids[2 * idx + !reverse];
+      }
+
+      ndpi_detection_process_packet_burst(ndpi_struct, entries, &results[i], n);
+    }
+  }
+
+  elapsed = usec_now() - begin;
+
+  for(i = 0; i < num_flows; i++) {
+    ndpi_free_flow(flows[i]);
+    free(ids[2 * i]), free(ids[2 * i + 1]);
+  }
+
+  free(flows), free(ids);
+  ndpi_exit_detection_module(ndpi_struct);
+
+  return(elapsed);
+}
+
+/* ********************************** */
+
+static void print_rate(const char *what, u_int64_t usec) {
+  printf("%-24s %10.3f ms %10.3f Mpps\n", what, usec / 1000.0,
+	 usec ? ((double)num_packets / usec) : 0.0);
+}
+
+/* ********************************** */
+
+static patricia_tree_t* lpm_patricia() {
+  patricia_tree_t *tree = ndpi_New_Patricia(32);
+  u_int32_t i;
+
+  for(i = 0; host_protocol_list[i].network != 0x0; i++) {
+    prefix_t prefix;
+    patricia_node_t *node;
+
+    memset(&prefix, 0, sizeof(prefix));
+    prefix.family = AF_INET, prefix.bitlen = host_protocol_list[i].cidr;
+    prefix.add.sin.s_addr = htonl(host_protocol_list[i].network);
+
+    if((node = ndpi_patricia_lookup(tree, &prefix)) != NULL)
+      node->value.user_value = host_protocol_list[i].value;
+  }
+
+  return(tree);
+}
+
+/* ********************************** */
+
+static u_int16_t patricia_match(patricia_tree_t *tree, struct in_addr *pin) {
+  prefix_t prefix;
+  patricia_node_t *node;
+
+  memset(&prefix, 0, sizeof(prefix));
+  prefix.family = AF_INET, prefix.bitlen = 32, prefix.add.sin = *pin;
+  node = ndpi_patricia_search_best(tree, &prefix);
+
+  return(node ? node->value.user_value : NDPI_PROTOCOL_UNKNOWN);
+}
+
+/* ********************************** */
+
+static void print_lookup_rate(const char *what, u_int64_t usec) {
+  printf("%-24s %10.3f ms %10.3f M lookups/s\n", what, usec / 1000.0,
+	 usec ? ((double)num_addresses / usec) : 0.0);
+}
+
+/*
+  Half of the addresses fall in the listed networks (as many flows of a
+  real network do), the other half are random.
+*/
+static void bench_lpm() {
+  struct ndpi_detection_module_struct *ndpi_struct = init_module();
+  patricia_tree_t *tree = lpm_patricia();
+  struct in_addr *addrs = malloc(num_addresses * sizeof(struct in_addr));
+  u_int16_t *expected = malloc(num_addresses * sizeof(u_int16_t));
+  u_int16_t *found = malloc(num_addresses * sizeof(u_int16_t));
+  u_int64_t best_tree = (u_int64_t)-1, best_single = (u_int64_t)-1, best_pair = (u_int64_t)-1, begin, t;
+  u_int32_t num_networks, i, l, diffs = 0, hits = 0;
+
+  if((tree == NULL) || (addrs == NULL) || (expected == NULL) || (found == NULL)) {
+    printf("Not enough memory\n");
+    exit(-1);
+  }
+
+  num_addresses &= ~1; /* looked up in pairs too */
+
+  for(num_networks = 0; host_protocol_list[num_networks].network != 0x0; num_networks++)
+    ;
+
+  srand(1);
+
+  for(i = 0; i < num_addresses; i++) {
+    u_int32_t addr = ((u_int32_t)rand() << 16) ^ (u_int32_t)rand();
+
+    if(i & 1) {
+      ndpi_network *net = &host_protocol_list[rand() % num_networks];
+      u_int32_t mask = net->cidr ? (0xFFFFFFFF << (32 - net->cidr)) : 0;
+
+      addr = (net->network & mask) | (addr & ~mask);
+    }
+
+    addrs[i].s_addr = htonl(addr);
+  }
+
+  printf("%u networks, %u addresses\n", num_networks, num_addresses);
+
+  for(l = 0; l < num_loops; l++) {
+    begin = usec_now();
+    for(i = 0; i < num_addresses; i++)
+      expected[i] = patricia_match(tree, &addrs[i]);
+    if((t = usec_now() - begin) < best_tree) best_tree = t;
+
+    begin = usec_now();
+    for(i = 0; i < num_addresses; i++)
+      found[i] = ndpi_network_ptree_match(ndpi_struct, &addrs[i]);
+    if((t = usec_now() - begin) < best_single) best_single = t;
+
+    for(i = 0; i < num_addresses; i++)
+      if(found[i] != expected[i]) diffs++;
+
+    begin = usec_now();
+    for(i = 0; i < num_addresses; i += 2)
+      ndpi_network_ptree_match_pair(ndpi_struct, &addrs[i], &addrs[i + 1], &found[i], &found[i + 1]);
+    if((t = usec_now() - begin) < best_pair) best_pair = t;
+
+    for(i = 0; i < num_addresses; i++)
+      if(found[i] != expected[i]) diffs++;
+  }
+
+  for(i = 0; i < num_addresses; i++)
+    if(expected[i] != NDPI_PROTOCOL_UNKNOWN) hits++;
+
+  print_lookup_rate("patricia tree", best_tree);
+  print_lookup_rate("ptree_match", best_single);
+  print_lookup_rate("ptree_match_pair", best_pair);
+  printf("Addresses with a protocol: %u\n", hits);
+  printf("Lookups with a different result: %u\n", diffs);
+
+  free(addrs), free(expected), free(found);
+  ndpi_Destroy_Patricia(tree, NULL);
+  ndpi_exit_detection_module(ndpi_struct);
+}
+
+/* ********************************** */
+
+static void bench_burst() {
+  ndpi_protocol *single = calloc(num_packets, sizeof(ndpi_protocol));
+  ndpi_protocol *burst = calloc(num_packets, sizeof(ndpi_protocol));
+  u_int64_t best_single = (u_int64_t)-1, best_burst = (u_int64_t)-1, t;
+  u_int32_t i, diffs = 0;
+  char label[32];
+
+  if((single == NULL) || (burst == NULL)) {
+    printf("Not enough memory\n");
+    exit(-1);
+  }
+
+  for(i = 0; i < num_loops; i++) {
+    if((t = run_detection(1, single)) < best_single) best_single = t;
+    if((t = run_detection(burst_size, burst)) < best_burst) best_burst = t;
+  }
+
+  for(i = 0; i < num_packets; i++)
+    if((single[i].app_protocol != burst[i].app_protocol)
+       || (single[i].master_protocol != burst[i].master_protocol))
+      diffs++;
+
+  print_rate("single packet", best_single);
+  snprintf(label, sizeof(label), "burst of %u", burst_size);
+  print_rate(label, best_burst);
+  printf("Packets with a different result: %u\n", diffs);
+
+  free(single), free(burst);
+}
+
+/* ********************************** */
+
+/* The TCP/UDP payload of a packet, or NULL */
+static const u_int8_t* packet_payload(const struct bench_packet *pkt, u_int16_t *len) {
+  const u_int8_t *l3 = pkt->l3;
+  u_int32_t l4_offset, l4_len;
+  u_int8_t protocol;
+
+  if((l3[0] >> 4) == 4)
+    protocol = l3[9], l4_offset = (l3[0] & 0x0F) * 4;
+  else
+    protocol = l3[6], l4_offset = 40;
+
+  if(pkt->l3_len <= l4_offset)
+    return(NULL);
+
+  l4_len = pkt->l3_len - l4_offset;
+
+  if((protocol == IPPROTO_TCP) && (l4_len >= 20) && (l4_len > (u_int32_t)(l3[l4_offset + 12] >> 4) * 4)) {
+    *len = l4_len - (l3[l4_offset + 12] >> 4) * 4;
+    return(&l3[l4_offset + (l3[l4_offset + 12] >> 4) * 4]);
+  } else if((protocol == IPPROTO_UDP) && (l4_len > 8)) {
+    *len = l4_len - 8;
+    return(&l3[l4_offset + 8]);
+  }
+
+  return(NULL);
+}
+
+/* ********************************** */
+
+/*
+  Byte by byte reference of ndpi_parse_packet_line_info(): every line is
+  compared with all the headers, in this order.
+*/
+struct bench_header {
+  const char *name;
+  u_int8_t name_len, optional_space;
+  int16_t value_offset; /* -1 to only count */
+};
+
+#define BENCH_HEADER(name, space, value) { name, sizeof(name) - 1, space, offsetof(struct ndpi_packet_lines, value) }
+#define BENCH_HEADER_COUNT(name)         { name, sizeof(name) - 1, 0, -1 }
+
+static const struct bench_header bench_headers[] = {
+  BENCH_HEADER("Server:", 1, server_line),
+  BENCH_HEADER("Host:", 1, host_line),
+  BENCH_HEADER("X-Forwarded-For:", 1, forwarded_line),
+  BENCH_HEADER("Content-Type: ", 0, content_line),
+  BENCH_HEADER("Content-type:", 0, content_line),
+  BENCH_HEADER("Accept: ", 0, accept_line),
+  BENCH_HEADER("Referer: ", 0, referer_line),
+  BENCH_HEADER("User-Agent: ", 0, user_agent_line),
+  BENCH_HEADER("Content-Encoding: ", 0, http_encoding),
+  BENCH_HEADER("Transfer-Encoding: ", 0, http_transfer_encoding),
+  BENCH_HEADER("Content-Length: ", 0, http_contentlen),
+  BENCH_HEADER("Cookie: ", 0, http_cookie),
+  BENCH_HEADER("Origin: ", 0, http_origin),
+  BENCH_HEADER("X-Session-Type: ", 0, http_x_session_type),
+  BENCH_HEADER_COUNT("Date: "), BENCH_HEADER_COUNT("Vary: "), BENCH_HEADER_COUNT("ETag: "),
+  BENCH_HEADER_COUNT("Pragma: "), BENCH_HEADER_COUNT("Expires: "), BENCH_HEADER_COUNT("Set-Cookie: "),
+  BENCH_HEADER_COUNT("Keep-Alive: "), BENCH_HEADER_COUNT("Connection: "), BENCH_HEADER_COUNT("Last-Modified: "),
+  BENCH_HEADER_COUNT("Accept-Ranges: "), BENCH_HEADER_COUNT("Accept-Language: "), BENCH_HEADER_COUNT("Accept-Encoding: "),
+  BENCH_HEADER_COUNT("Upgrade-Insecure-Requests: "),
+  { NULL, 0, 0, 0 }
+};
+
+static void reference_header_line(struct ndpi_packet_lines *lines, struct ndpi_int_one_line_struct *line) {
+  const struct bench_header *h;
+
+  for(h = bench_headers; h->name != NULL; h++) {
+    u_int32_t offset = h->name_len;
+
+    if((line->len <= h->name_len + h->optional_space)
+       || strncasecmp((const char*)line->ptr, h->name, h->name_len))
+      continue;
+
+    if(h->value_offset >= 0) {
+      struct ndpi_int_one_line_struct *value = (struct ndpi_int_one_line_struct*)((u_int8_t*)lines + h->value_offset);
+
+      if(h->optional_space && (line->ptr[offset] == ' '))
+	offset++;
+
+      value->ptr = &line->ptr[offset], value->len = line->len - offset;
+    }
+
+    lines->http_num_headers++;
+  }
+}
+
+static void reference_line_info(struct ndpi_flow_struct *flow) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+  struct ndpi_packet_lines *lines = packet->lines;
+  u_int32_t a;
+
+  memset(&lines->host_line, 0, (u_int8_t*)&lines->parsed_lines - (u_int8_t*)&lines->host_line);
+  lines->parsed_lines = 0, lines->empty_line_position_set = 0, lines->packet_lines_parsed_complete = 1;
+  lines->line[0].len = 0;
+
+  if((packet->payload_packet_len <= 1) || (packet->payload == NULL))
+    return;
+
+  lines->line[0].ptr = packet->payload;
+
+  for(a = 0; a + 2 < packet->payload_packet_len; a++) {
+    struct ndpi_int_one_line_struct *line = &lines->line[lines->parsed_lines];
+
+    if((packet->payload[a] != '\r') || (packet->payload[a + 1] != '\n'))
+      continue;
+
+    line->len = &packet->payload[a] - line->ptr;
+
+    if((lines->parsed_lines == 0) && (line->len >= 13)
+       && (strncasecmp((const char*)line->ptr, "HTTP/1.", 7) == 0)
+       && (line->ptr[9] > '0') && (line->ptr[9] < '6')) {
+      lines->http_response.ptr = &line->ptr[9], lines->http_response.len = line->len - 9;
+      lines->http_num_headers++;
+      if(ndpi_flow_cold(flow)) {
+	strncpy((char*)flow->cold->http.response_status_code, (const char*)&line->ptr[9], 3);
+	flow->cold->http.response_status_code[4] = '\0';
+      }
+    }
+
+    reference_header_line(lines, line);
+
+    if(line->len == 0)
+      lines->empty_line_position = a, lines->empty_line_position_set = 1;
+
+    if(lines->parsed_lines >= (NDPI_MAX_PARSE_LINES_PER_PACKET - 1))
+      return;
+
+    lines->parsed_lines++;
+    lines->line[lines->parsed_lines].ptr = &packet->payload[a + 2], lines->line[lines->parsed_lines].len = 0;
+    a++;
+  }
+
+  if(lines->parsed_lines >= 1) {
+    lines->line[lines->parsed_lines].len = &packet->payload[packet->payload_packet_len] - lines->line[lines->parsed_lines].ptr;
+    lines->parsed_lines++;
+  }
+}
+
+/* ********************************** */
+
+static void print_payload_rate(const char *what, u_int64_t usec, u_int32_t num_payloads, u_int64_t bytes) {
+  printf("%-24s %10.3f ms %10.3f M payloads/s %10.3f MB/s\n", what, usec / 1000.0,
+	 usec ? ((double)num_payloads / usec) : 0.0, usec ? ((double)bytes / usec) : 0.0);
+}
+
+/* Same parsed lines, headers and response code */
+static int same_line_info(struct ndpi_flow_struct *a, struct ndpi_flow_struct *b) {
+  struct ndpi_packet_lines *x = a->packet.lines, *y = b->packet.lines;
+  u_int32_t i;
+
+  if((x->parsed_lines != y->parsed_lines) || (x->http_num_headers != y->http_num_headers)
+     || (x->empty_line_position_set != y->empty_line_position_set)
+     || (x->empty_line_position_set && (x->empty_line_position != y->empty_line_position))
+     || memcmp(&x->host_line, &y->host_line, (u_int8_t*)&x->http_num_headers - (u_int8_t*)&x->host_line)
+     || ((a->cold == NULL) != (b->cold == NULL))
+     || (a->cold && memcmp(a->cold->http.response_status_code, b->cold->http.response_status_code,
+			   sizeof(a->cold->http.response_status_code))))
+    return(0);
+
+  for(i = 0; i < x->parsed_lines; i++)
+    if((x->line[i].ptr != y->line[i].ptr) || (x->line[i].len != y->line[i].len))
+      return(0);
+
+  return(1);
+}
+
+static void bench_lines() {
+  struct ndpi_detection_module_struct *ndpi_struct = init_module();
+  struct ndpi_flow_struct *flow = calloc(1, sizeof(struct ndpi_flow_struct));
+  struct ndpi_flow_struct *reference = calloc(1, sizeof(struct ndpi_flow_struct));
+  struct ndpi_packet_lines *lines = calloc(1, sizeof(struct ndpi_packet_lines));
+  struct ndpi_packet_lines *reference_lines = calloc(1, sizeof(struct ndpi_packet_lines));
+  struct ndpi_int_one_line_struct *payloads = malloc(num_packets * sizeof(struct ndpi_int_one_line_struct));
+  u_int64_t best_parse = (u_int64_t)-1, best_reference = (u_int64_t)-1, begin, t, bytes = 0;
+  u_int32_t num_payloads = 0, i, l, diffs = 0, headers = 0;
+
+  if((flow == NULL) || (reference == NULL) || (lines == NULL) || (reference_lines == NULL) || (payloads == NULL)) {
+    printf("Not enough memory\n");
+    exit(-1);
+  }
+
+  for(i = 0; i < num_packets; i++) {
+    u_int16_t len;
+    const u_int8_t *payload = packet_payload(&packets[i], &len);
+
+    if(payload != NULL)
+      payloads[num_payloads].ptr = payload, payloads[num_payloads].len = len, num_payloads++, bytes += len;
+  }
+
+  flow->packet.lines = lines, reference->packet.lines = reference_lines;
+  printf("%u payloads, %llu bytes\n", num_payloads, (unsigned long long)bytes);
+
+  for(l = 0; l < num_loops; l++) {
+    begin = usec_now();
+    for(i = 0; i < num_payloads; i++) {
+      reference->packet.payload = payloads[i].ptr, reference->packet.payload_packet_len = payloads[i].len;
+      reference_line_info(reference);
+    }
+    if((t = usec_now() - begin) < best_reference) best_reference = t;
+
+    begin = usec_now();
+    for(i = 0; i < num_payloads; i++) {
+      flow->packet.payload = payloads[i].ptr, flow->packet.payload_packet_len = payloads[i].len;
+      lines->packet_lines_parsed_complete = 0;
+      ndpi_parse_packet_line_info(ndpi_struct, flow);
+    }
+    if((t = usec_now() - begin) < best_parse) best_parse = t;
+  }
+
+  for(i = 0; i < num_payloads; i++) {
+    flow->packet.payload = reference->packet.payload = payloads[i].ptr;
+    flow->packet.payload_packet_len = reference->packet.payload_packet_len = payloads[i].len;
+    lines->packet_lines_parsed_complete = 0;
+    ndpi_parse_packet_line_info(ndpi_struct, flow);
+    reference_line_info(reference);
+
+    headers += lines->http_num_headers;
+    if(!same_line_info(flow, reference))
+      diffs++;
+  }
+
+  print_payload_rate("byte by byte", best_reference, num_payloads, bytes);
+  print_payload_rate("parse_packet_line_info", best_parse, num_payloads, bytes);
+  printf("HTTP headers found: %u\n", headers);
+  printf("Payloads with a different result: %u\n", diffs);
+
+  ndpi_free_flow(flow), ndpi_free_flow(reference);
+  free(lines), free(reference_lines), free(payloads);
+  ndpi_exit_detection_module(ndpi_struct);
+}
+
+/* ********************************** */
+
+/*
+  Reference of getSSLcertificate(): the previous heuristic, scanning the
+  handshake for the commonName OID and cleaning the name afterwards.
+*/
+#define REF_SSL_NAME_PADDING 256 /* The scan may read past the payload */
+
+#define ref_isalpha(ch) (((ch) >= 'a' && (ch) <= 'z') || ((ch) >= 'A' && (ch) <= 'Z'))
+#define ref_isdigit(ch) ((ch) >= '0' && (ch) <= '9')
+#define ref_isspace(ch) (((ch) >= '\t' && (ch) <= '\r') || ((ch) == ' '))
+#define ref_isprint(ch) ((ch) >= 0x20 && (ch) <= 0x7e)
+#define ref_ispunct(ch) (((ch) >= '!' && (ch) <= '/') || ((ch) >= ':' && (ch) <= '@') || \
+			 ((ch) >= '[' && (ch) <= '`') || ((ch) >= '{' && (ch) <= '~'))
+
+static void reference_ssl_strip(char *buffer, int buffer_len) {
+  int i;
+
+  for(i = 0; i < buffer_len; i++) {
+    if((buffer[i] != '.') && (buffer[i] != '-') && (buffer[i] != '_') && (buffer[i] != '*')
+       && (!ref_isalpha(buffer[i])) && (!ref_isdigit(buffer[i]))) {
+      buffer[i] = '\0', buffer_len = i;
+      break;
+    }
+  }
+
+  if(check_punycode_string(buffer, buffer_len))
+    return;
+
+  if(i > 0) i--;
+
+  while((i > 0) && !ref_isalpha(buffer[i]))
+    buffer[i] = '\0', buffer_len = i, i--;
+
+  for(i = buffer_len; i > 0; i--) {
+    if(buffer[i] == '.') break;
+    else if(ref_isdigit(buffer[i])) buffer[i] = '\0', buffer_len = i;
+  }
+}
+
+static int reference_ssl_name(const u_int8_t *payload, u_int16_t payload_len, char *buffer, int buffer_len) {
+  u_int16_t total_len;
+  int i;
+
+  memset(buffer, 0, buffer_len);
+
+  if((payload_len < 6) || (payload[0] != 0x16))
+    return(0);
+
+  total_len = ndpi_min((payload[3] << 8) + payload[4] + 5, payload_len);
+  if(total_len <= 4)
+    return(0);
+
+  if((payload[5] == 0x02) || (payload[5] == 0x0b)) {
+    u_int num_found = 0;
+
+    for(i = 9; i < payload_len - 3; i++) {
+      if(((payload[i] == 0x04) && (payload[i+1] == 0x03) && ((payload[i+2] == 0x0c) || (payload[i+2] == 0x13)))
+	 || ((payload[i] == 0x55) && (payload[i+1] == 0x04) && (payload[i+2] == 0x03))) {
+	u_int8_t server_len = payload[i+3], begin = 0, j, num_dots;
+	const char *server_name = (const char*)&payload[i+4];
+
+	if((payload[i] == 0x55) && (++num_found != 2)) continue;
+	if(server_len + i + 3 >= payload_len) continue;
+
+	while((begin < server_len) && !ref_isprint(server_name[begin])) begin++;
+
+	strncpy(buffer, &server_name[begin], buffer_len - 1);
+	buffer[buffer_len - 1] = '\0';
+
+	for(j = 0, num_dots = 0; j < buffer_len - 1; j++) {
+	  if(!ref_isprint(buffer[j])) { num_dots = 0; break; }
+	  else if((buffer[j] == '.') && (++num_dots >= 2)) break;
+	}
+
+	if(num_dots >= 2) {
+	  reference_ssl_strip(buffer, buffer_len);
+	  return(1);
+	}
+      }
+    }
+  } else if(payload[5] == 0x01) {
+    u_int offset, base_offset = 43, session_id_len, extension_offset = 1, extensions_len;
+
+    if(base_offset + 2 > payload_len)
+      return(0);
+
+    session_id_len = payload[base_offset];
+    if(session_id_len + base_offset + 2 > total_len)
+      return(0);
+
+    offset = base_offset + session_id_len + 2
+      + (payload[session_id_len + base_offset + 2] + (payload[session_id_len + base_offset + 1] << 8));
+    if(offset >= total_len)
+      return(0);
+
+    offset += payload[offset + 1] + 3;
+    if(offset >= total_len)
+      return(0);
+
+    extensions_len = payload[offset];
+    if(extensions_len + offset >= total_len)
+      return(0);
+
+    while(extension_offset < extensions_len) {
+      u_int16_t extension_id = (payload[offset + extension_offset] << 8) + payload[offset + extension_offset + 1];
+      u_int16_t extension_len = (payload[offset + extension_offset + 2] << 8) + payload[offset + extension_offset + 3];
+
+      extension_offset += 4;
+
+      if(extension_id == 0) {
+	const char *server_name = (const char*)&payload[offset + extension_offset];
+	u_int begin = 0, len;
+
+	while((begin < extension_len)
+	      && ((!ref_isprint(server_name[begin])) || ref_ispunct(server_name[begin]) || ref_isspace(server_name[begin])))
+	  begin++;
+
+	len = (u_int)ndpi_min(extension_len - begin, buffer_len - 1);
+	strncpy(buffer, &server_name[begin], len);
+	buffer[len] = '\0';
+	reference_ssl_strip(buffer, buffer_len);
+	return(2);
+      }
+
+      extension_offset += extension_len;
+    }
+  }
+
+  return(0);
+}
+
+static void bench_ssl() {
+  struct ndpi_detection_module_struct *ndpi_struct = init_module();
+  struct ndpi_flow_struct *flow = calloc(1, sizeof(struct ndpi_flow_struct));
+  struct ndpi_int_one_line_struct *payloads = malloc(num_packets * sizeof(struct ndpi_int_one_line_struct));
+  u_int64_t best_parse = (u_int64_t)-1, best_reference = (u_int64_t)-1, begin, t, bytes = 0;
+  u_int32_t num_payloads = 0, i, l, diffs = 0, found = 0, reference_found = 0;
+  char name[64], reference_name[64];
+
+  if((flow == NULL) || (payloads == NULL)) {
+    printf("Not enough memory\n");
+    exit(-1);
+  }
+
+  /* TLS handshake records only, copied with some padding for the reference */
+  for(i = 0; i < num_packets; i++) {
+    u_int16_t len;
+    const u_int8_t *payload = packet_payload(&packets[i], &len);
+    u_int8_t *copy;
+
+    if((payload == NULL) || (payload[0] != 0x16) || ((copy = calloc(1, len + REF_SSL_NAME_PADDING)) == NULL))
+      continue;
+
+    memcpy(copy, payload, len);
+    payloads[num_payloads].ptr = copy, payloads[num_payloads].len = len, num_payloads++, bytes += len;
+  }
+
+  printf("%u handshake payloads, %llu bytes\n", num_payloads, (unsigned long long)bytes);
+
+  for(l = 0; l < num_loops; l++) {
+    begin = usec_now();
+    for(i = 0; i < num_payloads; i++)
+      reference_ssl_name(payloads[i].ptr, payloads[i].len, reference_name, sizeof(reference_name));
+    if((t = usec_now() - begin) < best_reference) best_reference = t;
+
+    begin = usec_now();
+    for(i = 0; i < num_payloads; i++) {
+      flow->packet.payload = payloads[i].ptr, flow->packet.payload_packet_len = payloads[i].len;
+      getSSLcertificate(ndpi_struct, flow, name, sizeof(name));
+    }
+    if((t = usec_now() - begin) < best_parse) best_parse = t;
+  }
+
+  for(i = 0; i < num_payloads; i++) {
+    int rc, reference_rc = reference_ssl_name(payloads[i].ptr, payloads[i].len, reference_name, sizeof(reference_name));
+
+    flow->packet.payload = payloads[i].ptr, flow->packet.payload_packet_len = payloads[i].len;
+    rc = getSSLcertificate(ndpi_struct, flow, name, sizeof(name));
+
+    if(rc > 0) found++;
+    if(reference_rc > 0) reference_found++;
+    if((rc != reference_rc) || strcmp(name, reference_name))
+      diffs++;
+  }
+
+  print_payload_rate("OID scan", best_reference, num_payloads, bytes);
+  print_payload_rate("getSSLcertificate", best_parse, num_payloads, bytes);
+  printf("Names found: %u (OID scan: %u)\n", found, reference_found);
+  printf("Payloads with a different name: %u\n", diffs);
+
+  for(i = 0; i < num_payloads; i++)
+    free((u_int8_t*)payloads[i].ptr);
+  ndpi_free_flow(flow), free(payloads);
+  ndpi_exit_detection_module(ndpi_struct);
+}
+
+/* ********************************** */
+
+/* Strings of a match table that the two modules classify differently */
+static u_int32_t snapshot_string_diffs(void *a, void *b, ndpi_protocol_match *table) {
+  u_int32_t i, diffs = 0;
+
+  for(i = 0; table[i].string_to_match != NULL; i++) {
+    unsigned long a_id, b_id;
+
+    ndpi_match_string_id(a, table[i].string_to_match, &a_id);
+    ndpi_match_string_id(b, table[i].string_to_match, &b_id);
+    if(a_id != b_id) diffs++;
+  }
+
+  return(diffs);
+}
+
+/* ********************************** */
+
+static void bench_snapshot() {
+  struct ndpi_detection_module_struct *built, *loaded;
+  u_int64_t best_build = (u_int64_t)-1, best_load = (u_int64_t)-1, begin, t;
+  u_int32_t i, diffs;
+  char tmp_path[64];
+  u_int8_t remove_snapshot = 0;
+
+  if(snapshot_path == NULL) {
+    snprintf(tmp_path, sizeof(tmp_path), "/tmp/ndpiBench-%d.snapshot", (int)getpid());
+    snapshot_path = tmp_path, remove_snapshot = 1;
+  }
+
+  built = init_module();
+  if(ndpi_save_snapshot(built, snapshot_path) != 0) {
+    printf("Unable to save snapshot %s\n", snapshot_path);
+    exit(-1);
+  }
+
+  for(i = 0; i < num_loops; i++) {
+    struct ndpi_detection_module_struct *ndpi_struct;
+
+    use_snapshot = 0, begin = usec_now();
+    ndpi_struct = init_module();
+    if((t = usec_now() - begin) < best_build) best_build = t;
+    ndpi_exit_detection_module(ndpi_struct);
+
+    use_snapshot = 1, begin = usec_now();
+    ndpi_struct = init_module();
+    if((t = usec_now() - begin) < best_load) best_load = t;
+    ndpi_exit_detection_module(ndpi_struct);
+  }
+
+  printf("%-24s %10.3f ms\n", "init from scratch", best_build / 1000.0);
+  printf("%-24s %10.3f ms\n", "init from snapshot", best_load / 1000.0);
+
+  loaded = init_module();
+  diffs = snapshot_string_diffs(built->host_automa.ac_automa, loaded->host_automa.ac_automa, bench_host_match);
+  printf("Host names with a different result: %u\n", diffs);
+
+  if(memcmp(built->tcp_ports_index, loaded->tcp_ports_index, 65536 * sizeof(u_int16_t))
+     || memcmp(built->udp_ports_index, loaded->udp_ports_index, 65536 * sizeof(u_int16_t))
+     || (built->ndpi_num_supported_protocols != loaded->ndpi_num_supported_protocols))
+    printf("Default ports or protocols differ\n");
+
+  ndpi_exit_detection_module(built), ndpi_exit_detection_module(loaded);
+
+  if(pcap_path != NULL) {
+    ndpi_protocol *a = calloc(num_packets, sizeof(ndpi_protocol));
+    ndpi_protocol *b = calloc(num_packets, sizeof(ndpi_protocol));
+
+    if((a == NULL) || (b == NULL)) {
+      printf("Not enough memory\n");
+      exit(-1);
+    }
+
+    use_snapshot = 0, run_detection(1, a);
+    use_snapshot = 1, run_detection(1, b);
+
+    for(i = 0, diffs = 0; i < num_packets; i++)
+      if((a[i].app_protocol != b[i].app_protocol) || (a[i].master_protocol != b[i].master_protocol))
+	diffs++;
+
+    printf("Packets with a different result: %u\n", diffs);
+    free(a), free(b);
+  }
+
+  use_snapshot = 0;
+  if(remove_snapshot)
+    unlink(snapshot_path);
+}
+
+/* ********************************** */
+
+int main(int argc, char **argv) {
+  char *bench;
+  int opt;
+
+  if(argc < 2)
+    help();
+
+  bench = argv[1], optind = 2;
+
+  while((opt = getopt(argc, argv, "b:i:l:n:p:S:h")) != EOF) {
+    switch(opt) {
+    case 'b':
+      burst_size = atoi(optarg);
+      if((burst_size == 0) || (burst_size > MAX_BURST_SIZE)) help();
+      break;
+
+    case 'i':
+      pcap_path = optarg;
+      break;
+
+    case 'l':
+      num_loops = atoi(optarg);
+      if(num_loops == 0) num_loops = 1;
+      break;
+
+    case 'n':
+      num_addresses = atoi(optarg);
+      if(num_addresses < 2) help();
+      break;
+
+    case 'p':
+      protos_path = optarg;
+      break;
+
+    case 'S':
+      snapshot_path = optarg;
+      break;
+
+    default:
+      help();
+    }
+  }
+
+  if(!strcmp(bench, "burst")) {
+    if(pcap_path == NULL) help();
+
+    load_packets();
+    bench_burst();
+    ndpi_flow_table_free(flow_table, NULL);
+  } else if(!strcmp(bench, "lines")) {
+    if(pcap_path == NULL) help();
+
+    load_packets();
+    bench_lines();
+    ndpi_flow_table_free(flow_table, NULL);
+  } else if(!strcmp(bench, "ssl")) {
+    if(pcap_path == NULL) help();
+
+    load_packets();
+    bench_ssl();
+    ndpi_flow_table_free(flow_table, NULL);
+  } else if(!strcmp(bench, "lpm"))
+    bench_lpm();
+  else if(!strcmp(bench, "snapshot")) {
+    if(pcap_path != NULL)
+      load_packets();
+
+    bench_snapshot();
+
+    if(pcap_path != NULL)
+      ndpi_flow_table_free(flow_table, NULL);
+  } else
+    help();
+
+  return(0);
+}
@@ -33,6 +33,7 @@
 #else
 #include <unistd.h>
 #include <netinet/in.h>
+#include <sched.h>
 #endif
 #include <string.h>
 #include <stdarg.h>
@@ -50,6 +51,16 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <libgen.h>
+#ifdef linux
+#include <errno.h>
+#include <poll.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#endif
 
 #ifdef HAVE_JSON_C
 #include <json.h>
@@ -64,6 +75,7 @@ static FILE *results_file           = NULL;
 static char *results_path           = NULL;
 static char * bpfFilter             = NULL; /**< bpf filter  */
 static char *_protoFilePath         = NULL; /**< Protocol file path  */
+static char *_snapshotPath          = NULL; /**< Detection module snapshot path */
 #ifdef HAVE_JSON_C
 static char *_statsFilePath         = NULL; /**< Top stats file path */
 static char *_diagnoseFilePath      = NULL; /**< Top stats file path */
@@ -88,7 +100,11 @@ static u_int32_t pcap_analysis_duration = (u_int32_t)-1;
 static u_int16_t decode_tunnels = 0;
 static u_int16_t num_loops = 1;
 static u_int8_t shutdown_app = 0, quiet_mode = 0;
-static u_int8_t num_threads = 1;
+static u_int16_t num_threads = 1;
+static u_int16_t num_pipeline_threads = 0; /* pcap files: threads fed by a reader thread */
+#ifdef linux
+static u_int8_t fanout_capture = 0; /* a single device: the threads share its traffic */
+#endif
 static struct timeval begin, end;
 #ifdef linux
 static int core_affinity[MAX_NUM_READER_THREADS];
@@ -98,6 +114,16 @@ static struct timeval pcap_start, pcap_end;
 static time_t capture_for = 0;
 static time_t capture_until = 0;
 static u_int32_t num_flows;
+static u_int32_t flow_pool_size = 0; /* per thread */
+static u_int32_t tcp_reassembly_bytes = 0; /* per flow direction, 0: disabled */
+static u_int8_t host_match_most_specific = 0;
+/* How packets are handed to nDPI */
+enum packet_copy_mode {
+  PACKET_COPY_NONE = 0, /* zero-copy from the libpcap buffer */
+  PACKET_COPY_BUFFER,   /* copy into a per-thread reusable buffer */
+  PACKET_COPY_CHECK     /* exact size copy checked for changes after detection (debug) */
+};
+static u_int8_t packet_copy_mode = PACKET_COPY_NONE;
 static struct ndpi_detection_module_struct *ndpi_info_mod = NULL;
 
 struct flow_info {
@@ -181,14 +207,77 @@ static char extcap_buf[16384];
 static char *extcap_capture_fifo    = NULL;
 static u_int16_t extcap_packet_filter = (u_int16_t)-1;
 
+/*
+  Offline pipeline (-n with pcap files): a reader thread hands the packets
+  of each flow to the same thread through a single producer single consumer
+  ring, so that every thread sees the packets of its flows in file order
+*/
+#define PIPELINE_RING_SIZE     4096 /* packets, power of 2 */
+#define PIPELINE_SNAPLEN      65535
+
+struct pipeline_slot {
+  struct pcap_pkthdr header;
+  const u_int8_t *packet; /* data, or the packet in the mapping of a savefile */
+  u_int8_t *data;
+  u_int32_t data_len; /* allocated */
+};
+
+struct pipeline_ring {
+  u_int32_t head, cached_tail; /* reader thread */
+  u_int8_t head_pad[56];
+  u_int32_t tail;              /* processing thread */
+  u_int8_t done;
+  u_int8_t tail_pad[59];
+  struct pipeline_slot slots[PIPELINE_RING_SIZE];
+};
+
+static pthread_t pipeline_reader;
+static int pipeline_datalink;
+static struct timeval pipeline_last_ts;
+
+/* pcap files read from a mapping (see ndpi_savefile_open), the others by libpcap */
+struct savefile_reader {
+  struct ndpi_savefile *file;
+  struct bpf_program filter;
+  u_int8_t filtered;
+  volatile u_int8_t breakloop;
+};
+
+static struct savefile_reader savefile_readers[MAX_NUM_READER_THREADS];
+
+#ifdef linux
+/* Live capture of a device shared by the threads (see fanout_capture) */
+#define FANOUT_BLOCK_SIZE   (1 << 20) /* bytes, multiple of the page size */
+#define FANOUT_NUM_BLOCKS          16 /* per thread */
+#define FANOUT_FRAME_SIZE        2048
+#define FANOUT_BLOCK_TIMEOUT       10 /* msec before a partially filled block is handed over */
+#define FANOUT_POLL_TIMEOUT       100 /* msec between shutdown checks */
+#define FANOUT_RELEASE_BATCH        4 /* blocks processed before they are released */
+
+/* TPACKET_V3 receive ring of a PACKET_FANOUT member */
+struct fanout_ring {
+  int fd;
+  u_int8_t *map; /* NULL: not a fanout member */
+  u_int32_t next_block;
+  u_int8_t raw; /* SOCK_RAW (link header) or SOCK_DGRAM (IP packets) */
+
+  /* statistics */
+  u_int64_t num_packets, num_drops; /* PACKET_STATISTICS: packets seen by the socket, not in the ring */
+  u_int64_t ready_blocks_sum, num_checks; /* blocks waiting for the thread when it looked for packets */
+  u_int32_t max_ready_blocks;
+};
+
+static struct fanout_ring fanout_rings[MAX_NUM_READER_THREADS];
+#endif
+
 // struct associated to a workflow for a thread
 struct reader_thread {
   struct ndpi_workflow *workflow;
   pthread_t pthread;
   u_int64_t last_idle_scan_time;
-  u_int32_t idle_scan_idx;
-  u_int32_t num_idle_flows;
-  struct ndpi_flow_info *idle_flows[IDLE_SCAN_BUDGET];
+  u_int8_t *packet_buffer; /* see PACKET_COPY_BUFFER */
+  u_int32_t packet_buffer_len;
+  struct pipeline_ring *ring; /* see num_pipeline_threads */
 };
 
 // array for every thread created for a flow
@@ -227,18 +316,38 @@ static void help(u_int long_help) {
 
   printf("ndpiReader -i <file|device> [-f <filter>][-s <duration>][-m <duration>]\n"
 	 "          [-p <protos>][-l <loops> [-q][-d][-h][-t][-v <level>]\n"
-	 "          [-n <threads>] [-w <file>] [-j <file>] [-x <file>] \n\n"
+	 "          [-n <threads>] [-w <file>] [-j <file>] [-x <file>] [-F <num flows>]\n"
+	 "          [-C <none|buffer|check>] [-S <file>] [-M]\n\n"
 	 "Usage:\n"
 	 "  -i <file.pcap|device>     | Specify a pcap file/playlist to read packets from or a\n"
 	 "                            | device for live capture (comma-separated list)\n"
 	 "  -f <BPF filter>           | Specify a BPF filter for filtering selected traffic\n"
 	 "  -s <duration>             | Maximum capture duration in seconds (live traffic capture only)\n"
 	 "  -m <duration>             | Split analysis duration in <duration> max seconds\n"
-	 "  -p <file>.protos          | Specify a protocol file (eg. protos.txt)\n"
+	 "  -p <file>.protos          | Specify a protocol file (eg. protos.txt), reloaded\n"
+	 "                            | on SIGHUP without stopping the capture\n"
+	 "  -S <file>                 | Load the detection module (including -p protocols) from\n"
+	 "                            | this snapshot, creating it when missing or outdated.\n"
+	 "                            | Remove it after changing the protocol file\n"
 	 "  -l <num loops>            | Number of detection loops (test only)\n"
-	 "  -n <num threads>          | Number of threads. Default: number of interfaces in -i.\n"
-	 "                            | Ignored with pcap files.\n"
+	 "  -n <num threads>          | Number of threads. Default:\n"
+	 "                            | number of interfaces in -i. With pcap files a reader\n"
+	 "                            | thread spreads the flows across the threads (ignored\n"
+	 "                            | with -m)\n"
+#ifdef linux
+	 "                            | With one device the threads share its traffic\n"
+	 "                            | (PACKET_FANOUT, flows hashed to threads, up to one\n"
+	 "                            | thread per core)\n"
+#endif
 	 "  -j <file.json>            | Specify a file to write the content of packets in .json format\n"
+	 "  -F <num flows>            | Preallocate a pool of <num flows> flows per thread\n"
+	 "  -R <bytes>                | Reassemble up to <bytes> of the TCP streams of the flows\n"
+	 "                            | being detected (TLS handshakes, HTTP requests, mail)\n"
+	 "  -M                        | Match host names to the most specific host pattern\n"
+	 "                            | instead of the last one matched\n"
+	 "  -C <none|buffer|check>    | Packet copy mode: none (default, zero-copy), buffer (per\n"
+	 "                            | thread reusable buffer) or check (debug: check that nDPI\n"
+	 "                            | does not modify or overflow packets)\n"
 #ifdef linux
          "  -g <id:id...>             | Thread affinity mask (one core id per thread)\n"
 #endif
@@ -306,8 +415,12 @@ static struct option longopts[] = {
   { "cpu-bind", required_argument, NULL, 'g'},
   { "loops", required_argument, NULL, 'l'},
   { "num-threads", required_argument, NULL, 'n'},
+  { "packet-copy", required_argument, NULL, 'C'},
+  { "tcp-reassembly", required_argument, NULL, 'R'},
+  { "most-specific-host", no_argument, NULL, 'M'},
 
   { "protos", required_argument, NULL, 'p'},
+  { "snapshot", required_argument, NULL, 'S'},
   { "capture-duration", required_argument, NULL, 's'},
   { "decode-tunnels", no_argument, NULL, 't'},
   { "revision", no_argument, NULL, 'r'},
@@ -367,6 +480,7 @@ int cmpFlows(const void *_a, const void *_b) {
   if(htons(fa->src_port) < htons(fb->src_port)) return(-1); else { if(htons(fa->src_port) > htons(fb->src_port)) return(1); }
   if(htonl(fa->dst_ip)   < htonl(fb->dst_ip)  ) return(-1); else { if(htonl(fa->dst_ip)   > htonl(fb->dst_ip)  ) return(1); }
   if(htons(fa->dst_port) < htons(fb->dst_port)) return(-1); else { if(htons(fa->dst_port) > htons(fb->dst_port)) return(1); }
+  if(fa->vlan_id < fb->vlan_id) return(-1); else { if(fa->vlan_id > fb->vlan_id) return(1); }
   return(0);
 }
 
@@ -446,7 +560,7 @@ static void parseOptions(int argc, char **argv) {
   if(trace) fprintf(trace, " #### %s #### \n", __FUNCTION__);
 #endif
 
-  while ((opt = getopt_long(argc, argv, "df:g:i:hp:l:s:tv:V:n:j:rp:w:q0123:456:7:89:m:b:x:", longopts, &option_idx)) != EOF) {
+  while ((opt = getopt_long(argc, argv, "dC:f:F:g:i:hp:l:MR:s:S:tv:V:n:j:rp:w:q0123:456:7:89:m:b:x:", longopts, &option_idx)) != EOF) {
 #ifdef DEBUG_TRACE
     if(trace) fprintf(trace, " #### -%c [%s] #### \n", opt, optarg ? optarg : "");
 #endif
@@ -474,6 +588,31 @@ static void parseOptions(int argc, char **argv) {
       pcap_analysis_duration = atol(optarg);
       break;
 
+    case 'F':
+      flow_pool_size = atoi(optarg);
+      break;
+
+    case 'R':
+      tcp_reassembly_bytes = atoi(optarg);
+      break;
+
+    case 'M':
+      host_match_most_specific = 1;
+      break;
+
+    case 'C':
+      if(!strcmp(optarg, "none"))
+	packet_copy_mode = PACKET_COPY_NONE;
+      else if(!strcmp(optarg, "buffer"))
+	packet_copy_mode = PACKET_COPY_BUFFER;
+      else if(!strcmp(optarg, "check"))
+	packet_copy_mode = PACKET_COPY_CHECK;
+      else {
+	printf("Invalid packet copy mode %s\n", optarg);
+	help(0);
+      }
+      break;
+
     case 'x':
 #ifndef HAVE_JSON_C
       printf("WARNING: this copy of ndpiReader has been compiled without JSON-C: json export disabled\n");
@@ -497,13 +636,17 @@ static void parseOptions(int argc, char **argv) {
       break;
 
     case 'n':
-      num_threads = atoi(optarg);
+      num_threads = (u_int16_t)ndpi_min((u_int)atoi(optarg), MAX_NUM_READER_THREADS);
       break;
 
     case 'p':
       _protoFilePath = optarg;
       break;
 
+    case 'S':
+      _snapshotPath = optarg;
+      break;
+
     case 's':
       capture_for = atoi(optarg);
       capture_until = capture_for + time(NULL);
@@ -620,7 +763,9 @@ static void parseOptions(int argc, char **argv) {
         __pcap_file = strtok(NULL, ",");
       }
     } else {
-      if(num_threads > MAX_NUM_READER_THREADS) num_threads = MAX_NUM_READER_THREADS;
+#ifdef linux
+      fanout_capture = (num_threads > 1);
+#endif
       for(thread_id = 1; thread_id < num_threads; thread_id++)
         _pcap_file[thread_id] = _pcap_file[0];
     }
@@ -823,35 +968,29 @@ static void printFlow(u_int16_t id, struct ndpi_flow_info *flow, u_int16_t threa
 /**
  * @brief Unknown Proto Walker
  */
-static void node_print_unknown_proto_walker(const void *node, ndpi_VISIT which, int depth, void *user_data) {
+static void node_print_unknown_proto_walker(const struct ndpi_flow_key *key, void *node, void *user_data) {
 
-  struct ndpi_flow_info *flow = *(struct ndpi_flow_info**)node;
+  struct ndpi_flow_info *flow = (struct ndpi_flow_info*)node;
   u_int16_t thread_id = *((u_int16_t*)user_data);
 
   if(flow->detected_protocol.app_protocol != NDPI_PROTOCOL_UNKNOWN) return;
 
-  if((which == ndpi_preorder) || (which == ndpi_leaf)) {
-     /* Avoid walking the same node multiple times */
-     all_flows[num_flows].thread_id = thread_id, all_flows[num_flows].flow = flow;
-     num_flows++;
-  }
+  all_flows[num_flows].thread_id = thread_id, all_flows[num_flows].flow = flow;
+  num_flows++;
 }
 
 /**
  * @brief Known Proto Walker
  */
-static void node_print_known_proto_walker(const void *node, ndpi_VISIT which, int depth, void *user_data) {
+static void node_print_known_proto_walker(const struct ndpi_flow_key *key, void *node, void *user_data) {
 
-  struct ndpi_flow_info *flow = *(struct ndpi_flow_info**)node;
+  struct ndpi_flow_info *flow = (struct ndpi_flow_info*)node;
   u_int16_t thread_id = *((u_int16_t*)user_data);
 
   if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN) return;
 
-  if((which == ndpi_preorder) || (which == ndpi_leaf)) {
-     /* Avoid walking the same node multiple times */
-     all_flows[num_flows].thread_id = thread_id, all_flows[num_flows].flow = flow;
-     num_flows++;
-  }
+  all_flows[num_flows].thread_id = thread_id, all_flows[num_flows].flow = flow;
+  num_flows++;
 }
 
 
@@ -877,25 +1016,23 @@ static u_int16_t node_guess_undetected_protocol(u_int16_t thread_id, struct ndpi
 /**
  * @brief Proto Guess Walker
  */
-static void node_proto_guess_walker(const void *node, ndpi_VISIT which, int depth, void *user_data) {
-  struct ndpi_flow_info *flow = *(struct ndpi_flow_info **) node;
+static void node_proto_guess_walker(const struct ndpi_flow_key *key, void *node, void *user_data) {
+  struct ndpi_flow_info *flow = (struct ndpi_flow_info *) node;
   u_int16_t thread_id = *((u_int16_t *) user_data);
 
-  if((which == ndpi_preorder) || (which == ndpi_leaf)) { /* Avoid walking the same node multiple times */
-    if((!flow->detection_completed) && flow->ndpi_flow)
-      flow->detected_protocol = ndpi_detection_giveup(ndpi_thread_info[0].workflow->ndpi_struct, flow->ndpi_flow);
+  if((!flow->detection_completed) && flow->ndpi_flow)
+    flow->detected_protocol = ndpi_detection_giveup(ndpi_thread_info[0].workflow->ndpi_struct, flow->ndpi_flow);
 
-    if(enable_protocol_guess) {
-      if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN) {
-	node_guess_undetected_protocol(thread_id, flow);
-      }
+  if(enable_protocol_guess) {
+    if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN) {
+      node_guess_undetected_protocol(thread_id, flow);
     }
-
-    process_ndpi_collected_info(ndpi_thread_info[thread_id].workflow, flow);
-    ndpi_thread_info[thread_id].workflow->stats.protocol_counter[flow->detected_protocol.app_protocol]       += flow->src2dst_packets + flow->dst2src_packets;
-    ndpi_thread_info[thread_id].workflow->stats.protocol_counter_bytes[flow->detected_protocol.app_protocol] += flow->src2dst_bytes + flow->dst2src_bytes;
-    ndpi_thread_info[thread_id].workflow->stats.protocol_flows[flow->detected_protocol.app_protocol]++;
   }
+
+  process_ndpi_collected_info(ndpi_thread_info[thread_id].workflow, flow);
+  ndpi_thread_info[thread_id].workflow->stats.protocol_counter[flow->detected_protocol.app_protocol]       += flow->src2dst_packets + flow->dst2src_packets;
+  ndpi_thread_info[thread_id].workflow->stats.protocol_counter_bytes[flow->detected_protocol.app_protocol] += flow->src2dst_bytes + flow->dst2src_bytes;
+  ndpi_thread_info[thread_id].workflow->stats.protocol_flows[flow->detected_protocol.app_protocol]++;
 }
 
 /* *********************************************** */
@@ -1297,68 +1434,55 @@ static void deletePortsStats(struct port_stats *stats) {
 /**
  * @brief Ports stats
  */
-static void port_stats_walker(const void *node, ndpi_VISIT which, int depth, void *user_data) {
-  if((which == ndpi_preorder) || (which == ndpi_leaf)) { /* Avoid walking the same node multiple times */
-    struct ndpi_flow_info *flow = *(struct ndpi_flow_info **) node;
-    u_int16_t thread_id = *(int *)user_data;
-    u_int16_t sport, dport;
-    char proto[16];
-    int r;
+static void port_stats_walker(const struct ndpi_flow_key *key, void *node, void *user_data) {
+  struct ndpi_flow_info *flow = (struct ndpi_flow_info *) node;
+  u_int16_t thread_id = *(int *)user_data;
+  u_int16_t sport, dport;
+  char proto[16];
+  int r;
 
-    sport = ntohs(flow->src_port), dport = ntohs(flow->dst_port);
+  sport = ntohs(flow->src_port), dport = ntohs(flow->dst_port);
 
-    /* get app level protocol */
-    if(flow->detected_protocol.master_protocol)
-      ndpi_protocol2name(ndpi_thread_info[thread_id].workflow->ndpi_struct,
+  /* get app level protocol */
+  if(flow->detected_protocol.master_protocol)
+    ndpi_protocol2name(ndpi_thread_info[thread_id].workflow->ndpi_struct,
 			 flow->detected_protocol, proto, sizeof(proto));
-    else
-      strncpy(proto, ndpi_get_proto_name(ndpi_thread_info[thread_id].workflow->ndpi_struct,
+  else
+    strncpy(proto, ndpi_get_proto_name(ndpi_thread_info[thread_id].workflow->ndpi_struct,
 					 flow->detected_protocol.app_protocol),sizeof(proto));
 
-    if(((r = strcmp(ipProto2Name(flow->protocol), "TCP")) == 0)
-       && (flow->src2dst_packets == 1) && (flow->dst2src_packets == 0)) {
-       updateScanners(&scannerHosts, flow->src_ip, flow->ip_version, dport);
-    }
+  if(((r = strcmp(ipProto2Name(flow->protocol), "TCP")) == 0)
+     && (flow->src2dst_packets == 1) && (flow->dst2src_packets == 0)) {
+     updateScanners(&scannerHosts, flow->src_ip, flow->ip_version, dport);
+  }
 
-    updateReceivers(&receivers, flow->dst_ip, flow->ip_version,
-                    flow->src2dst_packets, &topReceivers);
+  updateReceivers(&receivers, flow->dst_ip, flow->ip_version,
+                  flow->src2dst_packets, &topReceivers);
 
-    updatePortStats(&srcStats, sport, flow->src_ip, flow->ip_version,
-                    flow->src2dst_packets, flow->src2dst_bytes, proto);
+  updatePortStats(&srcStats, sport, flow->src_ip, flow->ip_version,
+                  flow->src2dst_packets, flow->src2dst_bytes, proto);
 
-    updatePortStats(&dstStats, dport, flow->dst_ip, flow->ip_version,
-                    flow->dst2src_packets, flow->dst2src_bytes, proto);
-  }
+  updatePortStats(&dstStats, dport, flow->dst_ip, flow->ip_version,
+                  flow->dst2src_packets, flow->dst2src_bytes, proto);
 }
 
 /* *********************************************** */
 
 /**
- * @brief Idle Scan Walker
+ * @brief On Idle Flows - account the flows expired by the workflow
  */
-static void node_idle_scan_walker(const void *node, ndpi_VISIT which, int depth, void *user_data) {
-
-  struct ndpi_flow_info *flow = *(struct ndpi_flow_info **) node;
-  u_int16_t thread_id = *((u_int16_t *) user_data);
-
-  if(ndpi_thread_info[thread_id].num_idle_flows == IDLE_SCAN_BUDGET) /* TODO optimise with a budget-based walk */
-    return;
-
-  if((which == ndpi_preorder) || (which == ndpi_leaf)) { /* Avoid walking the same node multiple times */
-    if(flow->last_seen + MAX_IDLE_TIME < ndpi_thread_info[thread_id].workflow->last_time) {
-
-      /* update stats */
-      node_proto_guess_walker(node, which, depth, user_data);
-
-      if((flow->detected_protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN) && !undetected_flows_deleted)
-        undetected_flows_deleted = 1;
+static void on_idle_flows_exported(struct ndpi_workflow * workflow,
+				   struct ndpi_flow_info **flows, u_int32_t num_flows,
+				   void * udata) {
+  u_int16_t thread_id = (uintptr_t) udata;
+  u_int32_t i;
 
-      ndpi_free_flow_info_half(flow);
-      ndpi_thread_info[thread_id].workflow->stats.ndpi_flow_count--;
+  for(i=0; i<num_flows; i++) {
+    /* update stats */
+    node_proto_guess_walker(&flows[i]->key, flows[i], &thread_id);
 
-      /* adding to a queue (we can't delete it from the tree inline ) */
-      ndpi_thread_info[thread_id].idle_flows[ndpi_thread_info[thread_id].num_idle_flows++] = flow;
-    }
+    if((flows[i]->detected_protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN) && !undetected_flows_deleted)
+      undetected_flows_deleted = 1;
   }
 }
 
@@ -1435,9 +1559,12 @@ static void setupDetection(u_int16_t thread_id, pcap_t * pcap_handle) {
 
   memset(&prefs, 0, sizeof(prefs));
   prefs.decode_tunnels = decode_tunnels;
-  prefs.num_roots = NUM_ROOTS;
+  prefs.flow_table_size = FLOW_TABLE_SIZE;
   prefs.max_ndpi_flows = MAX_NDPI_FLOWS;
+  prefs.flow_pool_size = flow_pool_size;
   prefs.quiet_mode = quiet_mode;
+  /* The next threads share the detection module of the first one */
+  prefs.shared_module = (thread_id > 0) ? ndpi_thread_info[0].workflow->ndpi_struct : NULL;
 
   memset(&ndpi_thread_info[thread_id], 0, sizeof(ndpi_thread_info[thread_id]));
   ndpi_thread_info[thread_id].workflow = ndpi_workflow_init(&prefs, pcap_handle);
@@ -1445,21 +1572,39 @@ static void setupDetection(u_int16_t thread_id, pcap_t * pcap_handle) {
   /* Preferences */
   ndpi_thread_info[thread_id].workflow->ndpi_struct->http_dont_dissect_response = 0;
   ndpi_thread_info[thread_id].workflow->ndpi_struct->dns_dissect_response = 0;
+  ndpi_set_tcp_reassembly(ndpi_thread_info[thread_id].workflow->ndpi_struct, tcp_reassembly_bytes);
+  ndpi_set_host_match_most_specific(ndpi_thread_info[thread_id].workflow->ndpi_struct, host_match_most_specific);
 
   ndpi_workflow_set_flow_detected_callback(ndpi_thread_info[thread_id].workflow,
 					   on_protocol_discovered, (void *)(uintptr_t)thread_id);
-
-  // enable all protocols
-  NDPI_BITMASK_SET_ALL(all);
-  ndpi_set_protocol_detection_bitmask2(ndpi_thread_info[thread_id].workflow->ndpi_struct, &all);
+  ndpi_workflow_set_flow_export_callback(ndpi_thread_info[thread_id].workflow,
+					 on_idle_flows_exported, (void *)(uintptr_t)thread_id);
 
   // clear memory for results
   memset(ndpi_thread_info[thread_id].workflow->stats.protocol_counter, 0, sizeof(ndpi_thread_info[thread_id].workflow->stats.protocol_counter));
   memset(ndpi_thread_info[thread_id].workflow->stats.protocol_counter_bytes, 0, sizeof(ndpi_thread_info[thread_id].workflow->stats.protocol_counter_bytes));
   memset(ndpi_thread_info[thread_id].workflow->stats.protocol_flows, 0, sizeof(ndpi_thread_info[thread_id].workflow->stats.protocol_flows));
 
+  if(prefs.shared_module != NULL)
+    return;
+
+  // enable all protocols
+  NDPI_BITMASK_SET_ALL(all);
+  ndpi_set_protocol_detection_bitmask2(ndpi_thread_info[thread_id].workflow->ndpi_struct, &all);
+
+  if((_snapshotPath != NULL)
+     && (ndpi_load_snapshot(ndpi_thread_info[thread_id].workflow->ndpi_struct, _snapshotPath) == 0))
+    return;
+
   if(_protoFilePath != NULL)
     ndpi_load_protocols_file(ndpi_thread_info[thread_id].workflow->ndpi_struct, _protoFilePath);
+
+  ndpi_finalize_initialization(ndpi_thread_info[thread_id].workflow->ndpi_struct);
+
+  /* The next threads (and runs) will load it */
+  if((_snapshotPath != NULL)
+     && (ndpi_save_snapshot(ndpi_thread_info[thread_id].workflow->ndpi_struct, _snapshotPath) != 0))
+    printf("WARNING: unable to save snapshot %s\n", _snapshotPath);
 }
 
 
@@ -1468,6 +1613,11 @@ static void setupDetection(u_int16_t thread_id, pcap_t * pcap_handle) {
  */
 static void terminateDetection(u_int16_t thread_id) {
   ndpi_workflow_free(ndpi_thread_info[thread_id].workflow);
+
+  if(ndpi_thread_info[thread_id].packet_buffer) {
+    free(ndpi_thread_info[thread_id].packet_buffer);
+    ndpi_thread_info[thread_id].packet_buffer = NULL, ndpi_thread_info[thread_id].packet_buffer_len = 0;
+  }
 }
 
 
@@ -1847,10 +1997,8 @@ static void printResults(u_int64_t tot_usec) {
        && (ndpi_thread_info[thread_id].workflow->stats.raw_packet_count == 0))
       continue;
 
-    for(i=0; i<NUM_ROOTS; i++) {
-      ndpi_twalk(ndpi_thread_info[thread_id].workflow->ndpi_flows_root[i], node_proto_guess_walker, &thread_id);
-      if(verbose == 3 || stats_flag) ndpi_twalk(ndpi_thread_info[thread_id].workflow->ndpi_flows_root[i], port_stats_walker, &thread_id);
-    }
+    ndpi_flow_table_walk(ndpi_thread_info[thread_id].workflow->flow_table, node_proto_guess_walker, &thread_id);
+    if(verbose == 3 || stats_flag) ndpi_flow_table_walk(ndpi_thread_info[thread_id].workflow->flow_table, port_stats_walker, &thread_id);
 
     /* Stats aggregation */
     cumulative_stats.guessed_flow_protocols += ndpi_thread_info[thread_id].workflow->stats.guessed_flow_protocols;
@@ -1873,9 +2021,12 @@ static void printResults(u_int64_t tot_usec) {
     cumulative_stats.pppoe_count += ndpi_thread_info[thread_id].workflow->stats.pppoe_count;
     cumulative_stats.vlan_count  += ndpi_thread_info[thread_id].workflow->stats.vlan_count;
     cumulative_stats.fragmented_count += ndpi_thread_info[thread_id].workflow->stats.fragmented_count;
+    cumulative_stats.reassembled_count += ndpi_thread_info[thread_id].workflow->stats.reassembled_count;
+    cumulative_stats.fragment_drop_count += ndpi_thread_info[thread_id].workflow->stats.fragment_drop_count;
     for(i = 0; i < sizeof(cumulative_stats.packet_len)/sizeof(cumulative_stats.packet_len[0]); i++)
       cumulative_stats.packet_len[i] += ndpi_thread_info[thread_id].workflow->stats.packet_len[i];
-    cumulative_stats.max_packet_len += ndpi_thread_info[thread_id].workflow->stats.max_packet_len;
+    if(ndpi_thread_info[thread_id].workflow->stats.max_packet_len > cumulative_stats.max_packet_len)
+      cumulative_stats.max_packet_len = ndpi_thread_info[thread_id].workflow->stats.max_packet_len;
   }
 
   if(cumulative_stats.total_wire_bytes == 0)
@@ -1888,6 +2039,28 @@ static void printResults(u_int64_t tot_usec) {
     printf("\tActual Memory:           %-13s\n", formatBytes(current_ndpi_memory, buf, sizeof(buf)));
     printf("\tPeak Memory:             %-13s\n", formatBytes(max_ndpi_memory, buf, sizeof(buf)));
 
+    for(thread_id = 0; thread_id < num_threads; thread_id++) {
+      struct ndpi_flow_pool_stats pool_stats;
+
+      if(ndpi_thread_info[thread_id].workflow->flow_pool == NULL)
+	continue;
+
+      ndpi_get_flow_pool_stats(ndpi_thread_info[thread_id].workflow->flow_pool, &pool_stats);
+      printf("\tFlow Pool [thread %d]:    %u/%u flows high water, %llu fallback allocations\n",
+	     thread_id, pool_stats.flows_high_water, pool_stats.capacity,
+	     (long long unsigned int)pool_stats.fallbacks);
+    }
+
+    if(tcp_reassembly_bytes > 0) {
+      struct ndpi_tcp_reassembly_stats reassembly_stats;
+
+      ndpi_get_tcp_reassembly_stats(&reassembly_stats);
+      printf("\tTCP Reassembly:          %s peak, %llu streams (%llu truncated)\n",
+	     formatBytes((u_int32_t)reassembly_stats.bytes_high_water, buf, sizeof(buf)),
+	     (long long unsigned int)reassembly_stats.streams,
+	     (long long unsigned int)reassembly_stats.streams_truncated);
+    }
+
     if(!json_flag) {
       printf("\nTraffic statistics:\n");
       printf("\tEthernet bytes:        %-13llu (includes ethernet CRC/IFC/trailer)\n",
@@ -1910,6 +2083,8 @@ static void printResults(u_int64_t tot_usec) {
       printf("\tMPLS Packets:          %-13lu\n", (unsigned long)cumulative_stats.mpls_count);
       printf("\tPPPoE Packets:         %-13lu\n", (unsigned long)cumulative_stats.pppoe_count);
       printf("\tFragmented Packets:    %-13lu\n", (unsigned long)cumulative_stats.fragmented_count);
+      printf("\tReassembled Packets:   %-13lu (%lu fragments dropped)\n", (unsigned long)cumulative_stats.reassembled_count,
+	     (unsigned long)cumulative_stats.fragment_drop_count);
       printf("\tMax Packet size:       %-13u\n",   cumulative_stats.max_packet_len);
       printf("\tPacket Len < 64:       %-13lu\n", (unsigned long)cumulative_stats.packet_len[0]);
       printf("\tPacket Len 64-128:     %-13lu\n", (unsigned long)cumulative_stats.packet_len[1]);
@@ -1918,6 +2093,20 @@ static void printResults(u_int64_t tot_usec) {
       printf("\tPacket Len 1024-1500:  %-13lu\n", (unsigned long)cumulative_stats.packet_len[4]);
       printf("\tPacket Len > 1500:     %-13lu\n", (unsigned long)cumulative_stats.packet_len[5]);
 
+#ifdef linux
+      for(thread_id = 0; thread_id < num_threads; thread_id++) {
+	struct fanout_ring *fanout = &fanout_rings[thread_id];
+
+	if(fanout->num_checks == 0)
+	  continue;
+
+	printf("\tFanout Ring [thread %d]: %llu packets, %llu dropped, %.1f%% avg / %u%% max blocks in use\n",
+	       thread_id, (long long unsigned int)fanout->num_packets, (long long unsigned int)fanout->num_drops,
+	       (float)(fanout->ready_blocks_sum * 100) / (float)(fanout->num_checks * FANOUT_NUM_BLOCKS),
+	       (fanout->max_ready_blocks * 100) / FANOUT_NUM_BLOCKS);
+      }
+#endif
+
       if(tot_usec > 0) {
 	char buf[32], buf1[32], when[64];
 	float t = (float)(cumulative_stats.ip_packet_count*1000000)/(float)tot_usec;
@@ -1965,6 +2154,8 @@ static void printResults(u_int64_t tot_usec) {
       json_object_object_add(jObj_trafficStats,"mpls.pkts",json_object_new_int64(cumulative_stats.mpls_count));
       json_object_object_add(jObj_trafficStats,"pppoe.pkts",json_object_new_int64(cumulative_stats.pppoe_count));
       json_object_object_add(jObj_trafficStats,"fragmented.pkts",json_object_new_int64(cumulative_stats.fragmented_count));
+      json_object_object_add(jObj_trafficStats,"reassembled.pkts",json_object_new_int64(cumulative_stats.reassembled_count));
+      json_object_object_add(jObj_trafficStats,"fragments.dropped",json_object_new_int64(cumulative_stats.fragment_drop_count));
       json_object_object_add(jObj_trafficStats,"max.pkt.size",json_object_new_int(cumulative_stats.max_packet_len));
       json_object_object_add(jObj_trafficStats,"pkt.len_min64",json_object_new_int64(cumulative_stats.packet_len[0]));
       json_object_object_add(jObj_trafficStats,"pkt.len_64_128",json_object_new_int64(cumulative_stats.packet_len[1]));
@@ -2050,8 +2241,7 @@ static void printResults(u_int64_t tot_usec) {
 
     num_flows = 0;
     for(thread_id = 0; thread_id < num_threads; thread_id++) {
-      for(i=0; i<NUM_ROOTS; i++)
-        ndpi_twalk(ndpi_thread_info[thread_id].workflow->ndpi_flows_root[i], node_print_known_proto_walker, &thread_id);
+      ndpi_flow_table_walk(ndpi_thread_info[thread_id].workflow->flow_table, node_print_known_proto_walker, &thread_id);
     }
 
     qsort(all_flows, num_flows, sizeof(struct flow_info), cmpFlows);
@@ -2076,8 +2266,7 @@ static void printResults(u_int64_t tot_usec) {
     num_flows = 0;
     for(thread_id = 0; thread_id < num_threads; thread_id++) {
       if(ndpi_thread_info[thread_id].workflow->stats.protocol_counter[0] > 0) {
-        for(i=0; i<NUM_ROOTS; i++)
-	  ndpi_twalk(ndpi_thread_info[thread_id].workflow->ndpi_flows_root[i], node_print_unknown_proto_walker, &thread_id);
+        ndpi_flow_table_walk(ndpi_thread_info[thread_id].workflow->flow_table, node_print_unknown_proto_walker, &thread_id);
       }
     }
 
@@ -2182,6 +2371,8 @@ static void breakPcapLoop(u_int16_t thread_id) {
   if(ndpi_thread_info[thread_id].workflow->pcap_handle != NULL) {
     pcap_breakloop(ndpi_thread_info[thread_id].workflow->pcap_handle);
   }
+
+  savefile_readers[thread_id].breakloop = 1;
 }
 
 /**
@@ -2200,6 +2391,21 @@ void sigproc(int sig) {
 }
 
 
+/**
+ * @brief Read the next file name of a playlist, skipping empty lines and comments
+ */
+static int readPlaylistLine(FILE *fp, char filename[], u_int32_t filename_len) {
+
+ next_line:
+  if(fgets(filename, filename_len, fp)) {
+    int l = strlen(filename);
+    if(l > 0 && filename[l-1] == '\n') filename[l-1] = '\0';
+    if(filename[0] == '\0' || filename[0] == '#') goto next_line;
+    return 0;
+  } else
+    return -1;
+}
+
 /**
  * @brief Get the next pcap file from a passed playlist
  */
@@ -2210,13 +2416,9 @@ static int getNextPcapFileFromPlaylist(u_int16_t thread_id, char filename[], u_i
       return -1;
   }
 
- next_line:
-  if(fgets(filename, filename_len, playlist_fp[thread_id])) {
-    int l = strlen(filename);
-    if(filename[0] == '\0' || filename[0] == '#') goto next_line;
-    if(filename[l-1] == '\n') filename[l-1] = '\0';
+  if(readPlaylistLine(playlist_fp[thread_id], filename, filename_len) == 0)
     return 0;
-  } else {
+  else {
     fclose(playlist_fp[thread_id]);
     playlist_fp[thread_id] = NULL;
     return -1;
@@ -2224,6 +2426,25 @@ static int getNextPcapFileFromPlaylist(u_int16_t thread_id, char filename[], u_i
 }
 
 
+/**
+ * @brief Let the kernel read the file that follows in the playlist while the current one is processed
+ */
+static void prefetchNextPcapFileFromPlaylist(u_int16_t thread_id) {
+  FILE *fp = playlist_fp[thread_id];
+  long offset;
+  char filename[256];
+
+  if((fp == NULL) || ((offset = ftell(fp)) < 0))
+    return;
+
+  if(readPlaylistLine(fp, filename, sizeof(filename)) == 0)
+    ndpi_savefile_prefetch(filename);
+
+  clearerr(fp);
+  fseek(fp, offset, SEEK_SET);
+}
+
+
 /**
  * @brief Configure the pcap handle
  */
@@ -2244,6 +2465,164 @@ static void configurePcapHandle(pcap_t * pcap_handle) {
 }
 
 
+/**
+ * @brief Map a pcap file (see ndpi_savefile_open) and compile the BPF filter for it -
+ *        Returns NULL if the file is left to pcap_open_offline()
+ */
+static pcap_t * openSavefile(u_int16_t thread_id, const char *filename) {
+  struct savefile_reader *reader = &savefile_readers[thread_id];
+  pcap_t *pcap_handle;
+
+  if((reader->file = ndpi_savefile_open(filename)) == NULL)
+    return(NULL);
+
+  /* The workflow reads the datalink of the packets from the handle */
+  pcap_handle = pcap_open_dead(ndpi_savefile_datalink(reader->file), ndpi_savefile_snaplen(reader->file));
+
+  if(bpfFilter != NULL) {
+    if(pcap_compile(pcap_handle, &reader->filter, bpfFilter, 1, 0xFFFFFF00) < 0)
+      printf("pcap_compile error: '%s'\n", pcap_geterr(pcap_handle));
+    else {
+      reader->filtered = 1;
+      printf("Successfully set BPF filter to '%s'\n", bpfFilter);
+    }
+  }
+
+  prefetchNextPcapFileFromPlaylist(thread_id);
+
+  return(pcap_handle);
+}
+
+/**
+ * @brief Unmap the pcap file of a thread, if any
+ */
+static void closeSavefile(u_int16_t thread_id) {
+  struct savefile_reader *reader = &savefile_readers[thread_id];
+
+  if(reader->file != NULL) {
+    ndpi_savefile_close(reader->file);
+    reader->file = NULL;
+  }
+
+  if(reader->filtered) {
+    pcap_freecode(&reader->filter);
+    reader->filtered = 0;
+  }
+}
+
+
+#ifdef linux
+/**
+ * @brief Join the PACKET_FANOUT group of a device with a TPACKET_V3 ring (see
+ *        fanout_capture) - Returns NULL if the device does not exist
+ */
+static pcap_t * openFanoutDevice(u_int16_t thread_id, const char *device) {
+  struct fanout_ring *fanout = &fanout_rings[thread_id];
+  int ifindex = if_nametoindex(device), datalink, version = TPACKET_V3, reserve = 4 /* VLAN tag */;
+  u_int32_t fanout_arg = (getpid() & 0xFFFF) | ((u_int32_t)(PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+  struct tpacket_req3 req;
+  struct sockaddr_ll sll;
+  struct packet_mreq mreq;
+  struct ifreq ifr;
+
+  if(ifindex == 0)
+    return(NULL);
+
+  if((fanout->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+    goto fanout_error;
+
+  memset(&ifr, 0, sizeof(ifr));
+  snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", device);
+
+  if(ioctl(fanout->fd, SIOCGIFHWADDR, &ifr) < 0)
+    goto fanout_error;
+
+  /* Keep the link header when the workflow decodes it, otherwise packets start at IP */
+  if((ifr.ifr_hwaddr.sa_family == ARPHRD_ETHER) || (ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK))
+    fanout->raw = 1, datalink = DLT_EN10MB;
+  else {
+    close(fanout->fd);
+    fanout->raw = 0, datalink = DLT_RAW;
+
+    if((fanout->fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL))) < 0)
+      goto fanout_error;
+  }
+
+  if(bpfFilter != NULL) {
+    pcap_t *dead = pcap_open_dead(datalink, FANOUT_FRAME_SIZE);
+    struct bpf_program fcode;
+    struct sock_fprog fprog;
+
+    if(pcap_compile(dead, &fcode, bpfFilter, 1, 0xFFFFFF00) < 0)
+      printf("pcap_compile error: '%s'\n", pcap_geterr(dead));
+    else {
+      fprog.len = fcode.bf_len, fprog.filter = (struct sock_filter*)fcode.bf_insns;
+
+      if(setsockopt(fanout->fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+	printf("SO_ATTACH_FILTER error: '%s'\n", strerror(errno));
+      else if(thread_id == 0)
+	printf("Successfully set BPF filter to '%s'\n", bpfFilter);
+
+      pcap_freecode(&fcode);
+    }
+
+    pcap_close(dead);
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = FANOUT_BLOCK_SIZE, req.tp_block_nr = FANOUT_NUM_BLOCKS;
+  req.tp_frame_size = FANOUT_FRAME_SIZE, req.tp_frame_nr = (FANOUT_BLOCK_SIZE / FANOUT_FRAME_SIZE) * FANOUT_NUM_BLOCKS;
+  req.tp_retire_blk_tov = FANOUT_BLOCK_TIMEOUT;
+
+  if((setsockopt(fanout->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+     || (fanout->raw && (setsockopt(fanout->fd, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve)) < 0))
+     || (setsockopt(fanout->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0))
+    goto fanout_error;
+
+  if((fanout->map = mmap(NULL, FANOUT_BLOCK_SIZE * FANOUT_NUM_BLOCKS, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, fanout->fd, 0)) == MAP_FAILED) {
+    fanout->map = NULL;
+    goto fanout_error;
+  }
+
+  memset(&sll, 0, sizeof(sll));
+  sll.sll_family = AF_PACKET, sll.sll_protocol = htons(ETH_P_ALL), sll.sll_ifindex = ifindex;
+
+  memset(&mreq, 0, sizeof(mreq));
+  mreq.mr_ifindex = ifindex, mreq.mr_type = PACKET_MR_PROMISC;
+
+  /* The group is joined once bound: from now on the kernel spreads the flows across its members */
+  if((bind(fanout->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0)
+     || (setsockopt(fanout->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+     || (setsockopt(fanout->fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg, sizeof(fanout_arg)) < 0))
+    goto fanout_error;
+
+  fanout->next_block = 0;
+  fanout->num_packets = fanout->num_drops = 0;
+  fanout->ready_blocks_sum = fanout->num_checks = 0, fanout->max_ready_blocks = 0;
+
+  return(pcap_open_dead(datalink, FANOUT_FRAME_SIZE));
+
+ fanout_error:
+  printf("ERROR: could not capture from device %s with PACKET_FANOUT: %s\n", device, strerror(errno));
+  exit(-1);
+}
+
+/**
+ * @brief Leave the PACKET_FANOUT group of a thread
+ */
+static void closeFanoutDevice(u_int16_t thread_id) {
+  struct fanout_ring *fanout = &fanout_rings[thread_id];
+
+  if(fanout->map != NULL) {
+    munmap(fanout->map, FANOUT_BLOCK_SIZE * FANOUT_NUM_BLOCKS);
+    close(fanout->fd);
+    fanout->map = NULL;
+  }
+}
+#endif
+
+
 /**
  * @brief Open a pcap file or a specified device - Always returns a valid pcap_t
  */
@@ -2254,22 +2633,46 @@ static pcap_t * openPcapFileOrDevice(u_int16_t thread_id, const u_char * pcap_fi
   char pcap_error_buffer[PCAP_ERRBUF_SIZE];
   pcap_t * pcap_handle = NULL;
 
+#ifdef linux
+  if(fanout_capture && ((pcap_handle = openFanoutDevice(thread_id, (const char*)pcap_file)) != NULL)) {
+    u_int num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    live_capture = 1;
+
+    /* The threads sharing a device: up to one per core (pcap files are not capped) */
+    if((thread_id == 0) && (num_threads > num_cores)) {
+      if((!json_flag) && (!quiet_mode))
+	printf("WARNING: %u threads requested, using one thread per core (%u)\n", num_threads, num_cores);
+      num_threads = num_cores;
+    }
+
+    if((!json_flag) && (!quiet_mode) && (thread_id == 0))
+      printf("Capturing live traffic from device %s with %u threads (PACKET_FANOUT)...\n", pcap_file, num_threads);
+  } else
+#endif
   /* trying to open a live interface */
   if((pcap_handle = pcap_open_live((char*)pcap_file, snaplen, promisc,
 				   500, pcap_error_buffer)) == NULL) {
     capture_for = capture_until = 0;
 
     live_capture = 0;
-    num_threads = 1; /* Open pcap files in single threads mode */
+
+    /* Open pcap files in single threads mode, or with a reader thread feeding the -n threads */
+    if((thread_id == 0) && (num_threads > 1)
+       && (pcap_analysis_duration == (u_int32_t)-1) && (extcap_dumper == NULL))
+      num_pipeline_threads = num_threads;
+    num_threads = 1;
 
     /* trying to open a pcap file */
-    if((pcap_handle = pcap_open_offline((char*)pcap_file, pcap_error_buffer)) == NULL) {
+    if(((pcap_handle = openSavefile(thread_id, (const char*)pcap_file)) == NULL)
+       && ((pcap_handle = pcap_open_offline((char*)pcap_file, pcap_error_buffer)) == NULL)) {
       char filename[256] = { 0 };
 
       if(strstr((char*)pcap_file, (char*)".pcap"))
 	printf("ERROR: could not open pcap file %s: %s\n", pcap_file, pcap_error_buffer);
       else if((getNextPcapFileFromPlaylist(thread_id, filename, sizeof(filename)) != 0)
-	 || ((pcap_handle = pcap_open_offline(filename, pcap_error_buffer)) == NULL)) {
+	 || (((pcap_handle = openSavefile(thread_id, filename)) == NULL)
+	     && ((pcap_handle = pcap_open_offline(filename, pcap_error_buffer)) == NULL))) {
         printf("ERROR: could not open playlist %s: %s\n", filename, pcap_error_buffer);
         exit(-1);
       } else {
@@ -2287,7 +2690,13 @@ static pcap_t * openPcapFileOrDevice(u_int16_t thread_id, const u_char * pcap_fi
       printf("Capturing live traffic from device %s...\n", pcap_file);
   }
 
-  configurePcapHandle(pcap_handle);
+  /* The filter of fanout rings and savefiles is already compiled */
+  if(savefile_readers[thread_id].file == NULL
+#ifdef linux
+     && (fanout_rings[thread_id].map == NULL)
+#endif
+     )
+    configurePcapHandle(pcap_handle);
 
   if(capture_for > 0) {
     if((!json_flag) && (!quiet_mode))
@@ -2302,53 +2711,93 @@ static pcap_t * openPcapFileOrDevice(u_int16_t thread_id, const u_char * pcap_fi
   return pcap_handle;
 }
 
+/**
+ * @brief Process a packet with the workflow of a thread (see packet_copy_mode)
+ */
+static struct ndpi_proto processPacket(u_int16_t thread_id,
+				       const struct pcap_pkthdr *header,
+				       const u_char *packet) {
+  struct ndpi_proto p;
+  const u_char *packet_processed = packet;
+  uint8_t *packet_checked = NULL;
+
+  switch(packet_copy_mode) {
+  case PACKET_COPY_BUFFER:
+    if(header->caplen > ndpi_thread_info[thread_id].packet_buffer_len) {
+      uint8_t *buf = realloc(ndpi_thread_info[thread_id].packet_buffer, header->caplen);
+
+      if(buf == NULL) {
+	printf("Fatal error: not enough memory\n");
+	exit(-1);
+      }
+
+      ndpi_thread_info[thread_id].packet_buffer = buf, ndpi_thread_info[thread_id].packet_buffer_len = header->caplen;
+    }
+
+    memcpy(ndpi_thread_info[thread_id].packet_buffer, packet, header->caplen);
+    packet_processed = ndpi_thread_info[thread_id].packet_buffer;
+    break;
+
+  case PACKET_COPY_CHECK:
+    /* allocate an exact size buffer to check overflows */
+    if((packet_checked = malloc(header->caplen)) == NULL) {
+      printf("Fatal error: not enough memory\n");
+      exit(-1);
+    }
+
+    memcpy(packet_checked, packet, header->caplen);
+    packet_processed = packet_checked;
+    break;
+  }
+
+  p = ndpi_workflow_process_packet(ndpi_thread_info[thread_id].workflow, header, packet_processed);
+
+  if(packet_checked) {
+    /* check for buffer changes */
+    if(memcmp(packet, packet_checked, header->caplen) != 0)
+      printf("INTERNAL ERROR: ingress packet was modified by nDPI: this should not happen [thread_id=%u, packetId=%lu, caplen=%u]\n",
+	     thread_id, (unsigned long)ndpi_thread_info[thread_id].workflow->stats.raw_packet_count, header->caplen);
+    free(packet_checked);
+  }
+
+  return(p);
+}
+
+/**
+ * @brief Idle flows cleanup (live capture), every IDLE_SCAN_PERIOD
+ */
+static void checkIdleFlows(u_int16_t thread_id) {
+  if(live_capture) {
+    if(ndpi_thread_info[thread_id].last_idle_scan_time + IDLE_SCAN_PERIOD < ndpi_thread_info[thread_id].workflow->last_time) {
+      /* expire idle flows: they are accounted by on_idle_flows_exported() */
+      ndpi_workflow_expire_idle_flows(ndpi_thread_info[thread_id].workflow, MAX_IDLE_TIME, IDLE_SCAN_BUDGET);
+      ndpi_thread_info[thread_id].last_idle_scan_time = ndpi_thread_info[thread_id].workflow->last_time;
+    }
+  }
+}
+
 /**
  * @brief Check pcap packet
  */
 static void pcap_process_packet(u_char *args,
 				const struct pcap_pkthdr *header,
 				const u_char *packet) {
-  struct ndpi_proto p;
   u_int16_t thread_id = *((u_int16_t*)args);
+  struct ndpi_proto p;
 
-  /* allocate an exact size buffer to check overflows */
-  uint8_t *packet_checked = malloc(header->caplen);
-
-  memcpy(packet_checked, packet, header->caplen);
-  p = ndpi_workflow_process_packet(ndpi_thread_info[thread_id].workflow, header, packet_checked);
+  /* Packets of detected flows do not reach nDPI: switch to published rules anyway */
+  ndpi_rules_quiescent(ndpi_thread_info[thread_id].workflow->ndpi_struct);
+  p = processPacket(thread_id, header, packet);
 
   if((capture_until != 0) && (header->ts.tv_sec >= capture_until)) {
-    if(ndpi_thread_info[thread_id].workflow->pcap_handle != NULL)
-      pcap_breakloop(ndpi_thread_info[thread_id].workflow->pcap_handle);
+    breakPcapLoop(thread_id);
     return;
   }
 
   if(!pcap_start.tv_sec) pcap_start.tv_sec = header->ts.tv_sec, pcap_start.tv_usec = header->ts.tv_usec;
   pcap_end.tv_sec = header->ts.tv_sec, pcap_end.tv_usec = header->ts.tv_usec;
 
-  /* Idle flows cleanup */
-  if(live_capture) {
-    if(ndpi_thread_info[thread_id].last_idle_scan_time + IDLE_SCAN_PERIOD < ndpi_thread_info[thread_id].workflow->last_time) {
-      /* scan for idle flows */
-      ndpi_twalk(ndpi_thread_info[thread_id].workflow->ndpi_flows_root[ndpi_thread_info[thread_id].idle_scan_idx], node_idle_scan_walker, &thread_id);
-
-      /* remove idle flows (unfortunately we cannot do this inline) */
-      while (ndpi_thread_info[thread_id].num_idle_flows > 0) {
-
-	/* search and delete the idle flow from the "ndpi_flow_root" (see struct reader thread) - here flows are the node of a b-tree */
-	ndpi_tdelete(ndpi_thread_info[thread_id].idle_flows[--ndpi_thread_info[thread_id].num_idle_flows],
-		     &ndpi_thread_info[thread_id].workflow->ndpi_flows_root[ndpi_thread_info[thread_id].idle_scan_idx],
-		     ndpi_workflow_node_cmp);
-
-	/* free the memory associated to idle flow in "idle_flows" - (see struct reader thread)*/
-	ndpi_free_flow_info_half(ndpi_thread_info[thread_id].idle_flows[ndpi_thread_info[thread_id].num_idle_flows]);
-	ndpi_free(ndpi_thread_info[thread_id].idle_flows[ndpi_thread_info[thread_id].num_idle_flows]);
-      }
-
-      if(++ndpi_thread_info[thread_id].idle_scan_idx == ndpi_thread_info[thread_id].workflow->prefs.num_roots) ndpi_thread_info[thread_id].idle_scan_idx = 0;
-      ndpi_thread_info[thread_id].last_idle_scan_time = ndpi_thread_info[thread_id].workflow->last_time;
-    }
-  }
+  checkIdleFlows(thread_id);
 
 #ifdef DEBUG_TRACE
   if(trace) fprintf(trace, "Found %u bytes packet %u.%u\n", header->caplen, p.app_protocol, p.master_protocol);
@@ -2390,14 +2839,7 @@ static void pcap_process_packet(u_char *args,
     pcap_dump_flush(extcap_dumper);
   }
 
-  /* check for buffer changes */
-  if(memcmp(packet, packet_checked, header->caplen) != 0)
-    printf("INTERNAL ERROR: ingress packet was modified by nDPI: this should not happen [thread_id=%u, packetId=%lu, caplen=%u]\n",
-	   thread_id, (unsigned long)ndpi_thread_info[thread_id].workflow->stats.raw_packet_count, header->caplen);
-  free(packet_checked);
-
   if((pcap_end.tv_sec-pcap_start.tv_sec) > pcap_analysis_duration) {
-    int i;
     u_int64_t tot_usec;
 
     gettimeofday(&end, NULL);
@@ -2405,12 +2847,9 @@ static void pcap_process_packet(u_char *args,
 
     printResults(tot_usec);
 
-    for(i=0; i<ndpi_thread_info[thread_id].workflow->prefs.num_roots; i++) {
-      ndpi_tdestroy(ndpi_thread_info[thread_id].workflow->ndpi_flows_root[i], ndpi_flow_info_freer);
-      ndpi_thread_info[thread_id].workflow->ndpi_flows_root[i] = NULL;
+    ndpi_workflow_free_flows(ndpi_thread_info[thread_id].workflow);
 
-      memset(&ndpi_thread_info[thread_id].workflow->stats, 0, sizeof(struct ndpi_stats));
-    }
+    memset(&ndpi_thread_info[thread_id].workflow->stats, 0, sizeof(struct ndpi_stats));
 
     printf("\n-------------------------------------------\n\n");
 
@@ -2420,22 +2859,325 @@ static void pcap_process_packet(u_char *args,
 }
 
 
+/**
+ * @brief Process packets handed over together (ring blocks): as a single workflow
+ *        burst unless each packet has to be handled on its own
+ */
+static void processPacketBurst(u_int16_t thread_id,
+			       const struct pcap_pkthdr *headers,
+			       const u_char * const *packets,
+			       u_int32_t num_packets) {
+  u_int32_t i;
+
+  if((packet_copy_mode != PACKET_COPY_NONE) || (extcap_dumper != NULL)
+     || (pcap_analysis_duration != (u_int32_t)-1)) {
+    for(i = 0; i < num_packets; i++)
+      pcap_process_packet((u_char*)&thread_id, &headers[i], packets[i]);
+    return;
+  }
+
+  ndpi_workflow_process_burst(ndpi_thread_info[thread_id].workflow, headers, packets, num_packets, NULL);
+
+  if(!pcap_start.tv_sec) pcap_start.tv_sec = headers[0].ts.tv_sec, pcap_start.tv_usec = headers[0].ts.tv_usec;
+  pcap_end.tv_sec = headers[num_packets-1].ts.tv_sec, pcap_end.tv_usec = headers[num_packets-1].ts.tv_usec;
+
+  checkIdleFlows(thread_id);
+}
+
+/**
+ * @brief Wait for the other side of a pipeline ring
+ */
+static void pipeline_wait(u_int32_t *num_waits) {
+  if((*num_waits)++ < 64)
+    sched_yield();
+  else
+    usleep(50);
+}
+
+
+/**
+ * @brief Wait until the threads have processed all the packets handed to them
+ */
+static void pipeline_drain() {
+  int thread_id;
+
+  for(thread_id = 0; thread_id < num_threads; thread_id++) {
+    struct pipeline_ring *ring = ndpi_thread_info[thread_id].ring;
+    u_int32_t num_waits = 0;
+
+    while((ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) != ring->head)
+      pipeline_wait(&num_waits);
+  }
+}
+
+
+/**
+ * @brief The threads decode the packets with the datalink of their pcap handle
+ */
+static void pipeline_set_datalink(int datalink) {
+  int thread_id;
+
+  pipeline_drain();
+
+  /* The first thread shares the pcap handle of the reader */
+  for(thread_id = 1; thread_id < num_threads; thread_id++) {
+    if(ndpi_thread_info[thread_id].workflow->pcap_handle != NULL)
+      pcap_close(ndpi_thread_info[thread_id].workflow->pcap_handle);
+
+    ndpi_thread_info[thread_id].workflow->pcap_handle = pcap_open_dead(datalink, PIPELINE_SNAPLEN);
+  }
+
+  pipeline_datalink = datalink;
+}
+
+
+/**
+ * @brief Hand a packet to the thread of its flow
+ */
+static void pipeline_dispatch_packet(u_char *args,
+				     const struct pcap_pkthdr *header,
+				     const u_char *packet) {
+  int datalink = pcap_datalink(ndpi_thread_info[0].workflow->pcap_handle);
+  struct pipeline_ring *ring;
+  struct pipeline_slot *slot;
+  u_int32_t num_waits = 0;
+
+  if(datalink != pipeline_datalink)
+    pipeline_set_datalink(datalink);
+
+  ring = ndpi_thread_info[ndpi_workflow_packet_hash(datalink, header, packet) % num_threads].ring;
+
+  while(ring->head - ring->cached_tail == PIPELINE_RING_SIZE) {
+    ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if(ring->head - ring->cached_tail == PIPELINE_RING_SIZE)
+      pipeline_wait(&num_waits);
+  }
+
+  slot = &ring->slots[ring->head & (PIPELINE_RING_SIZE - 1)];
+  memcpy(&slot->header, header, sizeof(slot->header));
+
+  /* A mapped savefile stays until the threads have processed its packets (see pipeline_drain) */
+  if(savefile_readers[0].file != NULL)
+    slot->packet = packet;
+  else {
+    if(header->caplen > slot->data_len) {
+      uint8_t *buf = realloc(slot->data, header->caplen);
+
+      if(buf == NULL) {
+	printf("Fatal error: not enough memory\n");
+	exit(-1);
+      }
+
+      slot->data = buf, slot->data_len = header->caplen;
+    }
+
+    memcpy(slot->data, packet, header->caplen);
+    slot->packet = slot->data;
+  }
+
+  /*
+    A workflow never goes back in time: a thread has to see the time of the
+    packets it did not receive, as if it had processed all of them
+  */
+  if((header->ts.tv_sec < pipeline_last_ts.tv_sec)
+     || ((header->ts.tv_sec == pipeline_last_ts.tv_sec) && (header->ts.tv_usec < pipeline_last_ts.tv_usec)))
+    slot->header.ts = pipeline_last_ts;
+  else
+    pipeline_last_ts = header->ts;
+
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+  if(!pcap_start.tv_sec) pcap_start.tv_sec = header->ts.tv_sec, pcap_start.tv_usec = header->ts.tv_usec;
+  pcap_end.tv_sec = header->ts.tv_sec, pcap_end.tv_usec = header->ts.tv_usec;
+}
+
+
+/**
+ * @brief Process the packets of a mapped savefile: they are handed to the
+ *        workflow in bursts, or to the pipeline threads, without being copied
+ */
+static void runSavefileLoop(u_int16_t thread_id) {
+  struct savefile_reader *reader = &savefile_readers[thread_id];
+  struct pcap_pkthdr headers[WORKFLOW_BURST_SIZE];
+  const u_char *packets[WORKFLOW_BURST_SIZE];
+  u_int32_t num_packets = 0;
+  int rc = 0;
+
+  while((!shutdown_app) && (!reader->breakloop)) {
+    struct pcap_pkthdr *header = &headers[num_packets];
+
+    /* The pipeline threads own their modules, else this thread does */
+    if(!num_pipeline_threads)
+      ndpi_rules_quiescent(ndpi_thread_info[thread_id].workflow->ndpi_struct);
+
+    if((rc = ndpi_savefile_next(reader->file, header, &packets[num_packets])) != 1)
+      break;
+
+    if(reader->filtered && !pcap_offline_filter(&reader->filter, header, packets[num_packets]))
+      continue;
+
+    if(num_pipeline_threads)
+      pipeline_dispatch_packet((u_char*)&thread_id, header, packets[num_packets]);
+    else if(++num_packets == WORKFLOW_BURST_SIZE)
+      processPacketBurst(thread_id, headers, packets, num_packets), num_packets = 0;
+  }
+
+  if(num_packets > 0)
+    processPacketBurst(thread_id, headers, packets, num_packets);
+
+  if((rc < 0) && (!json_flag) && (!quiet_mode))
+    printf("WARNING: truncated or corrupted pcap file, its last packets are skipped\n");
+
+  reader->breakloop = 0;
+}
+
 /**
  * @brief Call pcap_loop() to process packets from a live capture or savefile
  */
 static void runPcapLoop(u_int16_t thread_id) {
-  if((!shutdown_app) && (ndpi_thread_info[thread_id].workflow->pcap_handle != NULL))
-    pcap_loop(ndpi_thread_info[thread_id].workflow->pcap_handle, -1, &pcap_process_packet, (u_char*)&thread_id);
+  struct ndpi_workflow *workflow = ndpi_thread_info[thread_id].workflow;
+
+  if(savefile_readers[thread_id].file != NULL)
+    runSavefileLoop(thread_id);
+  else if((!shutdown_app) && (workflow->pcap_handle != NULL)) {
+    if(live_capture && (!num_pipeline_threads)) {
+      /* pcap_dispatch() returns on the read timeout: rules published meanwhile are switched to */
+      while((!shutdown_app) && (pcap_dispatch(workflow->pcap_handle, -1, &pcap_process_packet, (u_char*)&thread_id) >= 0))
+	ndpi_rules_quiescent(workflow->ndpi_struct);
+    } else
+      pcap_loop(workflow->pcap_handle, -1,
+		num_pipeline_threads ? &pipeline_dispatch_packet : &pcap_process_packet, (u_char*)&thread_id);
+  }
 }
 
+#ifdef linux
 /**
- * @brief Process a running thread
+ * @brief Block i of a fanout ring, starting from the next one to process
  */
-void * processing_thread(void *_thread_id) {
+static struct tpacket_block_desc * fanoutBlock(struct fanout_ring *fanout, u_int32_t i) {
+  return((struct tpacket_block_desc*)&fanout->map[((fanout->next_block + i) % FANOUT_NUM_BLOCKS) * FANOUT_BLOCK_SIZE]);
+}
 
-  long thread_id = (long) _thread_id;
+/**
+ * @brief Process the packets of the TPACKET_V3 ring of a fanout member: the packets
+ *        of up to FANOUT_RELEASE_BATCH blocks go in bursts to the workflow, then the
+ *        blocks are given back to the kernel together
+ */
+static void runFanoutLoop(u_int16_t thread_id) {
+  struct fanout_ring *fanout = &fanout_rings[thread_id];
+  struct pcap_pkthdr headers[WORKFLOW_BURST_SIZE];
+  const u_char *packets[WORKFLOW_BURST_SIZE];
+  struct tpacket_stats_v3 stats;
+  socklen_t stats_len = sizeof(stats);
+  struct pollfd pfd;
+
+  pfd.fd = fanout->fd, pfd.events = POLLIN | POLLERR, pfd.revents = 0;
+
+  while(!shutdown_app) {
+    u_int32_t num_blocks = 0, num_packets = 0, b, i;
+
+    while((num_blocks < FANOUT_NUM_BLOCKS)
+	  && (__atomic_load_n(&fanoutBlock(fanout, num_blocks)->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+      num_blocks++;
+
+    fanout->ready_blocks_sum += num_blocks, fanout->num_checks++;
+    if(num_blocks > fanout->max_ready_blocks) fanout->max_ready_blocks = num_blocks;
+
+    if(num_blocks == 0) {
+      ndpi_rules_quiescent(ndpi_thread_info[thread_id].workflow->ndpi_struct);
+      poll(&pfd, 1, FANOUT_POLL_TIMEOUT);
+      continue;
+    }
+
+    if(num_blocks > FANOUT_RELEASE_BATCH)
+      num_blocks = FANOUT_RELEASE_BATCH;
+
+    for(b = 0; b < num_blocks; b++) {
+      struct tpacket_block_desc *block = fanoutBlock(fanout, b);
+      struct tpacket3_hdr *pkt = (struct tpacket3_hdr*)((u_int8_t*)block + block->hdr.bh1.offset_to_first_pkt);
+
+      for(i = 0; i < block->hdr.bh1.num_pkts; i++) {
+	struct pcap_pkthdr *header = &headers[num_packets];
+	u_int8_t *packet = (u_int8_t*)pkt + pkt->tp_mac;
+
+	header->ts.tv_sec = pkt->tp_sec, header->ts.tv_usec = pkt->tp_nsec / 1000;
+	header->caplen = pkt->tp_snaplen, header->len = pkt->tp_len;
+
+	/* The kernel strips the VLAN tag: put it back in the room left by PACKET_RESERVE */
+	if(fanout->raw && (pkt->hv1.tp_vlan_tci || (pkt->tp_status & TP_STATUS_VLAN_VALID)) && (header->caplen >= 12)) {
+	  u_int16_t tpid = htons((pkt->tp_status & TP_STATUS_VLAN_TPID_VALID) ? pkt->hv1.tp_vlan_tpid : ETH_P_8021Q);
+	  u_int16_t tci = htons(pkt->hv1.tp_vlan_tci);
+
+	  packet -= 4;
+	  memmove(packet, &packet[4], 12 /* MAC addresses */);
+	  memcpy(&packet[12], &tpid, 2), memcpy(&packet[14], &tci, 2);
+	  header->caplen += 4, header->len += 4;
+	}
+
+	packets[num_packets++] = packet;
+
+	if(num_packets == WORKFLOW_BURST_SIZE)
+	  processPacketBurst(thread_id, headers, packets, num_packets), num_packets = 0;
+
+	pkt = (struct tpacket3_hdr*)((u_int8_t*)pkt + pkt->tp_next_offset);
+      }
+    }
+
+    if(num_packets > 0)
+      processPacketBurst(thread_id, headers, packets, num_packets);
+
+    for(b = 0; b < num_blocks; b++)
+      __atomic_store_n(&fanoutBlock(fanout, b)->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+    fanout->next_block = (fanout->next_block + num_blocks) % FANOUT_NUM_BLOCKS;
+  }
+
+  /* The counters are reset when read */
+  if(getsockopt(fanout->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &stats_len) == 0)
+    fanout->num_packets += stats.tp_packets, fanout->num_drops += stats.tp_drops;
+}
+#endif
+
+/**
+ * @brief Read the packets of a thread, up to the last file of its playlist
+ */
+static void runPcapLoops(u_int16_t thread_id) {
   char pcap_error_buffer[PCAP_ERRBUF_SIZE];
 
+ pcap_loop:
+  runPcapLoop(thread_id);
+
+  if(playlist_fp[thread_id] != NULL) { /* playlist: read next file */
+    struct ndpi_workflow *workflow = ndpi_thread_info[thread_id].workflow;
+    char filename[256];
+
+    /* The pcap handle and the mapped file of the reader thread are also used by the processing threads */
+    if(num_pipeline_threads)
+      pipeline_drain();
+
+    closeSavefile(thread_id);
+
+    if(getNextPcapFileFromPlaylist(thread_id, filename, sizeof(filename)) == 0) {
+      pcap_t *pcap_handle = openSavefile(thread_id, filename);
+
+      if((pcap_handle == NULL) && ((pcap_handle = pcap_open_offline(filename, pcap_error_buffer)) != NULL))
+	configurePcapHandle(pcap_handle);
+
+      if(pcap_handle != NULL) {
+	if(workflow->pcap_handle != NULL)
+	  pcap_close(workflow->pcap_handle);
+
+	workflow->pcap_handle = pcap_handle;
+	goto pcap_loop;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Bind a thread to its core (see -g)
+ */
+static void setThreadAffinity(long thread_id) {
 #if defined(linux) && defined(HAVE_PTHREAD_SETAFFINITY_NP)
   if(core_affinity[thread_id] >= 0) {
     cpu_set_t cpuset;
@@ -2450,22 +3192,210 @@ void * processing_thread(void *_thread_id) {
   } else
 #endif
     if((!json_flag) && (!quiet_mode)) printf("Running thread %ld...\n", thread_id);
+}
 
- pcap_loop:
-  runPcapLoop(thread_id);
+/**
+ * @brief Process a running thread
+ */
+void * processing_thread(void *_thread_id) {
+
+  long thread_id = (long) _thread_id;
+
+  setThreadAffinity(thread_id);
+
+#ifdef linux
+  if(fanout_rings[thread_id].map != NULL)
+    runFanoutLoop(thread_id);
+  else
+#endif
+    runPcapLoops(thread_id);
+
+  return NULL;
+}
+
+/**
+ * @brief Process the packets that the reader thread hands to a thread
+ */
+static void * pipeline_processing_thread(void *_thread_id) {
+  long thread_id = (long) _thread_id;
+  struct pipeline_ring *ring = ndpi_thread_info[thread_id].ring;
+  struct pcap_pkthdr headers[WORKFLOW_BURST_SIZE];
+  const u_char *packets[WORKFLOW_BURST_SIZE];
+  u_int32_t tail = 0, head, num_waits = 0;
+
+  setThreadAffinity(thread_id);
+
+  for(;;) {
+    /* Idle or not (packets of detected flows do not reach nDPI) */
+    ndpi_rules_quiescent(ndpi_thread_info[thread_id].workflow->ndpi_struct);
+
+    if((head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) == tail) {
+      /* The last packets are published before done */
+      if(__atomic_load_n(&ring->done, __ATOMIC_ACQUIRE)
+	 && (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail))
+	break;
+
+      pipeline_wait(&num_waits);
+      continue;
+    }
+
+    for(num_waits = 0; tail != head; ) {
+      if(packet_copy_mode == PACKET_COPY_NONE) {
+	/* The slots ready are processed as a burst, then given back together */
+	u_int32_t num_packets = ndpi_min(head - tail, WORKFLOW_BURST_SIZE), i;
+
+	for(i = 0; i < num_packets; i++) {
+	  struct pipeline_slot *slot = &ring->slots[(tail + i) & (PIPELINE_RING_SIZE - 1)];
+
+	  headers[i] = slot->header, packets[i] = slot->packet;
+	}
+
+	ndpi_workflow_process_burst(ndpi_thread_info[thread_id].workflow, headers, packets, num_packets, NULL);
+	tail += num_packets;
+      } else {
+	struct pipeline_slot *slot = &ring->slots[tail & (PIPELINE_RING_SIZE - 1)];
+
+	processPacket(thread_id, &slot->header, slot->packet);
+	tail++;
+      }
+
+      __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Read the pcap files and hand the packets to the processing threads
+ */
+static void * pipeline_reader_thread(void *_arg) {
+  int thread_id;
+
+  runPcapLoops(0);
+
+  for(thread_id = 0; thread_id < num_threads; thread_id++)
+    __atomic_store_n(&ndpi_thread_info[thread_id].ring->done, 1, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+
+/**
+ * @brief Setup the processing threads of the pcap files read by the first one
+ */
+static void setupPipeline() {
+  long thread_id;
+
+  pipeline_datalink = pcap_datalink(ndpi_thread_info[0].workflow->pcap_handle);
+  memset(&pipeline_last_ts, 0, sizeof(pipeline_last_ts));
+  num_threads = num_pipeline_threads;
+
+  for(thread_id = 0; thread_id < num_threads; thread_id++) {
+    if(thread_id > 0)
+      setupDetection(thread_id, pcap_open_dead(pipeline_datalink, PIPELINE_SNAPLEN));
+
+    if((ndpi_thread_info[thread_id].ring = calloc(1, sizeof(struct pipeline_ring))) == NULL) {
+      printf("Fatal error: not enough memory\n");
+      exit(-1);
+    }
+  }
+}
 
-  if(playlist_fp[thread_id] != NULL) { /* playlist: read next file */
-    char filename[256];
 
-    if(getNextPcapFileFromPlaylist(thread_id, filename, sizeof(filename)) == 0 &&
-       (ndpi_thread_info[thread_id].workflow->pcap_handle = pcap_open_offline(filename, pcap_error_buffer)) != NULL) {
-      configurePcapHandle(ndpi_thread_info[thread_id].workflow->pcap_handle);
-      goto pcap_loop;
+/**
+ * @brief Free the rings of the processing threads
+ */
+static void freePipeline() {
+  int thread_id, i;
+
+  for(thread_id = 0; thread_id < num_threads; thread_id++) {
+    struct pipeline_ring *ring = ndpi_thread_info[thread_id].ring;
+
+    for(i = 0; i < PIPELINE_RING_SIZE; i++)
+      free(ring->slots[i].data);
+
+    free(ring);
+    ndpi_thread_info[thread_id].ring = NULL;
+  }
+}
+
+
+#ifndef WIN32
+static volatile u_int8_t reload_rules = 0, rules_thread_stop = 0;
+static struct ndpi_rules *last_rules = NULL; /* the protocols of the next rules build on it */
+
+/**
+ * @brief Ask for reloading the protocols file (SIGHUP)
+ */
+static void sighup(int sig) {
+  reload_rules = 1;
+}
+
+
+/**
+ * @brief Build the rules of the protocols file and hand them to every thread
+ */
+static void reloadRules() {
+  struct ndpi_rules *rules = ndpi_build_rules(ndpi_thread_info[0].workflow->ndpi_struct,
+					      last_rules, _protoFilePath);
+  u_int8_t published[MAX_NUM_READER_THREADS] = { 0 };
+  int thread_id, num_published = 0, tries, rc;
+
+  if(rules == NULL) {
+    printf("WARNING: unable to reload %s\n", _protoFilePath);
+    return;
+  }
+
+  /* A thread that has not switched to the previous rules yet is retried */
+  for(tries = 0; (tries < 50) && (num_published < num_threads) && (!rules_thread_stop); tries++) {
+    for(thread_id = 0; thread_id < num_threads; thread_id++) {
+      if(published[thread_id]) continue;
+
+      if((rc = ndpi_publish_rules(ndpi_thread_info[thread_id].workflow->ndpi_struct, rules)) == 0)
+	published[thread_id] = 1, num_published++;
+      else if(rc != -2)
+	published[thread_id] = 2, num_published++;
+    }
+
+    if(num_published < num_threads) usleep(100000);
+  }
+
+  for(thread_id = 0; thread_id < num_threads; thread_id++)
+    if(published[thread_id] != 1)
+      printf("WARNING: thread %d is still using the previous rules\n", thread_id);
+
+  /* Kept: the protocols it defines keep their id in the next rules */
+  ndpi_release_rules(last_rules);
+  last_rules = rules;
+  if(!quiet_mode) printf("Reloaded %s\n", _protoFilePath);
+}
+
+
+/**
+ * @brief Reload the protocols file on SIGHUP, free the rules the threads no longer use
+ */
+static void * rules_thread(void *_arg) {
+  int thread_id;
+
+  while(!rules_thread_stop) {
+    usleep(100000);
+
+    for(thread_id = 0; thread_id < num_threads; thread_id++)
+      ndpi_reclaim_rules(ndpi_thread_info[thread_id].workflow->ndpi_struct);
+
+    if(reload_rules) {
+      reload_rules = 0;
+      reloadRules();
     }
   }
 
+  ndpi_release_rules(last_rules);
+  last_rules = NULL;
+
   return NULL;
 }
+#endif
 
 
 /**
@@ -2485,6 +3415,8 @@ void test_lib() {
   if(trace) fprintf(trace, "Num threads: %d\n", num_threads);
 #endif
 
+  num_pipeline_threads = 0;
+
   for(thread_id = 0; thread_id < num_threads; thread_id++) {
     pcap_t *cap;
 
@@ -2496,6 +3428,11 @@ void test_lib() {
     setupDetection(thread_id, cap);
   }
 
+  if(num_pipeline_threads && (ndpi_thread_info[0].workflow->pcap_handle != NULL))
+    setupPipeline();
+  else
+    num_pipeline_threads = 0;
+
   gettimeofday(&begin, NULL);
 
   int status;
@@ -2503,13 +3440,32 @@ void test_lib() {
 
   /* Running processing threads */
   for(thread_id = 0; thread_id < num_threads; thread_id++) {
-    status = pthread_create(&ndpi_thread_info[thread_id].pthread, NULL, processing_thread, (void *) thread_id);
+    status = pthread_create(&ndpi_thread_info[thread_id].pthread, NULL,
+			    num_pipeline_threads ? pipeline_processing_thread : processing_thread, (void *) thread_id);
     /* check pthreade_create return value */
     if(status != 0) {
       fprintf(stderr, "error on create %ld thread\n", thread_id);
       exit(-1);
     }
   }
+
+  if(num_pipeline_threads && (pthread_create(&pipeline_reader, NULL, pipeline_reader_thread, NULL) != 0)) {
+    fprintf(stderr, "error on create reader thread\n");
+    exit(-1);
+  }
+#ifndef WIN32
+  /* Rules reload: the processing threads are never stopped */
+  pthread_t reload_thread;
+
+  if(_protoFilePath != NULL) {
+    signal(SIGHUP, sighup);
+    if(pthread_create(&reload_thread, NULL, rules_thread, NULL) != 0) {
+      fprintf(stderr, "error on create rules reload thread\n");
+      exit(-1);
+    }
+  }
+#endif
+
   /* Waiting for completion */
   for(thread_id = 0; thread_id < num_threads; thread_id++) {
     status = pthread_join(ndpi_thread_info[thread_id].pthread, &thd_res);
@@ -2524,6 +3480,18 @@ void test_lib() {
     }
   }
 
+  if(num_pipeline_threads) {
+    pthread_join(pipeline_reader, NULL);
+    freePipeline();
+  }
+
+#ifndef WIN32
+  if(_protoFilePath != NULL) {
+    rules_thread_stop = 1;
+    pthread_join(reload_thread, NULL);
+  }
+#endif
+
   gettimeofday(&end, NULL);
   tot_usec = end.tv_sec*1000000 + end.tv_usec - (begin.tv_sec*1000000 + begin.tv_usec);
 
@@ -2540,6 +3508,10 @@ void test_lib() {
     if(ndpi_thread_info[thread_id].workflow->pcap_handle != NULL)
       pcap_close(ndpi_thread_info[thread_id].workflow->pcap_handle);
 
+#ifdef linux
+    closeFanoutDevice(thread_id);
+#endif
+    closeSavefile(thread_id);
     terminateDetection(thread_id);
   }
 }
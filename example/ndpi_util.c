@@ -29,7 +29,10 @@
 #include <io.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 #ifndef ETH_P_IP
@@ -74,8 +77,8 @@
 
 void ndpi_free_flow_info_half(struct ndpi_flow_info *flow) {
   if(flow->ndpi_flow) { ndpi_flow_free(flow->ndpi_flow); flow->ndpi_flow = NULL; }
-  if(flow->src_id)    { ndpi_free(flow->src_id); flow->src_id = NULL; }
-  if(flow->dst_id)    { ndpi_free(flow->dst_id); flow->dst_id = NULL; }
+  if(flow->src_id)    { ndpi_flow_free(flow->src_id); flow->src_id = NULL; }
+  if(flow->dst_id)    { ndpi_flow_free(flow->dst_id); flow->dst_id = NULL; }
 }
 
 /* ***************************************************** */
@@ -86,10 +89,13 @@ extern u_int32_t current_ndpi_memory, max_ndpi_memory;
  * @brief malloc wrapper function
  */
 static void *malloc_wrapper(size_t size) {
-  current_ndpi_memory += size;
+  /* Workflows of several threads allocate concurrently */
+  u_int32_t current = __atomic_add_fetch(&current_ndpi_memory, size, __ATOMIC_RELAXED);
+  u_int32_t max = __atomic_load_n(&max_ndpi_memory, __ATOMIC_RELAXED);
 
-  if(current_ndpi_memory > max_ndpi_memory)
-    max_ndpi_memory = current_ndpi_memory;
+  while((current > max)
+	&& !__atomic_compare_exchange_n(&max_ndpi_memory, &max, current, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
 
   return malloc(size);
 }
@@ -162,9 +168,11 @@ static int _debug_protocols_ok = 0;
 
 struct ndpi_workflow * ndpi_workflow_init(const struct ndpi_workflow_prefs * prefs, pcap_t * pcap_handle) {
   set_ndpi_malloc(malloc_wrapper), set_ndpi_free(free_wrapper);
-  set_ndpi_flow_malloc(NULL), set_ndpi_flow_free(NULL);
+  /* Flow and id structures: from the workflow pool (if any) or ndpi_malloc() */
+  set_ndpi_flow_malloc(ndpi_flow_pool_malloc), set_ndpi_flow_free(ndpi_flow_pool_free);
   /* TODO: just needed here to init ndpi malloc wrapper */
-  struct ndpi_detection_module_struct * module = ndpi_init_detection_module();
+  struct ndpi_detection_module_struct * module = prefs->shared_module ?
+    ndpi_init_detection_context(prefs->shared_module, 0) : ndpi_init_detection_module();
 
   struct ndpi_workflow * workflow = ndpi_calloc(1, sizeof(struct ndpi_workflow));
 
@@ -188,7 +196,15 @@ struct ndpi_workflow * ndpi_workflow_init(const struct ndpi_workflow_prefs * pre
   if(_debug_protocols_ok)
 	  module->debug_bitmask = debug_bitmask;
 #endif
-  workflow->ndpi_flows_root = ndpi_calloc(workflow->prefs.num_roots, sizeof(void *));
+  if((workflow->flow_table = ndpi_flow_table_init(workflow->prefs.flow_table_size)) == NULL) {
+    NDPI_LOG(0, NULL, NDPI_LOG_ERROR, "flow table allocation failed\n");
+    exit(-1);
+  }
+
+  if(workflow->prefs.flow_pool_size
+     && ((workflow->flow_pool = ndpi_init_flow_pool(workflow->prefs.flow_pool_size)) == NULL))
+    NDPI_LOG(0, NULL, NDPI_LOG_ERROR, "flow pool allocation failed: using malloc\n");
+
   return workflow;
 }
 
@@ -203,53 +219,76 @@ void ndpi_flow_info_freer(void *node) {
 
 /* ***************************************************** */
 
-void ndpi_workflow_free(struct ndpi_workflow * workflow) {
-  int i;
+static void ndpi_ipv4_frag_table_free(struct ndpi_ipv4_frag_table *table);
 
-  for(i=0; i<workflow->prefs.num_roots; i++)
-    ndpi_tdestroy(workflow->ndpi_flows_root[i], ndpi_flow_info_freer);
+void ndpi_workflow_free(struct ndpi_workflow * workflow) {
+  ndpi_flow_table_free(workflow->flow_table, ndpi_flow_info_freer);
+  ndpi_ipv4_frag_table_free(workflow->frags);
 
+  ndpi_free_flow_pool(workflow->flow_pool);
   ndpi_exit_detection_module(workflow->ndpi_struct);
-  free(workflow->ndpi_flows_root);
   free(workflow);
 }
 
 /* ***************************************************** */
 
-int ndpi_workflow_node_cmp(const void *a, const void *b) {
-  struct ndpi_flow_info *fa = (struct ndpi_flow_info*)a;
-  struct ndpi_flow_info *fb = (struct ndpi_flow_info*)b;
-
-  if(fa->hashval < fb->hashval) return(-1); else if(fa->hashval > fb->hashval) return(1);
-
-  /* Flows have the same hash */
-
-  if(fa->vlan_id   < fb->vlan_id   ) return(-1); else { if(fa->vlan_id    > fb->vlan_id   ) return(1); }
-  if(fa->protocol  < fb->protocol  ) return(-1); else { if(fa->protocol   > fb->protocol  ) return(1); }
-
-  if(
-     (
-      (fa->src_ip      == fb->src_ip  )
-      && (fa->src_port == fb->src_port)
-      && (fa->dst_ip   == fb->dst_ip  )
-      && (fa->dst_port == fb->dst_port)
-      )
-     ||
-     (
-      (fa->src_ip      == fb->dst_ip  )
-      && (fa->src_port == fb->dst_port)
-      && (fa->dst_ip   == fb->src_ip  )
-      && (fa->dst_port == fb->src_port)
-      )
-     )
-    return(0);
+static void ndpi_idle_list_unlink(struct ndpi_workflow * workflow, struct ndpi_flow_info *flow) {
+  if(flow->idle_prev) flow->idle_prev->idle_next = flow->idle_next; else workflow->idle_head = flow->idle_next;
+  if(flow->idle_next) flow->idle_next->idle_prev = flow->idle_prev; else workflow->idle_tail = flow->idle_prev;
+  flow->idle_prev = flow->idle_next = NULL;
+}
+
+/* ***************************************************** */
+
+static void ndpi_idle_list_append(struct ndpi_workflow * workflow, struct ndpi_flow_info *flow) {
+  flow->idle_prev = workflow->idle_tail, flow->idle_next = NULL;
+  if(workflow->idle_tail) workflow->idle_tail->idle_next = flow; else workflow->idle_head = flow;
+  workflow->idle_tail = flow;
+}
+
+/* ***************************************************** */
+
+u_int32_t ndpi_workflow_expire_idle_flows(struct ndpi_workflow * workflow, u_int64_t max_idle_time, u_int32_t budget) {
+  struct ndpi_flow_info *batch[IDLE_EXPORT_BATCH];
+  u_int32_t i, num_batch = 0, num_expired = 0;
+
+  /* The list is sorted by last_seen: stop at the first active flow */
+  while((num_expired < budget) && (workflow->idle_head != NULL)
+	&& (workflow->idle_head->last_seen + max_idle_time < workflow->last_time)) {
+    struct ndpi_flow_info *flow = workflow->idle_head;
+
+    ndpi_idle_list_unlink(workflow, flow);
+    ndpi_flow_table_remove(workflow->flow_table, &flow->key);
+    workflow->stats.ndpi_flow_count--;
+    batch[num_batch++] = flow, num_expired++;
+
+    if((num_batch == IDLE_EXPORT_BATCH) || (num_expired == budget) || (workflow->idle_head == NULL)
+       || (workflow->idle_head->last_seen + max_idle_time >= workflow->last_time)) {
+      if(workflow->__flow_export_callback != NULL)
+	workflow->__flow_export_callback(workflow, batch, num_batch, workflow->__flow_export_udata);
+
+      for(i=0; i<num_batch; i++)
+	ndpi_flow_info_freer(batch[i]);
+
+      num_batch = 0;
+    }
+  }
+
+  return(num_expired);
+}
+
+/* ***************************************************** */
+
+void ndpi_workflow_free_flows(struct ndpi_workflow * workflow) {
+  struct ndpi_flow_info *flow, *next;
 
-  if(fa->src_ip   < fb->src_ip  ) return(-1); else { if(fa->src_ip   > fb->src_ip  ) return(1); }
-  if(fa->src_port < fb->src_port) return(-1); else { if(fa->src_port > fb->src_port) return(1); }
-  if(fa->dst_ip   < fb->dst_ip  ) return(-1); else { if(fa->dst_ip   > fb->dst_ip  ) return(1); }
-  if(fa->dst_port < fb->dst_port) return(-1); else { if(fa->dst_port > fb->dst_port) return(1); }
+  for(flow = workflow->idle_head; flow != NULL; flow = next) {
+    next = flow->idle_next;
+    ndpi_flow_table_remove(workflow->flow_table, &flow->key);
+    ndpi_flow_info_freer(flow);
+  }
 
-  return(0); /* notreached */
+  workflow->idle_head = workflow->idle_tail = NULL;
 }
 
 /* ***************************************************** */
@@ -289,10 +328,10 @@ static struct ndpi_flow_info *get_ndpi_flow_info(struct ndpi_workflow * workflow
 						 u_int8_t **payload,
 						 u_int16_t *payload_len,
 						 u_int8_t *src_to_dst_direction) {
-  u_int32_t idx, l4_offset, hashval;
-  struct ndpi_flow_info flow;
-  void *ret;
-  u_int8_t *l3, *l4;
+  u_int32_t l4_offset;
+  struct ndpi_flow_key key;
+  struct ndpi_flow_info *flow;
+  u_int8_t *l3, *l4, reverse = 0;
 
   /*
     Note: to keep things simple (ndpiReader is just a demo app)
@@ -302,8 +341,9 @@ static struct ndpi_flow_info *get_ndpi_flow_info(struct ndpi_workflow * workflow
     if(ipsize < 20)
       return NULL;
 
+    /* Fragments are reassembled before, except inside GTP tunnels */
     if((iph->ihl * 4) > ipsize || ipsize < ntohs(iph->tot_len)
-       /* || (iph->frag_off & htons(0x1FFF)) != 0 */)
+       || (iph->frag_off & htons(0x1FFF)) != 0)
       return NULL;
 
     l4_offset = iph->ihl * 4;
@@ -355,34 +395,18 @@ static struct ndpi_flow_info *get_ndpi_flow_info(struct ndpi_workflow * workflow
     *sport = *dport = 0;
   }
 
-  flow.protocol = iph->protocol, flow.vlan_id = vlan_id;
-  flow.src_ip = iph->saddr, flow.dst_ip = iph->daddr;
-  flow.src_port = htons(*sport), flow.dst_port = htons(*dport);
-  flow.hashval = hashval = flow.protocol + flow.vlan_id + flow.src_ip + flow.dst_ip + flow.src_port + flow.dst_port;
-  idx = hashval % workflow->prefs.num_roots;
-  ret = ndpi_tfind(&flow, &workflow->ndpi_flows_root[idx], ndpi_workflow_node_cmp);
-
-
-	/* to avoid two nodes in one binary tree for a flow */
-	int is_changed = 0;
-	if(ret == NULL)
-	{
-		u_int32_t orig_src_ip = flow.src_ip;
-		u_int16_t orig_src_port = flow.src_port;
-		u_int32_t orig_dst_ip = flow.dst_ip;
-		u_int16_t orig_dst_port = flow.dst_port;
-
-		flow.src_ip = orig_dst_ip;
-		flow.src_port = orig_dst_port;
-		flow.dst_ip = orig_src_ip;
-		flow.dst_port = orig_src_port;
-
-		is_changed = 1;
+  memset(&key, 0, sizeof(key));
+  key.protocol = iph->protocol, key.vlan_id = vlan_id, key.ip_version = version;
+  if(iph6 != NULL)
+    memcpy(key.src_ip, &iph6->ip6_src, sizeof(key.src_ip)), memcpy(key.dst_ip, &iph6->ip6_dst, sizeof(key.dst_ip));
+  else
+    key.src_ip[0] = iph->saddr, key.dst_ip[0] = iph->daddr;
+  key.src_port = htons(*sport), key.dst_port = htons(*dport);
 
-		ret = ndpi_tfind(&flow, &workflow->ndpi_flows_root[idx], ndpi_workflow_node_cmp);
-	}
+  /* A single lookup finds the flow whatever the packet direction */
+  flow = (struct ndpi_flow_info*)ndpi_flow_table_find(workflow->flow_table, &key, &reverse);
 
-  if(ret == NULL) {
+  if(flow == NULL) {
     if(workflow->stats.ndpi_flow_count == workflow->prefs.max_ndpi_flows) {
       NDPI_LOG(0, workflow->ndpi_struct, NDPI_LOG_ERROR,
 	       "maximum flow count (%u) has been exceeded\n",
@@ -398,7 +422,7 @@ static struct ndpi_flow_info *get_ndpi_flow_info(struct ndpi_workflow * workflow
         workflow->num_allocated_flows++;
 
       memset(newflow, 0, sizeof(struct ndpi_flow_info));
-      newflow->hashval = hashval;
+      newflow->key = key;
       newflow->protocol = iph->protocol, newflow->vlan_id = vlan_id;
       newflow->src_ip = iph->saddr, newflow->dst_ip = iph->daddr;
       newflow->src_port = htons(*sport), newflow->dst_port = htons(*dport);
@@ -414,6 +438,9 @@ static struct ndpi_flow_info *get_ndpi_flow_info(struct ndpi_workflow * workflow
 	patchIPv6Address(newflow->src_name), patchIPv6Address(newflow->dst_name);
       }
 
+      /* The workflow is processed by the calling thread */
+      ndpi_set_thread_flow_pool(workflow->flow_pool);
+
       if((newflow->ndpi_flow = ndpi_flow_malloc(SIZEOF_FLOW_STRUCT)) == NULL) {
 	NDPI_LOG(0, workflow->ndpi_struct, NDPI_LOG_ERROR, "[NDPI] %s(2): not enough memory\n", __FUNCTION__);
 	free(newflow);
@@ -421,21 +448,27 @@ static struct ndpi_flow_info *get_ndpi_flow_info(struct ndpi_workflow * workflow
       } else
 	memset(newflow->ndpi_flow, 0, SIZEOF_FLOW_STRUCT);
 
-      if((newflow->src_id = ndpi_malloc(SIZEOF_ID_STRUCT)) == NULL) {
+      if((newflow->src_id = ndpi_flow_malloc(SIZEOF_ID_STRUCT)) == NULL) {
 	NDPI_LOG(0, workflow->ndpi_struct, NDPI_LOG_ERROR, "[NDPI] %s(3): not enough memory\n", __FUNCTION__);
 	free(newflow);
 	return(NULL);
       } else
 	memset(newflow->src_id, 0, SIZEOF_ID_STRUCT);
 
-      if((newflow->dst_id = ndpi_malloc(SIZEOF_ID_STRUCT)) == NULL) {
+      if((newflow->dst_id = ndpi_flow_malloc(SIZEOF_ID_STRUCT)) == NULL) {
 	NDPI_LOG(0, workflow->ndpi_struct, NDPI_LOG_ERROR, "[NDPI] %s(4): not enough memory\n", __FUNCTION__);
 	free(newflow);
 	return(NULL);
       } else
 	memset(newflow->dst_id, 0, SIZEOF_ID_STRUCT);
 
-      ndpi_tsearch(newflow, &workflow->ndpi_flows_root[idx], ndpi_workflow_node_cmp); /* Add */
+      if(ndpi_flow_table_add(workflow->flow_table, &key, newflow) != 0) {
+	NDPI_LOG(0, workflow->ndpi_struct, NDPI_LOG_ERROR, "[NDPI] %s(5): not enough memory\n", __FUNCTION__);
+	ndpi_flow_info_freer(newflow);
+	return(NULL);
+      }
+
+      ndpi_idle_list_append(workflow, newflow);
       workflow->stats.ndpi_flow_count++;
 
       *src = newflow->src_id, *dst = newflow->dst_id;
@@ -443,28 +476,11 @@ static struct ndpi_flow_info *get_ndpi_flow_info(struct ndpi_workflow * workflow
       return newflow;
     }
   } else {
-    struct ndpi_flow_info *flow = *(struct ndpi_flow_info**)ret;
-
-	if (is_changed) {
-		if(flow->src_ip == iph->saddr
-		 && flow->dst_ip == iph->daddr
-		 && flow->src_port == htons(*sport)
-		 && flow->dst_port == htons(*dport)
-		 )
-			*src = flow->dst_id, *dst = flow->src_id, *src_to_dst_direction = 0, flow->bidirectional = 1;
-		  else
-			*src = flow->src_id, *dst = flow->dst_id, *src_to_dst_direction = 1;
-	}
-	else {
-		if(flow->src_ip == iph->saddr
-		   && flow->dst_ip == iph->daddr
-		   && flow->src_port == htons(*sport)
-		   && flow->dst_port == htons(*dport)
-		   )
-		  *src = flow->src_id, *dst = flow->dst_id, *src_to_dst_direction = 1;
-		else
-		  *src = flow->dst_id, *dst = flow->src_id, *src_to_dst_direction = 0, flow->bidirectional = 1;
-	}
+    if(reverse)
+      *src = flow->dst_id, *dst = flow->src_id, *src_to_dst_direction = 0, flow->bidirectional = 1;
+    else
+      *src = flow->src_id, *dst = flow->dst_id, *src_to_dst_direction = 1;
+
     return flow;
   }
 }
@@ -508,45 +524,50 @@ static struct ndpi_flow_info *get_ndpi_flow_info6(struct ndpi_workflow * workflo
 /* ****************************************************** */
 
 void process_ndpi_collected_info(struct ndpi_workflow * workflow, struct ndpi_flow_info *flow) {
+  struct ndpi_flow_cold_struct *cold;
+
   if(!flow->ndpi_flow) return;
 
-  snprintf(flow->host_server_name, sizeof(flow->host_server_name), "%s",
-	   flow->ndpi_flow->host_server_name);
+  /* The metadata is in the cold part of the flow, once a dissector has filled it in */
+  if((cold = flow->ndpi_flow->cold) != NULL) {
+    snprintf(flow->host_server_name, sizeof(flow->host_server_name), "%s",
+	   cold->host_server_name);
 
-  /* BITTORRENT */
-  if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_BITTORRENT) {
-    int i, j, n = 0;
+    /* BITTORRENT */
+    if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_BITTORRENT) {
+      int i, j, n = 0;
 
-    for(i=0, j = 0; j < sizeof(flow->bittorent_hash)-1; i++) {
-      sprintf(&flow->bittorent_hash[j], "%02x", flow->ndpi_flow->protos.bittorrent.hash[i]);
-      j += 2, n += flow->ndpi_flow->protos.bittorrent.hash[i];
-    }
+      for(i=0, j = 0; j < sizeof(flow->bittorent_hash)-1; i++) {
+	sprintf(&flow->bittorent_hash[j], "%02x", cold->protos.bittorrent.hash[i]);
+	j += 2, n += cold->protos.bittorrent.hash[i];
+      }
 
-    if(n == 0) flow->bittorent_hash[0] = '\0';
-  }
-  /* MDNS */
-  else if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_MDNS) {
-    snprintf(flow->info, sizeof(flow->info), "%s", flow->ndpi_flow->protos.mdns.answer);
-  }
-  /* UBNTAC2 */
-  else if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_UBNTAC2) {
-    snprintf(flow->info, sizeof(flow->info), "%s", flow->ndpi_flow->protos.ubntac2.version);
-  }
-  if(flow->detected_protocol.app_protocol != NDPI_PROTOCOL_DNS) {
-    /* SSH */
-    if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_SSH) {
-      snprintf(flow->ssh_ssl.client_info, sizeof(flow->ssh_ssl.client_info), "%s",
-	       flow->ndpi_flow->protos.ssh.client_signature);
-      snprintf(flow->ssh_ssl.server_info, sizeof(flow->ssh_ssl.server_info), "%s",
-	       flow->ndpi_flow->protos.ssh.server_signature);
+      if(n == 0) flow->bittorent_hash[0] = '\0';
+    }
+    /* MDNS */
+    else if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_MDNS) {
+      snprintf(flow->info, sizeof(flow->info), "%s", cold->protos.mdns.answer);
+    }
+    /* UBNTAC2 */
+    else if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_UBNTAC2) {
+      snprintf(flow->info, sizeof(flow->info), "%s", cold->protos.ubntac2.version);
     }
-    /* SSL */
-    else if((flow->detected_protocol.app_protocol == NDPI_PROTOCOL_SSL)
+    if(flow->detected_protocol.app_protocol != NDPI_PROTOCOL_DNS) {
+      /* SSH */
+      if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_SSH) {
+	snprintf(flow->ssh_ssl.client_info, sizeof(flow->ssh_ssl.client_info), "%s",
+	       cold->protos.ssh.client_signature);
+	snprintf(flow->ssh_ssl.server_info, sizeof(flow->ssh_ssl.server_info), "%s",
+	       cold->protos.ssh.server_signature);
+      }
+      /* SSL */
+      else if((flow->detected_protocol.app_protocol == NDPI_PROTOCOL_SSL)
 	    || (flow->detected_protocol.master_protocol == NDPI_PROTOCOL_SSL)) {
-      snprintf(flow->ssh_ssl.client_info, sizeof(flow->ssh_ssl.client_info), "%s",
-	       flow->ndpi_flow->protos.ssl.client_certificate);
-      snprintf(flow->ssh_ssl.server_info, sizeof(flow->ssh_ssl.server_info), "%s",
-	       flow->ndpi_flow->protos.ssl.server_certificate);
+	snprintf(flow->ssh_ssl.client_info, sizeof(flow->ssh_ssl.client_info), "%s",
+	       cold->protos.ssl.client_certificate);
+	snprintf(flow->ssh_ssl.server_info, sizeof(flow->ssh_ssl.server_info), "%s",
+	       cold->protos.ssl.server_certificate);
+      }
     }
   }
 
@@ -565,6 +586,71 @@ void process_ndpi_collected_info(struct ndpi_workflow * workflow, struct ndpi_fl
 
 /* ****************************************************** */
 
+/* Packets of the flows being detected, waiting to be handed to nDPI at once */
+struct ndpi_workflow_burst {
+  u_int32_t num_pkts;
+  struct ndpi_proto *result; /* where to store the protocol of the packet being processed */
+  struct ndpi_packet_burst_entry entries[WORKFLOW_BURST_SIZE];
+  struct ndpi_flow_info *flows[WORKFLOW_BURST_SIZE];
+  struct ndpi_proto *results[WORKFLOW_BURST_SIZE];
+  ndpi_protocol protocols[WORKFLOW_BURST_SIZE];
+  u_int8_t l4_protos[WORKFLOW_BURST_SIZE];
+};
+
+/* ****************************************************** */
+
+/**
+ * @brief Complete the detection of a flow once it is detected, or give up
+ */
+static void packet_detection_done(struct ndpi_workflow * workflow,
+				  struct ndpi_flow_info *flow, u_int8_t proto) {
+  if((flow->detected_protocol.app_protocol != NDPI_PROTOCOL_UNKNOWN)
+     || ((proto == IPPROTO_UDP) && ((flow->src2dst_packets + flow->dst2src_packets) > 8))
+     || ((proto == IPPROTO_TCP) && ((flow->src2dst_packets + flow->dst2src_packets) > 10))) {
+    /* New protocol detected or give up */
+    flow->detection_completed = 1;
+    /* Check if we should keep checking extra packets */
+    if (flow->ndpi_flow->check_extra_packets)
+      flow->check_extra_packets = 1;
+
+    if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN)
+	    flow->detected_protocol = ndpi_detection_giveup(workflow->ndpi_struct,
+							    flow->ndpi_flow);
+    process_ndpi_collected_info(workflow, flow);
+  }
+}
+
+/* ****************************************************** */
+
+/**
+ * @brief Detect the packets of the current burst
+ */
+static void ndpi_workflow_flush_burst(struct ndpi_workflow * workflow) {
+  struct ndpi_workflow_burst *burst = workflow->burst;
+  u_int32_t i;
+
+  if(burst->num_pkts == 0)
+    return;
+
+  ndpi_detection_process_packet_burst(workflow->ndpi_struct, burst->entries,
+				      burst->protocols, burst->num_pkts);
+
+  for(i = 0; i < burst->num_pkts; i++) {
+    struct ndpi_flow_info *flow = burst->flows[i];
+
+    flow->burst_pending = 0;
+    flow->detected_protocol = burst->protocols[i];
+    packet_detection_done(workflow, flow, burst->l4_protos[i]);
+
+    if(burst->results[i] != NULL)
+      *burst->results[i] = flow->detected_protocol;
+  }
+
+  burst->num_pkts = 0;
+}
+
+/* ****************************************************** */
+
 /**
    Function to process the packet:
    determine the flow of a packet and try to decode it
@@ -604,6 +690,10 @@ static struct ndpi_proto packet_processing(struct ndpi_workflow * workflow,
 			       &payload, &payload_len, &src_to_dst_direction);
 
   if(flow != NULL) {
+    /* The previous packet of the flow is detected before this one is accounted */
+    if(flow->burst_pending)
+      ndpi_workflow_flush_burst(workflow);
+
     workflow->stats.ip_packet_count++;
     workflow->stats.total_wire_bytes += rawsize + 24 /* CRC etc */,
       workflow->stats.total_ip_bytes += rawsize;
@@ -615,6 +705,10 @@ static struct ndpi_proto packet_processing(struct ndpi_workflow * workflow,
       flow->dst2src_packets++, flow->dst2src_bytes += rawsize;
 
     flow->last_seen = time;
+
+    /* Keep the idle list sorted by last_seen (time never goes backwards) */
+    if(flow != workflow->idle_tail)
+      ndpi_idle_list_unlink(workflow, flow), ndpi_idle_list_append(workflow, flow);
   } else { // flow is NULL
     workflow->stats.total_discarded_bytes++;
     return(nproto);
@@ -645,26 +739,260 @@ static struct ndpi_proto packet_processing(struct ndpi_workflow * workflow,
     return(flow->detected_protocol);
   }
 
+  if(workflow->burst != NULL) {
+    struct ndpi_workflow_burst *burst = workflow->burst;
+    struct ndpi_packet_burst_entry *entry;
+
+    if(burst->num_pkts == WORKFLOW_BURST_SIZE)
+      ndpi_workflow_flush_burst(workflow);
+
+    entry = &burst->entries[burst->num_pkts];
+    entry->flow = ndpi_flow, entry->packet = iph ? (uint8_t *)iph : (uint8_t *)iph6;
+    entry->packetlen = ipsize, entry->current_tick = time, entry->src = src, entry->dst = dst;
+    burst->flows[burst->num_pkts] = flow, burst->l4_protos[burst->num_pkts] = proto;
+    burst->results[burst->num_pkts++] = burst->result;
+    flow->burst_pending = 1;
+
+    return(flow->detected_protocol); /* updated by ndpi_workflow_flush_burst() */
+  }
+
   flow->detected_protocol = ndpi_detection_process_packet(workflow->ndpi_struct, ndpi_flow,
 							  iph ? (uint8_t *)iph : (uint8_t *)iph6,
 							  ipsize, time, src, dst);
+  packet_detection_done(workflow, flow, proto);
 
-  if((flow->detected_protocol.app_protocol != NDPI_PROTOCOL_UNKNOWN)
-     || ((proto == IPPROTO_UDP) && ((flow->src2dst_packets + flow->dst2src_packets) > 8))
-     || ((proto == IPPROTO_TCP) && ((flow->src2dst_packets + flow->dst2src_packets) > 10))) {
-    /* New protocol detected or give up */
-    flow->detection_completed = 1;
-    /* Check if we should keep checking extra packets */
-    if (ndpi_flow->check_extra_packets)
-      flow->check_extra_packets = 1;
+  return(flow->detected_protocol);
+}
 
-    if(flow->detected_protocol.app_protocol == NDPI_PROTOCOL_UNKNOWN)
-	    flow->detected_protocol = ndpi_detection_giveup(workflow->ndpi_struct,
-							    flow->ndpi_flow);
-    process_ndpi_collected_info(workflow, flow);
+/* ****************************************************** */
+
+#define IPV4_FRAG_HASH_SIZE     1024 /* buckets, power of 2 */
+#define IPV4_FRAG_MAX_LEN      65535 /* IP header included */
+#define IPV4_FRAG_MAX_HEADER     320 /* link and IP header of the first fragment */
+
+/* IPv4 datagram being reassembled */
+struct ndpi_ipv4_frag {
+  struct ndpi_ipv4_frag *hash_next, *lru_prev, *lru_next;
+  u_int32_t saddr, daddr;
+  u_int16_t id, vlan_id;
+  u_int8_t protocol;
+  u_int16_t ip_offset, header_len; /* header_len is 0 until the first fragment is received */
+  u_int16_t len;                   /* payload, 0 until the last fragment is received */
+  u_int16_t max_end;               /* of the fragments received */
+  u_int16_t num_blocks;            /* 8 byte payload blocks received */
+  u_int16_t num_fragments;
+  u_int64_t last_seen;
+  u_int8_t *payload;
+  u_int32_t payload_size;          /* allocated */
+  u_int8_t blocks[(IPV4_FRAG_MAX_LEN / 8 + 1) / 8 + 1]; /* bitmap of the blocks received */
+  u_int8_t header[IPV4_FRAG_MAX_HEADER];
+};
+
+/* Datagrams of a workflow, with the last one reassembled */
+struct ndpi_ipv4_frag_table {
+  struct ndpi_ipv4_frag *buckets[IPV4_FRAG_HASH_SIZE];
+  struct ndpi_ipv4_frag *lru_head, *lru_tail; /* least recently updated first */
+  u_int32_t memory;
+  struct pcap_pkthdr header;
+  u_int8_t packet[IPV4_FRAG_MAX_HEADER + IPV4_FRAG_MAX_LEN];
+};
+
+static u_int32_t ipv4_frag_hash(u_int32_t saddr, u_int32_t daddr, u_int16_t id, u_int8_t protocol, u_int16_t vlan_id) {
+  u_int32_t h = saddr * 0x9E3779B1 ^ daddr;
+
+  h = (h ^ (h >> 15)) * 0x85EBCA77 ^ ((u_int32_t)id << 16 | (u_int32_t)protocol << 8) ^ vlan_id;
+  return((h ^ (h >> 13)) & (IPV4_FRAG_HASH_SIZE - 1));
+}
+
+/* ****************************************************** */
+
+static void ipv4_frag_lru_unlink(struct ndpi_ipv4_frag_table *table, struct ndpi_ipv4_frag *frag) {
+  if(frag->lru_prev) frag->lru_prev->lru_next = frag->lru_next; else table->lru_head = frag->lru_next;
+  if(frag->lru_next) frag->lru_next->lru_prev = frag->lru_prev; else table->lru_tail = frag->lru_prev;
+  frag->lru_prev = frag->lru_next = NULL;
+}
+
+/* ****************************************************** */
+
+static void ipv4_frag_lru_append(struct ndpi_ipv4_frag_table *table, struct ndpi_ipv4_frag *frag) {
+  frag->lru_prev = table->lru_tail, frag->lru_next = NULL;
+  if(table->lru_tail) table->lru_tail->lru_next = frag; else table->lru_head = frag;
+  table->lru_tail = frag;
+}
+
+/* ****************************************************** */
+
+static void ipv4_frag_free(struct ndpi_ipv4_frag_table *table, struct ndpi_ipv4_frag *frag) {
+  struct ndpi_ipv4_frag **prev = &table->buckets[ipv4_frag_hash(frag->saddr, frag->daddr, frag->id,
+								  frag->protocol, frag->vlan_id)];
+
+  while(*prev != frag)
+    prev = &(*prev)->hash_next;
+
+  *prev = frag->hash_next;
+  ipv4_frag_lru_unlink(table, frag);
+  table->memory -= sizeof(struct ndpi_ipv4_frag) + frag->payload_size;
+  free(frag->payload);
+  free(frag);
+}
+
+/* ****************************************************** */
+
+/* Drop a datagram that will not be completed */
+static void ipv4_frag_drop(struct ndpi_workflow * workflow, struct ndpi_ipv4_frag *frag) {
+  workflow->stats.fragment_drop_count += frag->num_fragments;
+  ipv4_frag_free(workflow->frags, frag);
+}
+
+/* ****************************************************** */
+
+static void ndpi_ipv4_frag_table_free(struct ndpi_ipv4_frag_table *table) {
+  if(table != NULL) {
+    while(table->lru_head != NULL)
+      ipv4_frag_free(table, table->lru_head);
+
+    free(table);
   }
+}
 
-  return(flow->detected_protocol);
+/* ****************************************************** */
+
+/**
+   Add an IPv4 fragment to its datagram: once complete, the datagram is
+   returned as a packet starting with the link header of the first fragment
+   (*header and *ip_offset are updated). It stays valid until the next
+   datagram is completed: the current burst is detected before.
+
+   Datagrams are dropped when they are not updated for IPV4_FRAG_TIMEOUT or,
+   least recently updated first, when they take more than IPV4_FRAG_MAX_MEMORY.
+   @return: the reassembled packet, or NULL if the datagram is not complete
+*/
+static const u_char * ndpi_workflow_reassemble_ipv4(struct ndpi_workflow * workflow,
+						     const struct pcap_pkthdr **header,
+						     const u_char *packet,
+						     u_int16_t *ip_offset,
+						     u_int16_t vlan_id,
+						     u_int64_t time) {
+  struct ndpi_ipv4_frag_table *table = workflow->frags;
+  const struct ndpi_iphdr *iph = (const struct ndpi_iphdr *) &packet[*ip_offset];
+  u_int16_t frag_off = ntohs(iph->frag_off), ihl = iph->ihl * 4, tot_len = ntohs(iph->tot_len);
+  u_int32_t offset = (frag_off & 0x1FFF) * 8, len, end, block;
+  struct ndpi_iphdr *reassembled;
+  struct ndpi_ipv4_frag *frag;
+
+  workflow->stats.fragmented_count++;
+
+  if(table == NULL) {
+    if((table = workflow->frags = calloc(1, sizeof(struct ndpi_ipv4_frag_table))) == NULL) {
+      workflow->stats.fragment_drop_count++;
+      return(NULL);
+    }
+  }
+
+  while((table->lru_head != NULL) && ((table->lru_head->last_seen + IPV4_FRAG_TIMEOUT) < time))
+    ipv4_frag_drop(workflow, table->lru_head);
+
+  /* Non-last fragments carry a multiple of 8 bytes */
+  len = tot_len - ihl, end = offset + len;
+
+  if((ihl < 20) || (tot_len <= ihl) || ((*ip_offset + tot_len) > (*header)->caplen)
+     || ((*ip_offset + ihl) > IPV4_FRAG_MAX_HEADER) || ((ihl + end) > IPV4_FRAG_MAX_LEN)
+     || ((frag_off & 0x2000 /* MF */) && (len & 7))) {
+    workflow->stats.fragment_drop_count++;
+    return(NULL);
+  }
+
+  block = ipv4_frag_hash(iph->saddr, iph->daddr, iph->id, iph->protocol, vlan_id);
+
+  for(frag = table->buckets[block]; frag != NULL; frag = frag->hash_next)
+    if((frag->saddr == iph->saddr) && (frag->daddr == iph->daddr) && (frag->id == iph->id)
+       && (frag->protocol == iph->protocol) && (frag->vlan_id == vlan_id))
+      break;
+
+  if(frag == NULL) {
+    if((frag = calloc(1, sizeof(struct ndpi_ipv4_frag))) == NULL) {
+      workflow->stats.fragment_drop_count++;
+      return(NULL);
+    }
+
+    frag->saddr = iph->saddr, frag->daddr = iph->daddr, frag->id = iph->id;
+    frag->protocol = iph->protocol, frag->vlan_id = vlan_id;
+    frag->hash_next = table->buckets[block], table->buckets[block] = frag;
+    ipv4_frag_lru_append(table, frag);
+    table->memory += sizeof(struct ndpi_ipv4_frag);
+  }
+
+  frag->num_fragments++;
+
+  /* The last fragment sets the datagram length: no fragment can go beyond it */
+  if((frag_off & 0x2000) == 0 ? (((frag->len != 0) && (end != frag->len)) || (end < frag->max_end))
+     : ((frag->len != 0) && (end > frag->len))) {
+    ipv4_frag_drop(workflow, frag);
+    return(NULL);
+  }
+
+  if((frag_off & 0x2000) == 0)
+    frag->len = end;
+
+  frag->max_end = ndpi_max(frag->max_end, end);
+
+  if(end > frag->payload_size) {
+    u_int32_t payload_size = frag->len ? frag->len : ndpi_min(ndpi_max(end, 2 * frag->payload_size), IPV4_FRAG_MAX_LEN);
+    u_int8_t *payload = realloc(frag->payload, payload_size);
+
+    if(payload == NULL) {
+      ipv4_frag_drop(workflow, frag);
+      return(NULL);
+    }
+
+    table->memory += payload_size - frag->payload_size;
+    frag->payload = payload, frag->payload_size = payload_size;
+  }
+
+  /* Overlapping fragments: the last one wins */
+  memcpy(&frag->payload[offset], &packet[*ip_offset + ihl], len);
+
+  for(block = offset / 8; block < (end + 7) / 8; block++) {
+    if((frag->blocks[block / 8] & (1 << (block % 8))) == 0)
+      frag->blocks[block / 8] |= (1 << (block % 8)), frag->num_blocks++;
+  }
+
+  if(offset == 0) {
+    frag->ip_offset = *ip_offset, frag->header_len = *ip_offset + ihl;
+    memcpy(frag->header, packet, frag->header_len);
+  }
+
+  frag->last_seen = time;
+
+  if(frag != table->lru_tail)
+    ipv4_frag_lru_unlink(table, frag), ipv4_frag_lru_append(table, frag);
+
+  while((table->memory > IPV4_FRAG_MAX_MEMORY) && (table->lru_head != frag))
+    ipv4_frag_drop(workflow, table->lru_head);
+
+  if((frag->len == 0) || (frag->header_len == 0) || (frag->num_blocks < ((frag->len + 7) / 8)))
+    return(NULL);
+
+  /* The previous datagram may be waiting for detection in the burst */
+  if((workflow->burst != NULL) && (workflow->burst->num_pkts > 0))
+    ndpi_workflow_flush_burst(workflow);
+
+  memcpy(table->packet, frag->header, frag->header_len);
+  memcpy(&table->packet[frag->header_len], frag->payload, frag->len);
+
+  /* A whole datagram (its checksum is not updated) */
+  reassembled = (struct ndpi_iphdr *) &table->packet[frag->ip_offset];
+  reassembled->tot_len = htons(frag->header_len - frag->ip_offset + frag->len);
+  reassembled->frag_off &= htons(0x4000 /* DF */);
+
+  table->header = **header;
+  table->header.caplen = table->header.len = frag->header_len + frag->len;
+  *header = &table->header, *ip_offset = frag->ip_offset;
+
+  workflow->stats.reassembled_count++;
+  ipv4_frag_free(table, frag);
+
+  return(table->packet);
 }
 
 /* ****************************************************** */
@@ -711,7 +1039,7 @@ struct ndpi_proto ndpi_workflow_process_packet (struct ndpi_workflow * workflow,
   int check;
   u_int64_t time;
   u_int16_t ip_offset = 0, ip_len;
-  u_int16_t frag_off = 0, vlan_id = 0;
+  u_int16_t vlan_id = 0;
   u_int8_t proto = 0;
   u_int32_t label;
 
@@ -877,8 +1205,6 @@ struct ndpi_proto ndpi_workflow_process_packet (struct ndpi_workflow * workflow,
 
   /* just work on Ethernet packets that contain IP */
   if(type == ETH_P_IP && header->caplen >= ip_offset) {
-    frag_off = ntohs(iph->frag_off);
-
     proto = iph->protocol;
     if(header->caplen < header->len) {
       static u_int8_t cap_warning_used = 0;
@@ -892,6 +1218,15 @@ struct ndpi_proto ndpi_workflow_process_packet (struct ndpi_workflow * workflow,
   }
 
   if(iph->version == IPVERSION) {
+    /* The fragments are held until their datagram is processed as a whole packet */
+    if((ntohs(iph->frag_off) & 0x3FFF /* MF and offset */) != 0) {
+      if((packet = ndpi_workflow_reassemble_ipv4(workflow, &header, packet, &ip_offset, vlan_id, time)) == NULL)
+	return(nproto);
+
+      iph = (struct ndpi_iphdr *) &packet[ip_offset];
+      proto = iph->protocol;
+    }
+
     ip_len = ((u_int16_t)iph->ihl * 4);
     iph6 = NULL;
 
@@ -899,20 +1234,6 @@ struct ndpi_proto ndpi_workflow_process_packet (struct ndpi_workflow * workflow,
       ip_offset += ip_len;
       goto iph_check;
     }
-
-    if((frag_off & 0x1FFF) != 0) {
-      static u_int8_t ipv4_frags_warning_used = 0;
-      workflow->stats.fragmented_count++;
-
-      if(ipv4_frags_warning_used == 0) {
-	if(!workflow->prefs.quiet_mode)
-	  NDPI_LOG(0, workflow->ndpi_struct, NDPI_LOG_DEBUG, "\n\nWARNING: IPv4 fragments are not handled by this demo (nDPI supports them)\n");
-	ipv4_frags_warning_used = 1;
-      }
-
-      workflow->stats.total_discarded_bytes +=  header->len;
-      return(nproto);
-    }
   } else if(iph->version == 6) {
     iph6 = (struct ndpi_ipv6hdr *)&packet[ip_offset];
     proto = iph6->ip6_hdr.ip6_un1_nxt;
@@ -1010,6 +1331,564 @@ struct ndpi_proto ndpi_workflow_process_packet (struct ndpi_workflow * workflow,
 			   ip_offset, header->caplen - ip_offset, header->caplen));
 }
 
+/* ****************************************************** */
+
+void ndpi_workflow_process_burst(struct ndpi_workflow * workflow,
+				 const struct pcap_pkthdr *headers,
+				 const u_char * const *packets,
+				 u_int32_t num_packets,
+				 struct ndpi_proto *protos) {
+  struct ndpi_workflow_burst burst;
+  u_int32_t i;
+
+  /* Packets of detected flows do not reach nDPI: switch to published rules anyway */
+  ndpi_rules_quiescent(workflow->ndpi_struct);
+
+  burst.num_pkts = 0, burst.result = NULL;
+  workflow->burst = &burst;
+
+  for(i = 0; i < num_packets; i++) {
+    struct ndpi_proto p;
+
+    if(protos != NULL)
+      burst.result = &protos[i];
+
+    p = ndpi_workflow_process_packet(workflow, &headers[i], packets[i]);
+
+    if(protos != NULL)
+      protos[i] = p; /* overwritten when the packet is detected later in the burst */
+  }
+
+  ndpi_workflow_flush_burst(workflow);
+  workflow->burst = NULL;
+}
+
+/* ****************************************************** */
+
+u_int32_t ndpi_workflow_packet_hash(int datalink_type, const struct pcap_pkthdr *header, const u_char *packet) {
+  struct ndpi_flow_key key;
+  u_int32_t caplen = header->caplen, ip_offset = 0;
+  u_int16_t type = 0;
+
+  /* Same walk as ndpi_workflow_process_packet(), without counting */
+  switch(datalink_type) {
+  case DLT_NULL:
+    ip_offset = 4;
+    break;
+
+  case DLT_PPP_SERIAL:
+  case DLT_C_HDLC:
+  case DLT_PPP:
+    if(caplen < sizeof(struct ndpi_chdlc)) return(0);
+    type = ntohs(((const struct ndpi_chdlc *) packet)->proto_code);
+    ip_offset = sizeof(struct ndpi_chdlc);
+    break;
+
+  case DLT_EN10MB:
+    if(caplen < sizeof(struct ndpi_ethhdr)) return(0);
+    ip_offset = sizeof(struct ndpi_ethhdr);
+    type = ntohs(((const struct ndpi_ethhdr *) packet)->h_proto);
+
+    if((type != 0) && (type <= 1500)) {
+      const struct ndpi_llc_header_snap *llc = (const struct ndpi_llc_header_snap *) &packet[ip_offset];
+
+      if(caplen < ip_offset + sizeof(struct ndpi_llc_header_snap)) return(0);
+
+      if(llc->dsap == SNAP || llc->ssap == SNAP)
+	type = llc->snap.proto_ID, ip_offset += 8;
+      else if(llc->dsap == BSTP || llc->ssap == BSTP)
+	return(0);
+      else
+	type = 0;
+    } else if(type < 1536)
+      type = 0;
+    break;
+
+  case DLT_LINUX_SLL:
+    if(caplen < 16) return(0);
+    type = (packet[14] << 8) + packet[15];
+    ip_offset = 16;
+    break;
+
+  case DLT_IEEE802_11_RADIO:
+    {
+      const struct ndpi_radiotap_header *radiotap = (const struct ndpi_radiotap_header *) packet;
+      const struct ndpi_wifi_header *wifi;
+      u_int32_t wifi_len = 0;
+
+      if((caplen < sizeof(struct ndpi_radiotap_header))
+	 || (caplen < radiotap->len + sizeof(struct ndpi_wifi_header)))
+	return(0);
+
+      wifi = (const struct ndpi_wifi_header *) &packet[radiotap->len];
+      if(FCF_TYPE(wifi->fc) != WIFI_DATA) return(0);
+
+      if((FCF_TO_DS(wifi->fc) && FCF_FROM_DS(wifi->fc) == 0x0) || (FCF_TO_DS(wifi->fc) == 0x0 && FCF_FROM_DS(wifi->fc)))
+	wifi_len = 26;
+
+      ip_offset = wifi_len + radiotap->len + sizeof(struct ndpi_llc_header_snap);
+      if(caplen < ip_offset) return(0);
+
+      if(((const struct ndpi_llc_header_snap *) &packet[wifi_len + radiotap->len])->dsap == SNAP)
+	type = ntohs(((const struct ndpi_llc_header_snap *) &packet[wifi_len + radiotap->len])->snap.proto_ID);
+    }
+    break;
+
+  case DLT_RAW:
+    break;
+
+  default:
+    return(0);
+  }
+
+  switch(type) {
+  case VLAN:
+    if(caplen < ip_offset + 4) return(0);
+    type = (packet[ip_offset+2] << 8) + packet[ip_offset+3], ip_offset += 4;
+
+    if(type == 0x8100)
+      ip_offset += 4;
+    break;
+
+  case MPLS_UNI:
+  case MPLS_MULTI:
+    {
+      u_int8_t bottom_of_stack;
+
+      if(caplen < ip_offset + 4) return(0);
+      bottom_of_stack = packet[ip_offset+2] & 0x01, ip_offset += 4;
+
+      while(!bottom_of_stack) {
+	ip_offset += 4;
+	if(caplen < ip_offset + 4) return(0);
+	bottom_of_stack = packet[ip_offset+2] & 0x01;
+      }
+    }
+    break;
+
+  case PPPoE:
+    ip_offset += 8;
+    break;
+  }
+
+  memset(&key, 0, sizeof(key));
+
+  if(caplen < ip_offset + 1)
+    return(0);
+
+  /* 6in4 is hashed by the tunnel hosts too: its fragments (reassembled by the
+     workflow) have no IPv6 header to hash after the first one */
+  if((packet[ip_offset] >> 4) == IPVERSION) {
+    const struct ndpi_iphdr *iph = (const struct ndpi_iphdr *) &packet[ip_offset];
+
+    if(caplen < ip_offset + 20)
+      return(0);
+
+    key.ip_version = IPVERSION;
+    key.src_ip[0] = iph->saddr, key.dst_ip[0] = iph->daddr;
+  } else if((packet[ip_offset] >> 4) == 6) {
+    const struct ndpi_ipv6hdr *iph6 = (const struct ndpi_ipv6hdr *) &packet[ip_offset];
+
+    if(caplen < ip_offset + sizeof(struct ndpi_ipv6hdr))
+      return(0);
+
+    key.ip_version = 6;
+    memcpy(key.src_ip, &iph6->ip6_src, sizeof(key.src_ip)), memcpy(key.dst_ip, &iph6->ip6_dst, sizeof(key.dst_ip));
+  } else
+    return(0);
+
+  return(ndpi_flow_key_symmetric_hash(&key));
+}
+
+/* ****************************************************** */
+
+#define PCAP_MAGIC             0xa1b2c3d4
+#define PCAP_MAGIC_NSEC        0xa1b23c4d
+#define PCAP_MAGIC_MODIFIED    0xa1b2cd34 /* records with 8 more header bytes */
+#define PCAP_HEADER_LEN        24
+#define PCAP_RECORD_LEN        16
+#define PCAP_MAX_SNAPLEN       262144
+
+#define PCAPNG_SHB             0x0a0d0d0a
+#define PCAPNG_BYTE_ORDER      0x1a2b3c4d
+#define PCAPNG_IDB             0x00000001
+#define PCAPNG_PB              0x00000002 /* obsolete packet block */
+#define PCAPNG_SPB             0x00000003
+#define PCAPNG_EPB             0x00000006
+#define PCAPNG_IF_TSRESOL      9
+#define PCAPNG_IF_TSOFFSET     14
+
+#define LINKTYPE_RAW           101 /* DLT_RAW, whose value depends on the OS */
+
+#define SAVEFILE_PREFETCH_LEN  (64 * 1024 * 1024)
+
+struct ndpi_savefile_interface {
+  u_int32_t snaplen;
+  u_int64_t ts_units; /* per second */
+  int64_t ts_offset;  /* seconds */
+};
+
+struct ndpi_savefile {
+  const u_int8_t *map;
+  size_t len, offset;
+  u_int8_t pcapng, swapped, nsec;
+  u_int32_t record_len; /* pcap */
+  int datalink;
+  u_int32_t snaplen;
+
+  /* pcapng: interfaces of the current section, with the link type of the first one */
+  struct ndpi_savefile_interface *interfaces;
+  u_int32_t num_interfaces, max_interfaces;
+  int linktype;
+};
+
+static u_int32_t savefile_swap32(u_int32_t v) {
+  return((v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24));
+}
+
+static u_int16_t savefile_u16(const struct ndpi_savefile *savefile, const u_int8_t *p) {
+  u_int16_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return(savefile->swapped ? (u_int16_t)((v >> 8) | (v << 8)) : v);
+}
+
+static u_int32_t savefile_u32(const struct ndpi_savefile *savefile, const u_int8_t *p) {
+  u_int32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return(savefile->swapped ? savefile_swap32(v) : v);
+}
+
+/* 64 bit pcapng values are saved as two 32 bit words, most significant first */
+static u_int64_t savefile_u64(const struct ndpi_savefile *savefile, const u_int8_t *p) {
+  return(((u_int64_t)savefile_u32(savefile, p) << 32) | savefile_u32(savefile, &p[4]));
+}
+
+static int savefile_datalink(u_int32_t linktype) {
+  linktype &= 0x03FFFFFF; /* the upper bits are FCS flags */
+
+  return((linktype == LINKTYPE_RAW) ? DLT_RAW : (int)linktype);
+}
+
+/* ****************************************************** */
+
+/* Add the interface of a pcapng Interface Description Block */
+static int savefile_add_interface(struct ndpi_savefile *savefile, const u_int8_t *block, u_int32_t block_len) {
+  struct ndpi_savefile_interface *iface;
+  u_int32_t offset = 16;
+  int linktype;
+
+  if(block_len < 20)
+    return(-1);
+
+  /* As for libpcap, all the packets of a file have the same link type */
+  linktype = savefile_datalink(savefile_u16(savefile, &block[8]));
+
+  if(savefile->linktype == -1)
+    savefile->linktype = linktype;
+  else if(linktype != savefile->linktype)
+    return(-1);
+
+  if(savefile->num_interfaces == savefile->max_interfaces) {
+    u_int32_t max_interfaces = savefile->max_interfaces ? (2 * savefile->max_interfaces) : 4;
+
+    if((iface = realloc(savefile->interfaces, max_interfaces * sizeof(*iface))) == NULL)
+      return(-1);
+
+    savefile->interfaces = iface, savefile->max_interfaces = max_interfaces;
+  }
+
+  iface = &savefile->interfaces[savefile->num_interfaces++];
+  iface->snaplen = savefile_u32(savefile, &block[12]);
+  iface->ts_units = 1000000, iface->ts_offset = 0;
+
+  if((iface->snaplen == 0) || (iface->snaplen > PCAP_MAX_SNAPLEN))
+    iface->snaplen = PCAP_MAX_SNAPLEN;
+
+  while(offset + 4 <= block_len - 4) {
+    u_int16_t code = savefile_u16(savefile, &block[offset]), len = savefile_u16(savefile, &block[offset+2]);
+
+    if((code == 0 /* opt_endofopt */) || (offset + 4 + len > block_len - 4))
+      break;
+
+    if((code == PCAPNG_IF_TSRESOL) && (len == 1)) {
+      u_int8_t exp = block[offset+4] & 0x7F, base = (block[offset+4] & 0x80) ? 2 : 10, i;
+
+      if(exp > ((base == 2) ? 63 : 19))
+	return(-1);
+
+      for(iface->ts_units = 1, i = 0; i < exp; i++)
+	iface->ts_units *= base;
+    } else if((code == PCAPNG_IF_TSOFFSET) && (len == 8))
+      iface->ts_offset = (int64_t)savefile_u64(savefile, &block[offset+4]);
+
+    offset += 4 + ((len + 3) & ~3);
+  }
+
+  return(0);
+}
+
+/* ****************************************************** */
+
+/* Next packet block of a pcapng file: section and interface blocks are
+   handled here, blocks of other types are skipped. Returns 1 for a packet */
+static int savefile_next_block(struct ndpi_savefile *savefile, const u_int8_t **block,
+			       u_int32_t *block_type, u_int32_t *block_len) {
+  for(;;) {
+    const u_int8_t *b = &savefile->map[savefile->offset];
+    size_t left = savefile->len - savefile->offset;
+    u_int32_t type, len;
+
+    if(left == 0)
+      return(0);
+    else if(left < 12)
+      return(-1);
+
+    memcpy(&type, b, sizeof(type));
+
+    if(type == PCAPNG_SHB) {
+      u_int32_t byte_order;
+
+      /* A new section has its own byte order and interfaces */
+      memcpy(&byte_order, &b[8], sizeof(byte_order));
+
+      if(byte_order == PCAPNG_BYTE_ORDER)
+	savefile->swapped = 0;
+      else if(savefile_swap32(byte_order) == PCAPNG_BYTE_ORDER)
+	savefile->swapped = 1;
+      else
+	return(-1);
+
+      savefile->num_interfaces = 0;
+    } else
+      type = savefile_u32(savefile, b);
+
+    len = savefile_u32(savefile, &b[4]);
+
+    if((len < 12) || (len & 3) || (len > left))
+      return(-1);
+
+    savefile->offset += len;
+
+    if(type == PCAPNG_IDB) {
+      if(savefile_add_interface(savefile, b, len) != 0)
+	return(-1);
+    } else if((type == PCAPNG_EPB) || (type == PCAPNG_SPB) || (type == PCAPNG_PB)) {
+      *block = b, *block_type = type, *block_len = len;
+      return(1);
+    }
+  }
+}
+
+/* ****************************************************** */
+
+static int savefile_next_pcapng(struct ndpi_savefile *savefile, struct pcap_pkthdr *header, const u_char **packet) {
+  struct ndpi_savefile_interface *iface;
+  const u_int8_t *block;
+  u_int32_t type, len, data_offset, iface_id, caplen;
+  u_int64_t ts;
+  int rc;
+
+  if((rc = savefile_next_block(savefile, &block, &type, &len)) != 1)
+    return(rc);
+
+  if(type == PCAPNG_SPB) {
+    if((len < 16) || (savefile->num_interfaces == 0))
+      return(-1);
+
+    /* The packet is not timestamped and its capture length is the one of the block */
+    iface = &savefile->interfaces[0];
+    data_offset = 12, ts = 0;
+    header->len = savefile_u32(savefile, &block[8]);
+    caplen = ndpi_min(header->len, len - 16);
+  } else {
+    if(len < 32)
+      return(-1);
+
+    /* The obsolete packet block has a 16 bit interface and a 16 bit drops count */
+    iface_id = (type == PCAPNG_EPB) ? savefile_u32(savefile, &block[8]) : savefile_u16(savefile, &block[8]);
+
+    if(iface_id >= savefile->num_interfaces)
+      return(-1);
+
+    iface = &savefile->interfaces[iface_id];
+    data_offset = 28;
+    ts = savefile_u64(savefile, &block[12]);
+    caplen = savefile_u32(savefile, &block[20]);
+    header->len = savefile_u32(savefile, &block[24]);
+
+    if(caplen > len - 32)
+      return(-1);
+  }
+
+  if(iface->ts_units == 1000000)
+    header->ts.tv_sec = ts / 1000000, header->ts.tv_usec = ts % 1000000;
+  else {
+    u_int64_t frac = ts % iface->ts_units;
+
+    header->ts.tv_sec = ts / iface->ts_units;
+    header->ts.tv_usec = (iface->ts_units > 1000000000000ULL) ? (frac / (iface->ts_units / 1000000)) : (frac * 1000000 / iface->ts_units);
+  }
+
+  header->ts.tv_sec += iface->ts_offset;
+  header->caplen = ndpi_min(caplen, iface->snaplen);
+  *packet = &block[data_offset];
+
+  return(1);
+}
+
+/* ****************************************************** */
+
+static int savefile_next_pcap(struct ndpi_savefile *savefile, struct pcap_pkthdr *header, const u_char **packet) {
+  const u_int8_t *record = &savefile->map[savefile->offset];
+  size_t left = savefile->len - savefile->offset;
+  u_int32_t caplen, ts_frac;
+
+  if(left == 0)
+    return(0);
+  else if(left < savefile->record_len)
+    return(-1);
+
+  caplen = savefile_u32(savefile, &record[8]);
+
+  if((caplen > PCAP_MAX_SNAPLEN) || (caplen > left - savefile->record_len))
+    return(-1);
+
+  header->ts.tv_sec = savefile_u32(savefile, record);
+  ts_frac = savefile_u32(savefile, &record[4]);
+  header->ts.tv_usec = savefile->nsec ? (ts_frac / 1000) : ts_frac;
+  header->len = savefile_u32(savefile, &record[12]);
+
+  /* As libpcap, the packets are cut to the capture length of the file */
+  header->caplen = ndpi_min(caplen, savefile->snaplen);
+  *packet = &record[savefile->record_len];
+
+  savefile->offset += savefile->record_len + caplen;
+
+  return(1);
+}
+
+/* ****************************************************** */
+
+struct ndpi_savefile * ndpi_savefile_open(const char *path) {
+#ifdef WIN32
+  return(NULL);
+#else
+  struct ndpi_savefile *savefile;
+  struct stat st;
+  u_int32_t magic;
+  void *map;
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return(NULL);
+
+  /* Pipes and devices are read by libpcap */
+  if((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size < PCAP_HEADER_LEN)
+     || ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+    close(fd);
+    return(NULL);
+  }
+
+  close(fd); /* the mapping keeps the file */
+
+  if((savefile = calloc(1, sizeof(struct ndpi_savefile))) == NULL) {
+    munmap(map, st.st_size);
+    return(NULL);
+  }
+
+  savefile->map = (const u_int8_t*)map, savefile->len = st.st_size;
+  savefile->linktype = -1;
+
+  /* The file is read once from the beginning: read ahead and drop the pages behind */
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  memcpy(&magic, savefile->map, sizeof(magic));
+
+  if(magic == PCAPNG_SHB) {
+    const u_int8_t *block;
+    u_int32_t type, len;
+
+    savefile->pcapng = 1;
+
+    /* The link type is the one of the first interface, described before the packets */
+    savefile_next_block(savefile, &block, &type, &len);
+
+    if(savefile->linktype == -1) {
+      ndpi_savefile_close(savefile);
+      return(NULL);
+    }
+
+    savefile->datalink = savefile->linktype, savefile->snaplen = savefile->interfaces[0].snaplen;
+    savefile->offset = 0; /* the interfaces are read again along with the packets */
+    savefile->num_interfaces = 0;
+  } else {
+    if((savefile_swap32(magic) == PCAP_MAGIC) || (savefile_swap32(magic) == PCAP_MAGIC_NSEC)
+       || (savefile_swap32(magic) == PCAP_MAGIC_MODIFIED))
+      savefile->swapped = 1, magic = savefile_swap32(magic);
+
+    if((magic != PCAP_MAGIC) && (magic != PCAP_MAGIC_NSEC) && (magic != PCAP_MAGIC_MODIFIED)) {
+      ndpi_savefile_close(savefile);
+      return(NULL);
+    }
+
+    savefile->nsec = (magic == PCAP_MAGIC_NSEC);
+    savefile->record_len = (magic == PCAP_MAGIC_MODIFIED) ? (PCAP_RECORD_LEN + 8) : PCAP_RECORD_LEN;
+    savefile->snaplen = savefile_u32(savefile, &savefile->map[16]);
+    savefile->datalink = savefile_datalink(savefile_u32(savefile, &savefile->map[20]));
+    savefile->offset = PCAP_HEADER_LEN;
+
+    if((savefile->snaplen == 0) || (savefile->snaplen > PCAP_MAX_SNAPLEN))
+      savefile->snaplen = PCAP_MAX_SNAPLEN;
+  }
+
+  return(savefile);
+#endif
+}
+
+/* ****************************************************** */
+
+int ndpi_savefile_next(struct ndpi_savefile *savefile, struct pcap_pkthdr *header, const u_char **packet) {
+  return(savefile->pcapng ? savefile_next_pcapng(savefile, header, packet) : savefile_next_pcap(savefile, header, packet));
+}
+
+/* ****************************************************** */
+
+int ndpi_savefile_datalink(const struct ndpi_savefile *savefile) {
+  return(savefile->datalink);
+}
+
+/* ****************************************************** */
+
+u_int32_t ndpi_savefile_snaplen(const struct ndpi_savefile *savefile) {
+  return(savefile->snaplen);
+}
+
+/* ****************************************************** */
+
+void ndpi_savefile_close(struct ndpi_savefile *savefile) {
+#ifndef WIN32
+  munmap((void*)savefile->map, savefile->len);
+#endif
+  free(savefile->interfaces);
+  free(savefile);
+}
+
+/* ****************************************************** */
+
+void ndpi_savefile_prefetch(const char *path) {
+#if !defined(WIN32) && defined(POSIX_FADV_WILLNEED)
+  int fd = open(path, O_RDONLY);
+
+  if(fd >= 0) {
+    /* The kernel reads the beginning of the file in the background */
+    posix_fadvise(fd, 0, SAVEFILE_PREFETCH_LEN, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+#endif
+}
+
 /* ********************************************************** */
 /*       http://home.thep.lu.se/~bjorn/crc/crc32_fast.c       */
 /* ********************************************************** */
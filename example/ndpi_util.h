@@ -31,11 +31,15 @@
 
 #include <pcap.h>
 
-#define MAX_NUM_READER_THREADS     16
+#define MAX_NUM_READER_THREADS   1024 /* ndpiReader runs up to one thread per core */
 #define IDLE_SCAN_PERIOD           10 /* msec (use TICK_RESOLUTION = 1000) */
 #define MAX_IDLE_TIME           30000
 #define IDLE_SCAN_BUDGET         1024
-#define NUM_ROOTS                 512
+#define IDLE_EXPORT_BATCH          64  /* idle flows handed to the export callback at once */
+#define WORKFLOW_BURST_SIZE       256  /* packets detected at once by ndpi_workflow_process_burst() */
+#define FLOW_TABLE_SIZE         16384
+#define IPV4_FRAG_TIMEOUT       30000  /* msec (TICK_RESOLUTION), for a datagram not updated */
+#define IPV4_FRAG_MAX_MEMORY  4194304  /* bytes of IPv4 datagrams being reassembled per workflow */
 #define MAX_EXTRA_PACKETS_TO_CHECK  7
 #define MAX_NDPI_FLOWS      200000000
 #define TICK_RESOLUTION          1000
@@ -57,12 +61,13 @@
 
 // flow tracking
 typedef struct ndpi_flow_info {
-  u_int32_t hashval;
+  struct ndpi_flow_key key;
   u_int32_t src_ip;
   u_int32_t dst_ip;
   u_int16_t src_port;
   u_int16_t dst_port;
   u_int8_t detection_completed, protocol, bidirectional, check_extra_packets;
+  u_int8_t burst_pending; /* a packet waits for detection (see ndpi_workflow_process_burst) */
   u_int16_t vlan_id;
   struct ndpi_flow_struct *ndpi_flow;
   char src_name[48], dst_name[48];
@@ -83,6 +88,9 @@ typedef struct ndpi_flow_info {
   } ssh_ssl;
 
   void *src_id, *dst_id;
+
+  /* idle list of the workflow, least recently seen first */
+  struct ndpi_flow_info *idle_prev, *idle_next;
 } ndpi_flow_info_t;
 
 
@@ -98,6 +106,7 @@ typedef struct ndpi_stats {
   u_int32_t ndpi_flow_count;
   u_int64_t tcp_count, udp_count;
   u_int64_t mpls_count, pppoe_count, vlan_count, fragmented_count;
+  u_int64_t reassembled_count, fragment_drop_count; /* IPv4 datagrams reassembled, fragments dropped */
   u_int64_t packet_len[6];
   u_int16_t max_packet_len;
 } ndpi_stats_t;
@@ -107,15 +116,22 @@ typedef struct ndpi_stats {
 typedef struct ndpi_workflow_prefs {
   u_int8_t decode_tunnels;
   u_int8_t quiet_mode;
-  u_int32_t num_roots;
+  u_int32_t flow_table_size; /* initial number of flows, the table grows as needed */
   u_int32_t max_ndpi_flows;
+  u_int32_t flow_pool_size; /* preallocated flows (0 = use malloc) */
+  struct ndpi_detection_module_struct *shared_module; /* use a context of it (NULL = own module) */
 } ndpi_workflow_prefs_t;
 
 struct ndpi_workflow;
+struct ndpi_workflow_burst;
+struct ndpi_ipv4_frag_table;
 
 /** workflow, flow, user data */
 typedef void (*ndpi_workflow_callback_ptr) (struct ndpi_workflow *, struct ndpi_flow_info *, void *);
 
+/** workflow, flows, number of flows, user data */
+typedef void (*ndpi_workflow_export_callback_ptr) (struct ndpi_workflow *, struct ndpi_flow_info **, u_int32_t, void *);
+
 
 // workflow main structure
 typedef struct ndpi_workflow {
@@ -128,14 +144,20 @@ typedef struct ndpi_workflow {
   void * __flow_detected_udata;
   ndpi_workflow_callback_ptr __flow_giveup_callback;
   void * __flow_giveup_udata;
+  ndpi_workflow_export_callback_ptr __flow_export_callback;
+  void * __flow_export_udata;
 
   /* outside referencies */
   pcap_t *pcap_handle;
 
   /* allocated by prefs */
-  void **ndpi_flows_root;
+  struct ndpi_flow_table *flow_table;
+  struct ndpi_flow_info *idle_head, *idle_tail; /* flows by last_seen */
+  struct ndpi_workflow_burst *burst; /* packets waiting for detection, NULL out of bursts */
+  struct ndpi_ipv4_frag_table *frags; /* IPv4 datagrams being reassembled, NULL before the first fragment */
   struct ndpi_detection_module_struct *ndpi_struct;
   u_int32_t num_allocated_flows;
+  struct ndpi_flow_pool *flow_pool;
 } ndpi_workflow_t;
 
 
@@ -154,12 +176,68 @@ void ndpi_workflow_free(struct ndpi_workflow * workflow);
 void ndpi_free_flow_info_half(struct ndpi_flow_info *flow);
 
 
-/* Process a packet and update the workflow  */
+/* Process a packet and update the workflow: IPv4 fragments are held until
+   their datagram is complete, then it is processed as a single packet */
 struct ndpi_proto ndpi_workflow_process_packet(struct ndpi_workflow * workflow,
 					       const struct pcap_pkthdr *header,
 					       const u_char *packet);
 
 
+/* Process num_packets packets, as ndpi_workflow_process_packet() does for each
+   of them, and store their protocol in protos (if not NULL). The packets of
+   flows being detected are handed to nDPI in bursts of WORKFLOW_BURST_SIZE
+   (ndpi_detection_process_packet_burst()): they must stay valid until the
+   call returns */
+void ndpi_workflow_process_burst(struct ndpi_workflow * workflow,
+				 const struct pcap_pkthdr *headers,
+				 const u_char * const *packets,
+				 u_int32_t num_packets,
+				 struct ndpi_proto *protos);
+
+
+/* Hash of the hosts of a packet, the same in both directions: all the flows
+   between two hosts (and so all the packets of a flow, fragments included)
+   get the same hash, so it can be used to spread the flows across workflows
+   without splitting the dissectors that correlate flows of the same hosts.
+   Tunnels are not decoded (their flows share the hash of the tunnel) and the
+   VLAN is ignored. Returns 0 if the packet is not IP */
+u_int32_t ndpi_workflow_packet_hash(int datalink_type, const struct pcap_pkthdr *header, const u_char *packet);
+
+
+/* Expire up to budget flows not seen for max_idle_time (TICK_RESOLUTION units):
+   they are handed to the export callback, then removed and freed.
+   Returns the number of expired flows */
+u_int32_t ndpi_workflow_expire_idle_flows(struct ndpi_workflow * workflow, u_int64_t max_idle_time, u_int32_t budget);
+
+
+/* Remove and free all flows */
+void ndpi_workflow_free_flows(struct ndpi_workflow * workflow);
+
+
+/* pcap/pcapng file read from a read-only mapping of it */
+struct ndpi_savefile;
+
+/* Map a pcap (also nanosecond and modified) or pcapng file for sequential
+   reading. Returns NULL if the file cannot be mapped or has another format:
+   it is then left to pcap_open_offline() */
+struct ndpi_savefile * ndpi_savefile_open(const char *path);
+
+/* Next packet of the file: *packet points into the mapping, and stays valid
+   until ndpi_savefile_close(). Returns 1 for a packet, 0 at the end of the
+   file, -1 if the file is truncated or corrupted */
+int ndpi_savefile_next(struct ndpi_savefile *savefile, struct pcap_pkthdr *header, const u_char **packet);
+
+/* DLT_ link type of the packets and their capture length */
+int ndpi_savefile_datalink(const struct ndpi_savefile *savefile);
+u_int32_t ndpi_savefile_snaplen(const struct ndpi_savefile *savefile);
+
+void ndpi_savefile_close(struct ndpi_savefile *savefile);
+
+/* Ask the kernel to start reading a file that will be opened soon (e.g. the
+   next one of a playlist) while the current one is processed */
+void ndpi_savefile_prefetch(const char *path);
+
+
 /* flow callbacks for complete detected flow
    (ndpi_flow_info will be freed right after) */
 static inline void ndpi_workflow_set_flow_detected_callback(struct ndpi_workflow * workflow, ndpi_workflow_callback_ptr callback, void * udata) {
@@ -174,8 +252,13 @@ static inline void ndpi_workflow_set_flow_giveup_callback(struct ndpi_workflow *
   workflow->__flow_giveup_udata = udata;
 }
 
- /* compare two nodes in workflow */
-int ndpi_workflow_node_cmp(const void *a, const void *b);
+/* flow callback for idle flows, called with batches of up to IDLE_EXPORT_BATCH flows
+   (ndpi_flow_info will be freed right after) */
+static inline void ndpi_workflow_set_flow_export_callback(struct ndpi_workflow * workflow, ndpi_workflow_export_callback_ptr callback, void * udata) {
+  workflow->__flow_export_callback = callback;
+  workflow->__flow_export_udata = udata;
+}
+
 void process_ndpi_collected_info(struct ndpi_workflow * workflow, struct ndpi_flow_info *flow);
 u_int32_t ethernet_crc32(const void* data, size_t n_bytes);
 void ndpi_flow_info_freer(void *node);
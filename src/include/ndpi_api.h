@@ -123,6 +123,50 @@ extern "C" {
   u_int16_t ndpi_network_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, struct in_addr *pin);
 
 
+  /**
+   * Returns the nDPI protocol ids for IP-based protocol detection of both
+   * endpoints of a flow. The two lookups are interleaved, which is faster
+   * than two calls to ndpi_network_ptree_match()
+   *
+   * @par    ndpi_struct  = the struct created for the protocol detection
+   * @par    src          = source address (MUST BE in network byte order)
+   * @par    dst          = destination address (MUST BE in network byte order)
+   * @par    src_protocol = where the nDPI protocol ID of src is returned
+   * @par    dst_protocol = where the nDPI protocol ID of dst is returned
+   *
+   */
+  void ndpi_network_ptree_match_pair(struct ndpi_detection_module_struct *ndpi_struct,
+				     struct in_addr *src, struct in_addr *dst,
+				     u_int16_t *src_protocol, u_int16_t *dst_protocol);
+
+
+  /**
+   * Returns the nDPI protocol id for IP-based protocol detection of an
+   * IPv6 address
+   *
+   * @par    ndpi_struct  = the struct created for the protocol detection
+   * @par    pin          = IPv6 host address (network byte order)
+   * @return the nDPI protocol ID
+   *
+   */
+  u_int16_t ndpi_network6_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_in6_addr *pin);
+
+
+  /**
+   * Same as ndpi_network_ptree_match_pair() for IPv6 addresses
+   *
+   * @par    ndpi_struct  = the struct created for the protocol detection
+   * @par    src          = source address (network byte order)
+   * @par    dst          = destination address (network byte order)
+   * @par    src_protocol = where the nDPI protocol ID of src is returned
+   * @par    dst_protocol = where the nDPI protocol ID of dst is returned
+   *
+   */
+  void ndpi_network6_ptree_match_pair(struct ndpi_detection_module_struct *ndpi_struct,
+				      struct ndpi_in6_addr *src, struct ndpi_in6_addr *dst,
+				      u_int16_t *src_protocol, u_int16_t *dst_protocol);
+
+
   /**
    * Init single protocol match
    *
@@ -170,6 +214,27 @@ extern "C" {
   void ndpi_exit_detection_module(struct ndpi_detection_module_struct *ndpi_struct);
 
 
+  /**
+   * Returns a detection context of an initialized module, to be used by
+   * another thread in place of a module of its own. The context shares the
+   * dissectors, the protocols and the rules of the module and only holds
+   * the state of the packets being processed. Create the contexts once the
+   * module is configured (ndpi_finalize_initialization()) and before it
+   * processes packets; the rules can then be reloaded with
+   * ndpi_publish_rules() on each context. A context is destroyed with
+   * ndpi_exit_detection_module(), the module is freed with its last context.
+   *
+   * @par    ndpi_str       = the detection module (or one of its contexts)
+   * @par    replicate_core = 1 to give the context its own copy of the
+   *                          read-only dissector tables, allocated by the
+   *                          calling thread (i.e. on its NUMA node)
+   * @return the detection context; NULL if out of memory
+   *
+   */
+  struct ndpi_detection_module_struct* ndpi_init_detection_context(struct ndpi_detection_module_struct *ndpi_str,
+								   u_int8_t replicate_core);
+
+
   /**
    * Sets a single protocol bitmask
    * This function does not increment the index of the callback_buffer
@@ -205,6 +270,124 @@ extern "C" {
 					    const NDPI_PROTOCOL_BITMASK * detection_bitmask);
 
 
+  /**
+   * Completes the initialization of the detection module: to be called
+   * after the protocols (and the protocols file, if any) have been loaded
+   * and before processing packets. Once called, the string automata and
+   * the IP networks tables are read-only so the module can be shared by
+   * several threads for matching.
+   *
+   * @par ndpi_str = the detection module
+   *
+   */
+  void ndpi_finalize_initialization(struct ndpi_detection_module_struct *ndpi_str);
+
+
+  /**
+   * Saves the state of a detection module (custom protocols, default ports,
+   * IP networks and string automata) to a snapshot file that
+   * ndpi_load_snapshot() can load instead of rebuilding it. The module is
+   * finalized first. The file is replaced atomically.
+   *
+   * @par    ndpi_str = the detection module
+   * @par    path     = the snapshot file path
+   * @return 0 if the snapshot has been saved; -1 else
+   *
+   */
+  int ndpi_save_snapshot(struct ndpi_detection_module_struct *ndpi_str, const char *path);
+
+
+  /**
+   * Loads a snapshot saved by ndpi_save_snapshot(), in place of loading the
+   * protocols file and calling ndpi_finalize_initialization(). The module
+   * must come from ndpi_init_detection_module() and have no custom protocol.
+   * The file is mapped read-only until the module is released: modules
+   * loading the same file share its pages. Only the nDPI revision that saved
+   * a snapshot can load it.
+   *
+   * @par    ndpi_str = the detection module
+   * @par    path     = the snapshot file path
+   * @return 0 if the snapshot has been loaded; -1 else (the module is unchanged)
+   *
+   */
+  int ndpi_load_snapshot(struct ndpi_detection_module_struct *ndpi_str, const char *path);
+
+
+  /**
+   * Compiles the rules of a protocols file (see ndpi_load_protocols_file())
+   * into a new generation of the host names, default ports and IP networks
+   * tables, to be published to running modules with ndpi_publish_rules().
+   * This can be called from a control thread while the module processes
+   * packets: only its core and the base generation are read, never the
+   * protocols the thread processing its packets switches between. The
+   * caller must hold a reference to the base generation.
+   *
+   * @par    ndpi_str = the module the generation is built for
+   * @par    base     = the generation last built for the module, whose custom
+   *                    protocols keep their id; NULL if none was built (the
+   *                    custom protocols of the module core are used)
+   * @par    path     = the path of the protocols file
+   * @return the generation (to be released with ndpi_release_rules()); NULL
+   *         if the file cannot be loaded
+   *
+   */
+  struct ndpi_rules* ndpi_build_rules(struct ndpi_detection_module_struct *ndpi_str,
+				      const struct ndpi_rules *base, const char *path);
+
+
+  /**
+   * Publishes a generation of rules to a module, from a control thread,
+   * without stopping the thread processing the packets of the module: this
+   * thread switches to the new rules before its next packet, or in
+   * ndpi_rules_quiescent() if no packet comes, and retires the previous
+   * ones (see ndpi_reclaim_rules()). The generation can be
+   * published to several modules. Once published, ndpi_handle_rule() can
+   * no longer change the rules of the module.
+   *
+   * @par    ndpi_str = the detection module
+   * @par    rules    = the generation returned by ndpi_build_rules()
+   * @return 0 if published; -2 if the previous generation has not been
+   *         switched to yet (try again later); -1 if the generation has
+   *         not been built for this module
+   *
+   */
+  int ndpi_publish_rules(struct ndpi_detection_module_struct *ndpi_str, struct ndpi_rules *rules);
+
+
+  /**
+   * Quiescent point of the thread processing the packets of a module: it
+   * switches to the generation of rules published meanwhile, as the next
+   * packet would do. A thread waiting for packets (e.g. on a capture
+   * timeout) must call it regularly, else ndpi_publish_rules() keeps
+   * failing and the previous generations are never retired. Only the
+   * thread processing the packets of the module can call it.
+   *
+   * @par    ndpi_str = the detection module
+   *
+   */
+  void ndpi_rules_quiescent(struct ndpi_detection_module_struct *ndpi_str);
+
+
+  /**
+   * Releases the reference to a generation returned by ndpi_build_rules():
+   * the generation is freed once no module uses it any more.
+   *
+   * @par    rules = the generation
+   *
+   */
+  void ndpi_release_rules(struct ndpi_rules *rules);
+
+
+  /**
+   * Frees the generations of rules retired by the thread processing the
+   * packets of a module. To be called periodically by the control thread.
+   *
+   * @par    ndpi_str = the detection module
+   *
+   */
+  void ndpi_reclaim_rules(struct ndpi_detection_module_struct *ndpi_str);
+
+
   /**
    *  Function to be called before we give up with detection for a given flow.
    *  This function reduces the NDPI_UNKNOWN_PROTOCOL detection
@@ -263,6 +446,24 @@ extern "C" {
 					      struct ndpi_id_struct *dst);
 
 
+  /**
+   * Processes a burst of packets, as ndpi_detection_process_packet() does
+   * for each of them. Packets are grouped by transport (TCP, UDP, other)
+   * so that the same dissectors run back to back, while the packets of a
+   * flow are processed in their order
+   *
+   * @par    ndpi_struct   = the detection module
+   * @par    pkts          = the packets
+   * @par    results       = the detected protocol of each packet (num_pkts entries)
+   * @par    num_pkts      = the number of packets
+   *
+   */
+  void ndpi_detection_process_packet_burst(struct ndpi_detection_module_struct *ndpi_struct,
+					   const struct ndpi_packet_burst_entry *pkts,
+					   ndpi_protocol *results,
+					   u_int32_t num_pkts);
+
+
   /**
    * Get the main protocol of the passed flows for the detected module
    *
@@ -276,6 +477,19 @@ extern "C" {
 					 struct ndpi_flow_struct *flow);
 
 
+  /**
+   * Get the host name of the flow (HTTP host, DNS query, SSL certificate...).
+   * It is kept with the other dissected fields (flow->cold->host_server_name,
+   * flow->cold->http, flow->cold->protos) in the cold part of the flow,
+   * that is NULL until a dissector sets one of them
+   *
+   * @par    flow         = the flow given for the detection module
+   * @return the host name, an empty string if none
+   *
+   */
+  const char* ndpi_get_flow_host_server_name(struct ndpi_flow_struct *flow);
+
+
   /**
    * Query the pointer to the layer 4 packet
    *
@@ -332,7 +546,12 @@ extern "C" {
 
 
   /**
-   * Check if the string passed match with a protocol
+   * Check if the string passed match with a protocol.
+   * Host matches return the last pattern matched unless the most specific
+   * match is enabled (ndpi_set_host_match_most_specific()): in that case the
+   * patterns starting on a domain label boundary (or after a '-') are
+   * preferred, then the longest one, and the search stops as soon as no
+   * better match is possible.
    *
    * @par    ndpi_struct         = the detection module
    * @par    string_to_match     = the string to match
@@ -739,6 +958,216 @@ extern "C" {
   void * ndpi_malloc(size_t size);
   void * ndpi_calloc(unsigned long count, size_t size);
   void ndpi_free(void *ptr);
+
+
+  /**
+   * Allocate a pool of preallocated flow (and id) structures, meant to be
+   * used by a single thread at a time. Bind it to the thread with
+   * ndpi_set_thread_flow_pool() and install ndpi_flow_pool_malloc()
+   * and ndpi_flow_pool_free() with set_ndpi_flow_malloc()/set_ndpi_flow_free().
+   * The flows of the pool start at a cache line boundary
+   *
+   * @par     num_flows = number of ndpi_flow_struct (twice as many ndpi_id_struct) to preallocate
+   * @return  the pool, or NULL if an error occurred
+   *
+   */
+  struct ndpi_flow_pool* ndpi_init_flow_pool(u_int32_t num_flows);
+
+
+  /**
+   * Free a pool allocated with ndpi_init_flow_pool(). Its objects must no
+   * longer be in use
+   *
+   * @par     pool = the pool to free
+   *
+   */
+  void ndpi_free_flow_pool(struct ndpi_flow_pool *pool);
+
+
+  /**
+   * Set the pool used by ndpi_flow_pool_malloc() in the calling thread
+   *
+   * @par     pool = the pool, or NULL to allocate with ndpi_malloc()
+   *
+   */
+  void ndpi_set_thread_flow_pool(struct ndpi_flow_pool *pool);
+
+
+  /**
+   * Flow allocator to be installed with set_ndpi_flow_malloc(): it serves
+   * ndpi_flow_struct and ndpi_id_struct from the pool of the calling thread,
+   * and anything else (or everything once the pool is exhausted) with ndpi_malloc()
+   *
+   * @par     size = the size to allocate
+   * @return  the allocated memory, or NULL if an error occurred
+   *
+   */
+  void * ndpi_flow_pool_malloc(size_t size);
+
+
+  /**
+   * Release memory allocated with ndpi_flow_pool_malloc(), to be installed
+   * with set_ndpi_flow_free(). Flows are released as with ndpi_free_flow().
+   * The memory goes back to the pool it comes from, which must not be in
+   * use by another thread at the same time (pools are not locked)
+   *
+   * @par     ptr = the memory to release
+   *
+   */
+  void ndpi_flow_pool_free(void *ptr);
+
+
+  /**
+   * Read the pool statistics
+   *
+   * @par     pool  = the pool
+   * @par     stats = where the statistics are returned
+   *
+   */
+  void ndpi_get_flow_pool_stats(struct ndpi_flow_pool *pool, struct ndpi_flow_pool_stats *stats);
+
+
+  /**
+   * Let the dissectors (SSL, HTTP, SMTP, IMAP) reassemble the in-order
+   * segments of a TCP flow direction, up to max_bytes, when a message
+   * spans several segments. The buffers are released as soon as the
+   * flow detection completes, or by ndpi_free_flow() (and
+   * ndpi_flow_pool_free()). Disabled by default
+   *
+   * @par     ndpi_struct = the detection module
+   * @par     max_bytes   = bytes buffered per flow direction (at most 65535, 0 = disabled)
+   *
+   */
+  void ndpi_set_tcp_reassembly(struct ndpi_detection_module_struct *ndpi_struct, u_int32_t max_bytes);
+
+
+  /**
+   * Match the host names (HTTP Host, TLS SNI, DNS queries) to the most
+   * specific host pattern instead of the last one matched: patterns
+   * starting on a domain label boundary (or after a '-') first, then the
+   * longest one (e.g. googlevideo.com rather than google). Disabled by default
+   *
+   * @par     ndpi_struct = the detection module
+   * @par     enable      = 1 to enable, 0 to disable
+   *
+   */
+  void ndpi_set_host_match_most_specific(struct ndpi_detection_module_struct *ndpi_struct, u_int8_t enable);
+
+
+  /**
+   * Read the memory used by the TCP reassembly buffers of all the
+   * detection modules
+   *
+   * @par     stats = where the statistics are returned
+   *
+   */
+  void ndpi_get_tcp_reassembly_stats(struct ndpi_tcp_reassembly_stats *stats);
+
+
+  /**
+   * Allocate an open-addressing table mapping flow keys to user values,
+   * where a key and its reverse (endpoints swapped) identify the same
+   * flow. The table grows as needed and is not thread safe
+   *
+   * @par     initial_size = number of flows expected (0 = use a default)
+   * @return  the table, or NULL if an error occurred
+   *
+   */
+  struct ndpi_flow_table* ndpi_flow_table_init(u_int32_t initial_size);
+
+
+  /**
+   * Free a table allocated with ndpi_flow_table_init()
+   *
+   * @par     table      = the table to free
+   * @par     free_value = function called on every value still in the table (or NULL)
+   *
+   */
+  void ndpi_flow_table_free(struct ndpi_flow_table *table, void (*free_value)(void *value));
+
+
+  /**
+   * Search a flow in either direction
+   *
+   * @par     table   = the table
+   * @par     key     = the key of the packet
+   * @par     reverse = set to 1 if the packet goes in the opposite direction
+   *                    of the key used to add the flow, 0 otherwise (may be NULL)
+   * @return  the value of the flow, or NULL if not found
+   *
+   */
+  void* ndpi_flow_table_find(struct ndpi_flow_table *table, const struct ndpi_flow_key *key, u_int8_t *reverse);
+
+
+  /**
+   * Add a flow that is not yet in the table
+   *
+   * @par     table = the table
+   * @par     key   = the key of the flow (it defines its direction)
+   * @par     value = the value to associate to the flow (not NULL)
+   * @return  0 on success, or -1 if an error occurred
+   *
+   */
+  int ndpi_flow_table_add(struct ndpi_flow_table *table, const struct ndpi_flow_key *key, void *value);
+
+
+  /**
+   * Remove a flow
+   *
+   * @par     table = the table
+   * @par     key   = the key of the flow in either direction
+   * @return  the value of the removed flow, or NULL if not found
+   *
+   */
+  void* ndpi_flow_table_remove(struct ndpi_flow_table *table, const struct ndpi_flow_key *key);
+
+
+  /**
+   * Number of flows in the table
+   *
+   * @par     table = the table
+   * @return  the number of flows
+   *
+   */
+  u_int32_t ndpi_flow_table_count(struct ndpi_flow_table *table);
+
+
+  /**
+   * Call walker on every flow of the table. The table must not be
+   * modified while it is walked
+   *
+   * @par     table     = the table
+   * @par     walker    = the function to call
+   * @par     user_data = passed to walker
+   *
+   */
+  void ndpi_flow_table_walk(struct ndpi_flow_table *table, ndpi_flow_table_walker walker, void *user_data);
+
+
+  /**
+   * Same as ndpi_flow_table_walk() but limited to one of num_slices
+   * portions of the table, so that long scans can be spread over time
+   *
+   * @par     table      = the table
+   * @par     slice      = the portion to walk (0..num_slices-1)
+   * @par     num_slices = the number of portions the table is split into
+   * @par     walker     = the function to call
+   * @par     user_data  = passed to walker
+   *
+   */
+  void ndpi_flow_table_walk_slice(struct ndpi_flow_table *table, u_int32_t slice, u_int32_t num_slices,
+				  ndpi_flow_table_walker walker, void *user_data);
+
+
+  /**
+   * Hash of a flow key, the same in both directions: the flows of a
+   * capture can be spread across threads with it
+   *
+   * @par     key = the key of the packet
+   * @return  the hash of the flow
+   *
+   */
+  u_int32_t ndpi_flow_key_symmetric_hash(const struct ndpi_flow_key *key);
 #ifdef __cplusplus
 }
 #endif
@@ -31,6 +31,12 @@
 #include "ndpi_api.h"
 #include "ndpi_protocols.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -42,10 +48,113 @@ extern "C" {
   void ndpi_twalk(const void *, void (*)(const void *, ndpi_VISIT, int, void*), void *user_data);
   void ndpi_tdestroy(void *vrootp, void (*freefct)(void *));
 
+  /* Out of line versions of ndpi_bitmask_intersects()/ndpi_bitmask_is_empty() */
   int NDPI_BITMASK_COMPARE(NDPI_PROTOCOL_BITMASK a, NDPI_PROTOCOL_BITMASK b);
   int NDPI_BITMASK_IS_EMPTY(NDPI_PROTOCOL_BITMASK a);
   void NDPI_DUMP_BITMASK(NDPI_PROTOCOL_BITMASK a);
 
+  /*
+    Bitmask operations on whole NDPI_PROTOCOL_BITMASKs (NDPI_NUM_BITS bits),
+    one AVX2 or two SSE2 vectors at a time when the compiler targets them
+  */
+#if defined(__AVX2__) && (NDPI_NUM_BITS % 256 == 0)
+#define NDPI_BITMASK_VECTORS (sizeof(NDPI_PROTOCOL_BITMASK) / sizeof(__m256i))
+
+  static inline int ndpi_bitmask_intersects(const NDPI_PROTOCOL_BITMASK *a, const NDPI_PROTOCOL_BITMASK *b) {
+    __m256i r = _mm256_setzero_si256();
+    u_int32_t i;
+
+    for(i = 0; i < NDPI_BITMASK_VECTORS; i++)
+      r = _mm256_or_si256(r, _mm256_and_si256(_mm256_loadu_si256(&((const __m256i*)a->fds_bits)[i]),
+					     _mm256_loadu_si256(&((const __m256i*)b->fds_bits)[i])));
+
+    return(!_mm256_testz_si256(r, r));
+  }
+
+  static inline int ndpi_bitmask_is_empty(const NDPI_PROTOCOL_BITMASK *a) {
+    __m256i r = _mm256_setzero_si256();
+    u_int32_t i;
+
+    for(i = 0; i < NDPI_BITMASK_VECTORS; i++)
+      r = _mm256_or_si256(r, _mm256_loadu_si256(&((const __m256i*)a->fds_bits)[i]));
+
+    return(_mm256_testz_si256(r, r));
+  }
+
+  static inline void ndpi_bitmask_or(NDPI_PROTOCOL_BITMASK *a, const NDPI_PROTOCOL_BITMASK *b) {
+    u_int32_t i;
+
+    for(i = 0; i < NDPI_BITMASK_VECTORS; i++)
+      _mm256_storeu_si256(&((__m256i*)a->fds_bits)[i],
+			  _mm256_or_si256(_mm256_loadu_si256(&((const __m256i*)a->fds_bits)[i]),
+					  _mm256_loadu_si256(&((const __m256i*)b->fds_bits)[i])));
+  }
+#elif defined(__SSE2__) && (NDPI_NUM_BITS % 128 == 0)
+#define NDPI_BITMASK_VECTORS (sizeof(NDPI_PROTOCOL_BITMASK) / sizeof(__m128i))
+
+  static inline int ndpi_bitmask_intersects(const NDPI_PROTOCOL_BITMASK *a, const NDPI_PROTOCOL_BITMASK *b) {
+    __m128i r = _mm_setzero_si128();
+    u_int32_t i;
+
+    for(i = 0; i < NDPI_BITMASK_VECTORS; i++)
+      r = _mm_or_si128(r, _mm_and_si128(_mm_loadu_si128(&((const __m128i*)a->fds_bits)[i]),
+				       _mm_loadu_si128(&((const __m128i*)b->fds_bits)[i])));
+
+    return(_mm_movemask_epi8(_mm_cmpeq_epi8(r, _mm_setzero_si128())) != 0xFFFF);
+  }
+
+  static inline int ndpi_bitmask_is_empty(const NDPI_PROTOCOL_BITMASK *a) {
+    __m128i r = _mm_setzero_si128();
+    u_int32_t i;
+
+    for(i = 0; i < NDPI_BITMASK_VECTORS; i++)
+      r = _mm_or_si128(r, _mm_loadu_si128(&((const __m128i*)a->fds_bits)[i]));
+
+    return(_mm_movemask_epi8(_mm_cmpeq_epi8(r, _mm_setzero_si128())) == 0xFFFF);
+  }
+
+  static inline void ndpi_bitmask_or(NDPI_PROTOCOL_BITMASK *a, const NDPI_PROTOCOL_BITMASK *b) {
+    u_int32_t i;
+
+    for(i = 0; i < NDPI_BITMASK_VECTORS; i++)
+      _mm_storeu_si128(&((__m128i*)a->fds_bits)[i],
+		       _mm_or_si128(_mm_loadu_si128(&((const __m128i*)a->fds_bits)[i]),
+				    _mm_loadu_si128(&((const __m128i*)b->fds_bits)[i])));
+  }
+#else
+  static inline int ndpi_bitmask_intersects(const NDPI_PROTOCOL_BITMASK *a, const NDPI_PROTOCOL_BITMASK *b) {
+    ndpi_ndpi_mask r = 0;
+    u_int32_t i;
+
+    /* No early exit: the loop is unrolled and vectorized by the compiler */
+    for(i = 0; i < NDPI_NUM_FDS_BITS; i++)
+      r |= a->fds_bits[i] & b->fds_bits[i];
+
+    return(r != 0);
+  }
+
+  static inline int ndpi_bitmask_is_empty(const NDPI_PROTOCOL_BITMASK *a) {
+    ndpi_ndpi_mask r = 0;
+    u_int32_t i;
+
+    for(i = 0; i < NDPI_NUM_FDS_BITS; i++)
+      r |= a->fds_bits[i];
+
+    return(r == 0);
+  }
+
+  static inline void ndpi_bitmask_or(NDPI_PROTOCOL_BITMASK *a, const NDPI_PROTOCOL_BITMASK *b) {
+    u_int32_t i;
+
+    for(i = 0; i < NDPI_NUM_FDS_BITS; i++)
+      a->fds_bits[i] |= b->fds_bits[i];
+  }
+#endif
+
+  static inline int ndpi_bitmask_test(const NDPI_PROTOCOL_BITMASK *a, u_int32_t n) {
+    return((a->fds_bits[n / NDPI_BITS] >> (n % NDPI_BITS)) & 1);
+  }
+
   extern u_int8_t ndpi_net_match(u_int32_t ip_to_check,
 				 u_int32_t net,
 				 u_int32_t num_bits);
@@ -70,6 +179,23 @@ extern "C" {
   extern void ndpi_parse_packet_line_info(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow);
   extern void ndpi_parse_packet_line_info_any(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow);
 
+  /* Cold part of the flow, allocated on first use: NULL if out of memory */
+  extern struct ndpi_flow_cold_struct* ndpi_flow_cold(struct ndpi_flow_struct *flow);
+
+  /* TCP reassembly of the current packet direction (see ndpi_set_tcp_reassembly()) */
+  extern const u_int8_t* ndpi_tcp_stream_get(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow, u_int16_t proto, u_int32_t len);
+  extern u_int32_t ndpi_tcp_stream_len(struct ndpi_flow_struct *flow, u_int16_t proto);
+  extern u_int8_t ndpi_tcp_stream_pending(struct ndpi_flow_struct *flow, u_int16_t proto);
+  extern void ndpi_tcp_stream_stop(struct ndpi_flow_struct *flow, u_int16_t proto);
+  extern u_int8_t ndpi_tcp_stream_swap_payload(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow, u_int16_t proto);
+  extern void ndpi_tcp_stream_restore_payload(struct ndpi_flow_struct *flow);
+  extern u_int8_t ndpi_tcp_stream_lines(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow, u_int16_t proto);
+  extern void ndpi_tcp_stream_lines_done(struct ndpi_flow_struct *flow, u_int16_t proto);
+
+  /* Returns 1 for the server certificate name, 2 for the ClientHello SNI, 0 if none */
+  extern int getSSLcertificate(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow,
+			       char *buffer, int buffer_len);
+
   extern u_int16_t ndpi_check_for_email_address(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow, u_int16_t counter);
 
   extern void ndpi_int_change_packet_protocol(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow,
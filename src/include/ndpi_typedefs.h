@@ -676,6 +676,39 @@ struct ndpi_int_one_line_struct {
   u_int16_t len;
 };
 
+/*
+  Filled by ndpi_parse_packet_line_info(): it only refers to the packet
+  being processed, hence it is kept once per detection module instead
+  of once per flow
+*/
+struct ndpi_packet_lines {
+  struct ndpi_int_one_line_struct line[NDPI_MAX_PARSE_LINES_PER_PACKET];
+  /* HTTP headers */
+  struct ndpi_int_one_line_struct host_line;
+  struct ndpi_int_one_line_struct forwarded_line;
+  struct ndpi_int_one_line_struct referer_line;
+  struct ndpi_int_one_line_struct content_line;
+  struct ndpi_int_one_line_struct accept_line;
+  struct ndpi_int_one_line_struct user_agent_line;
+  struct ndpi_int_one_line_struct http_url_name;
+  struct ndpi_int_one_line_struct http_encoding;
+  struct ndpi_int_one_line_struct http_transfer_encoding;
+  struct ndpi_int_one_line_struct http_contentlen;
+  struct ndpi_int_one_line_struct http_cookie;
+  struct ndpi_int_one_line_struct http_origin;
+  struct ndpi_int_one_line_struct http_x_session_type;
+  struct ndpi_int_one_line_struct server_line;
+  struct ndpi_int_one_line_struct http_method;
+  struct ndpi_int_one_line_struct http_response; /* the first "word" in this pointer is the response code in the packet (200, etc) */
+  u_int8_t http_num_headers; /* number of found (valid) header lines in HTTP request or response */
+
+  u_int16_t parsed_lines;
+  u_int16_t parsed_unix_lines;
+  u_int16_t empty_line_position;
+  u_int8_t packet_lines_parsed_complete:1,
+    empty_line_position_set:1;
+};
+
 struct ndpi_packet_struct {
   const struct ndpi_iphdr *iph;
 #ifdef NDPI_DETECTION_SUPPORT_IPV6
@@ -698,41 +731,19 @@ struct ndpi_packet_struct {
 #endif
   u_int16_t protocol_stack_info;
 
-  struct ndpi_int_one_line_struct line[NDPI_MAX_PARSE_LINES_PER_PACKET];
-  /* HTTP headers */
-  struct ndpi_int_one_line_struct host_line;
-  struct ndpi_int_one_line_struct forwarded_line;
-  struct ndpi_int_one_line_struct referer_line;
-  struct ndpi_int_one_line_struct content_line;
-  struct ndpi_int_one_line_struct accept_line;
-  struct ndpi_int_one_line_struct user_agent_line;
-  struct ndpi_int_one_line_struct http_url_name;
-  struct ndpi_int_one_line_struct http_encoding;
-  struct ndpi_int_one_line_struct http_transfer_encoding;
-  struct ndpi_int_one_line_struct http_contentlen;
-  struct ndpi_int_one_line_struct http_cookie;
-  struct ndpi_int_one_line_struct http_origin;
-  struct ndpi_int_one_line_struct http_x_session_type;
-  struct ndpi_int_one_line_struct server_line;
-  struct ndpi_int_one_line_struct http_method;
-  struct ndpi_int_one_line_struct http_response; /* the first "word" in this pointer is the response code in the packet (200, etc) */
-  u_int8_t http_num_headers; /* number of found (valid) header lines in HTTP request or response */
+  /* line parsing scratch of the packet being processed (owned by the detection module) */
+  struct ndpi_packet_lines *lines;
 
   u_int16_t l3_packet_len;
   u_int16_t l4_packet_len;
   u_int16_t payload_packet_len;
   u_int16_t actual_payload_len;
   u_int16_t num_retried_bytes;
-  u_int16_t parsed_lines;
-  u_int16_t parsed_unix_lines;
-  u_int16_t empty_line_position;
   u_int8_t tcp_retransmission;
   u_int8_t l4_protocol;
 
   u_int8_t ssl_certificate_detected:4, ssl_certificate_num_checks:4;
-  u_int8_t packet_lines_parsed_complete:1,
-    packet_direction:1,
-    empty_line_position_set:1;
+  u_int8_t packet_direction:1;
 };
 
 struct ndpi_detection_module_struct;
@@ -813,11 +824,57 @@ typedef struct ndpi_proto_defaults {
   void (*func) (struct ndpi_detection_module_struct *, struct ndpi_flow_struct *flow);
 } ndpi_proto_defaults_t;
 
-typedef struct ndpi_default_ports_tree_node {
-  ndpi_proto_defaults_t *proto;
-  u_int8_t customUserProto;
-  u_int16_t default_port;
-} ndpi_default_ports_tree_node_t;
+/* See ndpi_init_flow_pool() */
+struct ndpi_flow_pool;
+
+struct ndpi_flow_pool_stats {
+  u_int32_t capacity; /* ndpi_flow_struct (twice as many ndpi_id_struct) */
+  u_int32_t flows_in_use, flows_high_water;
+  u_int32_t ids_in_use, ids_high_water;
+  u_int64_t fallbacks; /* Allocations served by ndpi_malloc() */
+};
+
+/* One direction of a TCP flow, see ndpi_tcp_stream_get() */
+struct ndpi_tcp_stream {
+  u_int8_t *buf;
+  u_int32_t len, size;  /* bytes buffered and allocated */
+  u_int32_t next_seq;   /* sequence number following buf[len - 1] */
+  u_int16_t proto;      /* dissector that started the stream */
+  u_int8_t active:1,
+    closed:1;           /* a gap or the size limit: no more bytes are appended */
+};
+
+struct ndpi_tcp_reassembly {
+  struct ndpi_tcp_stream stream[2]; /* by packet direction */
+
+  /* Packet payload replaced by ndpi_tcp_stream_swap_payload() */
+  const u_int8_t *payload;
+  u_int16_t payload_len;
+};
+
+/* See ndpi_get_tcp_reassembly_stats() */
+struct ndpi_tcp_reassembly_stats {
+  u_int64_t bytes_in_use, bytes_high_water; /* buffers of all the flows */
+  u_int64_t streams, streams_truncated;     /* started, stopped by a gap or the size limit */
+};
+
+/*
+  Flow table key (see ndpi_flow_table_init()): a flow has the same key in
+  both directions once endpoints are swapped. Addresses and ports are in
+  network byte order, IPv4 addresses use the first word only and the
+  unused words must be zero.
+*/
+struct ndpi_flow_key {
+  u_int32_t src_ip[4], dst_ip[4];
+  u_int16_t src_port, dst_port;
+  u_int16_t vlan_id;
+  u_int8_t protocol, ip_version;
+};
+
+/* See ndpi_flow_table_init() */
+struct ndpi_flow_table;
+
+typedef void (*ndpi_flow_table_walker)(const struct ndpi_flow_key *key, void *value, void *user_data);
 
 typedef struct _ndpi_automa {
   void *ac_automa; /* Real type is AC_AUTOMATA_t */
@@ -828,11 +885,50 @@ typedef struct ndpi_proto {
   u_int16_t master_protocol /* e.g. HTTP */, app_protocol /* e.g. FaceBook */;
 } ndpi_protocol;
 
+/* A packet of ndpi_detection_process_packet_burst() */
+struct ndpi_packet_burst_entry {
+  struct ndpi_flow_struct *flow;
+  const unsigned char *packet; /* Layer 3 (IP header) */
+  u_int16_t packetlen;
+  u_int64_t current_tick;
+  struct ndpi_id_struct *src, *dst;
+};
+
 #define NDPI_PROTOCOL_NULL { NDPI_PROTOCOL_UNKNOWN , NDPI_PROTOCOL_UNKNOWN }
 
 #define NUM_CUSTOM_CATEGORIES      5
 #define CUSTOM_CATEGORY_LABEL_LEN 32
 
+/*
+  Read-only part of a detection module, shared by the detection contexts
+  created with ndpi_init_detection_context(): it is only written while
+  the module is configured, before its contexts are created.
+*/
+struct ndpi_detection_core {
+  char custom_category_labels[NUM_CUSTOM_CATEGORIES][CUSTOM_CATEGORY_LABEL_LEN];
+
+  /* callback function buffers */
+  struct ndpi_call_function_struct callback_buffer[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
+  struct ndpi_call_function_struct callback_buffer_tcp_no_payload[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
+  struct ndpi_call_function_struct callback_buffer_tcp_payload[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
+  struct ndpi_call_function_struct callback_buffer_udp[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
+  struct ndpi_call_function_struct callback_buffer_non_tcp_udp[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
+
+  /*
+    Dispatch plans: for each L4 buffer and packet selection class, the
+    callback_buffer indexes to call while the flow is still unknown.
+    dissectors_excluded_by[p] lists the callback_buffer indexes that
+    must be skipped once protocol p is in the flow excluded bitmask.
+  */
+  NDPI_PROTOCOL_BITMASK dispatch_plan[NDPI_DISPATCH_NUM_L4][NDPI_DISPATCH_NUM_CLASSES];
+  NDPI_PROTOCOL_BITMASK dissectors_excluded_by[NDPI_NUM_BITS];
+
+  /* subprotocol registration handler */
+  struct ndpi_subprotocol_conf_struct subprotocol_conf[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
+
+  ndpi_proto_defaults_t proto_defaults[NDPI_MAX_SUPPORTED_PROTOCOLS+NDPI_MAX_NUM_CUSTOM_PROTOCOLS];
+};
+
 struct ndpi_detection_module_struct {
   NDPI_PROTOCOL_BITMASK detection_bitmask;
   NDPI_PROTOCOL_BITMASK generic_http_packet_bitmask;
@@ -843,24 +939,28 @@ struct ndpi_detection_module_struct {
 #ifdef NDPI_ENABLE_DEBUG_MESSAGES
   void *user_data;
 #endif
-  char custom_category_labels[NUM_CUSTOM_CATEGORIES][CUSTOM_CATEGORY_LABEL_LEN];
-  /* callback function buffer */
-  struct ndpi_call_function_struct callback_buffer[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
-  u_int32_t callback_buffer_size;
-
-  struct ndpi_call_function_struct callback_buffer_tcp_no_payload[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
-  u_int32_t callback_buffer_size_tcp_no_payload;
 
-  struct ndpi_call_function_struct callback_buffer_tcp_payload[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
-  u_int32_t callback_buffer_size_tcp_payload;
+  /*
+    The core (see struct ndpi_detection_core) and the module owning it:
+    a detection context only holds the state of the thread using it
+  */
+  struct ndpi_detection_core *core;
+  struct ndpi_detection_module_struct *parent; /* NULL unless a context */
+  int refcnt;                                  /* the module and its contexts */
 
-  struct ndpi_call_function_struct callback_buffer_udp[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
-  u_int32_t callback_buffer_size_udp;
+  /* Arrays of the core */
+  char (*custom_category_labels)[CUSTOM_CATEGORY_LABEL_LEN];
+  struct ndpi_call_function_struct *callback_buffer, *callback_buffer_tcp_no_payload,
+    *callback_buffer_tcp_payload, *callback_buffer_udp, *callback_buffer_non_tcp_udp;
+  NDPI_PROTOCOL_BITMASK (*dispatch_plan)[NDPI_DISPATCH_NUM_CLASSES];
+  NDPI_PROTOCOL_BITMASK *dissectors_excluded_by;
+  struct ndpi_subprotocol_conf_struct *subprotocol_conf;
+  ndpi_proto_defaults_t *proto_defaults; /* or those of the rules generation in use */
 
-  struct ndpi_call_function_struct callback_buffer_non_tcp_udp[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
-  u_int32_t callback_buffer_size_non_tcp_udp;
+  u_int32_t callback_buffer_size, callback_buffer_size_tcp_no_payload, callback_buffer_size_tcp_payload,
+    callback_buffer_size_udp, callback_buffer_size_non_tcp_udp;
 
-  ndpi_default_ports_tree_node_t *tcpRoot, *udpRoot;
+  u_int16_t *tcp_ports_index, *udp_ports_index; /* 65536 entries, see addDefaultPort() */
 
   ndpi_log_level_t ndpi_log_level; /* default error */
 #ifdef NDPI_ENABLE_DEBUG_MESSAGES
@@ -874,12 +974,10 @@ struct ndpi_detection_module_struct {
 
   /* misc parameters */
   u_int32_t tcp_max_retransmission_window_size;
+  u_int32_t tcp_reassembly_max_bytes; /* per flow direction, 0: disabled (see ndpi_set_tcp_reassembly()) */
 
   u_int32_t directconnect_connection_ip_tick_timeout;
 
-  /* subprotocol registration handler */
-  struct ndpi_subprotocol_conf_struct subprotocol_conf[NDPI_MAX_SUPPORTED_PROTOCOLS + 1];
-
   u_int ndpi_num_supported_protocols;
   u_int ndpi_num_custom_protocols;
 
@@ -890,7 +988,15 @@ struct ndpi_detection_module_struct {
     bigrams_automa, impossible_bigrams_automa; /* TOR */
 
   /* IP-based protocol detection */
-  void *protocols_ptree;
+  struct ndpi_lpm *protocols_lpm, *protocols_lpm6;
+
+  /* Rules generation in use, the one to switch to and the retired ones,
+     see ndpi_publish_rules() */
+  struct ndpi_rules *rules, *pending_rules, *retired_rules;
+
+  /* Read-only snapshot the automata are using, see ndpi_load_snapshot() */
+  void *snapshot;
+  size_t snapshot_len;
 
   /* irc parameters */
   u_int32_t irc_timeout;
@@ -933,49 +1039,21 @@ struct ndpi_detection_module_struct {
   cache_t tinc_cache;
 #endif
 
-  ndpi_proto_defaults_t proto_defaults[NDPI_MAX_SUPPORTED_PROTOCOLS+NDPI_MAX_NUM_CUSTOM_PROTOCOLS];
-
   u_int8_t http_dont_dissect_response:1, dns_dissect_response:1,
-    direction_detect_disable:1; /* disable internal detection of packet direction */
-};
-
-struct ndpi_flow_struct {
-  u_int16_t detected_protocol_stack[NDPI_PROTOCOL_SIZE];
-#ifndef WIN32
-  __attribute__ ((__packed__))
-#endif
-  u_int16_t protocol_stack_info;
-
-  /* init parameter, internal used to set up timestamp,... */
-  u_int16_t guessed_protocol_id, guessed_host_protocol_id;
-
-  u_int8_t protocol_id_already_guessed:1, host_already_guessed:1, init_finished:1, setup_packet_direction:1, packet_direction:1, check_extra_packets:1;
-
-  /*
-     if ndpi_struct->direction_detect_disable == 1
-     tcp sequence number connection tracking
-  */
-  u_int32_t next_tcp_seq_nr[2];
-
-  u_int8_t max_extra_packets_to_check;
-  u_int8_t num_extra_packets_checked;
-  int (*extra_packets_func) (struct ndpi_detection_module_struct *, struct ndpi_flow_struct *flow);
+    direction_detect_disable:1, /* disable internal detection of packet direction */
+    host_match_most_specific:1; /* see ndpi_set_host_match_most_specific() */
 
-  /*
-     the tcp / udp / other l4 value union
-     used to reduce the number of bytes for tcp or udp protocol states
-  */
-  union {
-    struct ndpi_flow_tcp_struct tcp;
-    struct ndpi_flow_udp_struct udp;
-  } l4;
+  /* line parsing scratch of the packet being processed (see ndpi_packet_struct.lines) */
+  struct ndpi_packet_lines packet_lines;
+};
 
-  /*
-     Pointer to src or dst
-     that identifies the
-     server of this connection
-  */
-  struct ndpi_id_struct *server_id;
+/*
+  Cold part of a flow: what is reported once the flow is detected (host
+  name, HTTP request, protocol specific metadata). Most flows never fill
+  it in: it is allocated by the first dissector writing to it, see
+  ndpi_flow_cold(), and flow->cold stays NULL until then.
+*/
+struct ndpi_flow_cold_struct {
   /* HTTP host or DNS query */
   u_char host_server_name[256];
 
@@ -1039,20 +1117,78 @@ struct ndpi_flow_struct {
       char class_ident[48];
     } dhcp;
   } protos;
+};
+
+struct ndpi_flow_struct {
+  /*
+     Hot header: what every packet of the flow reads or updates, kept in
+     the first cache line (flows of a pool start at a cache line, see
+     ndpi_init_flow_pool())
+  */
+  u_int16_t detected_protocol_stack[NDPI_PROTOCOL_SIZE];
+#ifndef WIN32
+  __attribute__ ((__packed__))
+#endif
+  u_int16_t protocol_stack_info;
+
+  /* init parameter, internal used to set up timestamp,... */
+  u_int16_t guessed_protocol_id, guessed_host_protocol_id;
+
+  u_int8_t protocol_id_already_guessed:1, host_already_guessed:1, init_finished:1, setup_packet_direction:1, packet_direction:1, check_extra_packets:1;
+
+  u_int8_t max_extra_packets_to_check;
+  u_int8_t num_extra_packets_checked;
+
+  u_int16_t packet_counter;		      // can be 0 - 65000
+  u_int16_t packet_direction_counter[2];
+  u_int16_t byte_counter[2];
+
+  /*
+     if ndpi_struct->direction_detect_disable == 1
+     tcp sequence number connection tracking
+  */
+  u_int32_t next_tcp_seq_nr[2];
+
+  int (*extra_packets_func) (struct ndpi_detection_module_struct *, struct ndpi_flow_struct *flow);
+
+  /* allocated when a dissector needs more than one segment, see ndpi_tcp_stream_get() */
+  struct ndpi_tcp_reassembly *tcp_reassembly;
+
+  /* allocated when the flow has metadata to report, see ndpi_flow_cold() */
+  struct ndpi_flow_cold_struct *cold;
+
+  /*
+     the tcp / udp / other l4 value union
+     used to reduce the number of bytes for tcp or udp protocol states
+  */
+  union {
+    struct ndpi_flow_tcp_struct tcp;
+    struct ndpi_flow_udp_struct udp;
+  } l4;
+
+  /*
+     Pointer to src or dst
+     that identifies the
+     server of this connection
+  */
+  struct ndpi_id_struct *server_id;
 
   /*** ALL protocol specific 64 bit variables here ***/
 
   /* protocols which have marked a connection as this connection cannot be protocol XXX, multiple u_int64_t */
   NDPI_PROTOCOL_BITMASK excluded_protocol_bitmask;
 
+  /*
+    callback_buffer indexes no longer eligible for this flow, derived
+    incrementally from the excluded_protocol_bitmask snapshot below
+  */
+  NDPI_PROTOCOL_BITMASK excluded_dissector_bitmask, excluded_protocol_bitmask_synced;
+
   u_int8_t num_stun_udp_pkts;
 
 #ifdef NDPI_PROTOCOL_REDIS
   u_int8_t redis_s2d_first_char, redis_d2s_first_char;
 #endif
-  u_int16_t packet_counter;		      // can be 0 - 65000
-  u_int16_t packet_direction_counter[2];
-  u_int16_t byte_counter[2];
 #ifdef NDPI_PROTOCOL_BITTORRENT
   u_int8_t bittorrent_stage;		      // can be 0 - 255
 #endif
@@ -1157,4 +1293,10 @@ typedef struct {
   u_int8_t value;
 } ndpi_network;
 
+typedef struct {
+  u_int16_t network[8]; /* host byte order 16 bits groups */
+  u_int8_t cidr;
+  u_int8_t value;
+} ndpi_network6;
+
 #endif/* __NDPI_TYPEDEFS_H__ */
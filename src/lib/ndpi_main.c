@@ -31,8 +31,14 @@
 #include "../../config.h"
 
 #include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #ifndef WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #endif
 
 #include "ndpi_content_match.c.inc"
@@ -309,12 +315,13 @@ static void addDefaultPort(struct ndpi_detection_module_struct *ndpi_mod,
 			   ndpi_port_range *range,
 			   ndpi_proto_defaults_t *def,
 			   u_int8_t customUserProto,
-			   ndpi_default_ports_tree_node_t **root,
+			   u_int16_t *ports_index,
 			   const char *_func, int _line);
 
-static int removeDefaultPort(ndpi_port_range *range,
+static int removeDefaultPort(struct ndpi_detection_module_struct *ndpi_mod,
+			     ndpi_port_range *range,
 			     ndpi_proto_defaults_t *def,
-			     ndpi_default_ports_tree_node_t **root);
+			     u_int16_t *ports_index);
 
 /* ****************************************** */
 
@@ -341,6 +348,476 @@ void ndpi_flow_free(void *ptr) { if(_ndpi_flow_free) _ndpi_flow_free(ptr); else
 
 /* ****************************************** */
 
+/*
+  Flow pool: fixed-size slabs of ndpi_flow_struct and ndpi_id_struct.
+  Flows start at a cache line so that their hot header takes one line.
+  Every object returned by ndpi_flow_pool_malloc() is preceded by a header
+  pointing to its pool (NULL for ndpi_malloc() fallbacks), so it goes back
+  to that pool whatever the pool bound to the releasing thread. The free
+  lists are not locked: an object must not be released while another
+  thread uses its pool.
+*/
+typedef struct {
+  struct ndpi_flow_pool *pool;
+  u_int32_t size;
+  u_int32_t pad;
+} ndpi_flow_pool_hdr;
+
+#define NDPI_FLOW_POOL_CACHE_LINE 64
+
+struct ndpi_flow_slab {
+  void *mem;
+  u_int8_t *base;                  /* first header, in mem */
+  void *free_list;
+  u_int32_t obj_size, capacity, in_use, high_water;
+};
+
+struct ndpi_flow_pool {
+  struct ndpi_flow_slab flows, ids;
+  u_int64_t fallbacks;
+};
+
+#ifdef WIN32
+static __declspec(thread) struct ndpi_flow_pool *_ndpi_thread_flow_pool;
+#else
+static __thread struct ndpi_flow_pool *_ndpi_thread_flow_pool;
+#endif
+
+static void ndpi_free_tcp_reassembly(struct ndpi_flow_struct *flow);
+
+/* Release what a flow points to, but not the flow itself */
+static void ndpi_free_flow_data(struct ndpi_flow_struct *flow) {
+  ndpi_free_tcp_reassembly(flow);
+
+  if(flow->cold) {
+    if(flow->cold->http.url)
+      ndpi_free(flow->cold->http.url);
+    if(flow->cold->http.content_type)
+      ndpi_free(flow->cold->http.content_type);
+
+    ndpi_free(flow->cold);
+    flow->cold = NULL;
+  }
+}
+
+/* ****************************************** */
+
+struct ndpi_flow_cold_struct* ndpi_flow_cold(struct ndpi_flow_struct *flow) {
+  if(flow->cold == NULL)
+    flow->cold = ndpi_calloc(1, sizeof(struct ndpi_flow_cold_struct));
+
+  return(flow->cold);
+}
+
+/* ****************************************** */
+
+/* The objects (after their header) are aligned on align bytes, a power of 2 */
+static int ndpi_init_flow_slab(struct ndpi_flow_slab *slab, size_t size, u_int32_t capacity, u_int32_t align) {
+  u_int32_t i;
+
+  slab->obj_size = (sizeof(ndpi_flow_pool_hdr) + size + align - 1) & ~(align - 1);
+  slab->capacity = capacity;
+
+  if((slab->mem = ndpi_malloc((size_t)slab->obj_size * capacity + align)) == NULL)
+    return(-1);
+
+  slab->base = (u_int8_t*)((((size_t)slab->mem + sizeof(ndpi_flow_pool_hdr) + align - 1) & ~((size_t)align - 1))
+			   - sizeof(ndpi_flow_pool_hdr));
+
+  /* Thread the free list in address order */
+  for(i = capacity; i > 0; i--) {
+    void **obj = (void**)(slab->base + (size_t)(i - 1) * slab->obj_size);
+
+    *obj = slab->free_list, slab->free_list = obj;
+  }
+
+  return(0);
+}
+
+/* ****************************************** */
+
+struct ndpi_flow_pool* ndpi_init_flow_pool(u_int32_t num_flows) {
+  struct ndpi_flow_pool *pool = ndpi_calloc(1, sizeof(struct ndpi_flow_pool));
+
+  if(pool == NULL)
+    return(NULL);
+
+  if((ndpi_init_flow_slab(&pool->flows, sizeof(struct ndpi_flow_struct), num_flows, NDPI_FLOW_POOL_CACHE_LINE) != 0)
+     || (ndpi_init_flow_slab(&pool->ids, sizeof(struct ndpi_id_struct), 2 * num_flows, 16) != 0)) {
+    ndpi_free_flow_pool(pool);
+    return(NULL);
+  }
+
+  return(pool);
+}
+
+/* ****************************************** */
+
+void ndpi_free_flow_pool(struct ndpi_flow_pool *pool) {
+  if(pool) {
+    if(_ndpi_thread_flow_pool == pool)
+      _ndpi_thread_flow_pool = NULL;
+
+    if(pool->flows.mem) ndpi_free(pool->flows.mem);
+    if(pool->ids.mem)   ndpi_free(pool->ids.mem);
+    ndpi_free(pool);
+  }
+}
+
+/* ****************************************** */
+
+void ndpi_set_thread_flow_pool(struct ndpi_flow_pool *pool) { _ndpi_thread_flow_pool = pool; }
+
+/* ****************************************** */
+
+void * ndpi_flow_pool_malloc(size_t size) {
+  struct ndpi_flow_pool *pool = _ndpi_thread_flow_pool;
+  struct ndpi_flow_slab *slab = NULL;
+  ndpi_flow_pool_hdr *hdr;
+
+  if(pool) {
+    if(size == sizeof(struct ndpi_flow_struct))
+      slab = &pool->flows;
+    else if(size == sizeof(struct ndpi_id_struct))
+      slab = &pool->ids;
+  }
+
+  if(slab && slab->free_list) {
+    hdr = (ndpi_flow_pool_hdr*)slab->free_list;
+    slab->free_list = *(void**)hdr;
+
+    if(++slab->in_use > slab->high_water)
+      slab->high_water = slab->in_use;
+
+    hdr->pool = pool;
+  } else {
+    if((hdr = ndpi_malloc(sizeof(ndpi_flow_pool_hdr) + size)) == NULL)
+      return(NULL);
+
+    if(pool) pool->fallbacks++;
+    hdr->pool = NULL;
+  }
+
+  hdr->size = size;
+  return(&hdr[1]);
+}
+
+/* ****************************************** */
+
+void ndpi_flow_pool_free(void *ptr) {
+  ndpi_flow_pool_hdr *hdr;
+
+  if(ptr == NULL)
+    return;
+
+  hdr = &((ndpi_flow_pool_hdr*)ptr)[-1];
+
+  if(hdr->size == sizeof(struct ndpi_flow_struct))
+    ndpi_free_flow_data((struct ndpi_flow_struct*)ptr);
+
+  if(hdr->pool) {
+    struct ndpi_flow_slab *slab = (hdr->size == sizeof(struct ndpi_flow_struct)) ? &hdr->pool->flows : &hdr->pool->ids;
+
+    slab->in_use--;
+    *(void**)hdr = slab->free_list, slab->free_list = hdr;
+  } else
+    ndpi_free(hdr);
+}
+
+/* ****************************************** */
+
+void ndpi_get_flow_pool_stats(struct ndpi_flow_pool *pool, struct ndpi_flow_pool_stats *stats) {
+  memset(stats, 0, sizeof(struct ndpi_flow_pool_stats));
+
+  if(pool) {
+    stats->capacity = pool->flows.capacity;
+    stats->flows_in_use = pool->flows.in_use, stats->flows_high_water = pool->flows.high_water;
+    stats->ids_in_use = pool->ids.in_use, stats->ids_high_water = pool->ids.high_water;
+    stats->fallbacks = pool->fallbacks;
+  }
+}
+
+/* ****************************************** */
+
+/*
+  Flow table: linear probing over 64 bytes (one cache line) slots holding
+  the key in canonical order (lowest endpoint first) and its hash, so that
+  a packet is looked up with a single probe sequence whatever its direction.
+  Deletions shift the following entries back, hence no tombstones.
+*/
+#define NDPI_FLOW_TABLE_MIN_SIZE  1024
+
+struct ndpi_flow_table_slot {
+  struct ndpi_flow_key key;
+  u_int32_t hash;
+  u_int8_t reversed; /* key was swapped when the flow was added */
+  u_int8_t pad[3];
+  void *value;       /* NULL = empty slot */
+  u_int64_t pad2;
+};
+
+struct ndpi_flow_table {
+  struct ndpi_flow_table_slot *slots;
+  u_int32_t mask, count;
+};
+
+/* Put the lowest endpoint first, returns 1 if the key has been swapped */
+static u_int8_t ndpi_flow_key_canonical(const struct ndpi_flow_key *key, struct ndpi_flow_key *out) {
+  int i, cmp = 0;
+
+  for(i = 0; (i < 4) && (cmp == 0); i++)
+    if(key->src_ip[i] != key->dst_ip[i])
+      cmp = (ntohl(key->src_ip[i]) < ntohl(key->dst_ip[i])) ? -1 : 1;
+
+  if(cmp == 0 && key->src_port != key->dst_port)
+    cmp = (ntohs(key->src_port) < ntohs(key->dst_port)) ? -1 : 1;
+
+  *out = *key;
+
+  if(cmp <= 0)
+    return(0);
+
+  memcpy(out->src_ip, key->dst_ip, sizeof(out->src_ip)), memcpy(out->dst_ip, key->src_ip, sizeof(out->dst_ip));
+  out->src_port = key->dst_port, out->dst_port = key->src_port;
+  return(1);
+}
+
+/* ****************************************** */
+
+static u_int32_t ndpi_flow_key_hash(const struct ndpi_flow_key *key) {
+  u_int32_t w[sizeof(struct ndpi_flow_key) / 4], h = 0x9E3779B9, i;
+
+  memcpy(w, key, sizeof(w));
+
+  for(i = 0; i < sizeof(w) / 4; i++)
+    h = (h ^ w[i]) * 0x85EBCA6B, h ^= h >> 13;
+
+  h ^= h >> 16, h *= 0xC2B2AE35, h ^= h >> 16;
+  return(h);
+}
+
+/* ****************************************** */
+
+static inline int ndpi_flow_key_equal(const struct ndpi_flow_key *a, const struct ndpi_flow_key *b) {
+#ifdef __SSE2__
+  __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)a->src_ip), _mm_loadu_si128((const __m128i*)b->src_ip));
+  __m128i y = _mm_xor_si128(_mm_loadu_si128((const __m128i*)a->dst_ip), _mm_loadu_si128((const __m128i*)b->dst_ip));
+  u_int64_t ta, tb;
+
+  memcpy(&ta, &a->src_port, sizeof(ta)), memcpy(&tb, &b->src_port, sizeof(tb));
+
+  return((ta == tb)
+	 && (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(x, y), _mm_setzero_si128())) == 0xFFFF));
+#else
+  return(memcmp(a, b, sizeof(struct ndpi_flow_key)) == 0);
+#endif
+}
+
+/* ****************************************** */
+
+static struct ndpi_flow_table_slot* ndpi_flow_table_lookup(struct ndpi_flow_table *table,
+							    const struct ndpi_flow_key *key, u_int32_t hash) {
+  u_int32_t i = hash & table->mask;
+
+  while(table->slots[i].value != NULL) {
+    if((table->slots[i].hash == hash) && ndpi_flow_key_equal(&table->slots[i].key, key))
+      return(&table->slots[i]);
+
+    i = (i + 1) & table->mask;
+  }
+
+  return(NULL);
+}
+
+/* ****************************************** */
+
+static void ndpi_flow_table_place(struct ndpi_flow_table *table, const struct ndpi_flow_table_slot *slot) {
+  u_int32_t i = slot->hash & table->mask;
+
+  while(table->slots[i].value != NULL)
+    i = (i + 1) & table->mask;
+
+  table->slots[i] = *slot;
+}
+
+/* ****************************************** */
+
+static int ndpi_flow_table_resize(struct ndpi_flow_table *table, u_int32_t size) {
+  struct ndpi_flow_table_slot *old_slots = table->slots;
+  u_int32_t i, old_size = table->slots ? table->mask + 1 : 0;
+
+  if((table->slots = ndpi_calloc(size, sizeof(struct ndpi_flow_table_slot))) == NULL) {
+    table->slots = old_slots;
+    return(-1);
+  }
+
+  table->mask = size - 1;
+
+  for(i = 0; i < old_size; i++)
+    if(old_slots[i].value != NULL)
+      ndpi_flow_table_place(table, &old_slots[i]);
+
+  if(old_slots) ndpi_free(old_slots);
+  return(0);
+}
+
+/* ****************************************** */
+
+struct ndpi_flow_table* ndpi_flow_table_init(u_int32_t initial_size) {
+  struct ndpi_flow_table *table = ndpi_calloc(1, sizeof(struct ndpi_flow_table));
+  u_int32_t size = NDPI_FLOW_TABLE_MIN_SIZE;
+
+  if(table == NULL)
+    return(NULL);
+
+  /* Keep the load factor below 3/4 */
+  while((size < 0x80000000) && ((u_int64_t)size * 3 / 4 < initial_size))
+    size <<= 1;
+
+  if(ndpi_flow_table_resize(table, size) != 0) {
+    ndpi_free(table);
+    return(NULL);
+  }
+
+  return(table);
+}
+
+/* ****************************************** */
+
+void ndpi_flow_table_free(struct ndpi_flow_table *table, void (*free_value)(void *value)) {
+  u_int32_t i;
+
+  if(table == NULL)
+    return;
+
+  if(free_value) {
+    for(i = 0; i <= table->mask; i++)
+      if(table->slots[i].value != NULL)
+	free_value(table->slots[i].value);
+  }
+
+  ndpi_free(table->slots);
+  ndpi_free(table);
+}
+
+/* ****************************************** */
+
+void* ndpi_flow_table_find(struct ndpi_flow_table *table, const struct ndpi_flow_key *key, u_int8_t *reverse) {
+  struct ndpi_flow_key canonical;
+  u_int8_t swapped = ndpi_flow_key_canonical(key, &canonical);
+  struct ndpi_flow_table_slot *slot = ndpi_flow_table_lookup(table, &canonical, ndpi_flow_key_hash(&canonical));
+
+  if(slot == NULL)
+    return(NULL);
+
+  if(reverse) *reverse = (swapped != slot->reversed);
+  return(slot->value);
+}
+
+/* ****************************************** */
+
+int ndpi_flow_table_add(struct ndpi_flow_table *table, const struct ndpi_flow_key *key, void *value) {
+  struct ndpi_flow_table_slot slot;
+
+  if(value == NULL)
+    return(-1);
+
+  if(((u_int64_t)table->count + 1) * 4 > (u_int64_t)(table->mask + 1) * 3) {
+    if((table->mask == 0x7FFFFFFF) || (ndpi_flow_table_resize(table, (table->mask + 1) << 1) != 0))
+      return(-1);
+  }
+
+  memset(&slot, 0, sizeof(slot));
+  slot.reversed = ndpi_flow_key_canonical(key, &slot.key);
+  slot.hash = ndpi_flow_key_hash(&slot.key);
+  slot.value = value;
+
+  ndpi_flow_table_place(table, &slot);
+  table->count++;
+  return(0);
+}
+
+/* ****************************************** */
+
+void* ndpi_flow_table_remove(struct ndpi_flow_table *table, const struct ndpi_flow_key *key) {
+  struct ndpi_flow_key canonical;
+  struct ndpi_flow_table_slot *slot;
+  u_int32_t i, j, home;
+  void *value;
+
+  ndpi_flow_key_canonical(key, &canonical);
+
+  if((slot = ndpi_flow_table_lookup(table, &canonical, ndpi_flow_key_hash(&canonical))) == NULL)
+    return(NULL);
+
+  value = slot->value;
+  i = j = (u_int32_t)(slot - table->slots);
+
+  /* Shift back the entries whose probe sequence crosses the freed slot */
+  while(1) {
+    j = (j + 1) & table->mask;
+
+    if(table->slots[j].value == NULL)
+      break;
+
+    home = table->slots[j].hash & table->mask;
+
+    if((i <= j) ? ((home <= i) || (home > j)) : ((home <= i) && (home > j)))
+      table->slots[i] = table->slots[j], i = j;
+  }
+
+  table->slots[i].value = NULL;
+  table->count--;
+  return(value);
+}
+
+/* ****************************************** */
+
+u_int32_t ndpi_flow_table_count(struct ndpi_flow_table *table) { return(table->count); }
+
+/* ****************************************** */
+
+void ndpi_flow_table_walk_slice(struct ndpi_flow_table *table, u_int32_t slice, u_int32_t num_slices,
+				ndpi_flow_table_walker walker, void *user_data) {
+  u_int64_t size = (u_int64_t)table->mask + 1;
+  u_int32_t i, end;
+
+  if((num_slices == 0) || (slice >= num_slices))
+    return;
+
+  i = (u_int32_t)(size * slice / num_slices), end = (u_int32_t)(size * (slice + 1) / num_slices);
+
+  for(; i < end; i++)
+    if(table->slots[i].value != NULL) {
+      struct ndpi_flow_key key = table->slots[i].key;
+
+      if(table->slots[i].reversed) {
+	memcpy(key.src_ip, table->slots[i].key.dst_ip, sizeof(key.src_ip));
+	memcpy(key.dst_ip, table->slots[i].key.src_ip, sizeof(key.dst_ip));
+	key.src_port = table->slots[i].key.dst_port, key.dst_port = table->slots[i].key.src_port;
+      }
+
+      walker(&key, table->slots[i].value, user_data);
+    }
+}
+
+/* ****************************************** */
+
+void ndpi_flow_table_walk(struct ndpi_flow_table *table, ndpi_flow_table_walker walker, void *user_data) {
+  ndpi_flow_table_walk_slice(table, 0, 1, walker, user_data);
+}
+
+/* ****************************************** */
+
+u_int32_t ndpi_flow_key_symmetric_hash(const struct ndpi_flow_key *key) {
+  struct ndpi_flow_key canonical;
+
+  ndpi_flow_key_canonical(key, &canonical);
+  return(ndpi_flow_key_hash(&canonical));
+}
+
+/* ****************************************** */
+
 void * ndpi_realloc(void *ptr, size_t old_size, size_t new_size)
 {
   void *ret = ndpi_malloc(new_size);
@@ -348,8 +825,11 @@ void * ndpi_realloc(void *ptr, size_t old_size, size_t new_size)
   if(!ret)
     return(ret);
   else {
-    memcpy(ret, ptr, old_size);
-    ndpi_free(ptr);
+    /* like realloc(), a NULL ptr is a plain allocation */
+    if(ptr != NULL) {
+      memcpy(ret, ptr, old_size);
+      ndpi_free(ptr);
+    }
     return(ret);
   }
 }
@@ -540,68 +1020,46 @@ void ndpi_set_proto_defaults(struct ndpi_detection_module_struct *ndpi_mod,
   memcpy(&ndpi_mod->proto_defaults[protoId].master_udp_protoId, udp_master_protoId, 2*sizeof(u_int16_t));
 
   for(j=0; j<MAX_DEFAULT_PORTS; j++) {
-    if(udpDefPorts[j].port_low != 0) addDefaultPort(ndpi_mod, &udpDefPorts[j], &ndpi_mod->proto_defaults[protoId], 0, &ndpi_mod->udpRoot, __FUNCTION__,__LINE__);
-    if(tcpDefPorts[j].port_low != 0) addDefaultPort(ndpi_mod, &tcpDefPorts[j], &ndpi_mod->proto_defaults[protoId], 0, &ndpi_mod->tcpRoot, __FUNCTION__,__LINE__);
+    if(udpDefPorts[j].port_low != 0) addDefaultPort(ndpi_mod, &udpDefPorts[j], &ndpi_mod->proto_defaults[protoId], 0, ndpi_mod->udp_ports_index, __FUNCTION__,__LINE__);
+    if(tcpDefPorts[j].port_low != 0) addDefaultPort(ndpi_mod, &tcpDefPorts[j], &ndpi_mod->proto_defaults[protoId], 0, ndpi_mod->tcp_ports_index, __FUNCTION__,__LINE__);
   }
 }
 
 /* ******************************************************************** */
 
-static int ndpi_default_ports_tree_node_t_cmp(const void *a, const void *b)
-{
-  ndpi_default_ports_tree_node_t *fa = (ndpi_default_ports_tree_node_t*)a;
-  ndpi_default_ports_tree_node_t *fb = (ndpi_default_ports_tree_node_t*)b;
-
-  //printf("[NDPI] %s(%d, %d)\n", __FUNCTION__, fa->default_port, fb->default_port);
-
-  return((fa->default_port == fb->default_port) ? 0 : ((fa->default_port < fb->default_port) ? -1 : 1));
-}
-
-/* ******************************************************************** */
-
-void ndpi_default_ports_tree_node_t_walker(const void *node, const ndpi_VISIT which, const int depth)
-{
-  ndpi_default_ports_tree_node_t *f = *(ndpi_default_ports_tree_node_t **)node;
-
-  printf("<%d>Walk on node %s (%u)\n",
-	 depth,
-	 which == ndpi_preorder?"ndpi_preorder":
-	 which == ndpi_postorder?"ndpi_postorder":
-	 which == ndpi_endorder?"ndpi_endorder":
-	 which == ndpi_leaf?"ndpi_leaf": "unknown",
-	 f->default_port);
-}
-
-/* ******************************************************************** */
+/*
+  Default ports index: one 16 bit entry per port and L4 protocol, holding
+  the proto_defaults index of the protocol plus one (0 = no protocol) and
+  NDPI_PORT_CUSTOM_USER_PROTO when the port was first added by a user rule
+  (a later protocol on the same port does not change it).
+*/
+#define NDPI_PORT_CUSTOM_USER_PROTO  0x8000
+#define NDPI_PORT_PROTO_MASK         0x7FFF
 
 static void addDefaultPort(struct ndpi_detection_module_struct *ndpi_mod,
 			   ndpi_port_range *range,
 			   ndpi_proto_defaults_t *def,
 			   u_int8_t customUserProto,
-			   ndpi_default_ports_tree_node_t **root,
+			   u_int16_t *ports_index,
 			   const char *_func, int _line)
 {
-  ndpi_default_ports_tree_node_t *ret;
-  u_int16_t port;
-
-  for(port=range->port_low; port<=range->port_high; port++) {
-    ndpi_default_ports_tree_node_t *node = (ndpi_default_ports_tree_node_t*)ndpi_malloc(sizeof(ndpi_default_ports_tree_node_t));
+  u_int16_t entry = (u_int16_t)(def - ndpi_mod->proto_defaults) + 1;
+  u_int32_t port;
 
-    if(!node) {
-      NDPI_LOG_ERR(ndpi_mod, "%s:%d not enough memory\n", _func, _line);
-      break;
-    }
+  if(customUserProto) entry |= NDPI_PORT_CUSTOM_USER_PROTO;
 
-    node->proto = def, node->default_port = port, node->customUserProto = customUserProto;
-    ret = *(ndpi_default_ports_tree_node_t**)ndpi_tsearch(node, (void*)root, ndpi_default_ports_tree_node_t_cmp); /* Add it to the tree */
+  for(port=range->port_low; port<=range->port_high; port++) {
+    u_int16_t v = entry;
 
-    if(ret != node) {
+    if(ports_index[port] != 0) {
       NDPI_LOG_DBG(ndpi_mod, "[NDPI] %s:%d found duplicate for port %u: overwriting it with new value\n",
 		      _func, _line, port);
 
-      ret->proto = def;
-      ndpi_free(node);
+      /* Only the protocol is replaced: the port keeps the custom flag it was added with */
+      v = (entry & NDPI_PORT_PROTO_MASK) | (ports_index[port] & NDPI_PORT_CUSTOM_USER_PROTO);
     }
+
+    ports_index[port] = v;
   }
 }
 
@@ -613,26 +1071,21 @@ static void addDefaultPort(struct ndpi_detection_module_struct *ndpi_mod,
   This function must be called with a semaphore set, this in order to avoid
   changing the datastructures while using them
 */
-static int removeDefaultPort(ndpi_port_range *range,
+static int removeDefaultPort(struct ndpi_detection_module_struct *ndpi_mod,
+			     ndpi_port_range *range,
 			     ndpi_proto_defaults_t *def,
-			     ndpi_default_ports_tree_node_t **root)
+			     u_int16_t *ports_index)
 {
-  ndpi_default_ports_tree_node_t node;
-  ndpi_default_ports_tree_node_t *ret;
-  u_int16_t port;
+  u_int16_t idx = (u_int16_t)(def - ndpi_mod->proto_defaults) + 1;
+  u_int32_t port;
+  int rc = -1;
 
   for(port=range->port_low; port<=range->port_high; port++) {
-    node.proto = def, node.default_port = port;
-    ret = *(ndpi_default_ports_tree_node_t**)ndpi_tdelete(&node, (void*)root,
-							  ndpi_default_ports_tree_node_t_cmp); /* Add it to the tree */
-
-    if(ret != NULL) {
-      ndpi_free((ndpi_default_ports_tree_node_t*)ret);
-      return(0);
-    }
+    if((ports_index[port] & NDPI_PORT_PROTO_MASK) == idx)
+      ports_index[port] = 0, rc = 0;
   }
 
-  return(-1);
+  return(rc);
 }
 
 /* ****************************************************** */
@@ -650,6 +1103,12 @@ static int ndpi_string_to_automa(struct ndpi_detection_module_struct *ndpi_struc
   }
 
   if(automa->ac_automa == NULL) return(-2);
+
+  if(automa->ac_automa_finalized) {
+    NDPI_LOG_ERR(ndpi_struct, "[NDPI] Unable to add %s: automata already finalized\n", value ? value : "");
+    return(-1);
+  }
+
   ac_pattern.astring = value;
   ac_pattern.rep.number = protocol_id;
   if(value == NULL)
@@ -773,7 +1232,7 @@ static void ndpi_init_protocol_defaults(struct ndpi_detection_module_struct *ndp
     custom_master[2];
 
     /* Reset all settings */
-    memset(ndpi_mod->proto_defaults, 0, sizeof(ndpi_mod->proto_defaults));
+    memset(ndpi_mod->proto_defaults, 0, sizeof(ndpi_mod->core->proto_defaults));
 
     ndpi_set_proto_defaults(ndpi_mod, NDPI_PROTOCOL_UNRATED, NDPI_PROTOCOL_UNKNOWN,
 			    no_master,
@@ -1736,227 +2195,1413 @@ static int ac_match_handler(AC_MATCH_t *m, void *param) {
   return 0; /* 0 to continue searching, !0 to stop */
 }
 
-/* ******************************************************************** */
-
-#ifdef NDPI_PROTOCOL_TOR
-
-static int fill_prefix_v4(prefix_t *p, struct in_addr *a, int b, int mb) {
-  do {
-    if(b < 0 || b > mb)
-      return(-1);
+/* ****************************************************** */
 
-    memset(p, 0, sizeof(prefix_t));
-    memcpy(&p->add.sin, a, (mb+7)/8);
-    p->family = AF_INET;
-    p->bitlen = b;
-    p->ref_count = 0;
-  } while (0);
+/*
+  The traversal state is kept on the stack so that a finalized automata
+  is only read, and thus it can be shared by several threads
+*/
+static void ndpi_automa_search(AC_AUTOMATA_t *automa, char *string_to_match,
+			       u_int string_to_match_len, void *param) {
+  AC_SEARCH_t state;
+  AC_TEXT_t ac_input_text;
 
-  return(0);
+  ac_automata_search_init(automa, &state);
+  ac_input_text.astring = string_to_match, ac_input_text.length = string_to_match_len;
+  ac_automata_search_r(automa, &state, &ac_input_text, param);
 }
 
-/* ******************************************* */
+/* ****************************************************** */
+
+struct ndpi_specific_match {
+  char *string_to_match;
+  AC_SEARCH_t *state;
+  int matching_protocol_id;
+  u_int match_len;
+  u_int8_t anchored;
+};
+
+/*
+  Keep the most specific match: patterns starting on a domain label
+  boundary win over the others, then the longest one wins. A '-' also
+  starts a match, as in p53-buy.itunes.apple.com for buy.itunes.apple.com
+*/
+static int ac_specific_match_handler(AC_MATCH_t *m, void *param) {
+  struct ndpi_specific_match *best = (struct ndpi_specific_match*)param;
+  u_int i;
+
+  for(i = 0; i < m->match_num; i++) {
+    AC_PATTERN_t *p = &m->patterns[i];
+    long start = m->position - p->length;
+    u_int8_t anchored = (start == 0) || (best->string_to_match[start-1] == '.')
+      || (best->string_to_match[start-1] == '-') || (p->astring[0] == '.');
+
+    if((anchored > best->anchored)
+       || ((anchored == best->anchored) && (p->length > best->match_len)))
+      best->matching_protocol_id = p->rep.number, best->match_len = p->length, best->anchored = anchored;
+  }
+
+  /* From now on only a longer anchored match can replace the current one */
+  if(best->anchored)
+    best->state->stop_length = best->match_len;
+
+  return 0; /* 0 to continue searching, !0 to stop */
+}
+
+/* ****************************************************** */
+
+static int ndpi_automa_search_most_specific(AC_AUTOMATA_t *automa, char *string_to_match,
+					    u_int string_to_match_len) {
+  struct ndpi_specific_match best;
+  AC_SEARCH_t state;
+  AC_TEXT_t ac_input_text;
+
+  memset(&best, 0, sizeof(best));
+  best.string_to_match = string_to_match, best.state = &state;
+  best.matching_protocol_id = NDPI_PROTOCOL_UNKNOWN;
+
+  ac_automata_search_init(automa, &state);
+  state.match_callback = ac_specific_match_handler;
+  ac_input_text.astring = string_to_match, ac_input_text.length = string_to_match_len;
+  ac_automata_search_r(automa, &state, &ac_input_text, (void*)&best);
+
+  return(best.matching_protocol_id);
+}
+
+/* ****************************************************** */
+
+static void ndpi_automa_finalize(ndpi_automa *automa) {
+  if((automa->ac_automa != NULL) && (!automa->ac_automa_finalized)) {
+    ac_automata_finalize((AC_AUTOMATA_t*)automa->ac_automa);
+    automa->ac_automa_finalized = 1;
+  }
+}
+
+/* ******************************************************************** */
+
+#ifdef NDPI_PROTOCOL_TOR
+
+/*
+  Longest prefix match tables (IPv4 and IPv6), compiled from the list of
+  networks.
+
+  The first 16 address bits index a flat table; each following byte of
+  the address indexes a group of 256 entries, that exists only below
+  networks longer than the bits already looked at. An entry is either a
+  protocol id or, when NDPI_LPM_CHUNK is set, the offset of the group to
+  look into.
+
+  Groups are stored compressed: most of them only hold a few hosts, so
+  a group is a 256 bits bitmap of the entries starting a new run of
+  equal values, the number of runs before each 32 bits word of the bitmap,
+  and one value per run. A lookup is the rank of the entry in the bitmap,
+  that is usually in the same cache line as the value.
+
+  Adding networks only records them: the table is rebuilt from scratch by
+  ndpi_finalize_initialization() (ndpi_build_rules() for a generation).
+  Lookups only read it, so the contexts sharing it never write to it.
+*/
+#define NDPI_LPM_CHUNK         0x80000000
+#define NDPI_LPM_GROUP_SIZE    256
+#define NDPI_LPM_BITMAP_WORDS  (NDPI_LPM_GROUP_SIZE / 32)
+#define NDPI_LPM_CHUNK_HEADER  (NDPI_LPM_BITMAP_WORDS + NDPI_LPM_BITMAP_WORDS / 4) /* bitmap + ranks */
+
+struct ndpi_lpm_prefix {
+  u_int8_t addr[16]; /* network byte order */
+  u_int8_t bits;
+  u_int16_t value;
+  u_int32_t seq;     /* insertion order: the last network added wins */
+};
+
+struct ndpi_lpm {
+  u_int32_t tbl16[65536];
+  u_int32_t *chunks, chunks_len, chunks_size;
+  struct ndpi_lpm_prefix *prefixes;
+  u_int32_t num_prefixes, max_prefixes;
+  u_int8_t addr_len; /* 4 (IPv4) or 16 (IPv6) bytes */
+  u_int8_t dirty;
+};
+
+/* ******************************************* */
+
+static struct ndpi_lpm* ndpi_lpm_init(u_int8_t addr_len) {
+  struct ndpi_lpm *lpm = ndpi_calloc(1, sizeof(struct ndpi_lpm));
+
+  if(lpm)
+    lpm->addr_len = addr_len;
+
+  return(lpm);
+}
+
+/* ******************************************* */
+
+static void ndpi_lpm_free(struct ndpi_lpm *lpm) {
+  if(lpm->chunks)   ndpi_free(lpm->chunks);
+  if(lpm->prefixes) ndpi_free(lpm->prefixes);
+  ndpi_free(lpm);
+}
+
+/* ******************************************* */
+
+/* addr is in network byte order, returns 0 on success */
+static int ndpi_lpm_add(struct ndpi_lpm *lpm, const u_int8_t *addr, u_int8_t bits, u_int16_t value) {
+  struct ndpi_lpm_prefix *p;
+  u_int32_t i;
+
+  if(bits > lpm->addr_len * 8)
+    return(-1);
+
+  if(lpm->num_prefixes == lpm->max_prefixes) {
+    u_int32_t n = lpm->max_prefixes ? 2 * lpm->max_prefixes : 1024;
+
+    if((p = ndpi_realloc(lpm->prefixes, lpm->max_prefixes * sizeof(struct ndpi_lpm_prefix),
+			 n * sizeof(struct ndpi_lpm_prefix))) == NULL)
+      return(-1);
+
+    lpm->prefixes = p, lpm->max_prefixes = n;
+  }
+
+  p = &lpm->prefixes[lpm->num_prefixes];
+  memset(p->addr, 0, sizeof(p->addr));
+
+  for(i = 0; i * 8 < bits; i++)
+    p->addr[i] = (bits >= (i + 1) * 8) ? addr[i] : (addr[i] & (0xFF << ((i + 1) * 8 - bits)));
+
+  p->bits = bits, p->value = value, p->seq = lpm->num_prefixes++;
+  lpm->dirty = 1;
+
+  return(0);
+}
+
+/* ******************************************* */
+
+static int ndpi_lpm_prefix_cmp(const void *_a, const void *_b) {
+  const struct ndpi_lpm_prefix *a = (const struct ndpi_lpm_prefix*)_a, *b = (const struct ndpi_lpm_prefix*)_b;
+
+  if(a->bits != b->bits)
+    return((a->bits < b->bits) ? -1 : 1);
+
+  return((a->seq < b->seq) ? -1 : 1);
+}
+
+/* ******************************************* */
+
+/* Uncompressed groups used while compiling the table */
+struct ndpi_lpm_builder {
+  u_int32_t *groups, num_groups, max_groups;
+};
+
+/*
+  Returns the offset in groups of the group below the entry idx of tbl16
+  (in_groups = 0) or of groups (in_groups = 1), creating it if needed
+*/
+static int64_t ndpi_lpm_group(struct ndpi_lpm *lpm, struct ndpi_lpm_builder *b,
+			      u_int8_t in_groups, u_int32_t idx) {
+  u_int32_t value = in_groups ? b->groups[idx] : lpm->tbl16[idx], base, i;
+
+  if(value & NDPI_LPM_CHUNK)
+    return(value & ~NDPI_LPM_CHUNK);
+
+  if(b->num_groups == b->max_groups) {
+    u_int32_t n = b->max_groups ? 2 * b->max_groups : 64, *groups;
+
+    if((groups = ndpi_realloc(b->groups, b->max_groups * NDPI_LPM_GROUP_SIZE * sizeof(u_int32_t),
+			      n * NDPI_LPM_GROUP_SIZE * sizeof(u_int32_t))) == NULL)
+      return(-1);
+
+    b->groups = groups, b->max_groups = n;
+  }
+
+  base = b->num_groups++ * NDPI_LPM_GROUP_SIZE;
+
+  for(i = 0; i < NDPI_LPM_GROUP_SIZE; i++)
+    b->groups[base + i] = value;
+
+  if(in_groups)
+    b->groups[idx] = NDPI_LPM_CHUNK | base;
+  else
+    lpm->tbl16[idx] = NDPI_LPM_CHUNK | base;
+
+  return(base);
+}
+
+/* ******************************************* */
+
+/* Networks come shortest first, so they simply overwrite what they cover */
+static int ndpi_lpm_paint(struct ndpi_lpm *lpm, struct ndpi_lpm_builder *b,
+			  const struct ndpi_lpm_prefix *p) {
+  u_int32_t first = (p->addr[0] << 8) | p->addr[1], count, i, k;
+  int64_t group;
+
+  if(p->bits <= 16) {
+    count = 1 << (16 - p->bits);
+
+    for(i = first; i < first + count; i++)
+      lpm->tbl16[i] = p->value;
+
+    return(0);
+  }
+
+  if((group = ndpi_lpm_group(lpm, b, 0, first)) < 0)
+    return(-1);
+
+  for(k = 2; ; k++) {
+    first = group + p->addr[k];
+
+    if(p->bits <= (k + 1) * 8)
+      break;
+
+    if((group = ndpi_lpm_group(lpm, b, 1, first)) < 0)
+      return(-1);
+  }
+
+  count = 1 << ((k + 1) * 8 - p->bits);
+
+  for(i = first; i < first + count; i++)
+    b->groups[i] = p->value;
+
+  return(0);
+}
+
+/* ******************************************* */
+
+/* Appends a compressed copy of the group entries, returns its offset or -1 */
+static int64_t ndpi_lpm_compress(struct ndpi_lpm *lpm, const u_int32_t *entries) {
+  u_int32_t runs = 0, i, *chunk;
+  u_int8_t *ranks;
+
+  for(i = 0; i < NDPI_LPM_GROUP_SIZE; i++)
+    if((i == 0) || (entries[i] != entries[i - 1]))
+      runs++;
+
+  if(lpm->chunks_len + NDPI_LPM_CHUNK_HEADER + runs > lpm->chunks_size) {
+    u_int32_t n = ndpi_max(2 * lpm->chunks_size, lpm->chunks_len + NDPI_LPM_CHUNK_HEADER + runs);
+
+    if((chunk = ndpi_realloc(lpm->chunks, lpm->chunks_size * sizeof(u_int32_t), n * sizeof(u_int32_t))) == NULL)
+      return(-1);
+
+    lpm->chunks = chunk, lpm->chunks_size = n;
+  }
+
+  chunk = &lpm->chunks[lpm->chunks_len], ranks = (u_int8_t*)&chunk[NDPI_LPM_BITMAP_WORDS];
+  memset(chunk, 0, NDPI_LPM_CHUNK_HEADER * sizeof(u_int32_t));
+
+  for(i = 0, runs = 0; i < NDPI_LPM_GROUP_SIZE; i++) {
+    if((i % 32) == 0)
+      ranks[i / 32] = runs;
+
+    if((i == 0) || (entries[i] != entries[i - 1])) {
+      chunk[i / 32] |= 1U << (i % 32);
+      chunk[NDPI_LPM_CHUNK_HEADER + runs++] = entries[i];
+    }
+  }
+
+  lpm->chunks_len += NDPI_LPM_CHUNK_HEADER + runs;
+  return(chunk - lpm->chunks);
+}
+
+/* ******************************************* */
+
+/* Compresses the group below *entry, the groups below it first */
+static int ndpi_lpm_compress_group(struct ndpi_lpm *lpm, struct ndpi_lpm_builder *b, u_int32_t *entry) {
+  u_int32_t *group = &b->groups[*entry & ~NDPI_LPM_CHUNK], i;
+  int64_t off;
+
+  for(i = 0; i < NDPI_LPM_GROUP_SIZE; i++)
+    if((group[i] & NDPI_LPM_CHUNK) && (ndpi_lpm_compress_group(lpm, b, &group[i]) != 0))
+      return(-1);
+
+  if((off = ndpi_lpm_compress(lpm, group)) < 0)
+    return(-1);
+
+  *entry = NDPI_LPM_CHUNK | off;
+  return(0);
+}
+
+/* ******************************************* */
+
+static int ndpi_lpm_compile(struct ndpi_lpm *lpm) {
+  struct ndpi_lpm_builder b = { NULL, 0, 0 };
+  u_int32_t i;
+  int rc = 0;
+
+  memset(lpm->tbl16, 0, sizeof(lpm->tbl16));
+  lpm->chunks_len = 0;
+
+  if(lpm->num_prefixes > 0)
+    qsort(lpm->prefixes, lpm->num_prefixes, sizeof(struct ndpi_lpm_prefix), ndpi_lpm_prefix_cmp);
+
+  for(i = 0; (rc == 0) && (i < lpm->num_prefixes); i++)
+    rc = ndpi_lpm_paint(lpm, &b, &lpm->prefixes[i]);
+
+  for(i = 0; (rc == 0) && (i < 65536); i++)
+    if(lpm->tbl16[i] & NDPI_LPM_CHUNK)
+      rc = ndpi_lpm_compress_group(lpm, &b, &lpm->tbl16[i]);
+
+  if(b.groups) ndpi_free(b.groups);
+
+  if(rc != 0) {
+    /* Better no IP-based detection than a broken table */
+    memset(lpm->tbl16, 0, sizeof(lpm->tbl16));
+    lpm->chunks_len = 0;
+  }
+
+  lpm->dirty = 0;
+  return(rc);
+}
+
+/* ******************************************* */
+
+static inline u_int32_t ndpi_lpm_chunk_get(const u_int32_t *chunk, u_int32_t i) {
+  u_int32_t w = i / 32, rank = ((const u_int8_t*)&chunk[NDPI_LPM_BITMAP_WORDS])[w];
+
+  rank += __builtin_popcount(chunk[w] & (0xFFFFFFFF >> (31 - (i % 32))));
+  return(chunk[NDPI_LPM_CHUNK_HEADER + rank - 1]);
+}
+
+/* ******************************************* */
+
+/* a is in network byte order, looked up with at most two chunks for IPv4 */
+static inline u_int32_t ndpi_lpm_match_ipv4(const struct ndpi_lpm *lpm, const u_int8_t *a, u_int32_t e) {
+  if(e & NDPI_LPM_CHUNK) {
+    e = ndpi_lpm_chunk_get(&lpm->chunks[e & ~NDPI_LPM_CHUNK], a[2]);
+
+    if(e & NDPI_LPM_CHUNK)
+      e = ndpi_lpm_chunk_get(&lpm->chunks[e & ~NDPI_LPM_CHUNK], a[3]);
+  }
+
+  return(e);
+}
+
+/* ******************************************* */
+
+static inline u_int32_t ndpi_lpm_match_ipv6(const struct ndpi_lpm *lpm, const u_int8_t *a, u_int32_t e) {
+  u_int32_t i;
+
+  for(i = 2; e & NDPI_LPM_CHUNK; i++)
+    e = ndpi_lpm_chunk_get(&lpm->chunks[e & ~NDPI_LPM_CHUNK], a[i]);
+
+  return(e);
+}
+
+/* ******************************************* */
+
+/* Addresses are in network byte order */
+static inline void ndpi_lpm_match_pair(const struct ndpi_lpm *lpm, const u_int8_t *a, const u_int8_t *b,
+				       u_int16_t *a_value, u_int16_t *b_value) {
+  u_int32_t ae, be;
+
+  /* Both first level entries are loaded before looking at any of them */
+  ae = lpm->tbl16[(a[0] << 8) | a[1]], be = lpm->tbl16[(b[0] << 8) | b[1]];
+
+  if(lpm->addr_len == 4)
+    *a_value = ndpi_lpm_match_ipv4(lpm, a, ae), *b_value = ndpi_lpm_match_ipv4(lpm, b, be);
+  else
+    *a_value = ndpi_lpm_match_ipv6(lpm, a, ae), *b_value = ndpi_lpm_match_ipv6(lpm, b, be);
+}
+
+/* ******************************************* */
+
+static inline u_int16_t ndpi_lpm_match(const struct ndpi_lpm *lpm, const u_int8_t *a) {
+  u_int32_t e = lpm->tbl16[(a[0] << 8) | a[1]];
+
+  return((lpm->addr_len == 4) ? ndpi_lpm_match_ipv4(lpm, a, e) : ndpi_lpm_match_ipv6(lpm, a, e));
+}
+
+/* ******************************************* */
+
+/*
+  Image of a compiled table (see ndpi_save_snapshot()): the header, tbl16,
+  the chunks and the networks, so that the table can be extended later
+*/
+struct ndpi_lpm_image {
+  u_int32_t chunks_len, num_prefixes;
+  u_int32_t addr_len, reserved;
+};
+
+/* Returns the image size, the image is written if not NULL */
+static size_t ndpi_lpm_save(struct ndpi_lpm *lpm, u_int8_t *image) {
+  struct ndpi_lpm_image hdr;
+  size_t len;
+
+  if(lpm->dirty)
+    ndpi_lpm_compile(lpm);
+
+  len = sizeof(hdr) + sizeof(lpm->tbl16) + lpm->chunks_len * sizeof(u_int32_t)
+    + lpm->num_prefixes * sizeof(struct ndpi_lpm_prefix);
+
+  if(image != NULL) {
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.chunks_len = lpm->chunks_len, hdr.num_prefixes = lpm->num_prefixes, hdr.addr_len = lpm->addr_len;
+
+    memcpy(image, &hdr, sizeof(hdr)), image += sizeof(hdr);
+    memcpy(image, lpm->tbl16, sizeof(lpm->tbl16)), image += sizeof(lpm->tbl16);
+    if(lpm->chunks_len)
+      memcpy(image, lpm->chunks, lpm->chunks_len * sizeof(u_int32_t)), image += lpm->chunks_len * sizeof(u_int32_t);
+    if(lpm->num_prefixes)
+      memcpy(image, lpm->prefixes, lpm->num_prefixes * sizeof(struct ndpi_lpm_prefix));
+  }
+
+  return(len);
+}
+
+/* ******************************************* */
+
+/*
+  Checks an entry of a table read from an image: chunks must be well
+  formed, not deeper than the address and looked at once at most
+*/
+static int ndpi_lpm_check_entry(const u_int32_t *chunks, u_int32_t chunks_len, u_int32_t e,
+				u_int32_t level, u_int8_t addr_len, u_int32_t *budget) {
+  const u_int32_t *chunk;
+  const u_int8_t *ranks;
+  u_int32_t off = e & ~NDPI_LPM_CHUNK, runs, i;
+
+  if(!(e & NDPI_LPM_CHUNK))
+    return((e <= 0xFFFF) ? 0 : -1);
+
+  if((level >= addr_len) || (*budget == 0)
+     || (chunks_len < NDPI_LPM_CHUNK_HEADER) || (off > chunks_len - NDPI_LPM_CHUNK_HEADER))
+    return(-1);
+
+  (*budget)--;
+  chunk = &chunks[off], ranks = (const u_int8_t*)&chunk[NDPI_LPM_BITMAP_WORDS];
+
+  for(i = 0, runs = 0; i < NDPI_LPM_BITMAP_WORDS; i++) {
+    if(ranks[i] != (runs & 0xFF))
+      return(-1);
+
+    runs += __builtin_popcount(chunk[i]);
+  }
+
+  if(!(chunk[0] & 1) || (runs > chunks_len - off - NDPI_LPM_CHUNK_HEADER))
+    return(-1);
+
+  for(i = 0; i < runs; i++)
+    if(ndpi_lpm_check_entry(chunks, chunks_len, chunk[NDPI_LPM_CHUNK_HEADER + i],
+			    level + 1, addr_len, budget) != 0)
+      return(-1);
+
+  return(0);
+}
+
+/* ******************************************* */
+
+/* Returns a table loaded from an image, NULL if the image is not valid */
+static struct ndpi_lpm* ndpi_lpm_load(const u_int8_t *image, size_t len, u_int8_t addr_len) {
+  struct ndpi_lpm_image hdr;
+  struct ndpi_lpm *lpm;
+  const u_int32_t *tbl16, *chunks;
+  const struct ndpi_lpm_prefix *prefixes;
+  u_int32_t i, budget;
+
+  if(len < sizeof(hdr) + sizeof(lpm->tbl16))
+    return(NULL);
+
+  memcpy(&hdr, image, sizeof(hdr));
+
+  if((hdr.addr_len != addr_len)
+     || (hdr.chunks_len > (len - sizeof(hdr) - sizeof(lpm->tbl16)) / sizeof(u_int32_t))
+     || (hdr.num_prefixes > (len - sizeof(hdr) - sizeof(lpm->tbl16)) / sizeof(struct ndpi_lpm_prefix))
+     || (len != sizeof(hdr) + sizeof(lpm->tbl16) + (size_t)hdr.chunks_len * sizeof(u_int32_t)
+	 + (size_t)hdr.num_prefixes * sizeof(struct ndpi_lpm_prefix)))
+    return(NULL);
+
+  tbl16 = (const u_int32_t*)&image[sizeof(hdr)], chunks = &tbl16[65536];
+  prefixes = (const struct ndpi_lpm_prefix*)&chunks[hdr.chunks_len];
+
+  for(i = 0; i < hdr.num_prefixes; i++)
+    if(prefixes[i].bits > addr_len * 8)
+      return(NULL);
+
+  for(i = 0, budget = hdr.chunks_len / NDPI_LPM_CHUNK_HEADER; i < 65536; i++)
+    if(ndpi_lpm_check_entry(chunks, hdr.chunks_len, tbl16[i], 2, addr_len, &budget) != 0)
+      return(NULL);
+
+  if((lpm = ndpi_lpm_init(addr_len)) == NULL)
+    return(NULL);
+
+  if((hdr.chunks_len && ((lpm->chunks = ndpi_malloc(hdr.chunks_len * sizeof(u_int32_t))) == NULL))
+     || (hdr.num_prefixes && ((lpm->prefixes = ndpi_malloc(hdr.num_prefixes * sizeof(struct ndpi_lpm_prefix))) == NULL))) {
+    ndpi_lpm_free(lpm);
+    return(NULL);
+  }
+
+  memcpy(lpm->tbl16, tbl16, sizeof(lpm->tbl16));
+  if(hdr.chunks_len)
+    memcpy(lpm->chunks, chunks, hdr.chunks_len * sizeof(u_int32_t));
+  if(hdr.num_prefixes)
+    memcpy(lpm->prefixes, prefixes, hdr.num_prefixes * sizeof(struct ndpi_lpm_prefix));
+
+  lpm->chunks_len = lpm->chunks_size = hdr.chunks_len;
+  lpm->num_prefixes = lpm->max_prefixes = hdr.num_prefixes;
+
+  for(i = 0; i < lpm->num_prefixes; i++)
+    lpm->prefixes[i].seq = i; /* sorted by the compilation */
+
+  return(lpm);
+}
+
+/* ******************************************* */
+
+u_int16_t ndpi_network_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, struct in_addr *pin /* network byte order */) {
+  return(ndpi_lpm_match(ndpi_struct->protocols_lpm, (const u_int8_t*)&pin->s_addr));
+}
+
+/* ******************************************* */
+
+void ndpi_network_ptree_match_pair(struct ndpi_detection_module_struct *ndpi_struct,
+				   struct in_addr *src, struct in_addr *dst,
+				   u_int16_t *src_protocol, u_int16_t *dst_protocol) {
+  ndpi_lpm_match_pair(ndpi_struct->protocols_lpm, (const u_int8_t*)&src->s_addr, (const u_int8_t*)&dst->s_addr,
+		      src_protocol, dst_protocol);
+}
+
+/* ******************************************* */
+
+u_int16_t ndpi_network6_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_in6_addr *pin) {
+  return(ndpi_lpm_match(ndpi_struct->protocols_lpm6, pin->u6_addr.u6_addr8));
+}
+
+/* ******************************************* */
+
+void ndpi_network6_ptree_match_pair(struct ndpi_detection_module_struct *ndpi_struct,
+				    struct ndpi_in6_addr *src, struct ndpi_in6_addr *dst,
+				    u_int16_t *src_protocol, u_int16_t *dst_protocol) {
+  ndpi_lpm_match_pair(ndpi_struct->protocols_lpm6, src->u6_addr.u6_addr8, dst->u6_addr.u6_addr8,
+		      src_protocol, dst_protocol);
+}
+
+/* ******************************************* */
+
+/* u_int16_t ndpi_host_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, u_int32_t host /\* network byte order *\/) { */
+/*   struct in_addr pin; */
+
+/*   pin.s_addr = host; */
+
+/*   return(ndpi_network_ptree_match(ndpi_struct, &pin)); */
+/* } */
+
+/* ******************************************* */
+
+#if 0
+static u_int8_t tor_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, struct in_addr *pin) {
+  return((ndpi_network_ptree_match(ndpi_struct, pin) == NDPI_PROTOCOL_TOR) ? 1 : 0);
+}
+#endif
+
+/* ******************************************* */
+
+u_int8_t ndpi_is_tor_flow(struct ndpi_detection_module_struct *ndpi_struct,
+			  struct ndpi_flow_struct *flow) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+
+  if(packet->tcp != NULL) {
+    if(packet->iph) {
+      if(flow->guessed_host_protocol_id == NDPI_PROTOCOL_TOR)
+	return(1);
+    }
+  }
+
+  return(0);
+}
+
+/* ******************************************* */
+
+static void ndpi_init_lpm_ipv4(struct ndpi_detection_module_struct *ndpi_str,
+			       struct ndpi_lpm *lpm, ndpi_network host_list[]) {
+  int i;
+
+  for(i=0; host_list[i].network != 0x0; i++) {
+    u_int32_t pin = htonl(host_list[i].network);
+
+    ndpi_lpm_add(lpm, (const u_int8_t*)&pin, host_list[i].cidr, host_list[i].value);
+  }
+}
+
+/* ******************************************* */
+
+static void ndpi_init_lpm_ipv6(struct ndpi_detection_module_struct *ndpi_str,
+			       struct ndpi_lpm *lpm, ndpi_network6 host_list[]) {
+  int i, j;
+
+  for(i=0; host_list[i].cidr != 0; i++) {
+    u_int8_t pin[16];
+
+    for(j=0; j<8; j++)
+      pin[2*j] = host_list[i].network[j] >> 8, pin[2*j+1] = host_list[i].network[j] & 0xFF;
+
+    ndpi_lpm_add(lpm, pin, host_list[i].cidr, host_list[i].value);
+  }
+}
+
+/* ******************************************* */
+
+/* value is <address>[/<bits>], IPv4 or IPv6 */
+static int ndpi_add_host_ip_subprotocol(struct ndpi_detection_module_struct *ndpi_struct,
+					char *value, int protocol_id) {
+
+  u_int8_t pin[16];
+  int is_ipv6 = (strchr(value, ':') != NULL);
+  int bits = is_ipv6 ? 128 : 32;
+  char *ptr = strrchr(value, '/');
+
+  if (ptr)
+    {
+      ptr[0] = '\0';
+      ptr++;
+      if (atoi(ptr)>=0 && atoi(ptr)<=bits)
+	bits = atoi(ptr);
+    }
+
+  if(inet_pton(is_ipv6 ? AF_INET6 : AF_INET, value, pin) != 1)
+    return -1;
+
+  return ndpi_lpm_add(is_ipv6 ? ndpi_struct->protocols_lpm6 : ndpi_struct->protocols_lpm,
+		      pin, bits, protocol_id);
+}
+
+#endif
+
+void set_ndpi_malloc(void* (*__ndpi_malloc)(size_t size)) { _ndpi_malloc = __ndpi_malloc; }
+void set_ndpi_flow_malloc(void* (*__ndpi_flow_malloc)(size_t size)) { _ndpi_flow_malloc = __ndpi_flow_malloc; }
+
+void set_ndpi_free(void  (*__ndpi_free)(void *ptr))       { _ndpi_free = __ndpi_free; }
+void set_ndpi_flow_free(void  (*__ndpi_flow_free)(void *ptr))       { _ndpi_flow_free = __ndpi_flow_free; }
+
+void ndpi_debug_printf(unsigned int proto, struct ndpi_detection_module_struct *ndpi_str, 
+		ndpi_log_level_t log_level, const char *file_name, const char *func_name, int line_number,
+		const char * format, ...)
+{
+#ifdef NDPI_ENABLE_DEBUG_MESSAGES
+  va_list args;
+#define MAX_STR_LEN 120
+  char str[MAX_STR_LEN];
+  if(ndpi_str != NULL && log_level > NDPI_LOG_ERROR  &&
+	proto > 0 && proto < NDPI_MAX_SUPPORTED_PROTOCOLS &&
+	!NDPI_ISSET(&ndpi_str->debug_bitmask,proto)) return;
+  va_start(args, format);
+  vsprintf(str, format, args);
+  va_end(args);
+
+  if (ndpi_str != NULL) {
+    printf("%s:%s:%-3u - [%s]: %s", 
+	    file_name, func_name, line_number, ndpi_get_proto_name(ndpi_str, proto), str);
+  } else {
+    printf("Proto: %u, %s", proto, str);
+  }
+#endif
+}
+
+void set_ndpi_debug_function(struct ndpi_detection_module_struct *ndpi_str, ndpi_debug_function_ptr ndpi_debug_printf) {
+#ifdef NDPI_ENABLE_DEBUG_MESSAGES
+  ndpi_str->ndpi_debug_printf = ndpi_debug_printf;
+#endif
+}
+
+/* ******************************************************************** */
+
+static void ndpi_set_core(struct ndpi_detection_module_struct *ndpi_str, struct ndpi_detection_core *core) {
+  ndpi_str->core = core;
+  ndpi_str->custom_category_labels = core->custom_category_labels;
+  ndpi_str->callback_buffer = core->callback_buffer;
+  ndpi_str->callback_buffer_tcp_no_payload = core->callback_buffer_tcp_no_payload;
+  ndpi_str->callback_buffer_tcp_payload = core->callback_buffer_tcp_payload;
+  ndpi_str->callback_buffer_udp = core->callback_buffer_udp;
+  ndpi_str->callback_buffer_non_tcp_udp = core->callback_buffer_non_tcp_udp;
+  ndpi_str->dispatch_plan = core->dispatch_plan;
+  ndpi_str->dissectors_excluded_by = core->dissectors_excluded_by;
+  ndpi_str->subprotocol_conf = core->subprotocol_conf;
+  ndpi_str->proto_defaults = core->proto_defaults;
+}
+
+/* ******************************************************************** */
+
+struct ndpi_detection_module_struct *ndpi_init_detection_module(void) {
+  struct ndpi_detection_module_struct *ndpi_str = ndpi_malloc(sizeof(struct ndpi_detection_module_struct));
+  struct ndpi_detection_core *core;
+  int i;
+  
+  if(ndpi_str == NULL) {
+#ifdef NDPI_ENABLE_DEBUG_MESSAGES
+    NDPI_LOG_ERR(ndpi_str, "ndpi_init_detection_module initial malloc failed for ndpi_str\n");
+#endif /* NDPI_ENABLE_DEBUG_MESSAGES */
+    return NULL;
+  }
+  memset(ndpi_str, 0, sizeof(struct ndpi_detection_module_struct));
+
+  if((core = ndpi_calloc(1, sizeof(struct ndpi_detection_core))) == NULL) {
+    ndpi_free(ndpi_str);
+    return NULL;
+  }
+  ndpi_set_core(ndpi_str, core);
+  ndpi_str->refcnt = 1;
+
+#ifdef NDPI_ENABLE_DEBUG_MESSAGES
+  set_ndpi_debug_function(ndpi_str, (ndpi_debug_function_ptr)ndpi_debug_printf);
+#endif /* NDPI_ENABLE_DEBUG_MESSAGES */
+
+  if(((ndpi_str->protocols_lpm = ndpi_lpm_init(4)) == NULL)
+     || ((ndpi_str->protocols_lpm6 = ndpi_lpm_init(16)) == NULL)
+     || ((ndpi_str->tcp_ports_index = ndpi_calloc(65536, sizeof(u_int16_t))) == NULL)
+     || ((ndpi_str->udp_ports_index = ndpi_calloc(65536, sizeof(u_int16_t))) == NULL)) {
+    ndpi_exit_detection_module(ndpi_str);
+    return NULL;
+  }
+  ndpi_init_lpm_ipv4(ndpi_str, ndpi_str->protocols_lpm, host_protocol_list);
+  ndpi_init_lpm_ipv6(ndpi_str, ndpi_str->protocols_lpm6, host_protocol_list_6);
+
+  NDPI_BITMASK_RESET(ndpi_str->detection_bitmask);
+#ifdef NDPI_ENABLE_DEBUG_MESSAGES
+  ndpi_str->user_data = NULL;
+#endif
+
+  ndpi_str->ticks_per_second = 1000; /* ndpi_str->ticks_per_second */
+  ndpi_str->tcp_max_retransmission_window_size = NDPI_DEFAULT_MAX_TCP_RETRANSMISSION_WINDOW_SIZE;
+  ndpi_str->directconnect_connection_ip_tick_timeout =
+    NDPI_DIRECTCONNECT_CONNECTION_IP_TICK_TIMEOUT * ndpi_str->ticks_per_second;
+
+  ndpi_str->rtsp_connection_timeout = NDPI_RTSP_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->tvants_connection_timeout = NDPI_TVANTS_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->irc_timeout = NDPI_IRC_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->gnutella_timeout = NDPI_GNUTELLA_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+
+  ndpi_str->battlefield_timeout = NDPI_BATTLEFIELD_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+
+  ndpi_str->thunder_timeout = NDPI_THUNDER_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->yahoo_detect_http_connections = NDPI_YAHOO_DETECT_HTTP_CONNECTIONS;
+
+  ndpi_str->yahoo_lan_video_timeout = NDPI_YAHOO_LAN_VIDEO_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->zattoo_connection_timeout = NDPI_ZATTOO_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->jabber_stun_timeout = NDPI_JABBER_STUN_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->jabber_file_transfer_timeout = NDPI_JABBER_FT_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->soulseek_connection_ip_tick_timeout = NDPI_SOULSEEK_CONNECTION_IP_TICK_TIMEOUT * ndpi_str->ticks_per_second;
+
+  ndpi_str->ndpi_num_supported_protocols = NDPI_MAX_SUPPORTED_PROTOCOLS;
+  ndpi_str->ndpi_num_custom_protocols = 0;
+
+  ndpi_str->host_automa.ac_automa = ac_automata_init(ac_match_handler);
+  ndpi_str->content_automa.ac_automa = ac_automata_init(ac_match_handler);
+  ndpi_str->bigrams_automa.ac_automa = ac_automata_init(ac_match_handler);
+  ndpi_str->impossible_bigrams_automa.ac_automa = ac_automata_init(ac_match_handler);
+
+  ndpi_init_protocol_defaults(ndpi_str);
+
+  for(i=0; i<NUM_CUSTOM_CATEGORIES; i++)
+    snprintf(ndpi_str->custom_category_labels[i],
+	     CUSTOM_CATEGORY_LABEL_LEN, "User custom category %u", i+1);
+
+  return ndpi_str;
+}
+
+/* *********************************************** */
+
+void ndpi_finalize_initialization(struct ndpi_detection_module_struct *ndpi_str) {
+  ndpi_automa_finalize(&ndpi_str->host_automa);
+  ndpi_automa_finalize(&ndpi_str->content_automa);
+  ndpi_automa_finalize(&ndpi_str->bigrams_automa);
+  ndpi_automa_finalize(&ndpi_str->impossible_bigrams_automa);
+
+  if(ndpi_str->protocols_lpm->dirty)
+    ndpi_lpm_compile(ndpi_str->protocols_lpm);
+  if(ndpi_str->protocols_lpm6->dirty)
+    ndpi_lpm_compile(ndpi_str->protocols_lpm6);
+}
+
+/* *********************************************** */
+
+/*
+  Snapshot of an initialized detection module
+
+  A snapshot holds what ndpi_init_detection_module(), the protocols file
+  and ndpi_finalize_initialization() compute: the custom protocols, the
+  default ports, the IP networks and the compiled string automata. It only
+  contains offsets: ndpi_load_snapshot() maps the file read-only and the
+  automata are used in place, so their pages are shared by all the modules
+  (and processes) that load the same file. A snapshot can only be loaded
+  by the nDPI revision that saved it.
+*/
+#define NDPI_SNAPSHOT_MAGIC       "nDPIsnap"
+#define NDPI_SNAPSHOT_VERSION     1
+#define NDPI_SNAPSHOT_BYTE_ORDER  0x01020304
+#define NDPI_SNAPSHOT_ALIGN(x)    (((x) + 7) & ~((size_t)7))
+
+enum {
+  NDPI_SNAPSHOT_CUSTOM_PROTOCOLS = 0,
+  NDPI_SNAPSHOT_TCP_PORTS,
+  NDPI_SNAPSHOT_UDP_PORTS,
+  NDPI_SNAPSHOT_LPM,
+  NDPI_SNAPSHOT_LPM6,
+  NDPI_SNAPSHOT_HOST_AUTOMA,
+  NDPI_SNAPSHOT_CONTENT_AUTOMA,
+  NDPI_SNAPSHOT_BIGRAMS_AUTOMA,
+  NDPI_SNAPSHOT_IMPOSSIBLE_BIGRAMS_AUTOMA,
+  NDPI_SNAPSHOT_NUM_SECTIONS
+};
+
+struct ndpi_snapshot_header {
+  char magic[8];
+  u_int32_t version, byte_order;
+  char revision[64]; /* ndpi_revision() */
+  u_int32_t num_protocols, num_custom_protocols;
+  u_int64_t len;
+  struct {
+    u_int64_t offset, len; /* offsets are 8 bytes aligned */
+  } section[NDPI_SNAPSHOT_NUM_SECTIONS];
+};
+
+/* Custom protocol record, followed by the name and padded to 4 bytes */
+struct ndpi_snapshot_protocol {
+  u_int16_t breed, name_len;
+  u_int32_t category;
+};
+
+#define NDPI_SNAPSHOT_MAX_NAME_LEN 512
+
+/* *********************************************** */
+
+static ndpi_automa* ndpi_snapshot_automa(struct ndpi_detection_module_struct *ndpi_str, int section) {
+  switch(section) {
+  case NDPI_SNAPSHOT_HOST_AUTOMA:               return(&ndpi_str->host_automa);
+  case NDPI_SNAPSHOT_CONTENT_AUTOMA:            return(&ndpi_str->content_automa);
+  case NDPI_SNAPSHOT_BIGRAMS_AUTOMA:            return(&ndpi_str->bigrams_automa);
+  case NDPI_SNAPSHOT_IMPOSSIBLE_BIGRAMS_AUTOMA: return(&ndpi_str->impossible_bigrams_automa);
+  }
+
+  return(NULL);
+}
+
+/* *********************************************** */
+
+/* Returns the section size, the section is written if image is not NULL */
+static size_t ndpi_snapshot_section(struct ndpi_detection_module_struct *ndpi_str,
+				    int section, u_int8_t *image, size_t len) {
+  struct ndpi_snapshot_protocol rec;
+  size_t off = 0;
+  u_int32_t i;
+
+  switch(section) {
+  case NDPI_SNAPSHOT_CUSTOM_PROTOCOLS:
+    for(i = NDPI_MAX_SUPPORTED_PROTOCOLS; i < ndpi_str->ndpi_num_supported_protocols; i++) {
+      const char *name = ndpi_str->proto_defaults[i].protoName ? ndpi_str->proto_defaults[i].protoName : "";
+
+      rec.name_len = strlen(name) < NDPI_SNAPSHOT_MAX_NAME_LEN ? strlen(name) : NDPI_SNAPSHOT_MAX_NAME_LEN - 1;
+      rec.breed = ndpi_str->proto_defaults[i].protoBreed;
+      rec.category = ndpi_str->proto_defaults[i].protoCategory;
+
+      if(image != NULL) {
+	memcpy(&image[off], &rec, sizeof(rec));
+	memcpy(&image[off + sizeof(rec)], name, rec.name_len);
+      }
+
+      off += (sizeof(rec) + rec.name_len + 3) & ~3;
+    }
+    return(off);
+
+  case NDPI_SNAPSHOT_TCP_PORTS:
+  case NDPI_SNAPSHOT_UDP_PORTS:
+    if(image != NULL)
+      memcpy(image, (section == NDPI_SNAPSHOT_TCP_PORTS) ? ndpi_str->tcp_ports_index : ndpi_str->udp_ports_index,
+	     65536 * sizeof(u_int16_t));
+    return(65536 * sizeof(u_int16_t));
+
+  case NDPI_SNAPSHOT_LPM:
+    return(ndpi_lpm_save(ndpi_str->protocols_lpm, image));
+
+  case NDPI_SNAPSHOT_LPM6:
+    return(ndpi_lpm_save(ndpi_str->protocols_lpm6, image));
+
+  default:
+    return(ac_automata_save((AC_AUTOMATA_t*)ndpi_snapshot_automa(ndpi_str, section)->ac_automa, image, len));
+  }
+}
+
+/* *********************************************** */
+
+int ndpi_save_snapshot(struct ndpi_detection_module_struct *ndpi_str, const char *path) {
+  struct ndpi_snapshot_header hdr;
+  u_int8_t *image;
+  size_t len, sec_len;
+  char tmp_path[PATH_MAX];
+  FILE *fd;
+  int i, rc = -1;
+
+  ndpi_finalize_initialization(ndpi_str);
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, NDPI_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+  hdr.version = NDPI_SNAPSHOT_VERSION, hdr.byte_order = NDPI_SNAPSHOT_BYTE_ORDER;
+  snprintf(hdr.revision, sizeof(hdr.revision), "%s", ndpi_revision());
+  hdr.num_protocols = NDPI_MAX_SUPPORTED_PROTOCOLS;
+  hdr.num_custom_protocols = ndpi_str->ndpi_num_supported_protocols - NDPI_MAX_SUPPORTED_PROTOCOLS;
+
+  for(i = 0, len = NDPI_SNAPSHOT_ALIGN(sizeof(hdr)); i < NDPI_SNAPSHOT_NUM_SECTIONS; i++) {
+    if(((sec_len = ndpi_snapshot_section(ndpi_str, i, NULL, 0)) == 0) && (i >= NDPI_SNAPSHOT_HOST_AUTOMA))
+      return(-1); /* The automata could not be compiled */
+
+    hdr.section[i].offset = len, hdr.section[i].len = sec_len;
+    len += NDPI_SNAPSHOT_ALIGN(sec_len);
+  }
+  hdr.len = len;
+
+  if((image = ndpi_calloc(1, len)) == NULL)
+    return(-1);
+
+  memcpy(image, &hdr, sizeof(hdr));
+  for(i = 0; i < NDPI_SNAPSHOT_NUM_SECTIONS; i++)
+    ndpi_snapshot_section(ndpi_str, i, &image[hdr.section[i].offset], hdr.section[i].len);
+
+  /* Written aside then renamed: a snapshot in use is never changed */
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+  if((fd = fopen(tmp_path, "wb")) != NULL) {
+    if(fwrite(image, 1, len, fd) == len)
+      rc = 0;
+
+    if((fclose(fd) != 0) || (rc != 0) || (rename(tmp_path, path) != 0)) {
+      NDPI_LOG_ERR(ndpi_str, "Unable to write snapshot %s [%s]\n", path, strerror(errno));
+      unlink(tmp_path);
+      rc = -1;
+    }
+  } else
+    NDPI_LOG_ERR(ndpi_str, "Unable to create snapshot %s [%s]\n", path, strerror(errno));
+
+  ndpi_free(image);
+  return(rc);
+}
+
+/* *********************************************** */
+
+/* Checks the custom protocols section, returns the number of protocols or -1 */
+static int ndpi_snapshot_check_protocols(const u_int8_t *image, size_t len) {
+  struct ndpi_snapshot_protocol rec;
+  size_t off;
+  int num;
+
+  for(off = 0, num = 0; off < len; num++) {
+    if(len - off < sizeof(rec))
+      return(-1);
+
+    memcpy(&rec, &image[off], sizeof(rec));
+
+    if((rec.name_len == 0) || (rec.name_len >= NDPI_SNAPSHOT_MAX_NAME_LEN)
+       || (rec.name_len > len - off - sizeof(rec))
+       || (rec.breed >= NUM_BREEDS) || (rec.category >= NDPI_PROTOCOL_NUM_CATEGORIES))
+      return(-1);
+
+    off += (sizeof(rec) + rec.name_len + 3) & ~3;
+  }
+
+  return(num);
+}
+
+/* *********************************************** */
+
+static int ndpi_apply_snapshot(struct ndpi_detection_module_struct *ndpi_str,
+			       const u_int8_t *image, size_t len) {
+  struct ndpi_snapshot_header hdr;
+  AC_AUTOMATA_t *automa[NDPI_SNAPSHOT_NUM_SECTIONS];
+  struct ndpi_lpm *lpm = NULL, *lpm6 = NULL;
+  const u_int8_t *sec[NDPI_SNAPSHOT_NUM_SECTIONS];
+  const u_int16_t *ports;
+  u_int16_t no_master[2] = { NDPI_PROTOCOL_NO_MASTER_PROTO, NDPI_PROTOCOL_NO_MASTER_PROTO };
+  ndpi_port_range ports_a[MAX_DEFAULT_PORTS], ports_b[MAX_DEFAULT_PORTS];
+  u_int32_t i, num_protocols;
+  size_t off;
+  int rc = -1;
 
-u_int16_t ndpi_network_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, struct in_addr *pin /* network byte order */) {
-  prefix_t prefix;
-  patricia_node_t *node;
+  if((ndpi_str->snapshot != NULL) || (ndpi_str->rules != NULL)
+     || (ndpi_str->ndpi_num_custom_protocols != 0) || (len < sizeof(hdr)))
+    return(-1);
 
-  /* Make sure all in network byte order otherwise compares wont work */
-  fill_prefix_v4(&prefix, pin, 32, ((patricia_tree_t*)ndpi_struct->protocols_ptree)->maxbits);
-  node = ndpi_patricia_search_best(ndpi_struct->protocols_ptree, &prefix);
+  memcpy(&hdr, image, sizeof(hdr));
 
-  return(node ? node->value.user_value : NDPI_PROTOCOL_UNKNOWN);
-}
+  if((memcmp(hdr.magic, NDPI_SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0)
+     || (hdr.version != NDPI_SNAPSHOT_VERSION) || (hdr.byte_order != NDPI_SNAPSHOT_BYTE_ORDER)
+     || (strncmp(hdr.revision, ndpi_revision(), sizeof(hdr.revision)) != 0)
+     || (hdr.num_protocols != NDPI_MAX_SUPPORTED_PROTOCOLS)
+     || (hdr.num_custom_protocols >= NDPI_MAX_NUM_CUSTOM_PROTOCOLS)
+     || (hdr.len != len)) {
+    NDPI_LOG_ERR(ndpi_str, "Snapshot not compatible with this nDPI release\n");
+    return(-1);
+  }
 
-/* ******************************************* */
+  for(i = 0; i < NDPI_SNAPSHOT_NUM_SECTIONS; i++) {
+    if((hdr.section[i].offset & 7) || (hdr.section[i].offset > len)
+       || (hdr.section[i].len > len - hdr.section[i].offset))
+      return(-1);
 
-/* u_int16_t ndpi_host_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, u_int32_t host /\* network byte order *\/) { */
-/*   struct in_addr pin; */
+    sec[i] = &image[hdr.section[i].offset];
+    automa[i] = NULL;
+  }
 
-/*   pin.s_addr = host; */
+  if((ndpi_snapshot_check_protocols(sec[NDPI_SNAPSHOT_CUSTOM_PROTOCOLS],
+				    hdr.section[NDPI_SNAPSHOT_CUSTOM_PROTOCOLS].len) != (int)hdr.num_custom_protocols)
+     || (hdr.section[NDPI_SNAPSHOT_TCP_PORTS].len != 65536 * sizeof(u_int16_t))
+     || (hdr.section[NDPI_SNAPSHOT_UDP_PORTS].len != 65536 * sizeof(u_int16_t)))
+    goto out;
 
-/*   return(ndpi_network_ptree_match(ndpi_struct, &pin)); */
-/* } */
+  num_protocols = NDPI_MAX_SUPPORTED_PROTOCOLS + hdr.num_custom_protocols;
 
-/* ******************************************* */
+  for(i = NDPI_SNAPSHOT_TCP_PORTS; i <= NDPI_SNAPSHOT_UDP_PORTS; i++) {
+    u_int32_t port;
 
-#if 0
-static u_int8_t tor_ptree_match(struct ndpi_detection_module_struct *ndpi_struct, struct in_addr *pin) {
-  return((ndpi_network_ptree_match(ndpi_struct, pin) == NDPI_PROTOCOL_TOR) ? 1 : 0);
-}
-#endif
+    for(port = 0, ports = (const u_int16_t*)sec[i]; port < 65536; port++)
+      if((ports[port] & NDPI_PORT_PROTO_MASK) > num_protocols)
+	goto out;
+  }
 
-/* ******************************************* */
+  if(((lpm = ndpi_lpm_load(sec[NDPI_SNAPSHOT_LPM], hdr.section[NDPI_SNAPSHOT_LPM].len, 4)) == NULL)
+     || ((lpm6 = ndpi_lpm_load(sec[NDPI_SNAPSHOT_LPM6], hdr.section[NDPI_SNAPSHOT_LPM6].len, 16)) == NULL))
+    goto out;
 
-u_int8_t ndpi_is_tor_flow(struct ndpi_detection_module_struct *ndpi_struct,
-			  struct ndpi_flow_struct *flow) {
-  struct ndpi_packet_struct *packet = &flow->packet;
+  for(i = NDPI_SNAPSHOT_HOST_AUTOMA; i < NDPI_SNAPSHOT_NUM_SECTIONS; i++)
+    if((automa[i] = ac_automata_load(sec[i], hdr.section[i].len, ac_match_handler)) == NULL)
+      goto out;
 
-  if(packet->tcp != NULL) {
-    if(packet->iph) {
-      if(flow->guessed_host_protocol_id == NDPI_PROTOCOL_TOR)
-	return(1);
-    }
+  /* Everything is valid: the module can be changed */
+  for(i = NDPI_SNAPSHOT_HOST_AUTOMA; i < NDPI_SNAPSHOT_NUM_SECTIONS; i++) {
+    ndpi_automa *a = ndpi_snapshot_automa(ndpi_str, i);
+
+    if(a->ac_automa != NULL)
+      ac_automata_release((AC_AUTOMATA_t*)a->ac_automa);
+
+    a->ac_automa = automa[i], a->ac_automa_finalized = 1, automa[i] = NULL;
   }
 
-  return(0);
-}
+  ndpi_lpm_free(ndpi_str->protocols_lpm), ndpi_str->protocols_lpm = lpm, lpm = NULL;
+  ndpi_lpm_free(ndpi_str->protocols_lpm6), ndpi_str->protocols_lpm6 = lpm6, lpm6 = NULL;
 
-/* ******************************************* */
+  for(i = 0, off = 0; i < hdr.num_custom_protocols; i++) {
+    struct ndpi_snapshot_protocol rec;
+    char name[NDPI_SNAPSHOT_MAX_NAME_LEN];
+
+    memcpy(&rec, &sec[NDPI_SNAPSHOT_CUSTOM_PROTOCOLS][off], sizeof(rec));
+    memcpy(name, &sec[NDPI_SNAPSHOT_CUSTOM_PROTOCOLS][off + sizeof(rec)], rec.name_len);
+    name[rec.name_len] = '\0';
+    off += (sizeof(rec) + rec.name_len + 3) & ~3;
+
+    /* As ndpi_handle_rule() does: the ports come with the ports index */
+    ndpi_set_proto_defaults(ndpi_str, rec.breed, ndpi_str->ndpi_num_supported_protocols,
+			    no_master, no_master, name, rec.category,
+			    ndpi_build_default_ports(ports_a, 0, 0, 0, 0, 0) /* TCP */,
+			    ndpi_build_default_ports(ports_b, 0, 0, 0, 0, 0) /* UDP */);
+    ndpi_str->ndpi_num_supported_protocols++, ndpi_str->ndpi_num_custom_protocols++;
+  }
+
+  memcpy(ndpi_str->tcp_ports_index, sec[NDPI_SNAPSHOT_TCP_PORTS], 65536 * sizeof(u_int16_t));
+  memcpy(ndpi_str->udp_ports_index, sec[NDPI_SNAPSHOT_UDP_PORTS], 65536 * sizeof(u_int16_t));
 
-static patricia_node_t* add_to_ptree(patricia_tree_t *tree, int family,
-				     void *addr, int bits) {
-  prefix_t prefix;
-  patricia_node_t *node;
+  rc = 0;
 
-  fill_prefix_v4(&prefix, (struct in_addr*)addr, bits, tree->maxbits);
+ out:
+  if(lpm)  ndpi_lpm_free(lpm);
+  if(lpm6) ndpi_lpm_free(lpm6);
 
-  node = ndpi_patricia_lookup(tree, &prefix);
+  for(i = 0; i < NDPI_SNAPSHOT_NUM_SECTIONS; i++)
+    if(automa[i] != NULL)
+      ac_automata_release(automa[i]);
 
-  return(node);
+  if(rc != 0)
+    NDPI_LOG_ERR(ndpi_str, "Invalid snapshot\n");
+
+  return(rc);
 }
-/* ******************************************* */
 
-static void ndpi_init_ptree_ipv4(struct ndpi_detection_module_struct *ndpi_str,
-				 void *ptree, ndpi_network host_list[]) {
-  int i;
+/* *********************************************** */
 
-  for(i=0; host_list[i].network != 0x0; i++) {
-    struct in_addr pin;
-    patricia_node_t *node;
+int ndpi_load_snapshot(struct ndpi_detection_module_struct *ndpi_str, const char *path) {
+  void *image;
+  size_t len;
+  int rc;
+#ifndef WIN32
+  struct stat st;
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return(-1);
+
+  if((fstat(fd, &st) != 0) || (st.st_size <= 0)
+     || ((image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)) {
+    close(fd);
+    return(-1);
+  }
+
+  close(fd);
+  len = st.st_size;
+
+  if((rc = ndpi_apply_snapshot(ndpi_str, (const u_int8_t*)image, len)) != 0)
+    munmap(image, len);
+#else
+  FILE *fd;
+  long size;
 
-    pin.s_addr = htonl(host_list[i].network);
-    if((node = add_to_ptree(ptree, AF_INET, &pin, host_list[i].cidr /* bits */)) != NULL)
-      node->value.user_value = host_list[i].value;
+  if((fd = fopen(path, "rb")) == NULL)
+    return(-1);
+
+  if((fseek(fd, 0, SEEK_END) != 0) || ((size = ftell(fd)) <= 0)
+     || (fseek(fd, 0, SEEK_SET) != 0) || ((image = ndpi_malloc(size)) == NULL)) {
+    fclose(fd);
+    return(-1);
   }
+
+  len = size;
+  rc = (fread(image, 1, len, fd) == len) ? ndpi_apply_snapshot(ndpi_str, (const u_int8_t*)image, len) : -1;
+  fclose(fd);
+
+  if(rc != 0)
+    ndpi_free(image);
+#endif
+
+  if(rc == 0)
+    ndpi_str->snapshot = image, ndpi_str->snapshot_len = len;
+
+  return(rc);
 }
 
-/* ******************************************* */
+/* *********************************************** */
 
-static int ndpi_add_host_ip_subprotocol(struct ndpi_detection_module_struct *ndpi_struct,
-					char *value, int protocol_id) {
+/*
+  Rules generations
+
+  The rules of a protocols file (host names, ports and IP networks) can be
+  replaced while packets are being processed. ndpi_build_rules() compiles
+  a protocols file into a new generation away from the packet path, and
+  ndpi_publish_rules() hands it over to a module. The thread processing
+  the packets of the module switches to it before its next packet, where
+  nothing uses the previous generation any more (quiescent point), or
+  when it calls ndpi_rules_quiescent() while it has no packets: the
+  previous generation is then retired, and freed by ndpi_reclaim_rules().
+  The packet path takes no lock, it only checks for a pending generation.
+
+  A generation can be published to several modules (e.g. one per thread):
+  it is freed when the last of them retires it. Protocols defined by the
+  rules keep their id across generations.
+
+  A generation also carries the protocol defaults including its custom
+  protocols: the core shared by the contexts is never written once they
+  run, a module reads the defaults of the generation it has switched to.
+*/
+struct ndpi_rules {
+  AC_AUTOMATA_t *host_automa;
+  u_int16_t *tcp_ports_index, *udp_ports_index;
+  struct ndpi_lpm *protocols_lpm, *protocols_lpm6;
+  u_int32_t num_protocols;                /* including the custom ones */
+  ndpi_proto_defaults_t *proto_defaults;  /* NULL if those of the module core */
+  int refcnt;                             /* modules using it + ndpi_build_rules() caller */
+  struct ndpi_rules *next;                /* retired generations */
+};
 
-  patricia_node_t *node;
-  struct in_addr pin;
-  int bits = 32;
-  char *ptr = strrchr(value, '/');
+/* *********************************************** */
 
-  if (ptr)
-    {
-      ptr[0] = '\0';
-      ptr++;
-      if (atoi(ptr)>=0 && atoi(ptr)<=32)
-	bits = atoi(ptr);
-    }
+static void ndpi_free_rules(struct ndpi_rules *rules) {
+  u_int32_t i;
 
-  inet_pton(AF_INET, value, &pin);
+  if(rules->host_automa)     ac_automata_release(rules->host_automa);
+  if(rules->tcp_ports_index) ndpi_free(rules->tcp_ports_index);
+  if(rules->udp_ports_index) ndpi_free(rules->udp_ports_index);
+  if(rules->protocols_lpm)   ndpi_lpm_free(rules->protocols_lpm);
+  if(rules->protocols_lpm6)  ndpi_lpm_free(rules->protocols_lpm6);
 
-  if((node = add_to_ptree(ndpi_struct->protocols_ptree, AF_INET, &pin, bits)) != NULL)
-    node->value.user_value = protocol_id;
+  if(rules->proto_defaults) {
+    /* The names of the built-in protocols belong to the module */
+    for(i = NDPI_MAX_SUPPORTED_PROTOCOLS; i < rules->num_protocols; i++)
+      if(rules->proto_defaults[i].protoName) ndpi_free(rules->proto_defaults[i].protoName);
 
-  return 0;
+    ndpi_free(rules->proto_defaults);
+  }
+
+  ndpi_free(rules);
 }
 
-#endif
+/* *********************************************** */
 
-void set_ndpi_malloc(void* (*__ndpi_malloc)(size_t size)) { _ndpi_malloc = __ndpi_malloc; }
-void set_ndpi_flow_malloc(void* (*__ndpi_flow_malloc)(size_t size)) { _ndpi_flow_malloc = __ndpi_flow_malloc; }
+/* The generation of a module that has never switched: the module rules */
+static struct ndpi_rules* ndpi_module_rules(struct ndpi_detection_module_struct *ndpi_str) {
+  struct ndpi_rules *rules = ndpi_calloc(1, sizeof(struct ndpi_rules));
 
-void set_ndpi_free(void  (*__ndpi_free)(void *ptr))       { _ndpi_free = __ndpi_free; }
-void set_ndpi_flow_free(void  (*__ndpi_flow_free)(void *ptr))       { _ndpi_flow_free = __ndpi_flow_free; }
+  if(rules) {
+    rules->host_automa = (AC_AUTOMATA_t*)ndpi_str->host_automa.ac_automa;
+    rules->tcp_ports_index = ndpi_str->tcp_ports_index, rules->udp_ports_index = ndpi_str->udp_ports_index;
+    rules->protocols_lpm = ndpi_str->protocols_lpm, rules->protocols_lpm6 = ndpi_str->protocols_lpm6;
+    rules->num_protocols = ndpi_str->ndpi_num_supported_protocols;
+    rules->refcnt = 1;
+  }
 
-void ndpi_debug_printf(unsigned int proto, struct ndpi_detection_module_struct *ndpi_str, 
-		ndpi_log_level_t log_level, const char *file_name, const char *func_name, int line_number,
-		const char * format, ...)
-{
-#ifdef NDPI_ENABLE_DEBUG_MESSAGES
-  va_list args;
-#define MAX_STR_LEN 120
-  char str[MAX_STR_LEN];
-  if(ndpi_str != NULL && log_level > NDPI_LOG_ERROR  &&
-	proto > 0 && proto < NDPI_MAX_SUPPORTED_PROTOCOLS &&
-	!NDPI_ISSET(&ndpi_str->debug_bitmask,proto)) return;
-  va_start(args, format);
-  vsprintf(str, format, args);
-  va_end(args);
+  return(rules);
+}
 
-  if (ndpi_str != NULL) {
-    printf("%s:%s:%-3u - [%s]: %s", 
-	    file_name, func_name, line_number, ndpi_get_proto_name(ndpi_str, proto), str);
+/* *********************************************** */
+
+struct ndpi_rules* ndpi_build_rules(struct ndpi_detection_module_struct *ndpi_str,
+				    const struct ndpi_rules *base, const char *path) {
+  struct ndpi_detection_module_struct *tmp;
+  struct ndpi_rules *rules;
+  u_int16_t no_master[2] = { NDPI_PROTOCOL_NO_MASTER_PROTO, NDPI_PROTOCOL_NO_MASTER_PROTO };
+  ndpi_port_range ports_a[MAX_DEFAULT_PORTS], ports_b[MAX_DEFAULT_PORTS];
+  const ndpi_proto_defaults_t *defaults;
+  u_int32_t i, num_protocols;
+
+  /*
+    The custom protocols are read where nothing changes them: the base
+    generation, else the core (the module itself is repointed by
+    ndpi_switch_rules() on the thread processing its packets)
+  */
+  if(base != NULL) {
+    if(base->proto_defaults == NULL)
+      return(NULL); /* Not built by ndpi_build_rules() */
+
+    defaults = base->proto_defaults, num_protocols = base->num_protocols;
   } else {
-    printf("Proto: %u, %s", proto, str);
+    defaults = ndpi_str->core->proto_defaults;
+
+    for(num_protocols = NDPI_MAX_SUPPORTED_PROTOCOLS;
+	(num_protocols < NDPI_MAX_SUPPORTED_PROTOCOLS+NDPI_MAX_NUM_CUSTOM_PROTOCOLS)
+	  && (defaults[num_protocols].protoName != NULL); num_protocols++)
+      ;
   }
-#endif
-}
 
-void set_ndpi_debug_function(struct ndpi_detection_module_struct *ndpi_str, ndpi_debug_function_ptr ndpi_debug_printf) {
-#ifdef NDPI_ENABLE_DEBUG_MESSAGES
-  ndpi_str->ndpi_debug_printf = ndpi_debug_printf;
-#endif
+  /* The rules are loaded in a scratch module holding those protocols */
+  if((tmp = ndpi_init_detection_module()) == NULL)
+    return(NULL);
+
+  for(i = NDPI_MAX_SUPPORTED_PROTOCOLS; i < num_protocols; i++) {
+    ndpi_set_proto_defaults(tmp, defaults[i].protoBreed, i, no_master, no_master,
+			    defaults[i].protoName, defaults[i].protoCategory,
+			    ndpi_build_default_ports(ports_a, 0, 0, 0, 0, 0) /* TCP */,
+			    ndpi_build_default_ports(ports_b, 0, 0, 0, 0, 0) /* UDP */);
+    tmp->ndpi_num_supported_protocols++, tmp->ndpi_num_custom_protocols++;
+  }
+
+  if((ndpi_load_protocols_file(tmp, (char*)path) != 0)
+     || ((rules = ndpi_module_rules(tmp)) == NULL)) {
+    ndpi_exit_detection_module(tmp);
+    return(NULL);
+  }
+
+  if((rules->proto_defaults = ndpi_calloc(NDPI_MAX_SUPPORTED_PROTOCOLS+NDPI_MAX_NUM_CUSTOM_PROTOCOLS,
+					   sizeof(ndpi_proto_defaults_t))) == NULL) {
+    ndpi_free(rules);
+    ndpi_exit_detection_module(tmp);
+    return(NULL);
+  }
+
+  /* The built-in protocols as set up in the core of ndpi_str (dissectors
+     included), the custom ones taken over from the scratch module */
+  memcpy(rules->proto_defaults, ndpi_str->core->proto_defaults,
+	 NDPI_MAX_SUPPORTED_PROTOCOLS * sizeof(ndpi_proto_defaults_t));
+
+  for(i = NDPI_MAX_SUPPORTED_PROTOCOLS; i < rules->num_protocols; i++) {
+    rules->proto_defaults[i] = tmp->core->proto_defaults[i];
+    tmp->core->proto_defaults[i].protoName = NULL;
+  }
+
+  /* Only what the rules change is compiled and kept */
+  ndpi_automa_finalize(&tmp->host_automa);
+  if(tmp->protocols_lpm->dirty)  ndpi_lpm_compile(tmp->protocols_lpm);
+  if(tmp->protocols_lpm6->dirty) ndpi_lpm_compile(tmp->protocols_lpm6);
+
+  tmp->host_automa.ac_automa = NULL;
+  tmp->tcp_ports_index = tmp->udp_ports_index = NULL;
+  tmp->protocols_lpm = tmp->protocols_lpm6 = NULL;
+  ndpi_exit_detection_module(tmp);
+
+  return(rules);
 }
 
-/* ******************************************************************** */
+/* *********************************************** */
 
-struct ndpi_detection_module_struct *ndpi_init_detection_module(void) {
-  struct ndpi_detection_module_struct *ndpi_str = ndpi_malloc(sizeof(struct ndpi_detection_module_struct));
-  int i;
-  
-  if(ndpi_str == NULL) {
-#ifdef NDPI_ENABLE_DEBUG_MESSAGES
-    NDPI_LOG_ERR(ndpi_str, "ndpi_init_detection_module initial malloc failed for ndpi_str\n");
-#endif /* NDPI_ENABLE_DEBUG_MESSAGES */
-    return NULL;
+int ndpi_publish_rules(struct ndpi_detection_module_struct *ndpi_str, struct ndpi_rules *rules) {
+  struct ndpi_rules *expected = NULL;
+  u_int32_t i;
+
+  if(rules->proto_defaults == NULL)
+    return(-1); /* Not built by ndpi_build_rules() */
+
+  if(__atomic_load_n(&ndpi_str->pending_rules, __ATOMIC_ACQUIRE) != NULL)
+    return(-2);
+
+  /* The protocols of the module must be the first ones of the generation */
+  if(rules->num_protocols < ndpi_str->ndpi_num_supported_protocols)
+    return(-1);
+
+  for(i = NDPI_MAX_SUPPORTED_PROTOCOLS; i < ndpi_str->ndpi_num_supported_protocols; i++)
+    if((ndpi_str->proto_defaults[i].protoName == NULL)
+       || (rules->proto_defaults[i].protoName == NULL)
+       || (strcmp(ndpi_str->proto_defaults[i].protoName, rules->proto_defaults[i].protoName) != 0))
+      return(-1);
+
+  if((ndpi_str->rules == NULL) && ((ndpi_str->rules = ndpi_module_rules(ndpi_str)) == NULL))
+    return(-1);
+
+  __atomic_add_fetch(&rules->refcnt, 1, __ATOMIC_RELAXED);
+
+  if(!__atomic_compare_exchange_n(&ndpi_str->pending_rules, &expected, rules,
+				  0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    __atomic_sub_fetch(&rules->refcnt, 1, __ATOMIC_RELAXED);
+    return(-2);
   }
-  memset(ndpi_str, 0, sizeof(struct ndpi_detection_module_struct));
 
-#ifdef NDPI_ENABLE_DEBUG_MESSAGES
-  set_ndpi_debug_function(ndpi_str, (ndpi_debug_function_ptr)ndpi_debug_printf);
-#endif /* NDPI_ENABLE_DEBUG_MESSAGES */
+  return(0);
+}
 
-  if((ndpi_str->protocols_ptree = ndpi_New_Patricia(32 /* IPv4 */)) != NULL)
-    ndpi_init_ptree_ipv4(ndpi_str, ndpi_str->protocols_ptree, host_protocol_list);
+/* *********************************************** */
 
-  NDPI_BITMASK_RESET(ndpi_str->detection_bitmask);
-#ifdef NDPI_ENABLE_DEBUG_MESSAGES
-  ndpi_str->user_data = NULL;
-#endif
+/* Called by the thread processing the packets, before a packet */
+static void ndpi_switch_rules(struct ndpi_detection_module_struct *ndpi_str) {
+  struct ndpi_rules *rules = __atomic_load_n(&ndpi_str->pending_rules, __ATOMIC_ACQUIRE);
+  struct ndpi_rules *old = ndpi_str->rules;
 
-  ndpi_str->ticks_per_second = 1000; /* ndpi_str->ticks_per_second */
-  ndpi_str->tcp_max_retransmission_window_size = NDPI_DEFAULT_MAX_TCP_RETRANSMISSION_WINDOW_SIZE;
-  ndpi_str->directconnect_connection_ip_tick_timeout =
-    NDPI_DIRECTCONNECT_CONNECTION_IP_TICK_TIMEOUT * ndpi_str->ticks_per_second;
+  if(rules == NULL)
+    return;
 
-  ndpi_str->rtsp_connection_timeout = NDPI_RTSP_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
-  ndpi_str->tvants_connection_timeout = NDPI_TVANTS_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
-  ndpi_str->irc_timeout = NDPI_IRC_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
-  ndpi_str->gnutella_timeout = NDPI_GNUTELLA_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+  ndpi_str->host_automa.ac_automa = rules->host_automa;
+  ndpi_str->tcp_ports_index = rules->tcp_ports_index, ndpi_str->udp_ports_index = rules->udp_ports_index;
+  ndpi_str->protocols_lpm = rules->protocols_lpm, ndpi_str->protocols_lpm6 = rules->protocols_lpm6;
+  ndpi_str->proto_defaults = rules->proto_defaults;
 
-  ndpi_str->battlefield_timeout = NDPI_BATTLEFIELD_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
+  if(rules->num_protocols > ndpi_str->ndpi_num_supported_protocols) {
+    ndpi_str->ndpi_num_custom_protocols += rules->num_protocols - ndpi_str->ndpi_num_supported_protocols;
+    ndpi_str->ndpi_num_supported_protocols = rules->num_protocols;
+  }
 
-  ndpi_str->thunder_timeout = NDPI_THUNDER_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
-  ndpi_str->yahoo_detect_http_connections = NDPI_YAHOO_DETECT_HTTP_CONNECTIONS;
+  ndpi_str->rules = rules;
 
-  ndpi_str->yahoo_lan_video_timeout = NDPI_YAHOO_LAN_VIDEO_TIMEOUT * ndpi_str->ticks_per_second;
-  ndpi_str->zattoo_connection_timeout = NDPI_ZATTOO_CONNECTION_TIMEOUT * ndpi_str->ticks_per_second;
-  ndpi_str->jabber_stun_timeout = NDPI_JABBER_STUN_TIMEOUT * ndpi_str->ticks_per_second;
-  ndpi_str->jabber_file_transfer_timeout = NDPI_JABBER_FT_TIMEOUT * ndpi_str->ticks_per_second;
-  ndpi_str->soulseek_connection_ip_tick_timeout = NDPI_SOULSEEK_CONNECTION_IP_TICK_TIMEOUT * ndpi_str->ticks_per_second;
+  /* ndpi_publish_rules() sees the switched module once pending_rules is NULL */
+  __atomic_store_n(&ndpi_str->pending_rules, NULL, __ATOMIC_RELEASE);
 
-  ndpi_str->ndpi_num_supported_protocols = NDPI_MAX_SUPPORTED_PROTOCOLS;
-  ndpi_str->ndpi_num_custom_protocols = 0;
+  /* Not freed here: that is the job of ndpi_reclaim_rules() */
+  if(__atomic_sub_fetch(&old->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+    do {
+      old->next = __atomic_load_n(&ndpi_str->retired_rules, __ATOMIC_RELAXED);
+    } while(!__atomic_compare_exchange_n(&ndpi_str->retired_rules, &old->next, old,
+					 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  }
+}
 
-  ndpi_str->host_automa.ac_automa = ac_automata_init(ac_match_handler);
-  ndpi_str->content_automa.ac_automa = ac_automata_init(ac_match_handler);
-  ndpi_str->bigrams_automa.ac_automa = ac_automata_init(ac_match_handler);
-  ndpi_str->impossible_bigrams_automa.ac_automa = ac_automata_init(ac_match_handler);
+/* *********************************************** */
 
-  ndpi_init_protocol_defaults(ndpi_str);
+void ndpi_rules_quiescent(struct ndpi_detection_module_struct *ndpi_str) {
+  if(__atomic_load_n(&ndpi_str->pending_rules, __ATOMIC_RELAXED) != NULL)
+    ndpi_switch_rules(ndpi_str);
+}
 
-  for(i=0; i<NUM_CUSTOM_CATEGORIES; i++)
-    snprintf(ndpi_str->custom_category_labels[i],
-	     CUSTOM_CATEGORY_LABEL_LEN, "User custom category %u", i+1);
+/* *********************************************** */
 
-  return ndpi_str;
+void ndpi_release_rules(struct ndpi_rules *rules) {
+  if((rules != NULL) && (__atomic_sub_fetch(&rules->refcnt, 1, __ATOMIC_ACQ_REL) == 0))
+    ndpi_free_rules(rules);
+}
+
+/* *********************************************** */
+
+void ndpi_reclaim_rules(struct ndpi_detection_module_struct *ndpi_str) {
+  struct ndpi_rules *rules = __atomic_exchange_n(&ndpi_str->retired_rules, NULL, __ATOMIC_ACQUIRE), *next;
+
+  for(; rules != NULL; rules = next) {
+    next = rules->next;
+    ndpi_free_rules(rules);
+  }
 }
 
 /* *********************************************** */
@@ -1989,7 +3634,6 @@ void ndpi_finalize_automa(void *_automa) { ac_automata_finalize((AC_AUTOMATA_t*)
 
 int ndpi_match_string(void *_automa, char *string_to_match) {
   int matching_protocol_id = NDPI_PROTOCOL_UNKNOWN;
-  AC_TEXT_t ac_input_text;
   AC_AUTOMATA_t *automa = (AC_AUTOMATA_t*)_automa;
 
   if((automa == NULL)
@@ -1997,9 +3641,7 @@ int ndpi_match_string(void *_automa, char *string_to_match) {
      || (string_to_match[0] == '\0'))
     return(-2);
 
-  ac_input_text.astring = string_to_match, ac_input_text.length = strlen(string_to_match);
-  ac_automata_search(automa, &ac_input_text, (void*)&matching_protocol_id);
-  ac_automata_reset(automa);
+  ndpi_automa_search(automa, string_to_match, strlen(string_to_match), (void*)&matching_protocol_id);
 
   return(matching_protocol_id > 0 ? 0 : -1);
 }
@@ -2007,7 +3649,6 @@ int ndpi_match_string(void *_automa, char *string_to_match) {
 /* ****************************************************** */
 
 int ndpi_match_string_id(void *_automa, char *string_to_match, unsigned long *id) {
-  AC_TEXT_t ac_input_text;
   AC_AUTOMATA_t *automa = (AC_AUTOMATA_t*)_automa;
 
   *id = -1;
@@ -2016,55 +3657,149 @@ int ndpi_match_string_id(void *_automa, char *string_to_match, unsigned long *id
      || (string_to_match[0] == '\0'))
     return(-2);
 
-  ac_input_text.astring = string_to_match, ac_input_text.length = strlen(string_to_match);
-  ac_automata_search(automa, &ac_input_text, (void*)id);
-  ac_automata_reset(automa);
+  ndpi_automa_search(automa, string_to_match, strlen(string_to_match), (void*)id);
 
   return(*id != -1 ? 0 : -1);
 }
 
 /* *********************************************** */
 
-static void free_ptree_data(void *data) { ; }
+/* The module and its core, once the module and its contexts have exited */
+static void ndpi_free_detection_module(struct ndpi_detection_module_struct *ndpi_struct) {
+  int i;
+
+  for(i=0; i<NDPI_MAX_SUPPORTED_PROTOCOLS+NDPI_MAX_NUM_CUSTOM_PROTOCOLS; i++) {
+    if(ndpi_struct->core->proto_defaults[i].protoName)
+      ndpi_free(ndpi_struct->core->proto_defaults[i].protoName);
+  }
+
+  if(ndpi_struct->protocols_lpm)
+    ndpi_lpm_free(ndpi_struct->protocols_lpm);
+  if(ndpi_struct->protocols_lpm6)
+    ndpi_lpm_free(ndpi_struct->protocols_lpm6);
 
-/* ****************************************************** */
+  if(ndpi_struct->udp_ports_index != NULL)
+    ndpi_free(ndpi_struct->udp_ports_index);
+  if(ndpi_struct->tcp_ports_index != NULL)
+    ndpi_free(ndpi_struct->tcp_ports_index);
+
+  if(ndpi_struct->host_automa.ac_automa != NULL)
+    ac_automata_release((AC_AUTOMATA_t*)ndpi_struct->host_automa.ac_automa);
+
+  if(ndpi_struct->content_automa.ac_automa != NULL)
+    ac_automata_release((AC_AUTOMATA_t*)ndpi_struct->content_automa.ac_automa);
+
+  if(ndpi_struct->bigrams_automa.ac_automa != NULL)
+    ac_automata_release((AC_AUTOMATA_t*)ndpi_struct->bigrams_automa.ac_automa);
+
+  if(ndpi_struct->impossible_bigrams_automa.ac_automa != NULL)
+    ac_automata_release((AC_AUTOMATA_t*)ndpi_struct->impossible_bigrams_automa.ac_automa);
+
+  if(ndpi_struct->snapshot != NULL) {
+#ifndef WIN32
+    munmap(ndpi_struct->snapshot, ndpi_struct->snapshot_len);
+#else
+    ndpi_free(ndpi_struct->snapshot);
+#endif
+  }
+
+  ndpi_free(ndpi_struct->core);
+  ndpi_free(ndpi_struct);
+}
+
+/* *********************************************** */
 
 void ndpi_exit_detection_module(struct ndpi_detection_module_struct *ndpi_struct) {
   if(ndpi_struct != NULL) {
-    int i;
-
-    for(i=0; i<(int)ndpi_struct->ndpi_num_supported_protocols; i++) {
-      if(ndpi_struct->proto_defaults[i].protoName)
-	ndpi_free(ndpi_struct->proto_defaults[i].protoName);
-    }
+    struct ndpi_detection_module_struct *owner = ndpi_struct->parent ? ndpi_struct->parent : ndpi_struct;
 
 #ifdef NDPI_PROTOCOL_TINC
-    if(ndpi_struct->tinc_cache)
+    if(ndpi_struct->tinc_cache) {
       cache_free(ndpi_struct->tinc_cache);
+      ndpi_struct->tinc_cache = NULL;
+    }
 #endif
 
-    if(ndpi_struct->protocols_ptree)
-      ndpi_Destroy_Patricia((patricia_tree_t*)ndpi_struct->protocols_ptree, free_ptree_data);
+    /* The rules then belong to their generation */
+    ndpi_reclaim_rules(ndpi_struct);
+    ndpi_release_rules(ndpi_struct->pending_rules);
+    ndpi_struct->pending_rules = NULL;
+    if(ndpi_struct->rules != NULL) {
+      ndpi_release_rules(ndpi_struct->rules);
+      ndpi_struct->rules = NULL;
+      ndpi_struct->host_automa.ac_automa = NULL;
+      ndpi_struct->tcp_ports_index = ndpi_struct->udp_ports_index = NULL;
+      ndpi_struct->protocols_lpm = ndpi_struct->protocols_lpm6 = NULL;
+      ndpi_struct->proto_defaults = ndpi_struct->core->proto_defaults;
+    }
+
+    if(ndpi_struct->parent != NULL) {
+      /* A context: the rest belongs to its module, but for a replicated core
+	 (its protocol names are those of the module) */
+      if(ndpi_struct->core != owner->core)
+	ndpi_free(ndpi_struct->core);
+
+      ndpi_free(ndpi_struct);
+    }
+
+    if(__atomic_sub_fetch(&owner->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+      ndpi_free_detection_module(owner);
+  }
+}
+
+/* *********************************************** */
+
+struct ndpi_detection_module_struct* ndpi_init_detection_context(struct ndpi_detection_module_struct *ndpi_str,
+								 u_int8_t replicate_core) {
+  struct ndpi_detection_module_struct *ctx;
+  struct ndpi_detection_core *core = NULL;
+
+  /* Contexts are created from the module owning the core */
+  if(ndpi_str->parent != NULL)
+    ndpi_str = ndpi_str->parent;
+
+  /* The context shares the rules in use: the module keeps them in a generation */
+  if((ndpi_str->rules == NULL) && ((ndpi_str->rules = ndpi_module_rules(ndpi_str)) == NULL))
+    return(NULL);
 
-    if (ndpi_struct->udpRoot != NULL)
-      ndpi_tdestroy(ndpi_struct->udpRoot, ndpi_free);
-    if (ndpi_struct->tcpRoot != NULL)
-      ndpi_tdestroy(ndpi_struct->tcpRoot, ndpi_free);
+  if((ctx = ndpi_malloc(sizeof(struct ndpi_detection_module_struct))) == NULL)
+    return(NULL);
 
-    if(ndpi_struct->host_automa.ac_automa != NULL)
-      ac_automata_release((AC_AUTOMATA_t*)ndpi_struct->host_automa.ac_automa);
+  /* Allocated (and first touched) by the caller: local to its NUMA node */
+  if(replicate_core) {
+    if((core = ndpi_malloc(sizeof(struct ndpi_detection_core))) == NULL) {
+      ndpi_free(ctx);
+      return(NULL);
+    }
 
-    if(ndpi_struct->content_automa.ac_automa != NULL)
-      ac_automata_release((AC_AUTOMATA_t*)ndpi_struct->content_automa.ac_automa);
+    memcpy(core, ndpi_str->core, sizeof(struct ndpi_detection_core));
+  }
 
-    if(ndpi_struct->bigrams_automa.ac_automa != NULL)
-      ac_automata_release((AC_AUTOMATA_t*)ndpi_struct->bigrams_automa.ac_automa);
+  /* Same configuration, own packet processing state */
+  memcpy(ctx, ndpi_str, sizeof(struct ndpi_detection_module_struct));
+  ctx->parent = ndpi_str, ctx->refcnt = 0;
+  if(core) ndpi_set_core(ctx, core);
+  if(ctx->rules->proto_defaults) ctx->proto_defaults = ctx->rules->proto_defaults;
+  ctx->pending_rules = ctx->retired_rules = NULL;
+  ctx->snapshot = NULL, ctx->snapshot_len = 0;
+#ifdef NDPI_PROTOCOL_BITTORRENT
+  ctx->bt_ht = NULL;
+#ifdef NDPI_DETECTION_SUPPORT_IPV6
+  ctx->bt6_ht = NULL;
+#endif
+#ifdef BT_ANNOUNCE
+  ctx->bt_ann = NULL, ctx->bt_ann_len = 0;
+#endif
+#endif
+#ifdef NDPI_PROTOCOL_TINC
+  ctx->tinc_cache = NULL;
+#endif
+  memset(&ctx->packet_lines, 0, sizeof(ctx->packet_lines));
 
-    if(ndpi_struct->impossible_bigrams_automa.ac_automa != NULL)
-      ac_automata_release((AC_AUTOMATA_t*)ndpi_struct->impossible_bigrams_automa.ac_automa);
+  __atomic_add_fetch(&ctx->rules->refcnt, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&ndpi_str->refcnt, 1, __ATOMIC_RELAXED);
 
-    ndpi_free(ndpi_struct);
-  }
+  return(ctx);
 }
 
 /* ****************************************************** */
@@ -2086,31 +3821,19 @@ int ndpi_get_protocol_id_master_proto(struct ndpi_detection_module_struct *ndpi_
 
 /* ****************************************************** */
 
-static ndpi_default_ports_tree_node_t* ndpi_get_guessed_protocol_id(struct ndpi_detection_module_struct *ndpi_struct,
-								    u_int8_t proto, u_int16_t sport, u_int16_t dport) {
-  const void *ret;
-  ndpi_default_ports_tree_node_t node;
+static u_int16_t ndpi_get_guessed_protocol_id(struct ndpi_detection_module_struct *ndpi_struct,
+					       u_int8_t proto, u_int16_t sport, u_int16_t dport) {
+  const u_int16_t *ports_index = (proto == IPPROTO_TCP) ? ndpi_struct->tcp_ports_index : ndpi_struct->udp_ports_index;
 
   if(sport && dport) {
-    int low  = ndpi_min(sport, dport);
-    int high = ndpi_max(sport, dport);
-
-    node.default_port = low; /* Check server port first */
-    ret = ndpi_tfind(&node,
-		     (proto == IPPROTO_TCP) ? (void*)&ndpi_struct->tcpRoot : (void*)&ndpi_struct->udpRoot,
-		     ndpi_default_ports_tree_node_t_cmp);
-
-    if(ret == NULL) {
-      node.default_port = high;
-      ret = ndpi_tfind(&node,
-		       (proto == IPPROTO_TCP) ? (void*)&ndpi_struct->tcpRoot : (void*)&ndpi_struct->udpRoot,
-		       ndpi_default_ports_tree_node_t_cmp);
-    }
+    u_int16_t low  = ndpi_min(sport, dport);
+    u_int16_t high = ndpi_max(sport, dport);
 
-    if(ret) return(*(ndpi_default_ports_tree_node_t**)ret);
+    /* Check server port first */
+    return(ports_index[low] ? ports_index[low] : ports_index[high]);
   }
 
-  return(NULL);
+  return(0);
 }
 
 /* ****************************************************** */
@@ -2121,11 +3844,11 @@ u_int16_t ndpi_guess_protocol_id(struct ndpi_detection_module_struct *ndpi_struc
 
   *user_defined_proto = 0; /* Default */
   if(sport && dport) {
-    ndpi_default_ports_tree_node_t *found = ndpi_get_guessed_protocol_id(ndpi_struct, proto, sport, dport);
+    u_int16_t found = ndpi_get_guessed_protocol_id(ndpi_struct, proto, sport, dport);
 
-    if(found != NULL) {
-      *user_defined_proto = found->customUserProto;
-      return(found->proto->protoId);
+    if(found != 0) {
+      *user_defined_proto = (found & NDPI_PORT_CUSTOM_USER_PROTO) ? 1 : 0;
+      return(ndpi_struct->proto_defaults[(found & NDPI_PORT_PROTO_MASK) - 1].protoId);
     }
   } else {
     /* No TCP/UDP */
@@ -2198,6 +3921,11 @@ int ndpi_handle_rule(struct ndpi_detection_module_struct *ndpi_mod, char* rule,
   ndpi_proto_defaults_t *def;
   int subprotocol_id, i;
 
+  if(ndpi_mod->rules != NULL) {
+    NDPI_LOG_ERR(ndpi_mod, "Rules are read-only once published: skipping rule '%s'\n", rule);
+    return(-1);
+  }
+
   at = strrchr(rule, '@');
   if(at == NULL) {
     NDPI_LOG_ERR(ndpi_mod, "Invalid rule '%s'\n", rule);
@@ -2247,7 +3975,7 @@ int ndpi_handle_rule(struct ndpi_detection_module_struct *ndpi_mod, char* rule,
 			      ndpi_mod->ndpi_num_supported_protocols,
 			      no_master,
 			      no_master,
-			      ndpi_strdup(proto),
+			      proto,
 			      NDPI_PROTOCOL_CATEGORY_UNSPECIFIED, /* TODO add protocol category support in rules */
 			      ndpi_build_default_ports(ports_a, 0, 0, 0, 0, 0) /* TCP */,
 			      ndpi_build_default_ports(ports_b, 0, 0, 0, 0, 0) /* UDP */);
@@ -2279,9 +4007,9 @@ int ndpi_handle_rule(struct ndpi_detection_module_struct *ndpi_mod, char* rule,
       if(sscanf(value, "%u-%u", (u_int32_t *)&range.port_low, (u_int32_t *)&range.port_high) != 2)
 	range.port_low = range.port_high = atoi(&elem[4]);
       if(do_add)
-	addDefaultPort(ndpi_mod, &range, def, 1 /* Custom user proto */, is_tcp ? &ndpi_mod->tcpRoot : &ndpi_mod->udpRoot, __FUNCTION__,__LINE__);
+	addDefaultPort(ndpi_mod, &range, def, 1 /* Custom user proto */, is_tcp ? ndpi_mod->tcp_ports_index : ndpi_mod->udp_ports_index, __FUNCTION__,__LINE__);
       else
-	removeDefaultPort(&range, def, is_tcp ? &ndpi_mod->tcpRoot : &ndpi_mod->udpRoot);
+	removeDefaultPort(ndpi_mod, &range, def, is_tcp ? ndpi_mod->tcp_ports_index : ndpi_mod->udp_ports_index);
     } else if(is_ip) {
 #ifdef NDPI_PROTOCOL_TOR
       ndpi_add_host_ip_subprotocol(ndpi_mod, value, subprotocol_id);
@@ -2394,6 +4122,71 @@ void ndpi_set_bitmask_protocol_detection(char * label,
 
 /* ******************************************************************** */
 
+/*
+  Compile the callback_buffer into dense per-L4/per-class index sets so that
+  packet dispatch does not need to evaluate the selection and detection
+  bitmasks of every registered dissector. The membership rules are the same
+  used to build the callback_buffer_tcp_payload/udp/... copies.
+*/
+static void ndpi_build_dispatch_plans(struct ndpi_detection_module_struct *ndpi_struct) {
+  u_int32_t a, l4, c;
+
+  memset(ndpi_struct->dispatch_plan, 0, sizeof(ndpi_struct->core->dispatch_plan));
+  memset(ndpi_struct->dissectors_excluded_by, 0, sizeof(ndpi_struct->core->dissectors_excluded_by));
+
+  for(a = 0; a < ndpi_struct->callback_buffer_size; a++) {
+    struct ndpi_call_function_struct *cb = &ndpi_struct->callback_buffer[a];
+    NDPI_SELECTION_BITMASK_PROTOCOL_SIZE sel = cb->ndpi_selection_bitmask;
+    u_int8_t in_l4[NDPI_DISPATCH_NUM_L4];
+    u_int32_t p;
+
+    for(p = 0; p < NDPI_NUM_BITS; p++)
+      if(NDPI_ISSET(&cb->excluded_protocol_bitmask, p))
+	NDPI_SET(&ndpi_struct->dissectors_excluded_by[p], a);
+
+    /* Plans are compiled for unknown flows only: other states use the slow path */
+    if((cb->func == NULL) || (NDPI_COMPARE_PROTOCOL_TO_BITMASK(cb->detection_bitmask, NDPI_PROTOCOL_UNKNOWN) == 0))
+      continue;
+
+    in_l4[NDPI_DISPATCH_TCP_PAYLOAD] = (sel & (NDPI_SELECTION_BITMASK_PROTOCOL_INT_TCP |
+					       NDPI_SELECTION_BITMASK_PROTOCOL_INT_TCP_OR_UDP |
+					       NDPI_SELECTION_BITMASK_PROTOCOL_COMPLETE_TRAFFIC)) != 0;
+    in_l4[NDPI_DISPATCH_TCP_NO_PAYLOAD] = in_l4[NDPI_DISPATCH_TCP_PAYLOAD]
+      && ((sel & NDPI_SELECTION_BITMASK_PROTOCOL_HAS_PAYLOAD) == 0);
+    in_l4[NDPI_DISPATCH_UDP] = (sel & (NDPI_SELECTION_BITMASK_PROTOCOL_INT_UDP |
+				       NDPI_SELECTION_BITMASK_PROTOCOL_INT_TCP_OR_UDP |
+				       NDPI_SELECTION_BITMASK_PROTOCOL_COMPLETE_TRAFFIC)) != 0;
+    in_l4[NDPI_DISPATCH_NON_TCP_UDP] = ((sel & (NDPI_SELECTION_BITMASK_PROTOCOL_INT_TCP |
+						NDPI_SELECTION_BITMASK_PROTOCOL_INT_UDP |
+						NDPI_SELECTION_BITMASK_PROTOCOL_INT_TCP_OR_UDP)) == 0)
+      || ((sel & NDPI_SELECTION_BITMASK_PROTOCOL_COMPLETE_TRAFFIC) != 0);
+
+    for(l4 = 0; l4 < NDPI_DISPATCH_NUM_L4; l4++) {
+      if(!in_l4[l4]) continue;
+
+      for(c = 0; c < NDPI_DISPATCH_NUM_CLASSES; c++) {
+	/* Rebuild the packet selection bitmask that ndpi_detection_process_packet() computes for this class */
+	NDPI_SELECTION_BITMASK_PROTOCOL_SIZE pkt = NDPI_SELECTION_BITMASK_PROTOCOL_COMPLETE_TRAFFIC
+	  | NDPI_SELECTION_BITMASK_PROTOCOL_IPV4_OR_IPV6;
+
+	pkt |= (c & NDPI_DISPATCH_CLASS_IPV6) ? NDPI_SELECTION_BITMASK_PROTOCOL_IPV6 : NDPI_SELECTION_BITMASK_PROTOCOL_IP;
+	if(c & NDPI_DISPATCH_CLASS_PAYLOAD)           pkt |= NDPI_SELECTION_BITMASK_PROTOCOL_HAS_PAYLOAD;
+	if(c & NDPI_DISPATCH_CLASS_NO_RETRANSMISSION) pkt |= NDPI_SELECTION_BITMASK_PROTOCOL_NO_TCP_RETRANSMISSION;
+
+	if((l4 == NDPI_DISPATCH_TCP_PAYLOAD) || (l4 == NDPI_DISPATCH_TCP_NO_PAYLOAD))
+	  pkt |= NDPI_SELECTION_BITMASK_PROTOCOL_INT_TCP | NDPI_SELECTION_BITMASK_PROTOCOL_INT_TCP_OR_UDP;
+	else if(l4 == NDPI_DISPATCH_UDP)
+	  pkt |= NDPI_SELECTION_BITMASK_PROTOCOL_INT_UDP | NDPI_SELECTION_BITMASK_PROTOCOL_INT_TCP_OR_UDP;
+
+	if((sel & pkt) == sel)
+	  NDPI_SET(&ndpi_struct->dispatch_plan[l4][c], a);
+      }
+    }
+  }
+}
+
+/* ******************************************************************** */
+
 void ndpi_set_protocol_detection_bitmask2(struct ndpi_detection_module_struct *ndpi_struct,
 					  const NDPI_PROTOCOL_BITMASK * dbm)
 {
@@ -2401,6 +4194,11 @@ void ndpi_set_protocol_detection_bitmask2(struct ndpi_detection_module_struct *n
   NDPI_PROTOCOL_BITMASK *detection_bitmask = &detection_bitmask_local;
   u_int32_t a = 0;
 
+  if(ndpi_struct->parent != NULL) {
+    NDPI_LOG_ERR(ndpi_struct, "The dissectors of a detection context are the ones of its module\n");
+    return;
+  }
+
   NDPI_BITMASK_SET(detection_bitmask_local, *dbm);
   NDPI_BITMASK_SET(ndpi_struct->detection_bitmask, *dbm);
 
@@ -2917,6 +4715,8 @@ void ndpi_set_protocol_detection_bitmask2(struct ndpi_detection_module_struct *n
       ndpi_struct->callback_buffer_size_non_tcp_udp++;
     }
   }
+
+  ndpi_build_dispatch_plans(ndpi_struct);
 }
 
 #ifdef NDPI_DETECTION_SUPPORT_IPV6
@@ -3073,6 +4873,50 @@ void ndpi_apply_flow_protocol_to_packet(struct ndpi_flow_struct *flow,
   memcpy(&packet->protocol_stack_info, &flow->protocol_stack_info, sizeof(packet->protocol_stack_info));
 }
 
+/* ********************************************************************************* */
+
+static void ndpi_reset_packet_line_info(struct ndpi_packet_lines *lines)
+{
+  lines->parsed_lines = 0;
+  lines->empty_line_position_set = 0;
+
+  lines->host_line.ptr = NULL;
+  lines->host_line.len = 0;
+  lines->forwarded_line.ptr = NULL;
+  lines->forwarded_line.len = 0;
+  lines->referer_line.ptr = NULL;
+  lines->referer_line.len = 0;
+  lines->content_line.ptr = NULL;
+  lines->content_line.len = 0;
+  lines->accept_line.ptr = NULL;
+  lines->accept_line.len = 0;
+  lines->user_agent_line.ptr = NULL;
+  lines->user_agent_line.len = 0;
+  lines->http_url_name.ptr = NULL;
+  lines->http_url_name.len = 0;
+  lines->http_encoding.ptr = NULL;
+  lines->http_encoding.len = 0;
+  lines->http_transfer_encoding.ptr = NULL;
+  lines->http_transfer_encoding.len = 0;
+  lines->http_contentlen.ptr = NULL;
+  lines->http_contentlen.len = 0;
+  lines->http_cookie.ptr = NULL;
+  lines->http_cookie.len = 0;
+  lines->http_origin.len = 0;
+  lines->http_origin.ptr = NULL;
+  lines->http_x_session_type.ptr = NULL;
+  lines->http_x_session_type.len = 0;
+  lines->server_line.ptr = NULL;
+  lines->server_line.len = 0;
+  lines->http_method.ptr = NULL;
+  lines->http_method.len = 0;
+  lines->http_response.ptr = NULL;
+  lines->http_response.len = 0;
+  lines->http_num_headers = 0;
+}
+
+/* ********************************************************************************* */
+
 static int ndpi_init_packet_header(struct ndpi_detection_module_struct *ndpi_struct,
 				   struct ndpi_flow_struct *flow,
 				   unsigned short packetlen)
@@ -3085,6 +4929,9 @@ static int ndpi_init_packet_header(struct ndpi_detection_module_struct *ndpi_str
   u_int8_t l4_result;
 
   if (flow) {
+    /* The line parsing scratch is shared by all the flows of this module */
+    flow->packet.lines = &ndpi_struct->packet_lines;
+
     /* reset payload_packet_len, will be set if ipv4 tcp or udp */
     flow->packet.payload_packet_len = 0;
     flow->packet.l4_packet_len = 0;
@@ -3172,7 +5019,9 @@ static int ndpi_init_packet_header(struct ndpi_detection_module_struct *ndpi_str
 	 && flow->packet.tcp->ack == 0
 	 && flow->init_finished != 0
 	 && flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN) {
+	ndpi_free_flow_data(flow);
 	memset(flow, 0, sizeof(*(flow)));
+	flow->packet.lines = &ndpi_struct->packet_lines;
 
 	NDPI_LOG_DBG(ndpi_struct,
 		 "tcp syn packet for unknown protocol, reset detection state\n");
@@ -3192,6 +5041,304 @@ static int ndpi_init_packet_header(struct ndpi_detection_module_struct *ndpi_str
   return 0;
 }
 
+/* ********************************************************************************* */
+
+/*
+  TCP reassembly. A dissector needing more than the current segment asks
+  for the first bytes of the packet direction with ndpi_tcp_stream_get():
+  from then on ndpi_connection_tracking() appends the in-order segments of
+  that direction to a per-flow buffer, until the dissector stops the
+  stream or the flow detection completes. Each direction has one stream,
+  owned by the dissector (protocol) that started it.
+*/
+
+/* Buffers of all the modules, updated atomically as flows are freed without their module */
+static struct ndpi_tcp_reassembly_stats ndpi_tcp_reassembly_stats;
+
+static void ndpi_tcp_reassembly_account(int64_t bytes) {
+  u_int64_t in_use = __atomic_add_fetch(&ndpi_tcp_reassembly_stats.bytes_in_use, (u_int64_t)bytes, __ATOMIC_RELAXED);
+  u_int64_t high_water = __atomic_load_n(&ndpi_tcp_reassembly_stats.bytes_high_water, __ATOMIC_RELAXED);
+
+  while((in_use > high_water)
+	&& !__atomic_compare_exchange_n(&ndpi_tcp_reassembly_stats.bytes_high_water, &high_water, in_use,
+					1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/* ********************************************************************************* */
+
+void ndpi_set_tcp_reassembly(struct ndpi_detection_module_struct *ndpi_struct, u_int32_t max_bytes) {
+  /* The reassembled bytes are handed to the dissectors as a packet payload */
+  ndpi_struct->tcp_reassembly_max_bytes = ndpi_min(max_bytes, 0xFFFF);
+}
+
+/* ********************************************************************************* */
+
+void ndpi_set_host_match_most_specific(struct ndpi_detection_module_struct *ndpi_struct, u_int8_t enable) {
+  ndpi_struct->host_match_most_specific = enable ? 1 : 0;
+}
+
+/* ********************************************************************************* */
+
+void ndpi_get_tcp_reassembly_stats(struct ndpi_tcp_reassembly_stats *stats) {
+  stats->bytes_in_use = __atomic_load_n(&ndpi_tcp_reassembly_stats.bytes_in_use, __ATOMIC_RELAXED);
+  stats->bytes_high_water = __atomic_load_n(&ndpi_tcp_reassembly_stats.bytes_high_water, __ATOMIC_RELAXED);
+  stats->streams = __atomic_load_n(&ndpi_tcp_reassembly_stats.streams, __ATOMIC_RELAXED);
+  stats->streams_truncated = __atomic_load_n(&ndpi_tcp_reassembly_stats.streams_truncated, __ATOMIC_RELAXED);
+}
+
+/* ********************************************************************************* */
+
+static void ndpi_tcp_stream_free(struct ndpi_tcp_stream *stream) {
+  if(stream->buf) {
+    ndpi_tcp_reassembly_account(-(int64_t)stream->size);
+    ndpi_free(stream->buf);
+  }
+
+  memset(stream, 0, sizeof(struct ndpi_tcp_stream));
+}
+
+/* ********************************************************************************* */
+
+static void ndpi_free_tcp_reassembly(struct ndpi_flow_struct *flow) {
+  if(flow->tcp_reassembly) {
+    ndpi_tcp_stream_free(&flow->tcp_reassembly->stream[0]);
+    ndpi_tcp_stream_free(&flow->tcp_reassembly->stream[1]);
+    ndpi_free(flow->tcp_reassembly);
+    flow->tcp_reassembly = NULL;
+  }
+}
+
+/* ********************************************************************************* */
+
+/* The buffers are no longer needed once the detection completes */
+static inline void ndpi_tcp_reassembly_check_done(struct ndpi_flow_struct *flow) {
+  if(flow->tcp_reassembly
+     && (flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)
+     && (!flow->check_extra_packets))
+    ndpi_free_tcp_reassembly(flow);
+}
+
+/* ********************************************************************************* */
+
+static void ndpi_tcp_stream_close(struct ndpi_tcp_stream *stream) {
+  stream->closed = 1;
+  __atomic_add_fetch(&ndpi_tcp_reassembly_stats.streams_truncated, 1, __ATOMIC_RELAXED);
+}
+
+/* ********************************************************************************* */
+
+static void ndpi_tcp_stream_append(struct ndpi_detection_module_struct *ndpi_struct,
+				   struct ndpi_tcp_stream *stream,
+				   const u_int8_t *data, u_int32_t len) {
+  u_int32_t max_bytes = ndpi_struct->tcp_reassembly_max_bytes;
+
+  if(stream->len + len > max_bytes) {
+    /* Keep the bytes that fit: the dissectors can still use them */
+    len = (max_bytes > stream->len) ? (max_bytes - stream->len) : 0;
+    ndpi_tcp_stream_close(stream);
+  }
+
+  if(stream->len + len > stream->size) {
+    u_int32_t size = ndpi_max(stream->len + len, ndpi_min(ndpi_max(2 * stream->size, 1024), max_bytes));
+    u_int8_t *buf = stream->buf ? ndpi_realloc(stream->buf, stream->len, size) : ndpi_malloc(size);
+
+    if(buf == NULL) {
+      if(!stream->closed) ndpi_tcp_stream_close(stream);
+      return;
+    }
+
+    ndpi_tcp_reassembly_account((int64_t)size - stream->size);
+    stream->buf = buf, stream->size = size;
+  }
+
+  memcpy(&stream->buf[stream->len], data, len);
+  stream->len += len;
+}
+
+/* ********************************************************************************* */
+
+/* Appends the payload of the current packet to the stream of its direction */
+static void ndpi_tcp_stream_ingest(struct ndpi_detection_module_struct *ndpi_struct,
+				   struct ndpi_flow_struct *flow) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+  struct ndpi_tcp_stream *stream = &flow->tcp_reassembly->stream[packet->packet_direction];
+  u_int32_t offset;
+
+  if((!stream->active) || stream->closed || (packet->payload_packet_len == 0))
+    return;
+
+  /* Bytes of the payload already in the stream (retransmission), or a gap */
+  offset = stream->next_seq - ntohl(packet->tcp->seq);
+
+  if(offset > 0x7FFFFFFF) {
+    ndpi_tcp_stream_close(stream);
+    return;
+  }
+
+  if(offset >= packet->payload_packet_len)
+    return;
+
+  ndpi_tcp_stream_append(ndpi_struct, stream, &packet->payload[offset], packet->payload_packet_len - offset);
+  stream->next_seq += packet->payload_packet_len - offset;
+}
+
+/* ********************************************************************************* */
+
+static inline struct ndpi_tcp_stream* ndpi_tcp_stream_active(struct ndpi_flow_struct *flow, u_int16_t proto) {
+  struct ndpi_tcp_stream *stream;
+
+  if(flow->tcp_reassembly == NULL)
+    return(NULL);
+
+  stream = &flow->tcp_reassembly->stream[flow->packet.packet_direction];
+  return((stream->active && (stream->proto == proto)) ? stream : NULL);
+}
+
+/* ********************************************************************************* */
+
+/*
+  Returns the first len bytes of the current packet direction, NULL while
+  they are missing: the stream is started with the current packet when it
+  is too short and the stream of the direction is not used by another
+  dissector.
+*/
+const u_int8_t* ndpi_tcp_stream_get(struct ndpi_detection_module_struct *ndpi_struct,
+				    struct ndpi_flow_struct *flow, u_int16_t proto, u_int32_t len) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+  struct ndpi_tcp_stream *stream = ndpi_tcp_stream_active(flow, proto);
+
+  if(stream)
+    return((len <= stream->len) ? stream->buf : NULL);
+
+  if(len <= packet->payload_packet_len)
+    return(packet->payload);
+
+  if((packet->tcp == NULL) || packet->tcp_retransmission || (len > ndpi_struct->tcp_reassembly_max_bytes))
+    return(NULL);
+
+  if((flow->tcp_reassembly == NULL)
+     && ((flow->tcp_reassembly = ndpi_calloc(1, sizeof(struct ndpi_tcp_reassembly))) == NULL))
+    return(NULL);
+
+  stream = &flow->tcp_reassembly->stream[packet->packet_direction];
+
+  if(stream->active)
+    return(NULL);
+
+  stream->active = 1, stream->proto = proto, stream->next_seq = ntohl(packet->tcp->seq) + packet->payload_packet_len;
+  __atomic_add_fetch(&ndpi_tcp_reassembly_stats.streams, 1, __ATOMIC_RELAXED);
+
+  ndpi_tcp_stream_append(ndpi_struct, stream, packet->payload, packet->payload_packet_len);
+  return(NULL);
+}
+
+/* ********************************************************************************* */
+
+/* Bytes buffered for the current packet direction */
+u_int32_t ndpi_tcp_stream_len(struct ndpi_flow_struct *flow, u_int16_t proto) {
+  struct ndpi_tcp_stream *stream = ndpi_tcp_stream_active(flow, proto);
+
+  return(stream ? stream->len : 0);
+}
+
+/* ********************************************************************************* */
+
+/* 1 if the stream of the current packet direction can still grow */
+u_int8_t ndpi_tcp_stream_pending(struct ndpi_flow_struct *flow, u_int16_t proto) {
+  struct ndpi_tcp_stream *stream = ndpi_tcp_stream_active(flow, proto);
+
+  return((stream && !stream->closed) ? 1 : 0);
+}
+
+/* ********************************************************************************* */
+
+/* The dissector no longer needs the stream of the current packet direction */
+void ndpi_tcp_stream_stop(struct ndpi_flow_struct *flow, u_int16_t proto) {
+  struct ndpi_tcp_stream *stream = ndpi_tcp_stream_active(flow, proto);
+
+  if(stream)
+    ndpi_tcp_stream_free(stream);
+}
+
+/* ********************************************************************************* */
+
+/*
+  Replaces the packet payload with the stream of its direction, i.e. the
+  previous segments followed by the current one (a closed stream ends
+  with the bytes buffered before the gap). Returns 1 if replaced:
+  ndpi_tcp_stream_restore_payload() must then be called before the
+  dissector returns.
+*/
+u_int8_t ndpi_tcp_stream_swap_payload(struct ndpi_detection_module_struct *ndpi_struct,
+				      struct ndpi_flow_struct *flow, u_int16_t proto) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+  struct ndpi_tcp_stream *stream = ndpi_tcp_stream_active(flow, proto);
+
+  if((stream == NULL) || packet->tcp_retransmission
+     || (stream->len <= packet->payload_packet_len))
+    return(0);
+
+  flow->tcp_reassembly->payload = packet->payload, flow->tcp_reassembly->payload_len = packet->payload_packet_len;
+  packet->payload = stream->buf, packet->payload_packet_len = stream->len;
+  packet->lines->packet_lines_parsed_complete = 0;
+
+  return(1);
+}
+
+/* ********************************************************************************* */
+
+void ndpi_tcp_stream_restore_payload(struct ndpi_flow_struct *flow) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+
+  if((flow->tcp_reassembly == NULL) || (flow->tcp_reassembly->payload == NULL))
+    return;
+
+  packet->payload = flow->tcp_reassembly->payload, packet->payload_packet_len = flow->tcp_reassembly->payload_len;
+  packet->lines->packet_lines_parsed_complete = 0;
+  flow->tcp_reassembly->payload = NULL;
+}
+
+/* ********************************************************************************* */
+
+/*
+  Line based protocols: the segments ending with an incomplete line are
+  buffered, and the payload of the segment completing it is replaced
+  with all of them (see ndpi_tcp_stream_swap_payload()). Returns 1 if
+  replaced, to be followed by ndpi_tcp_stream_lines_done(); while a line
+  is incomplete 0 is returned with ndpi_tcp_stream_pending() set.
+*/
+u_int8_t ndpi_tcp_stream_lines(struct ndpi_detection_module_struct *ndpi_struct,
+			       struct ndpi_flow_struct *flow, u_int16_t proto) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+
+  if((packet->tcp == NULL) || (packet->payload_packet_len == 0))
+    return(0);
+
+  if((packet->payload_packet_len < 2)
+     || (packet->payload[packet->payload_packet_len - 2] != '\r')
+     || (packet->payload[packet->payload_packet_len - 1] != '\n')) {
+    ndpi_tcp_stream_get(ndpi_struct, flow, proto, ndpi_max(ndpi_tcp_stream_len(flow, proto), packet->payload_packet_len) + 1);
+    return(0);
+  }
+
+  if(ndpi_tcp_stream_swap_payload(ndpi_struct, flow, proto))
+    return(1);
+
+  /* The line started in this segment */
+  ndpi_tcp_stream_stop(flow, proto);
+  return(0);
+}
+
+/* ********************************************************************************* */
+
+void ndpi_tcp_stream_lines_done(struct ndpi_flow_struct *flow, u_int16_t proto) {
+  ndpi_tcp_stream_restore_payload(flow);
+  ndpi_tcp_stream_stop(flow, proto);
+}
+
+/* ********************************************************************************* */
+
 void ndpi_connection_tracking(struct ndpi_detection_module_struct *ndpi_struct,
 			      struct ndpi_flow_struct *flow)
 {
@@ -3221,7 +5368,11 @@ void ndpi_connection_tracking(struct ndpi_detection_module_struct *ndpi_struct,
 #endif
   }
 
-  packet->packet_lines_parsed_complete = 0;
+  /* Do not expose the lines of the previous packet (possibly of another flow) */
+  if(packet->lines->packet_lines_parsed_complete)
+    ndpi_reset_packet_line_info(packet->lines);
+
+  packet->lines->packet_lines_parsed_complete = 0;
   if(flow == NULL)
     return;
 
@@ -3273,54 +5424,193 @@ void ndpi_connection_tracking(struct ndpi_detection_module_struct *ndpi_struct,
 
 	packet->tcp_retransmission = 1;
 
-	/* CHECK IF PARTIAL RETRY IS HAPPENING */
-	if((flow->next_tcp_seq_nr[packet->packet_direction] - ntohl(tcph->seq) < packet->payload_packet_len)) {
-	  /* num_retried_bytes actual_payload_len hold info about the partial retry
-	     analyzer which require this info can make use of this info
-	     Other analyzer can use packet->payload_packet_len */
-	  packet->num_retried_bytes = (u_int16_t)(flow->next_tcp_seq_nr[packet->packet_direction] - ntohl(tcph->seq));
-	  packet->actual_payload_len = packet->payload_packet_len - packet->num_retried_bytes;
-	  flow->next_tcp_seq_nr[packet->packet_direction] = ntohl(tcph->seq) + packet->payload_packet_len;
-	}
-      }
+	/* CHECK IF PARTIAL RETRY IS HAPPENING */
+	if((flow->next_tcp_seq_nr[packet->packet_direction] - ntohl(tcph->seq) < packet->payload_packet_len)) {
+	  /* num_retried_bytes actual_payload_len hold info about the partial retry
+	     analyzer which require this info can make use of this info
+	     Other analyzer can use packet->payload_packet_len */
+	  packet->num_retried_bytes = (u_int16_t)(flow->next_tcp_seq_nr[packet->packet_direction] - ntohl(tcph->seq));
+	  packet->actual_payload_len = packet->payload_packet_len - packet->num_retried_bytes;
+	  flow->next_tcp_seq_nr[packet->packet_direction] = ntohl(tcph->seq) + packet->payload_packet_len;
+	}
+      }
+
+      /* normal path
+	 actual_payload_len is initialized to payload_packet_len during tcp header parsing itself.
+	 It will be changed only in case of retransmission */
+      else {
+	packet->num_retried_bytes = 0;
+	flow->next_tcp_seq_nr[packet->packet_direction] = ntohl(tcph->seq) + packet->payload_packet_len;
+      }
+    }
+
+    if(flow->tcp_reassembly)
+      ndpi_tcp_stream_ingest(ndpi_struct, flow);
+
+    if(tcph->rst) {
+      flow->next_tcp_seq_nr[0] = 0;
+      flow->next_tcp_seq_nr[1] = 0;
+    }
+  } else if(udph != NULL) {
+    if(!ndpi_struct->direction_detect_disable)
+      packet->packet_direction = (udph->source < udph->dest) ? 1 : 0;
+  }
+
+  if(flow->packet_counter < MAX_PACKET_COUNTER && packet->payload_packet_len) {
+    flow->packet_counter++;
+  }
+
+  if(flow->packet_direction_counter[packet->packet_direction] < MAX_PACKET_COUNTER && packet->payload_packet_len) {
+    flow->packet_direction_counter[packet->packet_direction]++;
+  }
+
+  if(flow->byte_counter[packet->packet_direction] + packet->payload_packet_len >
+     flow->byte_counter[packet->packet_direction]) {
+    flow->byte_counter[packet->packet_direction] += packet->payload_packet_len;
+  }
+}
+
+#ifdef __GNUC__
+#define ndpi_ctz(x) __builtin_ctz(x)
+#else
+static u_int32_t ndpi_ctz(ndpi_ndpi_mask x) {
+  u_int32_t n = 0;
+
+  while((x & 1) == 0) x >>= 1, n++;
+  return(n);
+}
+#endif
+
+/*
+  Dissectors update flow->excluded_protocol_bitmask directly (either via
+  NDPI_EXCLUDE_PROTO or the bitmask macros) so the per-flow set of excluded
+  dissectors is synchronized lazily: only protocols excluded since the last
+  call are folded in, hence the cost is proportional to the new exclusions.
+*/
+static void ndpi_sync_excluded_dissectors(struct ndpi_detection_module_struct *ndpi_struct,
+					  struct ndpi_flow_struct *flow) {
+  u_int32_t i;
+
+  for(i = 0; i < NDPI_NUM_FDS_BITS; i++) {
+    if(flow->excluded_protocol_bitmask_synced.fds_bits[i] & ~flow->excluded_protocol_bitmask.fds_bits[i]) {
+      /* A protocol has been removed from the excluded set: start over */
+      NDPI_ZERO(&flow->excluded_dissector_bitmask);
+      NDPI_ZERO(&flow->excluded_protocol_bitmask_synced);
+      break;
+    }
+  }
+
+  for(i = 0; i < NDPI_NUM_FDS_BITS; i++) {
+    ndpi_ndpi_mask added = flow->excluded_protocol_bitmask.fds_bits[i] & ~flow->excluded_protocol_bitmask_synced.fds_bits[i];
+
+    if(added == 0) continue;
+
+    flow->excluded_protocol_bitmask_synced.fds_bits[i] |= added;
+
+    for(; added != 0; added &= added - 1) {
+      ndpi_bitmask_or(&flow->excluded_dissector_bitmask,
+		      &ndpi_struct->dissectors_excluded_by[i * NDPI_BITS + ndpi_ctz(added)]);
+    }
+  }
+}
+
+/* ********************************************************************************* */
+
+static u_int32_t ndpi_dispatch_class(NDPI_SELECTION_BITMASK_PROTOCOL_SIZE ndpi_selection_packet) {
+  return(((ndpi_selection_packet & NDPI_SELECTION_BITMASK_PROTOCOL_IPV6) ? NDPI_DISPATCH_CLASS_IPV6 : 0)
+	 | ((ndpi_selection_packet & NDPI_SELECTION_BITMASK_PROTOCOL_HAS_PAYLOAD) ? NDPI_DISPATCH_CLASS_PAYLOAD : 0)
+	 | ((ndpi_selection_packet & NDPI_SELECTION_BITMASK_PROTOCOL_NO_TCP_RETRANSMISSION) ? NDPI_DISPATCH_CLASS_NO_RETRANSMISSION : 0));
+}
+
+/* ********************************************************************************* */
+
+/*
+  Call, in callback_buffer order, the dissectors of the plan that are still
+  eligible for this flow. Exclusions made by a dissector are honoured by the
+  following ones as it happened with the linear scan.
+*/
+static void ndpi_dispatch_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
+				    struct ndpi_flow_struct *flow,
+				    const NDPI_PROTOCOL_BITMASK *plan,
+				    void *func) {
+  u_int32_t i;
+
+  ndpi_sync_excluded_dissectors(ndpi_struct, flow);
+
+  for(i = 0; i < NDPI_NUM_FDS_BITS; i++) {
+    ndpi_ndpi_mask todo = plan->fds_bits[i] & ~flow->excluded_dissector_bitmask.fds_bits[i];
+
+    while(todo != 0) {
+      struct ndpi_call_function_struct *cb = &ndpi_struct->callback_buffer[i * NDPI_BITS + ndpi_ctz(todo)];
+
+      todo &= todo - 1;
+
+      if(func == cb->func)
+	continue;
+
+      cb->func(ndpi_struct, flow);
 
-      /* normal path
-	 actual_payload_len is initialized to payload_packet_len during tcp header parsing itself.
-	 It will be changed only in case of retransmission */
-      else {
-	packet->num_retried_bytes = 0;
-	flow->next_tcp_seq_nr[packet->packet_direction] = ntohl(tcph->seq) + packet->payload_packet_len;
-      }
-    }
+      if(flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)
+	return; /* Stop after detecting the first protocol */
 
-    if(tcph->rst) {
-      flow->next_tcp_seq_nr[0] = 0;
-      flow->next_tcp_seq_nr[1] = 0;
+      ndpi_sync_excluded_dissectors(ndpi_struct, flow);
+      todo &= ~flow->excluded_dissector_bitmask.fds_bits[i];
     }
-  } else if(udph != NULL) {
-    if(!ndpi_struct->direction_detect_disable)
-      packet->packet_direction = (udph->source < udph->dest) ? 1 : 0;
   }
+}
 
-  if(flow->packet_counter < MAX_PACKET_COUNTER && packet->payload_packet_len) {
-    flow->packet_counter++;
-  }
+/* ********************************************************************************* */
 
-  if(flow->packet_direction_counter[packet->packet_direction] < MAX_PACKET_COUNTER && packet->payload_packet_len) {
-    flow->packet_direction_counter[packet->packet_direction]++;
-  }
+/* Linear scan used when the flow state is not covered by the dispatch plans */
+static void ndpi_scan_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
+				struct ndpi_flow_struct *flow,
+				struct ndpi_call_function_struct *callback_buffer,
+				u_int32_t callback_buffer_size,
+				NDPI_SELECTION_BITMASK_PROTOCOL_SIZE *ndpi_selection_packet,
+				NDPI_PROTOCOL_BITMASK *detection_bitmask,
+				void *func) {
+  u_int32_t a;
 
-  if(flow->byte_counter[packet->packet_direction] + packet->payload_packet_len >
-     flow->byte_counter[packet->packet_direction]) {
-    flow->byte_counter[packet->packet_direction] += packet->payload_packet_len;
+  for(a = 0; a < callback_buffer_size; a++) {
+    if((func != callback_buffer[a].func)
+       && (callback_buffer[a].ndpi_selection_bitmask & *ndpi_selection_packet) == callback_buffer[a].ndpi_selection_bitmask
+       && !ndpi_bitmask_intersects(&flow->excluded_protocol_bitmask, &callback_buffer[a].excluded_protocol_bitmask)
+       && ndpi_bitmask_intersects(&callback_buffer[a].detection_bitmask, detection_bitmask)) {
+      if(callback_buffer[a].func != NULL)
+	callback_buffer[a].func(ndpi_struct, flow);
+
+      if(flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)
+	break; /* Stop after detecting the first protocol */
+    } else
+      if(_ndpi_debug_callbacks) NDPI_LOG_DBG2(ndpi_struct,
+	       "[SKIP] dissector of protocol as callback_buffer idx =  %d\n",a);
   }
 }
 
+/* ********************************************************************************* */
+
+static void ndpi_run_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
+			       struct ndpi_flow_struct *flow,
+			       u_int32_t l4,
+			       struct ndpi_call_function_struct *callback_buffer,
+			       u_int32_t callback_buffer_size,
+			       NDPI_SELECTION_BITMASK_PROTOCOL_SIZE *ndpi_selection_packet,
+			       NDPI_PROTOCOL_BITMASK *detection_bitmask,
+			       void *func) {
+  if(flow->packet.detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN)
+    ndpi_dispatch_flow_func(ndpi_struct, flow,
+			    &ndpi_struct->dispatch_plan[l4][ndpi_dispatch_class(*ndpi_selection_packet)], func);
+  else
+    ndpi_scan_flow_func(ndpi_struct, flow, callback_buffer, callback_buffer_size,
+			ndpi_selection_packet, detection_bitmask, func);
+}
+
+/* ********************************************************************************* */
+
 void check_ndpi_other_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
 				struct ndpi_flow_struct *flow,
 				NDPI_SELECTION_BITMASK_PROTOCOL_SIZE *ndpi_selection_packet) {
   void *func = NULL;
-  u_int32_t a;
   u_int16_t proto_index = ndpi_struct->proto_defaults[flow->guessed_protocol_id].protoIdx;
   int16_t proto_id = ndpi_struct->proto_defaults[flow->guessed_protocol_id].protoId;
   NDPI_PROTOCOL_BITMASK detection_bitmask;
@@ -3328,10 +5618,10 @@ void check_ndpi_other_flow_func(struct ndpi_detection_module_struct *ndpi_struct
   NDPI_SAVE_AS_BITMASK(detection_bitmask, flow->packet.detected_protocol_stack[0]);
 
   if((proto_id != NDPI_PROTOCOL_UNKNOWN)
-     && NDPI_BITMASK_COMPARE(flow->excluded_protocol_bitmask,
-			     ndpi_struct->callback_buffer[proto_index].excluded_protocol_bitmask) == 0
-     && NDPI_BITMASK_COMPARE(ndpi_struct->callback_buffer[proto_index].detection_bitmask,
-			     detection_bitmask) != 0
+     && !ndpi_bitmask_intersects(&flow->excluded_protocol_bitmask,
+				 &ndpi_struct->callback_buffer[proto_index].excluded_protocol_bitmask)
+     && ndpi_bitmask_intersects(&ndpi_struct->callback_buffer[proto_index].detection_bitmask,
+				&detection_bitmask)
      && (ndpi_struct->callback_buffer[proto_index].ndpi_selection_bitmask
 	 & *ndpi_selection_packet) == ndpi_struct->callback_buffer[proto_index].ndpi_selection_bitmask) {
     if((flow->guessed_protocol_id != NDPI_PROTOCOL_UNKNOWN)
@@ -3340,25 +5630,10 @@ void check_ndpi_other_flow_func(struct ndpi_detection_module_struct *ndpi_struct
 	func = ndpi_struct->proto_defaults[flow->guessed_protocol_id].func;
   }
 
-  for(a = 0; a < ndpi_struct->callback_buffer_size_non_tcp_udp; a++) {
-    if((func != ndpi_struct->callback_buffer_non_tcp_udp[a].func)
-       && (ndpi_struct->callback_buffer_non_tcp_udp[a].ndpi_selection_bitmask & *ndpi_selection_packet) ==
-       ndpi_struct->callback_buffer_non_tcp_udp[a].ndpi_selection_bitmask
-       && (flow == NULL
-	   ||
-	   NDPI_BITMASK_COMPARE
-	   (flow->excluded_protocol_bitmask,
-	    ndpi_struct->callback_buffer_non_tcp_udp[a].excluded_protocol_bitmask) == 0)
-       && NDPI_BITMASK_COMPARE(ndpi_struct->callback_buffer_non_tcp_udp[a].detection_bitmask,
-			       detection_bitmask) != 0) {
-
-      if(ndpi_struct->callback_buffer_non_tcp_udp[a].func != NULL)
-	ndpi_struct->callback_buffer_non_tcp_udp[a].func(ndpi_struct, flow);
-
-      if(flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)
-	break; /* Stop after detecting the first protocol */
-    }
-  }
+  if(flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN)
+    ndpi_run_flow_func(ndpi_struct, flow, NDPI_DISPATCH_NON_TCP_UDP,
+		       ndpi_struct->callback_buffer_non_tcp_udp, ndpi_struct->callback_buffer_size_non_tcp_udp,
+		       ndpi_selection_packet, &detection_bitmask, func);
 }
 
 
@@ -3366,7 +5641,6 @@ void check_ndpi_udp_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
 			      struct ndpi_flow_struct *flow,
 			      NDPI_SELECTION_BITMASK_PROTOCOL_SIZE *ndpi_selection_packet) {
   void *func = NULL;
-  u_int32_t a;
   u_int16_t proto_index = ndpi_struct->proto_defaults[flow->guessed_protocol_id].protoIdx;
   int16_t proto_id = ndpi_struct->proto_defaults[flow->guessed_protocol_id].protoId;
   NDPI_PROTOCOL_BITMASK detection_bitmask;
@@ -3374,10 +5648,10 @@ void check_ndpi_udp_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
   NDPI_SAVE_AS_BITMASK(detection_bitmask, flow->packet.detected_protocol_stack[0]);
 
   if((proto_id != NDPI_PROTOCOL_UNKNOWN)
-     && NDPI_BITMASK_COMPARE(flow->excluded_protocol_bitmask,
-			     ndpi_struct->callback_buffer[proto_index].excluded_protocol_bitmask) == 0
-     && NDPI_BITMASK_COMPARE(ndpi_struct->callback_buffer[proto_index].detection_bitmask,
-			     detection_bitmask) != 0
+     && !ndpi_bitmask_intersects(&flow->excluded_protocol_bitmask,
+				 &ndpi_struct->callback_buffer[proto_index].excluded_protocol_bitmask)
+     && ndpi_bitmask_intersects(&ndpi_struct->callback_buffer[proto_index].detection_bitmask,
+				&detection_bitmask)
      && (ndpi_struct->callback_buffer[proto_index].ndpi_selection_bitmask
 	 & *ndpi_selection_packet) == ndpi_struct->callback_buffer[proto_index].ndpi_selection_bitmask) {
     if((flow->guessed_protocol_id != NDPI_PROTOCOL_UNKNOWN)
@@ -3386,22 +5660,10 @@ void check_ndpi_udp_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
 	func = ndpi_struct->proto_defaults[flow->guessed_protocol_id].func;
   }
 
-  for(a = 0; a < ndpi_struct->callback_buffer_size_udp; a++) {
-    if((func != ndpi_struct->callback_buffer_udp[a].func)
-       && (ndpi_struct->callback_buffer_udp[a].ndpi_selection_bitmask & *ndpi_selection_packet) ==
-       ndpi_struct->callback_buffer_udp[a].ndpi_selection_bitmask
-       && NDPI_BITMASK_COMPARE(flow->excluded_protocol_bitmask,
-			       ndpi_struct->callback_buffer_udp[a].excluded_protocol_bitmask) == 0
-       && NDPI_BITMASK_COMPARE(ndpi_struct->callback_buffer_udp[a].detection_bitmask,
-			       detection_bitmask) != 0) {
-      ndpi_struct->callback_buffer_udp[a].func(ndpi_struct, flow);
-      // NDPI_LOG_DBG(ndpi_struct, "[UDP,CALL] dissector of protocol as callback_buffer idx =  %d\n",a);
-      if(flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)
-	break; /* Stop after detecting the first protocol */
-    } else
-      if(_ndpi_debug_callbacks) NDPI_LOG_DBG2(ndpi_struct,
-	       "[UDP,SKIP] dissector of protocol as callback_buffer idx =  %d\n",a);
-  }
+  if(flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN)
+    ndpi_run_flow_func(ndpi_struct, flow, NDPI_DISPATCH_UDP,
+		       ndpi_struct->callback_buffer_udp, ndpi_struct->callback_buffer_size_udp,
+		       ndpi_selection_packet, &detection_bitmask, func);
 }
 
 
@@ -3409,7 +5671,6 @@ void check_ndpi_tcp_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
 			      struct ndpi_flow_struct *flow,
 			      NDPI_SELECTION_BITMASK_PROTOCOL_SIZE *ndpi_selection_packet) {
   void *func = NULL;
-  u_int32_t a;
   u_int16_t proto_index = ndpi_struct->proto_defaults[flow->guessed_protocol_id].protoIdx;
   int16_t proto_id = ndpi_struct->proto_defaults[flow->guessed_protocol_id].protoId;
   NDPI_PROTOCOL_BITMASK detection_bitmask;
@@ -3418,10 +5679,10 @@ void check_ndpi_tcp_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
 
   if(flow->packet.payload_packet_len != 0) {
     if((proto_id != NDPI_PROTOCOL_UNKNOWN)
-       && NDPI_BITMASK_COMPARE(flow->excluded_protocol_bitmask,
-			       ndpi_struct->callback_buffer[proto_index].excluded_protocol_bitmask) == 0
-       && NDPI_BITMASK_COMPARE(ndpi_struct->callback_buffer[proto_index].detection_bitmask,
-			       detection_bitmask) != 0
+       && !ndpi_bitmask_intersects(&flow->excluded_protocol_bitmask,
+				   &ndpi_struct->callback_buffer[proto_index].excluded_protocol_bitmask)
+       && ndpi_bitmask_intersects(&ndpi_struct->callback_buffer[proto_index].detection_bitmask,
+				  &detection_bitmask)
        && (ndpi_struct->callback_buffer[proto_index].ndpi_selection_bitmask & *ndpi_selection_packet) == ndpi_struct->callback_buffer[proto_index].ndpi_selection_bitmask) {
       if((flow->guessed_protocol_id != NDPI_PROTOCOL_UNKNOWN)
 	 && (ndpi_struct->proto_defaults[flow->guessed_protocol_id].func != NULL))
@@ -3429,29 +5690,17 @@ void check_ndpi_tcp_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
 	  func = ndpi_struct->proto_defaults[flow->guessed_protocol_id].func;
     }
 
-    if(flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN) {
-      for(a = 0; a < ndpi_struct->callback_buffer_size_tcp_payload; a++) {
-	if((func != ndpi_struct->callback_buffer_tcp_payload[a].func)
-	   && (ndpi_struct->callback_buffer_tcp_payload[a].ndpi_selection_bitmask & *ndpi_selection_packet) == ndpi_struct->callback_buffer_tcp_payload[a].ndpi_selection_bitmask
-	   && NDPI_BITMASK_COMPARE(flow->excluded_protocol_bitmask,
-				   ndpi_struct->callback_buffer_tcp_payload[a].excluded_protocol_bitmask) == 0
-	   && NDPI_BITMASK_COMPARE(ndpi_struct->callback_buffer_tcp_payload[a].detection_bitmask,
-				   detection_bitmask) != 0) {
-	  ndpi_struct->callback_buffer_tcp_payload[a].func(ndpi_struct, flow);
-
-
-	  if(flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)
-	    break; /* Stop after detecting the first protocol */
-	}
-      }
-    }
+    if(flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN)
+      ndpi_run_flow_func(ndpi_struct, flow, NDPI_DISPATCH_TCP_PAYLOAD,
+			 ndpi_struct->callback_buffer_tcp_payload, ndpi_struct->callback_buffer_size_tcp_payload,
+			 ndpi_selection_packet, &detection_bitmask, func);
   } else {
     /* no payload */
     if((proto_id != NDPI_PROTOCOL_UNKNOWN)
-       && NDPI_BITMASK_COMPARE(flow->excluded_protocol_bitmask,
-			       ndpi_struct->callback_buffer[proto_index].excluded_protocol_bitmask) == 0
-       && NDPI_BITMASK_COMPARE(ndpi_struct->callback_buffer[proto_index].detection_bitmask,
-			       detection_bitmask) != 0
+       && !ndpi_bitmask_intersects(&flow->excluded_protocol_bitmask,
+				   &ndpi_struct->callback_buffer[proto_index].excluded_protocol_bitmask)
+       && ndpi_bitmask_intersects(&ndpi_struct->callback_buffer[proto_index].detection_bitmask,
+				  &detection_bitmask)
        && (ndpi_struct->callback_buffer[proto_index].ndpi_selection_bitmask
 	   & *ndpi_selection_packet) == ndpi_struct->callback_buffer[proto_index].ndpi_selection_bitmask) {
       if((flow->guessed_protocol_id != NDPI_PROTOCOL_UNKNOWN)
@@ -3461,21 +5710,10 @@ void check_ndpi_tcp_flow_func(struct ndpi_detection_module_struct *ndpi_struct,
 	  func = ndpi_struct->proto_defaults[flow->guessed_protocol_id].func;
     }
 
-    for(a = 0; a < ndpi_struct->callback_buffer_size_tcp_no_payload; a++) {
-      if((func != ndpi_struct->callback_buffer_tcp_payload[a].func)
-	 && (ndpi_struct->callback_buffer_tcp_no_payload[a].ndpi_selection_bitmask & *ndpi_selection_packet) ==
-	 ndpi_struct->callback_buffer_tcp_no_payload[a].ndpi_selection_bitmask
-	 && NDPI_BITMASK_COMPARE(flow->excluded_protocol_bitmask,
-				 ndpi_struct->
-				 callback_buffer_tcp_no_payload[a].excluded_protocol_bitmask) == 0
-	 && NDPI_BITMASK_COMPARE(ndpi_struct->callback_buffer_tcp_no_payload[a].detection_bitmask,
-				 detection_bitmask) != 0) {
-	ndpi_struct->callback_buffer_tcp_no_payload[a].func(ndpi_struct, flow);
-
-	if(flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)
-	  break; /* Stop after detecting the first protocol */
-      }
-    }
+    if(flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN)
+      ndpi_run_flow_func(ndpi_struct, flow, NDPI_DISPATCH_TCP_NO_PAYLOAD,
+			 ndpi_struct->callback_buffer_tcp_no_payload, ndpi_struct->callback_buffer_size_tcp_no_payload,
+			 ndpi_selection_packet, &detection_bitmask, func);
   }
 }
 
@@ -3502,7 +5740,7 @@ ndpi_protocol ndpi_detection_giveup(struct ndpi_detection_module_struct *ndpi_st
   if(flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN) {
     u_int16_t guessed_protocol_id, guessed_host_protocol_id;
 
-    if(flow->protos.ssl.client_certificate[0] != '\0') {
+    if(flow->cold && (flow->cold->protos.ssl.client_certificate[0] != '\0')) {
       ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_SSL, NDPI_PROTOCOL_UNKNOWN);
     } else {
       if((flow->guessed_protocol_id == NDPI_PROTOCOL_UNKNOWN)
@@ -3542,6 +5780,8 @@ ndpi_protocol ndpi_detection_giveup(struct ndpi_detection_module_struct *ndpi_st
   if((flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN) && (flow->num_stun_udp_pkts > 0))
     ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_STUN, flow->guessed_host_protocol_id);
 
+  ndpi_free_tcp_reassembly(flow);
+
   ret.master_protocol = flow->detected_protocol_stack[1], ret.app_protocol = flow->detected_protocol_stack[0];
 
   return(ret);
@@ -3588,6 +5828,42 @@ void ndpi_process_extra_packet(struct ndpi_detection_module_struct *ndpi_struct,
   }
 
   flow->num_extra_packets_checked++;
+  ndpi_tcp_reassembly_check_done(flow);
+}
+
+/* ********************************************************************************* */
+
+/* IP-based protocol of the flow: the source address first, then the destination one */
+static inline u_int16_t ndpi_guess_host_protocol_id(struct ndpi_detection_module_struct *ndpi_struct,
+						    struct ndpi_flow_struct *flow) {
+  u_int16_t src_protocol = NDPI_PROTOCOL_UNKNOWN, dst_protocol = NDPI_PROTOCOL_UNKNOWN;
+
+  if(flow->packet.iph)
+    ndpi_network_ptree_match_pair(ndpi_struct, (struct in_addr *)&flow->packet.iph->saddr,
+				  (struct in_addr *)&flow->packet.iph->daddr, &src_protocol, &dst_protocol);
+#ifdef NDPI_DETECTION_SUPPORT_IPV6
+  else if(flow->packet.iphv6)
+    ndpi_network6_ptree_match_pair(ndpi_struct, (struct ndpi_in6_addr *)&flow->packet.iphv6->ip6_src,
+				   (struct ndpi_in6_addr *)&flow->packet.iphv6->ip6_dst, &src_protocol, &dst_protocol);
+#endif
+
+  return((src_protocol != NDPI_PROTOCOL_UNKNOWN) ? src_protocol : dst_protocol);
+}
+
+/* ********************************************************************************* */
+
+static inline ndpi_protocol ndpi_flow_protocols(struct ndpi_flow_struct *flow) {
+  ndpi_protocol ret = { NDPI_PROTOCOL_UNKNOWN, NDPI_PROTOCOL_UNKNOWN };
+
+  if(flow->detected_protocol_stack[1] != NDPI_PROTOCOL_UNKNOWN) {
+    ret.master_protocol = flow->detected_protocol_stack[1], ret.app_protocol = flow->detected_protocol_stack[0];
+
+    if(ret.app_protocol == ret.master_protocol)
+      ret.master_protocol = NDPI_PROTOCOL_UNKNOWN;
+  } else
+    ret.app_protocol = flow->detected_protocol_stack[0];
+
+  return(ret);
 }
 
 /* ********************************************************************************* */
@@ -3604,6 +5880,9 @@ ndpi_protocol ndpi_detection_process_packet(struct ndpi_detection_module_struct
   u_int32_t a;
   ndpi_protocol ret = { NDPI_PROTOCOL_UNKNOWN, NDPI_PROTOCOL_UNKNOWN };
 
+  /* Quiescent point: no packet uses the rules */
+  ndpi_rules_quiescent(ndpi_struct);
+
   if(ndpi_struct->ndpi_log_level >= NDPI_LOG_TRACE)
   	NDPI_LOG(flow ? flow->detected_protocol_stack[0]:NDPI_PROTOCOL_UNKNOWN,
 		  ndpi_struct, NDPI_LOG_TRACE, "START packet processing\n");
@@ -3695,25 +5974,15 @@ ndpi_protocol ndpi_detection_process_packet(struct ndpi_detection_module_struct
       return(ret);
     }
 
+    /* guess host protocol (IPv4 or IPv6) */
+    flow->guessed_host_protocol_id = ndpi_guess_host_protocol_id(ndpi_struct, flow);
+
     if(user_defined_proto && flow->guessed_protocol_id != NDPI_PROTOCOL_UNKNOWN) {
-      if(flow->packet.iph) {
-	/* guess host protocol */
-	flow->guessed_host_protocol_id = ndpi_network_ptree_match(ndpi_struct, (struct in_addr *)&flow->packet.iph->saddr);
-	if(flow->guessed_host_protocol_id == NDPI_PROTOCOL_UNKNOWN)
-	  flow->guessed_host_protocol_id = ndpi_network_ptree_match(ndpi_struct, (struct in_addr *)&flow->packet.iph->daddr);
-	if(flow->guessed_host_protocol_id != NDPI_PROTOCOL_UNKNOWN)
-	  /* ret.master_protocol = flow->guessed_protocol_id , ret.app_protocol = flow->guessed_host_protocol_id; /\* ****** *\/ */
-	  ret = ndpi_detection_giveup(ndpi_struct, flow);
+      if(flow->guessed_host_protocol_id != NDPI_PROTOCOL_UNKNOWN)
+	/* ret.master_protocol = flow->guessed_protocol_id , ret.app_protocol = flow->guessed_host_protocol_id; /\* ****** *\/ */
+	ret = ndpi_detection_giveup(ndpi_struct, flow);
 
-	return(ret);
-      }
-    } else {
-      /* guess host protocol */
-      if(flow->packet.iph) {
-	flow->guessed_host_protocol_id = ndpi_network_ptree_match(ndpi_struct, (struct in_addr *)&flow->packet.iph->saddr);
-	if(flow->guessed_host_protocol_id == NDPI_PROTOCOL_UNKNOWN)
-	  flow->guessed_host_protocol_id = ndpi_network_ptree_match(ndpi_struct, (struct in_addr *)&flow->packet.iph->daddr);
-      }
+      return(ret);
     }
   }
 
@@ -3729,27 +5998,115 @@ ndpi_protocol ndpi_detection_process_packet(struct ndpi_detection_module_struct
   if(NDPI_COMPARE_PROTOCOL_TO_BITMASK(ndpi_struct->detection_bitmask, a) == 0)
     a = NDPI_PROTOCOL_UNKNOWN;
 
-  if(a != NDPI_PROTOCOL_UNKNOWN) {
+  if((a != NDPI_PROTOCOL_UNKNOWN) && flow->cold) {
+    u_char *host_server_name = flow->cold->host_server_name;
     int i;
 
-    for(i=0; (i<sizeof(flow->host_server_name)) && (flow->host_server_name[i] != '\0'); i++)
-      flow->host_server_name[i] = tolower(flow->host_server_name[i]);
+    for(i=0; (i<sizeof(flow->cold->host_server_name)) && (host_server_name[i] != '\0'); i++)
+      host_server_name[i] = tolower(host_server_name[i]);
 
-    flow->host_server_name[i] ='\0';
+    host_server_name[i] ='\0';
   }
 
  ret_protocols:
-  if(flow->detected_protocol_stack[1] != NDPI_PROTOCOL_UNKNOWN) {
-    ret.master_protocol = flow->detected_protocol_stack[1], ret.app_protocol = flow->detected_protocol_stack[0];
+  ndpi_tcp_reassembly_check_done(flow);
+  return(ndpi_flow_protocols(flow));
+}
 
-    if(ret.app_protocol == ret.master_protocol)
-      ret.master_protocol = NDPI_PROTOCOL_UNKNOWN;
-  } else
-    ret.app_protocol = flow->detected_protocol_stack[0];
+/* ********************************************************************************* */
 
-  return(ret);
+#define NDPI_BURST_CHUNK 256
+
+#ifdef __GNUC__
+#define ndpi_prefetch(p) __builtin_prefetch(p)
+#else
+#define ndpi_prefetch(p)
+#endif
+
+/* Transport of a packet, used to group a burst: all the packets of a flow share it */
+#define NDPI_BURST_TCP    0
+#define NDPI_BURST_UDP    1
+#define NDPI_BURST_OTHER  2
+#define NDPI_BURST_NUM_L4 3
+#define NDPI_BURST_DONE   NDPI_BURST_NUM_L4 /* flow already detected */
+
+static u_int8_t ndpi_burst_l4(const unsigned char *packet, u_int16_t packetlen) {
+  u_int8_t proto;
+
+  if(packetlen < 20)
+    return(NDPI_BURST_OTHER);
+
+  if((packet[0] >> 4) == 4)
+    proto = packet[9];
+  else if(((packet[0] >> 4) == 6) && (packetlen >= 40))
+    proto = packet[6];
+  else
+    return(NDPI_BURST_OTHER);
+
+  return((proto == IPPROTO_TCP) ? NDPI_BURST_TCP : ((proto == IPPROTO_UDP) ? NDPI_BURST_UDP : NDPI_BURST_OTHER));
+}
+
+/* ********************************************************************************* */
+
+void ndpi_detection_process_packet_burst(struct ndpi_detection_module_struct *ndpi_struct,
+					 const struct ndpi_packet_burst_entry *pkts,
+					 ndpi_protocol *results,
+					 u_int32_t num_pkts) {
+  u_int16_t order[NDPI_BURST_CHUNK];
+  u_int8_t l4[NDPI_BURST_CHUNK];
+  u_int32_t base;
+
+  for(base = 0; base < num_pkts; base += NDPI_BURST_CHUNK) {
+    const struct ndpi_packet_burst_entry *burst = &pkts[base];
+    u_int16_t start[NDPI_BURST_NUM_L4 + 2] = { 0 };
+    u_int32_t i, n = ndpi_min(num_pkts - base, NDPI_BURST_CHUNK), num_todo;
+
+    for(i = 0; i < n; i++)
+      if(burst[i].flow) ndpi_prefetch(burst[i].flow);
+
+    /*
+      Packets of detected flows only need the flow results (as in
+      ndpi_detection_process_packet()), the others are sorted by transport
+    */
+    for(i = 0; i < n; i++) {
+      struct ndpi_flow_struct *flow = burst[i].flow;
+
+      if(flow && (flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)) {
+	if(flow->server_id == NULL) flow->server_id = burst[i].dst;
+	results[base + i] = ndpi_flow_protocols(flow);
+	l4[i] = NDPI_BURST_DONE;
+      } else
+	l4[i] = ndpi_burst_l4(burst[i].packet, burst[i].packetlen);
+
+      start[l4[i] + 1]++;
+    }
+
+    num_todo = n - start[NDPI_BURST_DONE + 1];
+
+    for(i = 1; i <= NDPI_BURST_DONE; i++)
+      start[i] += start[i - 1];
+
+    /* Stable: the packets of a flow share the transport and keep their order */
+    for(i = 0; i < n; i++)
+      if(l4[i] != NDPI_BURST_DONE)
+	order[start[l4[i]]++] = i;
+
+    n = num_todo;
+
+    for(i = 0; i < n; i++) {
+      const struct ndpi_packet_burst_entry *e = &burst[order[i]];
+
+      if((i + 1 < n) && burst[order[i + 1]].flow)
+	ndpi_prefetch(&burst[order[i + 1]].flow->packet);
+
+      results[base + order[i]] = ndpi_detection_process_packet(ndpi_struct, e->flow, e->packet, e->packetlen,
+							       e->current_tick, e->src, e->dst);
+    }
+  }
 }
 
+/* ********************************************************************************* */
+
 u_int32_t ndpi_bytestream_to_number(const u_int8_t * str, u_int16_t max_chars_to_read, u_int16_t * bytes_read)
 {
   u_int32_t val;
@@ -3884,254 +6241,254 @@ u_int32_t ndpi_bytestream_to_ipv4(const u_int8_t * str, u_int16_t max_chars_to_r
   return htonl(val);
 }
 
+/*
+  HTTP header lines of interest. ndpi_parse_header_line() only checks the
+  entries starting with the first letter of the line: keep them grouped
+  by first letter, in the order they are checked (a later match of the
+  same line overwrites the value of an earlier one).
+*/
+struct ndpi_header_line {
+  const char *name;
+  u_int8_t name_len;
+  u_int8_t optional_space;   /* the value starts after name and an optional space */
+  int16_t value_offset;      /* offsetof(struct ndpi_packet_lines, ...), -1 to only count */
+};
+
+#define NDPI_HEADER(name, value)    { name, sizeof(name) - 1, 0, offsetof(struct ndpi_packet_lines, value) }
+#define NDPI_HEADER_SP(name, value) { name, sizeof(name) - 1, 1, offsetof(struct ndpi_packet_lines, value) }
+#define NDPI_HEADER_COUNT(name)     { name, sizeof(name) - 1, 0, -1 }
+
+static const struct ndpi_header_line ndpi_header_lines[] = {
+  /* a: 0 */
+  NDPI_HEADER("Accept: ", accept_line),
+  NDPI_HEADER_COUNT("Accept-Ranges: "),
+  NDPI_HEADER_COUNT("Accept-Language: "),
+  NDPI_HEADER_COUNT("Accept-Encoding: "),
+  /* c: 4 */
+  NDPI_HEADER("Content-Type: ", content_line),
+  NDPI_HEADER("Content-type:", content_line), /* Probably a bogus response without space after ":" */
+  NDPI_HEADER("Content-Encoding: ", http_encoding),
+  NDPI_HEADER("Content-Length: ", http_contentlen),
+  NDPI_HEADER("Cookie: ", http_cookie),
+  NDPI_HEADER_COUNT("Connection: "),
+  /* d: 10 */
+  NDPI_HEADER_COUNT("Date: "),
+  /* e: 11 */
+  NDPI_HEADER_COUNT("ETag: "),
+  NDPI_HEADER_COUNT("Expires: "),
+  /* h: 13 */
+  NDPI_HEADER_SP("Host:", host_line),
+  /* k: 14 */
+  NDPI_HEADER_COUNT("Keep-Alive: "),
+  /* l: 15 */
+  NDPI_HEADER_COUNT("Last-Modified: "),
+  /* o: 16 */
+  NDPI_HEADER("Origin: ", http_origin),
+  /* p: 17 */
+  NDPI_HEADER_COUNT("Pragma: "),
+  /* r: 18 */
+  NDPI_HEADER("Referer: ", referer_line),
+  /* s: 19 */
+  NDPI_HEADER_SP("Server:", server_line),
+  NDPI_HEADER_COUNT("Set-Cookie: "),
+  /* t: 21 */
+  NDPI_HEADER("Transfer-Encoding: ", http_transfer_encoding),
+  /* u: 22 */
+  NDPI_HEADER("User-Agent: ", user_agent_line),
+  NDPI_HEADER_COUNT("Upgrade-Insecure-Requests: "),
+  /* v: 24 */
+  NDPI_HEADER_COUNT("Vary: "),
+  /* x: 25 */
+  NDPI_HEADER_SP("X-Forwarded-For:", forwarded_line),
+  NDPI_HEADER("X-Session-Type: ", http_x_session_type),
+  /* 27 */
+};
+
+/* First entry of ndpi_header_lines[] for each letter, then the end of the letter ('a'..'z', 27) */
+static const u_int8_t ndpi_header_lines_by_letter[27] = {
+  /* a */ 0, /* b */ 4, /* c */ 4, /* d */ 10, /* e */ 11, /* f */ 13, /* g */ 13, /* h */ 13,
+  /* i */ 14, /* j */ 14, /* k */ 14, /* l */ 15, /* m */ 16, /* n */ 16, /* o */ 16, /* p */ 17,
+  /* q */ 18, /* r */ 18, /* s */ 19, /* t */ 21, /* u */ 22, /* v */ 24, /* w */ 25, /* x */ 25,
+  /* y */ 27, /* z */ 27, 27
+};
+
+/* ********************************************************************************* */
+
+/* strncasecmp() of a name made of ASCII characters, on a non NUL-terminated buffer */
+static inline int ndpi_header_name_match(const u_int8_t *ptr, const char *name, u_int32_t len) {
+  u_int32_t i;
+
+  for(i = 0; i < len; i++) {
+    u_int8_t c = ptr[i], n = (u_int8_t)name[i];
+
+    if((c != n) && (((n | 0x20) < 'a') || ((n | 0x20) > 'z') || ((c | 0x20) != (n | 0x20))))
+      return(0);
+  }
+
+  return(1);
+}
+
+/* ********************************************************************************* */
+
+static void ndpi_parse_header_line(struct ndpi_packet_lines *lines, const struct ndpi_int_one_line_struct *line) {
+  u_int32_t letter, i;
+
+  if(line->len == 0)
+    return;
+
+  letter = (line->ptr[0] | 0x20) - 'a';
+  if(letter >= 26)
+    return;
+
+  for(i = ndpi_header_lines_by_letter[letter]; i < ndpi_header_lines_by_letter[letter + 1]; i++) {
+    const struct ndpi_header_line *h = &ndpi_header_lines[i];
+    u_int32_t offset = h->name_len;
+
+    /* A value of at least one character (two with the optional space) */
+    if((line->len <= h->name_len + h->optional_space) || (!ndpi_header_name_match(line->ptr, h->name, h->name_len)))
+      continue;
+
+    if(h->value_offset >= 0) {
+      struct ndpi_int_one_line_struct *value = (struct ndpi_int_one_line_struct*)((u_int8_t*)lines + h->value_offset);
+
+      /* some stupid clients omit a space and place the value directly after the colon */
+      if(h->optional_space && (line->ptr[offset] == ' '))
+	offset++;
+
+      value->ptr = &line->ptr[offset], value->len = line->len - offset;
+    }
+
+    lines->http_num_headers++;
+  }
+}
+
+/* ********************************************************************************* */
+
+/*
+  Returns the offset of the first CR+LF ("\r\n") of payload starting in
+  [offset, last], or -1. payload[last + 1] must be readable.
+*/
+static int32_t ndpi_find_crlf(const u_int8_t *payload, u_int32_t offset, u_int32_t last) {
+#if defined(__AVX2__)
+  const __m256i cr = _mm256_set1_epi8('\r');
+
+  /* Whole vectors up to payload[last + 2], the last readable byte */
+  for(; offset + 32 <= last + 3; offset += 32) {
+    u_int32_t m = (u_int32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)&payload[offset]), cr));
+
+    for(; m != 0; m &= m - 1) {
+      u_int32_t a = offset + ndpi_ctz(m);
+
+      if(a > last) return(-1);
+      if(payload[a + 1] == '\n') return(a);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i cr = _mm_set1_epi8('\r');
+
+  for(; offset + 16 <= last + 3; offset += 16) {
+    u_int32_t m = (u_int32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)&payload[offset]), cr));
+
+    for(; m != 0; m &= m - 1) {
+      u_int32_t a = offset + ndpi_ctz(m);
+
+      if(a > last) return(-1);
+      if(payload[a + 1] == '\n') return(a);
+    }
+  }
+#endif
+
+  while(offset <= last) {
+    const u_int8_t *cr = (const u_int8_t*)memchr(&payload[offset], '\r', last - offset + 1);
+
+    if(cr == NULL)
+      break;
+
+    offset = (u_int32_t)(cr - payload);
+    if(payload[offset + 1] == '\n')
+      return(offset);
+
+    offset++;
+  }
+
+  return(-1);
+}
+
+/* ********************************************************************************* */
+
 /* internal function for every detection to parse one packet and to increase the info buffer */
 void ndpi_parse_packet_line_info(struct ndpi_detection_module_struct *ndpi_struct,
 				 struct ndpi_flow_struct *flow)
 {
-  u_int32_t a;
+  int32_t a;
   struct ndpi_packet_struct *packet = &flow->packet;
-  u_int16_t end = packet->payload_packet_len - 1;
-  if(packet->packet_lines_parsed_complete != 0)
-    return;
+  struct ndpi_packet_lines *lines = packet->lines;
+  struct ndpi_int_one_line_struct *line;
 
-  packet->packet_lines_parsed_complete = 1;
-  packet->parsed_lines = 0;
-
-  packet->empty_line_position_set = 0;
-
-  packet->host_line.ptr = NULL;
-  packet->host_line.len = 0;
-  packet->referer_line.ptr = NULL;
-  packet->referer_line.len = 0;
-  packet->content_line.ptr = NULL;
-  packet->content_line.len = 0;
-  packet->accept_line.ptr = NULL;
-  packet->accept_line.len = 0;
-  packet->user_agent_line.ptr = NULL;
-  packet->user_agent_line.len = 0;
-  packet->http_url_name.ptr = NULL;
-  packet->http_url_name.len = 0;
-  packet->http_encoding.ptr = NULL;
-  packet->http_encoding.len = 0;
-  packet->http_transfer_encoding.ptr = NULL;
-  packet->http_transfer_encoding.len = 0;
-  packet->http_contentlen.ptr = NULL;
-  packet->http_contentlen.len = 0;
-  packet->http_cookie.ptr = NULL;
-  packet->http_cookie.len = 0;
-  packet->http_origin.len = 0;
-  packet->http_origin.ptr = NULL;
-  packet->http_x_session_type.ptr = NULL;
-  packet->http_x_session_type.len = 0;
-  packet->server_line.ptr = NULL;
-  packet->server_line.len = 0;
-  packet->http_method.ptr = NULL;
-  packet->http_method.len = 0;
-  packet->http_response.ptr = NULL;
-  packet->http_response.len = 0;
-  packet->http_num_headers=0;
-
-  if((packet->payload_packet_len == 0)
-     || (packet->payload == NULL)
-     || (end == 0))
+  if(lines->packet_lines_parsed_complete != 0)
     return;
 
-  packet->line[packet->parsed_lines].ptr = packet->payload;
-  packet->line[packet->parsed_lines].len = 0;
+  lines->packet_lines_parsed_complete = 1;
+  ndpi_reset_packet_line_info(lines);
 
-  for(a = 0; a < end-1 /* This because get_u_int16_t(packet->payload, a) reads 2 bytes */; a++) {
-    if(get_u_int16_t(packet->payload, a) == ntohs(0x0d0a)) { /* If end of line char sequence CR+NL "\r\n", process line */
-      packet->line[packet->parsed_lines].len = (u_int16_t)(((unsigned long) &packet->payload[a]) - ((unsigned long) packet->line[packet->parsed_lines].ptr));
-
-      /* First line of a HTTP response parsing. Expected a "HTTP/1.? ???" */
-      if(packet->parsed_lines == 0 && packet->line[0].len >= NDPI_STATICSTRING_LEN("HTTP/1.X 200 ") &&
-	     strncasecmp((const char *)packet->line[0].ptr, "HTTP/1.", NDPI_STATICSTRING_LEN("HTTP/1.")) == 0 &&
-	     packet->line[0].ptr[NDPI_STATICSTRING_LEN("HTTP/1.X ")] > '0' && /* response code between 000 and 699 */
-	     packet->line[0].ptr[NDPI_STATICSTRING_LEN("HTTP/1.X ")] < '6') {
+  if((packet->payload_packet_len <= 1)
+     || (packet->payload == NULL))
+    return;
 
-	    packet->http_response.ptr = &packet->line[0].ptr[NDPI_STATICSTRING_LEN("HTTP/1.1 ")];
-	    packet->http_response.len = packet->line[0].len - NDPI_STATICSTRING_LEN("HTTP/1.1 ");
-	    packet->http_num_headers++;
+  line = &lines->line[0];
+  line->ptr = packet->payload, line->len = 0;
 
-	    /* Set server HTTP response code */
-	    strncpy((char*)flow->http.response_status_code, (char*)packet->http_response.ptr, 3);
-	    flow->http.response_status_code[4]='\0';
+  /* A CR+LF in the last two bytes does not end a line */
+  if(packet->payload_packet_len < 3)
+    return;
 
+  for(a = 0; (a = ndpi_find_crlf(packet->payload, a, packet->payload_packet_len - 3)) >= 0; a += 2) {
+    line->len = (u_int16_t)(&packet->payload[a] - line->ptr);
 
-	    NDPI_LOG_DBG2(ndpi_struct,
-		  "ndpi_parse_packet_line_info: HTTP response parsed: \"%.*s\"\n",
-		   packet->http_response.len, packet->http_response.ptr);
-      }
-      /* "Server:" header line in HTTP response */
-      if(packet->line[packet->parsed_lines].len > NDPI_STATICSTRING_LEN("Server:") + 1
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Server:", NDPI_STATICSTRING_LEN("Server:")) == 0) {
-	    // some stupid clients omit a space and place the servername directly after the colon
-        if(packet->line[packet->parsed_lines].ptr[NDPI_STATICSTRING_LEN("Server:")] == ' ') {
-          packet->server_line.ptr =
-            &packet->line[packet->parsed_lines].ptr[NDPI_STATICSTRING_LEN("Server:") + 1];
-          packet->server_line.len =
-            packet->line[packet->parsed_lines].len - (NDPI_STATICSTRING_LEN("Server:") + 1);
-        } else {
-          packet->server_line.ptr = &packet->line[packet->parsed_lines].ptr[NDPI_STATICSTRING_LEN("Server:")];
-          packet->server_line.len = packet->line[packet->parsed_lines].len - NDPI_STATICSTRING_LEN("Server:");
-        }
-        packet->http_num_headers++;
-      }
-      /* "Host:" header line in HTTP request */
-      if(packet->line[packet->parsed_lines].len > 6
-	 && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr,
-			     "Host:", 5) == 0) {
-        // some stupid clients omit a space and place the hostname directly after the colon
-        if(packet->line[packet->parsed_lines].ptr[5] == ' ') {
-          packet->host_line.ptr = &packet->line[packet->parsed_lines].ptr[6];
-          packet->host_line.len = packet->line[packet->parsed_lines].len - 6;
-        } else {
-          packet->host_line.ptr = &packet->line[packet->parsed_lines].ptr[5];
-          packet->host_line.len = packet->line[packet->parsed_lines].len - 5;
-        }
-        packet->http_num_headers++;
-      }
-      /* "X-Forwarded-For:" header line in HTTP request. Commonly used for HTTP proxies. */
-      if(packet->line[packet->parsed_lines].len > 17
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "X-Forwarded-For:", 16) == 0) {
-        // some stupid clients omit a space and place the hostname directly after the colon
-        if(packet->line[packet->parsed_lines].ptr[16] == ' ') {
-          packet->forwarded_line.ptr = &packet->line[packet->parsed_lines].ptr[17];
-          packet->forwarded_line.len = packet->line[packet->parsed_lines].len - 17;
-        } else {
-          packet->forwarded_line.ptr = &packet->line[packet->parsed_lines].ptr[16];
-          packet->forwarded_line.len = packet->line[packet->parsed_lines].len - 16;
-        }
-        packet->http_num_headers++;
-      }
-      /* "Content-Type:" header line in HTTP. */
-      if(packet->line[packet->parsed_lines].len > 14
-	     && (strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Content-Type: ", 14) == 0
-	         || strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Content-type: ", 14) == 0)) {
-        packet->content_line.ptr = &packet->line[packet->parsed_lines].ptr[14];
-        packet->content_line.len = packet->line[packet->parsed_lines].len - 14;
-        packet->http_num_headers++;
-      }
-      /* "Content-Type:" header line in HTTP AGAIN. Probably a bogus response without space after ":" */
-      if(packet->line[packet->parsed_lines].len > 13
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Content-type:", 13) == 0) {
-        packet->content_line.ptr = &packet->line[packet->parsed_lines].ptr[13];
-        packet->content_line.len = packet->line[packet->parsed_lines].len - 13;
-        packet->http_num_headers++;
-      }
-      /* "Accept:" header line in HTTP request. */
-      if(packet->line[packet->parsed_lines].len > 8
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Accept: ", 8) == 0) {
-        packet->accept_line.ptr = &packet->line[packet->parsed_lines].ptr[8];
-        packet->accept_line.len = packet->line[packet->parsed_lines].len - 8;
-        packet->http_num_headers++;
-      }
-      /* "Referer:" header line in HTTP request. */
-      if(packet->line[packet->parsed_lines].len > 9
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Referer: ", 9) == 0) {
-        packet->referer_line.ptr = &packet->line[packet->parsed_lines].ptr[9];
-        packet->referer_line.len = packet->line[packet->parsed_lines].len - 9;
-        packet->http_num_headers++;
-      }
-      /* "User-Agent:" header line in HTTP request. */
-      if(packet->line[packet->parsed_lines].len > 12
-	     && (strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "User-Agent: ", 12) == 0
-	         || strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "User-agent: ", 12) == 0)) {
-        packet->user_agent_line.ptr = &packet->line[packet->parsed_lines].ptr[12];
-        packet->user_agent_line.len = packet->line[packet->parsed_lines].len - 12;
-        packet->http_num_headers++;
-      }
-      /* "Content-Encoding:" header line in HTTP response (and request?). */
-      if(packet->line[packet->parsed_lines].len > 18
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Content-Encoding: ", 18) == 0) {
-        packet->http_encoding.ptr = &packet->line[packet->parsed_lines].ptr[18];
-        packet->http_encoding.len = packet->line[packet->parsed_lines].len - 18;
-        packet->http_num_headers++;
-      }
-      /* "Transfer-Encoding:" header line in HTTP. */
-      if(packet->line[packet->parsed_lines].len > 19
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Transfer-Encoding: ", 19) == 0) {
-        packet->http_transfer_encoding.ptr = &packet->line[packet->parsed_lines].ptr[19];
-        packet->http_transfer_encoding.len = packet->line[packet->parsed_lines].len - 19;
-        packet->http_num_headers++;
-      }
-      /* "Content-Length:" header line in HTTP. */
-      if(packet->line[packet->parsed_lines].len > 16
-	     && ((strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Content-Length: ", 16) == 0)
-	     || (strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "content-length: ", 16) == 0))) {
-        packet->http_contentlen.ptr = &packet->line[packet->parsed_lines].ptr[16];
-        packet->http_contentlen.len = packet->line[packet->parsed_lines].len - 16;
-        packet->http_num_headers++;
-      }
-      /* "Cookie:" header line in HTTP. */
-      if(packet->line[packet->parsed_lines].len > 8
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Cookie: ", 8) == 0) {
-        packet->http_cookie.ptr = &packet->line[packet->parsed_lines].ptr[8];
-        packet->http_cookie.len = packet->line[packet->parsed_lines].len - 8;
-        packet->http_num_headers++;
-      }
-      /* "Origin:" header line in HTTP. */
-      if(packet->line[packet->parsed_lines].len > 8
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Origin: ", 8) == 0) {
-        packet->http_origin.ptr = &packet->line[packet->parsed_lines].ptr[8];
-        packet->http_origin.len = packet->line[packet->parsed_lines].len - 8;
-        packet->http_num_headers++;
-      }
-      /* "X-Session-Type:" header line in HTTP. */
-      if(packet->line[packet->parsed_lines].len > 16
-	     && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "X-Session-Type: ", 16) == 0) {
-        packet->http_x_session_type.ptr = &packet->line[packet->parsed_lines].ptr[16];
-        packet->http_x_session_type.len = packet->line[packet->parsed_lines].len - 16;
-        packet->http_num_headers++;
-      }
-      /* Identification and counting of other HTTP headers.
-       * We consider the most common headers, but there are many others,
-       * which can be seen at references below:
-       * - https://tools.ietf.org/html/rfc7230
-       * - https://en.wikipedia.org/wiki/List_of_HTTP_header_fields
-       */
-      if((packet->line[packet->parsed_lines].len >  6 && ( strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Date: ", 6) == 0 ||
-                                                           strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Vary: ", 6) == 0 ||
-                                                           strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "ETag: ", 6) == 0 )) ||
-         (packet->line[packet->parsed_lines].len >  8 && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Pragma: ", 8) == 0) ||
-         (packet->line[packet->parsed_lines].len >  9 && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Expires: ", 9) == 0) ||
-         (packet->line[packet->parsed_lines].len > 12 && ( strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Set-Cookie: ", 12) == 0 ||
-                                                           strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Keep-Alive: ", 12) == 0 ||
-                                                           strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Connection: ", 12) == 0)) ||
-         (packet->line[packet->parsed_lines].len > 15 && ( strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Last-Modified: ", 15) == 0 ||
-                                                           strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Accept-Ranges: ", 15) == 0)) ||
-         (packet->line[packet->parsed_lines].len > 17 && ( strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Accept-Language: ", 17) == 0 ||
-                                                           strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Accept-Encoding: ", 17) == 0)) ||
-         (packet->line[packet->parsed_lines].len > 27 && strncasecmp((const char *)packet->line[packet->parsed_lines].ptr, "Upgrade-Insecure-Requests: ", 27) == 0)) {
-        /* Just count. In the future, if needed, this if can be splited to parse these headers */
-        packet->http_num_headers++;
-      }
+    /* First line of a HTTP response parsing. Expected a "HTTP/1.? ???" */
+    if(lines->parsed_lines == 0 && line->len >= NDPI_STATICSTRING_LEN("HTTP/1.X 200 ") &&
+       strncasecmp((const char *)line->ptr, "HTTP/1.", NDPI_STATICSTRING_LEN("HTTP/1.")) == 0 &&
+       line->ptr[NDPI_STATICSTRING_LEN("HTTP/1.X ")] > '0' && /* response code between 000 and 699 */
+       line->ptr[NDPI_STATICSTRING_LEN("HTTP/1.X ")] < '6') {
 
+      lines->http_response.ptr = &line->ptr[NDPI_STATICSTRING_LEN("HTTP/1.1 ")];
+      lines->http_response.len = line->len - NDPI_STATICSTRING_LEN("HTTP/1.1 ");
+      lines->http_num_headers++;
 
-      if(packet->line[packet->parsed_lines].len == 0) {
-        packet->empty_line_position = a;
-        packet->empty_line_position_set = 1;
+      /* Set server HTTP response code */
+      if(ndpi_flow_cold(flow)) {
+	strncpy((char*)flow->cold->http.response_status_code, (char*)lines->http_response.ptr, 3);
+	flow->cold->http.response_status_code[4]='\0';
       }
 
-      if(packet->parsed_lines >= (NDPI_MAX_PARSE_LINES_PER_PACKET - 1))
-        return;
+      NDPI_LOG_DBG2(ndpi_struct,
+		    "ndpi_parse_packet_line_info: HTTP response parsed: \"%.*s\"\n",
+		    lines->http_response.len, lines->http_response.ptr);
+    }
 
-      packet->parsed_lines++;
-      packet->line[packet->parsed_lines].ptr = &packet->payload[a + 2];
-      packet->line[packet->parsed_lines].len = 0;
+    /* Identification and counting of the HTTP headers.
+     * We consider the most common headers, but there are many others,
+     * which can be seen at references below:
+     * - https://tools.ietf.org/html/rfc7230
+     * - https://en.wikipedia.org/wiki/List_of_HTTP_header_fields
+     */
+    ndpi_parse_header_line(lines, line);
+
+    if(line->len == 0) {
+      lines->empty_line_position = a;
+      lines->empty_line_position_set = 1;
+    }
 
-      if((a + 2) >= packet->payload_packet_len)
-	    return;
+    if(lines->parsed_lines >= (NDPI_MAX_PARSE_LINES_PER_PACKET - 1))
+      return;
 
-      a++; /* next char in the payload */
-    }
+    line = &lines->line[++lines->parsed_lines];
+    line->ptr = &packet->payload[a + 2], line->len = 0;
   }
 
-  if(packet->parsed_lines >= 1) {
-    packet->line[packet->parsed_lines].len
-      = (u_int16_t)(((unsigned long) &packet->payload[packet->payload_packet_len]) -
-		    ((unsigned long) packet->line[packet->parsed_lines].ptr));
-    packet->parsed_lines++;
+  if(lines->parsed_lines >= 1) {
+    line->len = (u_int16_t)(&packet->payload[packet->payload_packet_len] - line->ptr);
+    lines->parsed_lines++;
   }
 }
 
@@ -4142,33 +6499,33 @@ void ndpi_parse_packet_line_info_any(struct ndpi_detection_module_struct *ndpi_s
   u_int32_t a;
   u_int16_t end = packet->payload_packet_len;
 
-  if(packet->packet_lines_parsed_complete != 0)
+  if(packet->lines->packet_lines_parsed_complete != 0)
     return;
 
-  packet->packet_lines_parsed_complete = 1;
-  packet->parsed_lines = 0;
+  packet->lines->packet_lines_parsed_complete = 1;
+  packet->lines->parsed_lines = 0;
 
   if(packet->payload_packet_len == 0)
     return;
 
-  packet->line[packet->parsed_lines].ptr = packet->payload;
-  packet->line[packet->parsed_lines].len = 0;
+  packet->lines->line[packet->lines->parsed_lines].ptr = packet->payload;
+  packet->lines->line[packet->lines->parsed_lines].len = 0;
 
   for(a = 0; a < end; a++) {
     if(packet->payload[a] == 0x0a) {
-      packet->line[packet->parsed_lines].len = (u_int16_t)(
+      packet->lines->line[packet->lines->parsed_lines].len = (u_int16_t)(
 							   ((unsigned long) &packet->payload[a]) -
-							   ((unsigned long) packet->line[packet->parsed_lines].ptr));
+							   ((unsigned long) packet->lines->line[packet->lines->parsed_lines].ptr));
 
       if(a > 0 && packet->payload[a-1] == 0x0d)
-        packet->line[packet->parsed_lines].len--;
+        packet->lines->line[packet->lines->parsed_lines].len--;
 
-      if(packet->parsed_lines >= (NDPI_MAX_PARSE_LINES_PER_PACKET - 1))
+      if(packet->lines->parsed_lines >= (NDPI_MAX_PARSE_LINES_PER_PACKET - 1))
         break;
 
-      packet->parsed_lines++;
-      packet->line[packet->parsed_lines].ptr = &packet->payload[a + 1];
-      packet->line[packet->parsed_lines].len = 0;
+      packet->lines->parsed_lines++;
+      packet->lines->line[packet->lines->parsed_lines].ptr = &packet->payload[a + 1];
+      packet->lines->line[packet->lines->parsed_lines].len = 0;
 
       if((a + 1) >= packet->payload_packet_len)
         break;
@@ -4311,6 +6668,10 @@ u_int16_t ndpi_get_flow_masterprotocol(struct ndpi_detection_module_struct *ndpi
   return(flow->detected_protocol_stack[1]);
 }
 
+const char* ndpi_get_flow_host_server_name(struct ndpi_flow_struct *flow) {
+  return(flow->cold ? (const char*)flow->cold->host_server_name : "");
+}
+
 void ndpi_int_change_flow_protocol(struct ndpi_detection_module_struct *ndpi_struct,
 				   struct ndpi_flow_struct *flow,
 				   u_int16_t upper_detected_protocol,
@@ -4909,20 +7270,19 @@ int ndpi_match_string_subprotocol(struct ndpi_detection_module_struct *ndpi_stru
 				  char *string_to_match, u_int string_to_match_len,
 				  u_int8_t is_host_match) {
   int matching_protocol_id = NDPI_PROTOCOL_UNKNOWN;
-  AC_TEXT_t ac_input_text;
   ndpi_automa *automa = is_host_match ? &ndpi_struct->host_automa : &ndpi_struct->content_automa;
 
   if((automa->ac_automa == NULL) || (string_to_match_len == 0)) return(NDPI_PROTOCOL_UNKNOWN);
 
-  if(!automa->ac_automa_finalized) {
-    ac_automata_finalize((AC_AUTOMATA_t*)automa->ac_automa);
-    automa->ac_automa_finalized = 1;
-  }
-
-  ac_input_text.astring = string_to_match, ac_input_text.length = string_to_match_len;
-  ac_automata_search(((AC_AUTOMATA_t*)automa->ac_automa), &ac_input_text, (void*)&matching_protocol_id);
+  /* Only for applications that did not call ndpi_finalize_initialization() */
+  ndpi_automa_finalize(automa);
 
-  ac_automata_reset(((AC_AUTOMATA_t*)automa->ac_automa));
+  if(is_host_match && ndpi_struct->host_match_most_specific)
+    matching_protocol_id = ndpi_automa_search_most_specific((AC_AUTOMATA_t*)automa->ac_automa,
+							    string_to_match, string_to_match_len);
+  else
+    ndpi_automa_search((AC_AUTOMATA_t*)automa->ac_automa, string_to_match, string_to_match_len,
+		       (void*)&matching_protocol_id);
 
   return(matching_protocol_id);
 }
@@ -4995,20 +7355,15 @@ int ndpi_match_content_subprotocol(struct ndpi_detection_module_struct *ndpi_str
 
 int ndpi_match_bigram(struct ndpi_detection_module_struct *ndpi_struct,
 		      ndpi_automa *automa, char *bigram_to_match) {
-  AC_TEXT_t ac_input_text;
   int ret = 0;
 
   if((automa->ac_automa == NULL) || (bigram_to_match == NULL))
     return(ret);
 
-  if(!automa->ac_automa_finalized) {
-    ac_automata_finalize((AC_AUTOMATA_t*)automa->ac_automa);
-    automa->ac_automa_finalized = 1;
-  }
+  /* Only for applications that did not call ndpi_finalize_initialization() */
+  ndpi_automa_finalize(automa);
 
-  ac_input_text.astring = bigram_to_match, ac_input_text.length = 2;
-  ac_automata_search(((AC_AUTOMATA_t*)automa->ac_automa), &ac_input_text, (void*)&ret);
-  ac_automata_reset(((AC_AUTOMATA_t*)automa->ac_automa));
+  ndpi_automa_search((AC_AUTOMATA_t*)automa->ac_automa, bigram_to_match, 2, (void*)&ret);
 
   return(ret);
 }
@@ -5017,10 +7372,7 @@ int ndpi_match_bigram(struct ndpi_detection_module_struct *ndpi_struct,
 
 void ndpi_free_flow(struct ndpi_flow_struct *flow) {
   if(flow) {
-    if(flow->http.url)
-      ndpi_free(flow->http.url);
-    if(flow->http.content_type)
-      ndpi_free(flow->http.content_type);
+    ndpi_free_flow_data(flow);
     ndpi_free(flow);
   }
 }
@@ -5054,25 +7406,13 @@ int gettimeofday(struct timeval * tp, struct timezone * tzp) {
 }
 #endif
 
+/* Kept for the ABI: see ndpi_bitmask_intersects() and ndpi_bitmask_is_empty() */
 int NDPI_BITMASK_COMPARE(NDPI_PROTOCOL_BITMASK a, NDPI_PROTOCOL_BITMASK b) {
-  int i;
-
-  for(i=0; i<NDPI_NUM_FDS_BITS; i++) {
-    if(a.fds_bits[i] & b.fds_bits[i])
-      return(1);
-  }
-
-  return(0);
+  return(ndpi_bitmask_intersects(&a, &b));
 }
 
 int NDPI_BITMASK_IS_EMPTY(NDPI_PROTOCOL_BITMASK a) {
-  int i;
-
-  for(i=0; i<NDPI_NUM_FDS_BITS; i++)
-    if(a.fds_bits[i] != 0)
-      return(0);
-
-  return(1);
+  return(ndpi_bitmask_is_empty(&a));
 }
 
 void NDPI_DUMP_BITMASK(NDPI_PROTOCOL_BITMASK a) {
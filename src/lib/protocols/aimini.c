@@ -241,8 +241,8 @@ void ndpi_search_aimini(struct ndpi_detection_module_struct *ndpi_struct, struct
 			 (memcmp(packet->payload, "GET /play/?fid=", NDPI_STATICSTRING_LEN("GET /play/?fid=")) == 0))) {
 			NDPI_LOG_DBG2(ndpi_struct, "HTTP packet detected\n");
 			ndpi_parse_packet_line_info(ndpi_struct, flow);
-			if (packet->host_line.ptr != NULL && packet->host_line.len > 11
-				&& (memcmp(&packet->host_line.ptr[packet->host_line.len - 11], ".aimini.net", 11) == 0)) {
+			if (packet->lines->host_line.ptr != NULL && packet->lines->host_line.len > 11
+				&& (memcmp(&packet->lines->host_line.ptr[packet->lines->host_line.len - 11], ".aimini.net", 11) == 0)) {
 				NDPI_LOG_INFO(ndpi_struct, "found AIMINI HTTP traffic\n");
 				ndpi_int_aimini_add_connection(ndpi_struct, flow);
 				return;
@@ -255,7 +255,7 @@ void ndpi_search_aimini(struct ndpi_detection_module_struct *ndpi_struct, struct
 					memcmp(&packet->payload[NDPI_STATICSTRING_LEN("GET /")], "download/",
 						   NDPI_STATICSTRING_LEN("download/")) == 0) {
 					ndpi_parse_packet_line_info(ndpi_struct, flow);
-					if (is_special_aimini_host(packet->host_line) == 1) {
+					if (is_special_aimini_host(packet->lines->host_line) == 1) {
 						NDPI_LOG_INFO(ndpi_struct,
 								"found AIMINI HTTP traffic\n");
 						ndpi_int_aimini_add_connection(ndpi_struct, flow);
@@ -266,7 +266,7 @@ void ndpi_search_aimini(struct ndpi_detection_module_struct *ndpi_struct, struct
 				if (memcmp(&packet->payload[NDPI_STATICSTRING_LEN("POST /")], "upload/",
 						   NDPI_STATICSTRING_LEN("upload/")) == 0) {
 					ndpi_parse_packet_line_info(ndpi_struct, flow);
-					if (is_special_aimini_host(packet->host_line) == 1) {
+					if (is_special_aimini_host(packet->lines->host_line) == 1) {
 						NDPI_LOG_INFO(ndpi_struct,
 								"found AIMINI HTTP traffic detected.\n");
 						ndpi_int_aimini_add_connection(ndpi_struct, flow);
@@ -73,7 +73,7 @@ static void ndpi_add_connection_as_bittorrent(struct ndpi_detection_module_struc
     } else
       bt_hash = (const char*)&flow->packet.payload[28];
 
-    if(bt_hash) memcpy(flow->protos.bittorrent.hash, bt_hash, 20);
+    if(bt_hash && ndpi_flow_cold(flow)) memcpy(flow->cold->protos.bittorrent.hash, bt_hash, 20);
   }
 
   ndpi_int_change_protocol(ndpi_struct, flow, NDPI_PROTOCOL_BITTORRENT, NDPI_PROTOCOL_UNKNOWN);
@@ -139,20 +139,20 @@ static u_int8_t ndpi_int_search_bittorrent_tcp_zero(struct ndpi_detection_module
     /* parse complete get packet here into line structure elements */
     ndpi_parse_packet_line_info(ndpi_struct, flow);
     /* answer to this pattern is HTTP....Server: hypertracker */
-    if(packet->user_agent_line.ptr != NULL
-	&& ((packet->user_agent_line.len > 8 && memcmp(packet->user_agent_line.ptr, "Azureus ", 8) == 0)
-	    || (packet->user_agent_line.len >= 10 && memcmp(packet->user_agent_line.ptr, "BitTorrent", 10) == 0)
-	    || (packet->user_agent_line.len >= 11 && memcmp(packet->user_agent_line.ptr, "BTWebClient", 11) == 0))) {
+    if(packet->lines->user_agent_line.ptr != NULL
+	&& ((packet->lines->user_agent_line.len > 8 && memcmp(packet->lines->user_agent_line.ptr, "Azureus ", 8) == 0)
+	    || (packet->lines->user_agent_line.len >= 10 && memcmp(packet->lines->user_agent_line.ptr, "BitTorrent", 10) == 0)
+	    || (packet->lines->user_agent_line.len >= 11 && memcmp(packet->lines->user_agent_line.ptr, "BTWebClient", 11) == 0))) {
       NDPI_LOG_INFO(ndpi_struct, "found BT: Azureus /Bittorrent user agent\n");
       ndpi_add_connection_as_bittorrent(ndpi_struct, flow, -1, 1,
 			NDPI_PROTOCOL_SAFE_DETECTION, NDPI_PROTOCOL_WEBSEED_DETECTION);
       return 1;
     }
 
-    if(packet->user_agent_line.ptr != NULL
-       && (packet->user_agent_line.len >= 9 && memcmp(packet->user_agent_line.ptr, "Shareaza ", 9) == 0)
-       && (packet->parsed_lines > 8 && packet->line[8].ptr != 0
-	   && packet->line[8].len >= 9 && memcmp(packet->line[8].ptr, "X-Queue: ", 9) == 0)) {
+    if(packet->lines->user_agent_line.ptr != NULL
+       && (packet->lines->user_agent_line.len >= 9 && memcmp(packet->lines->user_agent_line.ptr, "Shareaza ", 9) == 0)
+       && (packet->lines->parsed_lines > 8 && packet->lines->line[8].ptr != 0
+	   && packet->lines->line[8].len >= 9 && memcmp(packet->lines->line[8].ptr, "X-Queue: ", 9) == 0)) {
       NDPI_LOG_INFO(ndpi_struct, "found BT: Shareaza detected\n");
       ndpi_add_connection_as_bittorrent(ndpi_struct, flow, -1, 1,
 			NDPI_PROTOCOL_SAFE_DETECTION, NDPI_PROTOCOL_WEBSEED_DETECTION);
@@ -160,32 +160,32 @@ static u_int8_t ndpi_int_search_bittorrent_tcp_zero(struct ndpi_detection_module
     }
 
     /* this is a self built client, not possible to catch asymmetrically */
-    if((packet->parsed_lines == 10 || (packet->parsed_lines == 11 && packet->line[11].len == 0))
-	&& packet->user_agent_line.ptr != NULL
-	&& packet->user_agent_line.len > 12
-	&& memcmp(packet->user_agent_line.ptr, "Mozilla/4.0 ",
+    if((packet->lines->parsed_lines == 10 || (packet->lines->parsed_lines == 11 && packet->lines->line[11].len == 0))
+	&& packet->lines->user_agent_line.ptr != NULL
+	&& packet->lines->user_agent_line.len > 12
+	&& memcmp(packet->lines->user_agent_line.ptr, "Mozilla/4.0 ",
 		  12) == 0
-	&& packet->host_line.ptr != NULL
-	&& packet->host_line.len >= 7
-	&& packet->line[2].ptr != NULL
-	&& packet->line[2].len > 14
-	&& memcmp(packet->line[2].ptr, "Keep-Alive: 300", 15) == 0
-	&& packet->line[3].ptr != NULL
-	&& packet->line[3].len > 21
-	&& memcmp(packet->line[3].ptr, "Connection: Keep-alive", 22) == 0
-	&& packet->line[4].ptr != NULL
-	&& packet->line[4].len > 10
-	&& (memcmp(packet->line[4].ptr, "Accpet: */*", 11) == 0
-	    || memcmp(packet->line[4].ptr, "Accept: */*", 11) == 0)
-
-	&& packet->line[5].ptr != NULL
-	&& packet->line[5].len > 12
-	&& memcmp(packet->line[5].ptr, "Range: bytes=", 13) == 0
-	&& packet->line[7].ptr != NULL
-	&& packet->line[7].len > 15
-	&& memcmp(packet->line[7].ptr, "Pragma: no-cache", 16) == 0
-	&& packet->line[8].ptr != NULL
-	&& packet->line[8].len > 22 && memcmp(packet->line[8].ptr, "Cache-Control: no-cache", 23) == 0) {
+	&& packet->lines->host_line.ptr != NULL
+	&& packet->lines->host_line.len >= 7
+	&& packet->lines->line[2].ptr != NULL
+	&& packet->lines->line[2].len > 14
+	&& memcmp(packet->lines->line[2].ptr, "Keep-Alive: 300", 15) == 0
+	&& packet->lines->line[3].ptr != NULL
+	&& packet->lines->line[3].len > 21
+	&& memcmp(packet->lines->line[3].ptr, "Connection: Keep-alive", 22) == 0
+	&& packet->lines->line[4].ptr != NULL
+	&& packet->lines->line[4].len > 10
+	&& (memcmp(packet->lines->line[4].ptr, "Accpet: */*", 11) == 0
+	    || memcmp(packet->lines->line[4].ptr, "Accept: */*", 11) == 0)
+
+	&& packet->lines->line[5].ptr != NULL
+	&& packet->lines->line[5].len > 12
+	&& memcmp(packet->lines->line[5].ptr, "Range: bytes=", 13) == 0
+	&& packet->lines->line[7].ptr != NULL
+	&& packet->lines->line[7].len > 15
+	&& memcmp(packet->lines->line[7].ptr, "Pragma: no-cache", 16) == 0
+	&& packet->lines->line[8].ptr != NULL
+	&& packet->lines->line[8].len > 22 && memcmp(packet->lines->line[8].ptr, "Cache-Control: no-cache", 23) == 0) {
 
       NDPI_LOG_INFO(ndpi_struct, "found BT: Bitcomet LTS\n");
       ndpi_add_connection_as_bittorrent(ndpi_struct, flow, -1, 1,
@@ -194,23 +194,23 @@ static u_int8_t ndpi_int_search_bittorrent_tcp_zero(struct ndpi_detection_module
     }
 
     /* FlashGet pattern */
-    if(packet->parsed_lines == 8
-	&& packet->user_agent_line.ptr != NULL
-	&& packet->user_agent_line.len > (sizeof("Mozilla/4.0 (compatible; MSIE 6.0;") - 1)
-	&& memcmp(packet->user_agent_line.ptr, "Mozilla/4.0 (compatible; MSIE 6.0;",
+    if(packet->lines->parsed_lines == 8
+	&& packet->lines->user_agent_line.ptr != NULL
+	&& packet->lines->user_agent_line.len > (sizeof("Mozilla/4.0 (compatible; MSIE 6.0;") - 1)
+	&& memcmp(packet->lines->user_agent_line.ptr, "Mozilla/4.0 (compatible; MSIE 6.0;",
 		  sizeof("Mozilla/4.0 (compatible; MSIE 6.0;") - 1) == 0
-	&& packet->host_line.ptr != NULL
-	&& packet->host_line.len >= 7
-	&& packet->line[2].ptr != NULL
-	&& packet->line[2].len == 11
-	&& memcmp(packet->line[2].ptr, "Accept: */*", 11) == 0
-	&& packet->line[3].ptr != NULL && packet->line[3].len >= (sizeof("Referer: ") - 1)
-	&& memcmp(packet->line[3].ptr, "Referer: ", sizeof("Referer: ") - 1) == 0
-	&& packet->line[5].ptr != NULL
-	&& packet->line[5].len > 13
-	&& memcmp(packet->line[5].ptr, "Range: bytes=", 13) == 0
-	&& packet->line[6].ptr != NULL
-	&& packet->line[6].len > 21 && memcmp(packet->line[6].ptr, "Connection: Keep-Alive", 22) == 0) {
+	&& packet->lines->host_line.ptr != NULL
+	&& packet->lines->host_line.len >= 7
+	&& packet->lines->line[2].ptr != NULL
+	&& packet->lines->line[2].len == 11
+	&& memcmp(packet->lines->line[2].ptr, "Accept: */*", 11) == 0
+	&& packet->lines->line[3].ptr != NULL && packet->lines->line[3].len >= (sizeof("Referer: ") - 1)
+	&& memcmp(packet->lines->line[3].ptr, "Referer: ", sizeof("Referer: ") - 1) == 0
+	&& packet->lines->line[5].ptr != NULL
+	&& packet->lines->line[5].len > 13
+	&& memcmp(packet->lines->line[5].ptr, "Range: bytes=", 13) == 0
+	&& packet->lines->line[6].ptr != NULL
+	&& packet->lines->line[6].len > 21 && memcmp(packet->lines->line[6].ptr, "Connection: Keep-Alive", 22) == 0) {
 
       NDPI_LOG_INFO(ndpi_struct, "found BT: FlashGet\n");
       ndpi_add_connection_as_bittorrent(ndpi_struct, flow, -1, 1,
@@ -218,20 +218,20 @@ static u_int8_t ndpi_int_search_bittorrent_tcp_zero(struct ndpi_detection_module
       return 1;
     }
 
-    if(packet->parsed_lines == 7
-	&& packet->user_agent_line.ptr != NULL
-	&& packet->user_agent_line.len > (sizeof("Mozilla/4.0 (compatible; MSIE 6.0;") - 1)
-	&& memcmp(packet->user_agent_line.ptr, "Mozilla/4.0 (compatible; MSIE 6.0;",
+    if(packet->lines->parsed_lines == 7
+	&& packet->lines->user_agent_line.ptr != NULL
+	&& packet->lines->user_agent_line.len > (sizeof("Mozilla/4.0 (compatible; MSIE 6.0;") - 1)
+	&& memcmp(packet->lines->user_agent_line.ptr, "Mozilla/4.0 (compatible; MSIE 6.0;",
 		  sizeof("Mozilla/4.0 (compatible; MSIE 6.0;") - 1) == 0
-	&& packet->host_line.ptr != NULL
-	&& packet->host_line.len >= 7
-	&& packet->line[2].ptr != NULL
-	&& packet->line[2].len == 11
-	&& memcmp(packet->line[2].ptr, "Accept: */*", 11) == 0
-	&& packet->line[3].ptr != NULL && packet->line[3].len >= (sizeof("Referer: ") - 1)
-	&& memcmp(packet->line[3].ptr, "Referer: ", sizeof("Referer: ") - 1) == 0
-	&& packet->line[5].ptr != NULL
-	&& packet->line[5].len > 21 && memcmp(packet->line[5].ptr, "Connection: Keep-Alive", 22) == 0) {
+	&& packet->lines->host_line.ptr != NULL
+	&& packet->lines->host_line.len >= 7
+	&& packet->lines->line[2].ptr != NULL
+	&& packet->lines->line[2].len == 11
+	&& memcmp(packet->lines->line[2].ptr, "Accept: */*", 11) == 0
+	&& packet->lines->line[3].ptr != NULL && packet->lines->line[3].len >= (sizeof("Referer: ") - 1)
+	&& memcmp(packet->lines->line[3].ptr, "Referer: ", sizeof("Referer: ") - 1) == 0
+	&& packet->lines->line[5].ptr != NULL
+	&& packet->lines->line[5].len > 21 && memcmp(packet->lines->line[5].ptr, "Connection: Keep-Alive", 22) == 0) {
 
       NDPI_LOG_INFO(ndpi_struct, "found BT: FlashGet\n");
       ndpi_add_connection_as_bittorrent(ndpi_struct, flow, -1, 1,
@@ -340,8 +340,8 @@ static u_int8_t ndpi_int_search_bittorrent_tcp_zero(struct ndpi_detection_module
 
       ndpi_parse_packet_line_info(ndpi_struct, flow);
       /* haven't fount this pattern anywhere */
-      if(packet->host_line.ptr != NULL
-	  && packet->host_line.len >= 9 && memcmp(packet->host_line.ptr, "ip2p.com:", 9) == 0) {
+      if(packet->lines->host_line.ptr != NULL
+	  && packet->lines->host_line.len >= 9 && memcmp(packet->lines->host_line.ptr, "ip2p.com:", 9) == 0) {
 	NDPI_LOG_INFO(ndpi_struct, "found BT: Warez - Plain Host: ip2p.com: pattern\n");
 	ndpi_add_connection_as_bittorrent(ndpi_struct, flow, -1, 1,
 			NDPI_PROTOCOL_SAFE_DETECTION, NDPI_PROTOCOL_WEBSEED_DETECTION);
@@ -472,8 +472,8 @@ void ndpi_search_bittorrent(struct ndpi_detection_module_struct *ndpi_struct, st
 	       || (bt_proto = ndpi_strnstr((const char *)packet->payload, "BitTorrent protocol", packet->payload_packet_len))
 	       ) {
 	    bittorrent_found:
-	      if(bt_proto && (packet->payload_packet_len > 47))
-		memcpy(flow->protos.bittorrent.hash, &bt_proto[27], 20);
+	      if(bt_proto && (packet->payload_packet_len > 47) && ndpi_flow_cold(flow))
+		memcpy(flow->cold->protos.bittorrent.hash, &bt_proto[27], 20);
 
 	      NDPI_LOG_INFO(ndpi_struct, "found BT: plain\n");
 	      ndpi_add_connection_as_bittorrent(ndpi_struct, flow, -1, 0,
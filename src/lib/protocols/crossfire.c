@@ -57,14 +57,14 @@ void ndpi_search_crossfire_tcp_udp(struct ndpi_detection_module_struct *ndpi_str
 
 		if (packet->payload_packet_len > 4 && memcmp(packet->payload, "GET /", 5) == 0) {
 			ndpi_parse_packet_line_info(ndpi_struct, flow);
-			if (packet->parsed_lines == 8
-				&& (packet->line[0].ptr != NULL && packet->line[0].len >= 30
+			if (packet->lines->parsed_lines == 8
+				&& (packet->lines->line[0].ptr != NULL && packet->lines->line[0].len >= 30
 					&& (memcmp(&packet->payload[5], "notice/login_big", 16) == 0
 						|| memcmp(&packet->payload[5], "notice/login_small", 18) == 0))
-				&& memcmp(&packet->payload[packet->line[0].len - 19], "/index.asp HTTP/1.", 18) == 0
-				&& (packet->host_line.ptr != NULL && packet->host_line.len >= 13
-					&& (memcmp(packet->host_line.ptr, "crossfire", 9) == 0
-						|| memcmp(packet->host_line.ptr, "www.crossfire", 13) == 0))
+				&& memcmp(&packet->payload[packet->lines->line[0].len - 19], "/index.asp HTTP/1.", 18) == 0
+				&& (packet->lines->host_line.ptr != NULL && packet->lines->host_line.len >= 13
+					&& (memcmp(packet->lines->host_line.ptr, "crossfire", 9) == 0
+						|| memcmp(packet->lines->host_line.ptr, "www.crossfire", 13) == 0))
 				) {
 			     NDPI_LOG_DBG(ndpi_struct, "found Crossfire: HTTP request\n");
 			     ndpi_int_crossfire_add_connection(ndpi_struct, flow);
@@ -99,9 +99,9 @@ void ndpi_search_dhcp_udp(struct ndpi_detection_module_struct *ndpi_struct, stru
 	  } else if(id == 55 /* Parameter Request List / Fingerprint */) {
 	    u_int idx, offset = 0;
 
-	    for(idx=0; idx<len; idx++) {
-	      snprintf((char*)&flow->protos.dhcp.fingerprint[offset],
-		       sizeof(flow->protos.dhcp.fingerprint)-offset-1,
+	    for(idx=0; (idx<len) && ndpi_flow_cold(flow); idx++) {
+	      snprintf((char*)&flow->cold->protos.dhcp.fingerprint[offset],
+		       sizeof(flow->cold->protos.dhcp.fingerprint)-offset-1,
 		       "%02X",  dhcp->options[i+2+idx] & 0xFF);
 	      offset += 2;
 	    }
@@ -109,9 +109,11 @@ void ndpi_search_dhcp_udp(struct ndpi_detection_module_struct *ndpi_struct, stru
 	    char *name = (char*)&dhcp->options[i+2];
 	    int j = 0;
 
-	    j = ndpi_min(len, sizeof(flow->protos.dhcp.class_ident)-1);
-	    strncpy((char*)flow->protos.dhcp.class_ident, name, j);
-	    flow->protos.dhcp.class_ident[j] = '\0';
+	    if(ndpi_flow_cold(flow)) {
+	      j = ndpi_min(len, sizeof(flow->cold->protos.dhcp.class_ident)-1);
+	      strncpy((char*)flow->cold->protos.dhcp.class_ident, name, j);
+	      flow->cold->protos.dhcp.class_ident[j] = '\0';
+	    }
 	  } else if(id == 12 /* Host Name */) {
 	    char *name = (char*)&dhcp->options[i+2];
 	    int j = 0;
@@ -120,9 +122,11 @@ void ndpi_search_dhcp_udp(struct ndpi_detection_module_struct *ndpi_struct, stru
 	    NDPI_LOG_DBG2(ndpi_struct, "[DHCP] '%.*s'\n",name,len);
 //	    while(j < len) { printf( "%c", name[j]); j++; }; printf("\n");
 #endif
-	    j = ndpi_min(len, sizeof(flow->host_server_name)-1);
-	    strncpy((char*)flow->host_server_name, name, j);
-	    flow->host_server_name[j] = '\0';
+	    if(ndpi_flow_cold(flow)) {
+	      j = ndpi_min(len, sizeof(flow->cold->host_server_name)-1);
+	      strncpy((char*)flow->cold->host_server_name, name, j);
+	      flow->cold->host_server_name[j] = '\0';
+	    }
 	  }
 
 	  i += len + 2;
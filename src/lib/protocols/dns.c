@@ -87,6 +87,7 @@ void ndpi_search_dns(struct ndpi_detection_module_struct *ndpi_struct, struct nd
   if((s_port == 53 || d_port == 53 || d_port == 5355)
      && (flow->packet.payload_packet_len > sizeof(struct ndpi_dns_packet_header)+x)) {
     struct ndpi_dns_packet_header dns_header;
+    struct ndpi_flow_cold_struct *cold;
     int invalid = 0;
 
     memcpy(&dns_header, (struct ndpi_dns_packet_header*) &flow->packet.payload[x], sizeof(struct ndpi_dns_packet_header));
@@ -108,6 +109,10 @@ void ndpi_search_dns(struct ndpi_detection_module_struct *ndpi_struct, struct nd
       invalid = 1;
 
     if(!invalid) {
+      /* The query and its reply are kept in the cold part of the flow */
+      if((cold = ndpi_flow_cold(flow)) == NULL)
+	return;
+
       if(is_query) {
 	/* DNS Request */
 	if((dns_header.num_queries > 0) && (dns_header.num_queries <= NDPI_MAX_DNS_REQUESTS)
@@ -119,9 +124,9 @@ void ndpi_search_dns(struct ndpi_detection_module_struct *ndpi_struct, struct nd
 	    while(x < flow->packet.payload_packet_len) {
 	      if(flow->packet.payload[x] == '\0') {
 		x++;
-		flow->protos.dns.query_type = get16(&x, flow->packet.payload);
+		cold->protos.dns.query_type = get16(&x, flow->packet.payload);
 #ifdef DNS_DEBUG		
-    		NDPI_LOG_DBG2(ndpi_struct, "query_type=%2d\n", flow->protos.dns.query_type);
+    		NDPI_LOG_DBG2(ndpi_struct, "query_type=%2d\n", cold->protos.dns.query_type);
 #endif
 		break;
 	      } else
@@ -134,7 +139,7 @@ void ndpi_search_dns(struct ndpi_detection_module_struct *ndpi_struct, struct nd
       } else {
 	/* DNS Reply */
 
-	flow->protos.dns.reply_code = dns_header.flags & 0x0F;
+	cold->protos.dns.reply_code = dns_header.flags & 0x0F;
 
 	if((dns_header.num_queries > 0) && (dns_header.num_queries <= NDPI_MAX_DNS_REQUESTS) /* Don't assume that num_queries must be zero */
 	   && (((dns_header.num_answers > 0) && (dns_header.num_answers <= NDPI_MAX_DNS_REQUESTS))
@@ -173,7 +178,7 @@ void ndpi_search_dns(struct ndpi_detection_module_struct *ndpi_struct, struct nd
 		  x += data_len;
  
 		rsp_type = get16(&x, flow->packet.payload);
-		flow->protos.dns.rsp_type = rsp_type;
+		cold->protos.dns.rsp_type = rsp_type;
 		break;
 	      }
 	    }
@@ -187,13 +192,13 @@ void ndpi_search_dns(struct ndpi_detection_module_struct *ndpi_struct, struct nd
       }
 
       /* extract host name server */
-      int j = 0, max_len = sizeof(flow->host_server_name)-1, off = sizeof(struct ndpi_dns_packet_header) + 1;
+      int j = 0, max_len = sizeof(cold->host_server_name)-1, off = sizeof(struct ndpi_dns_packet_header) + 1;
 
       while(off < flow->packet.payload_packet_len && flow->packet.payload[off] != '\0') {
-	flow->host_server_name[j] = flow->packet.payload[off];
+	cold->host_server_name[j] = flow->packet.payload[off];
 	if(j < max_len) {
-	  if(flow->host_server_name[j] < ' ')
-	    flow->host_server_name[j] = '.';
+	  if(cold->host_server_name[j] < ' ')
+	    cold->host_server_name[j] = '.';
 	  j++;
 	} else
 	  break;
@@ -204,21 +209,21 @@ void ndpi_search_dns(struct ndpi_detection_module_struct *ndpi_struct, struct nd
 	if(is_query && ndpi_struct->dns_dissect_response)
 	  return; /* The response will set the verdict */
 
-      flow->host_server_name[j] = '\0';
+      cold->host_server_name[j] = '\0';
 
-      flow->protos.dns.num_queries = (u_int8_t)dns_header.num_queries,
-	flow->protos.dns.num_answers = (u_int8_t) (dns_header.num_answers + dns_header.authority_rrs + dns_header.additional_rrs);
+      cold->protos.dns.num_queries = (u_int8_t)dns_header.num_queries,
+	cold->protos.dns.num_answers = (u_int8_t) (dns_header.num_answers + dns_header.authority_rrs + dns_header.additional_rrs);
 
       if(j > 0)
 	ndpi_match_host_subprotocol(ndpi_struct, flow, 
-				    (char *)flow->host_server_name,
-				    strlen((const char*)flow->host_server_name),
+				    (char *)cold->host_server_name,
+				    strlen((const char*)cold->host_server_name),
 				    NDPI_PROTOCOL_DNS);
 
 #ifdef DNS_DEBUG
       NDPI_LOG_DBG2(ndpi_struct, "[num_queries=%d][num_answers=%d][reply_code=%u][rsp_type=%u][host_server_name=%s]\n",
-	     flow->protos.dns.num_queries, flow->protos.dns.num_answers,
-	     flow->protos.dns.reply_code, flow->protos.dns.rsp_type, flow->host_server_name
+	     cold->protos.dns.num_queries, cold->protos.dns.num_answers,
+	     cold->protos.dns.reply_code, cold->protos.dns.rsp_type, cold->host_server_name
 	     );
 #endif
     
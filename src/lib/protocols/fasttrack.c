@@ -66,9 +66,9 @@ void ndpi_search_fasttrack_tcp(struct ndpi_detection_module_struct *ndpi_struct,
 			u_int8_t a = 0;
 			NDPI_LOG_DBG2(ndpi_struct, "detected GET /. \n");
 			ndpi_parse_packet_line_info(ndpi_struct, flow);
-			for (a = 0; a < packet->parsed_lines; a++) {
-				if ((packet->line[a].len > 17 && memcmp(packet->line[a].ptr, "X-Kazaa-Username: ", 18) == 0)
-					|| (packet->line[a].len > 23 && memcmp(packet->line[a].ptr, "User-Agent: PeerEnabler/", 24) == 0)) {
+			for (a = 0; a < packet->lines->parsed_lines; a++) {
+				if ((packet->lines->line[a].len > 17 && memcmp(packet->lines->line[a].ptr, "X-Kazaa-Username: ", 18) == 0)
+					|| (packet->lines->line[a].len > 23 && memcmp(packet->lines->line[a].ptr, "User-Agent: PeerEnabler/", 24) == 0)) {
 					NDPI_LOG_INFO(ndpi_struct,
 							"found FASTTRACK X-Kazaa-Username: || User-Agent: PeerEnabler/\n");
 					ndpi_int_fasttrack_add_connection(ndpi_struct, flow);
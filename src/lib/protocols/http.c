@@ -60,10 +60,10 @@ static void flash_check_http_payload(struct ndpi_detection_module_struct
   struct ndpi_packet_struct *packet = &flow->packet;
   const u_int8_t *pos;
 
-  if(packet->empty_line_position_set == 0 || (packet->empty_line_position + 10) > (packet->payload_packet_len))
+  if(packet->lines->empty_line_position_set == 0 || (packet->lines->empty_line_position + 10) > (packet->payload_packet_len))
     return;
 
-  pos = &packet->payload[packet->empty_line_position] + 2;
+  pos = &packet->payload[packet->lines->empty_line_position] + 2;
 
   if(memcmp(pos, "FLV", 3) == 0 && pos[3] == 0x01 && (pos[4] == 0x01 || pos[4] == 0x04 || pos[4] == 0x05)
      && pos[5] == 0x00 && pos[6] == 0x00 && pos[7] == 0x00 && pos[8] == 0x09) {
@@ -81,12 +81,12 @@ static void avi_check_http_payload(struct ndpi_detection_module_struct *ndpi_str
 
 
   NDPI_LOG_DBG2(ndpi_struct, "called avi_check_http_payload: %u %u %u\n",
-	   packet->empty_line_position_set, flow->l4.tcp.http_empty_line_seen, packet->empty_line_position);
+	   packet->lines->empty_line_position_set, flow->l4.tcp.http_empty_line_seen, packet->lines->empty_line_position);
 
-  if(packet->empty_line_position_set == 0 && flow->l4.tcp.http_empty_line_seen == 0)
+  if(packet->lines->empty_line_position_set == 0 && flow->l4.tcp.http_empty_line_seen == 0)
     return;
 
-  if(packet->empty_line_position_set != 0 && ((packet->empty_line_position + 20) > (packet->payload_packet_len))
+  if(packet->lines->empty_line_position_set != 0 && ((packet->lines->empty_line_position + 20) > (packet->payload_packet_len))
      && flow->l4.tcp.http_empty_line_seen == 0) {
     flow->l4.tcp.http_empty_line_seen = 1;
     return;
@@ -105,9 +105,9 @@ static void avi_check_http_payload(struct ndpi_detection_module_struct *ndpi_str
   /**
      for reference see http://msdn.microsoft.com/archive/default.asp?url=/archive/en-us/directx9_c/directx/htm/avirifffilereference.asp
   **/
-  if(packet->empty_line_position_set != 0) {
+  if(packet->lines->empty_line_position_set != 0) {
 
-    u_int32_t p = packet->empty_line_position + 2;
+    u_int32_t p = packet->lines->empty_line_position + 2;
 
     // check for avi header
     NDPI_LOG_DBG2(ndpi_struct, "p = %u\n", p);
@@ -128,12 +128,12 @@ static void teamviewer_check_http_payload(struct ndpi_detection_module_struct *n
   const u_int8_t *pos;
 
   NDPI_LOG_DBG2(ndpi_struct, "called teamviewer_check_http_payload: %u %u %u\n",
-	   packet->empty_line_position_set, flow->l4.tcp.http_empty_line_seen, packet->empty_line_position);
+	   packet->lines->empty_line_position_set, flow->l4.tcp.http_empty_line_seen, packet->lines->empty_line_position);
 
-  if(packet->empty_line_position_set == 0 || (packet->empty_line_position + 5) > (packet->payload_packet_len))
+  if(packet->lines->empty_line_position_set == 0 || (packet->lines->empty_line_position + 5) > (packet->payload_packet_len))
     return;
 
-  pos = &packet->payload[packet->empty_line_position] + 2;
+  pos = &packet->payload[packet->lines->empty_line_position] + 2;
 
   if(pos[0] == 0x17 && pos[1] == 0x24) {
     NDPI_LOG_INFO(ndpi_struct, "found TeamViewer content in HTTP\n");
@@ -149,7 +149,7 @@ static void rtsp_parse_packet_acceptline(struct ndpi_detection_module_struct
 {
   struct ndpi_packet_struct *packet = &flow->packet;
 
-  if(packet->accept_line.len >= 28 && memcmp(packet->accept_line.ptr, "application/x-rtsp-tunnelled", 28) == 0) {
+  if(packet->lines->accept_line.len >= 28 && memcmp(packet->lines->accept_line.ptr, "application/x-rtsp-tunnelled", 28) == 0) {
     NDPI_LOG_INFO(ndpi_struct, "found RTSP accept line\n");
     ndpi_int_http_add_connection(ndpi_struct, flow, NDPI_PROTOCOL_RTSP);
   }
@@ -170,12 +170,16 @@ static void setHttpUserAgent(struct ndpi_flow_struct *flow, char *ua) {
    * https://github.com/ua-parser/uap-core/blob/master/regexes.yaml */
 
   //printf("==> %s\n", ua);
-  snprintf((char*)flow->protos.http.detected_os, sizeof(flow->protos.http.detected_os), "%s", ua);
+  if(ndpi_flow_cold(flow))
+    snprintf((char*)flow->cold->protos.http.detected_os, sizeof(flow->cold->protos.http.detected_os), "%s", ua);
 }
 
 static void parseHttpSubprotocol(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow) {
-  if((flow->l4.tcp.http_stage == 0) || (flow->http.url && flow->http_detected)) {
-      char *double_col = strchr((char*)flow->host_server_name, ':');
+  if(flow->cold == NULL)
+    return; /* No host name */
+
+  if((flow->l4.tcp.http_stage == 0) || (flow->cold->http.url && flow->http_detected)) {
+      char *double_col = strchr((char*)flow->cold->host_server_name, ':');
 
       if(double_col) double_col[0] = '\0';
 
@@ -184,8 +188,8 @@ static void parseHttpSubprotocol(struct ndpi_detection_module_struct *ndpi_struc
        If http_dont_dissect_response = 1 dissection of HTTP response
        mime types won't happen
     */
-    ndpi_match_host_subprotocol(ndpi_struct, flow, (char *)flow->host_server_name,
-				strlen((const char *)flow->host_server_name),
+    ndpi_match_host_subprotocol(ndpi_struct, flow, (char *)flow->cold->host_server_name,
+				strlen((const char *)flow->cold->host_server_name),
 				NDPI_PROTOCOL_HTTP);
   }
 }
@@ -224,69 +228,73 @@ static void check_content_type_and_change_protocol(struct ndpi_detection_module_
   }
 #endif
 
+  /* The cold part of the flow is only allocated when a field is set */
   if(!ndpi_struct->http_dont_dissect_response) {
-    if((flow->http.url == NULL)
-       && (packet->http_url_name.len > 0)
-       && (packet->host_line.len > 0)) {
-      int len = packet->http_url_name.len + packet->host_line.len + 7 + 1; /* "http://" */
-
-      flow->http.url = ndpi_malloc(len);
-      if(flow->http.url) {
-	strncpy(flow->http.url, "http://", 7);
-	strncpy(&flow->http.url[7], (char*)packet->host_line.ptr, packet->host_line.len);
-	strncpy(&flow->http.url[7+packet->host_line.len], (char*)packet->http_url_name.ptr,
-		packet->http_url_name.len);
-	flow->http.url[len-1] = '\0';
+    if(((flow->cold == NULL) || (flow->cold->http.url == NULL))
+       && (packet->lines->http_url_name.len > 0)
+       && (packet->lines->host_line.len > 0)
+       && ndpi_flow_cold(flow)) {
+      int len = packet->lines->http_url_name.len + packet->lines->host_line.len + 7 + 1; /* "http://" */
+
+      flow->cold->http.url = ndpi_malloc(len);
+      if(flow->cold->http.url) {
+	strncpy(flow->cold->http.url, "http://", 7);
+	strncpy(&flow->cold->http.url[7], (char*)packet->lines->host_line.ptr, packet->lines->host_line.len);
+	strncpy(&flow->cold->http.url[7+packet->lines->host_line.len], (char*)packet->lines->http_url_name.ptr,
+		packet->lines->http_url_name.len);
+	flow->cold->http.url[len-1] = '\0';
       }
 
-      if(flow->packet.http_method.len < 3)
-        flow->http.method = HTTP_METHOD_UNKNOWN;
+      if(flow->packet.lines->http_method.len < 3)
+        flow->cold->http.method = HTTP_METHOD_UNKNOWN;
       else {
-        switch(flow->packet.http_method.ptr[0]) {
-        case 'O':  flow->http.method = HTTP_METHOD_OPTIONS; break;
-        case 'G':  flow->http.method = HTTP_METHOD_GET; break;
-        case 'H':  flow->http.method = HTTP_METHOD_HEAD; break;
+        switch(flow->packet.lines->http_method.ptr[0]) {
+        case 'O':  flow->cold->http.method = HTTP_METHOD_OPTIONS; break;
+        case 'G':  flow->cold->http.method = HTTP_METHOD_GET; break;
+        case 'H':  flow->cold->http.method = HTTP_METHOD_HEAD; break;
 
         case 'P':
-          switch(flow->packet.http_method.ptr[1]) {
-          case 'O': flow->http.method = HTTP_METHOD_POST; break;
-          case 'U': flow->http.method = HTTP_METHOD_PUT; break;
+          switch(flow->packet.lines->http_method.ptr[1]) {
+          case 'O': flow->cold->http.method = HTTP_METHOD_POST; break;
+          case 'U': flow->cold->http.method = HTTP_METHOD_PUT; break;
           }
           break;
 
-        case 'D':   flow->http.method = HTTP_METHOD_DELETE; break;
-        case 'T':   flow->http.method = HTTP_METHOD_TRACE; break;
-        case 'C':   flow->http.method = HTTP_METHOD_CONNECT; break;
+        case 'D':   flow->cold->http.method = HTTP_METHOD_DELETE; break;
+        case 'T':   flow->cold->http.method = HTTP_METHOD_TRACE; break;
+        case 'C':   flow->cold->http.method = HTTP_METHOD_CONNECT; break;
         default:
-          flow->http.method = HTTP_METHOD_UNKNOWN;
+          flow->cold->http.method = HTTP_METHOD_UNKNOWN;
           break;
         }
       }
     }
 
-    if((flow->http.content_type == NULL) && (packet->content_line.len > 0)) {
-      int len = packet->content_line.len + 1;
+    if(((flow->cold == NULL) || (flow->cold->http.content_type == NULL))
+       && (packet->lines->content_line.len > 0)
+       && ndpi_flow_cold(flow)) {
+      int len = packet->lines->content_line.len + 1;
 
-      flow->http.content_type = ndpi_malloc(len);
-      if(flow->http.content_type) {
-	strncpy(flow->http.content_type, (char*)packet->content_line.ptr,
-		packet->content_line.len);
-	flow->http.content_type[packet->content_line.len] = '\0';
+      flow->cold->http.content_type = ndpi_malloc(len);
+      if(flow->cold->http.content_type) {
+	strncpy(flow->cold->http.content_type, (char*)packet->lines->content_line.ptr,
+		packet->lines->content_line.len);
+	flow->cold->http.content_type[packet->lines->content_line.len] = '\0';
       }
     }
   }
 
-  if(packet->user_agent_line.ptr != NULL && packet->user_agent_line.len != 0) {
+  if(packet->lines->user_agent_line.ptr != NULL && packet->lines->user_agent_line.len != 0) {
     /**
        Format examples:
          Mozilla/5.0 (iPad; U; CPU OS 3_2 like Mac OS X; en-us) AppleWebKit/531.21.10 (KHTML, like Gecko) ....
          Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:54.0) Gecko/20100101 Firefox/54.0
     */
-    if(packet->user_agent_line.len > 7) {
+    if(packet->lines->user_agent_line.len > 7) {
       char ua[256];
-      u_int mlen = ndpi_min(packet->user_agent_line.len, sizeof(ua)-1);
+      u_int mlen = ndpi_min(packet->lines->user_agent_line.len, sizeof(ua)-1);
 
-      strncpy(ua, (const char *)packet->user_agent_line.ptr, mlen);
+      strncpy(ua, (const char *)packet->lines->user_agent_line.ptr, mlen);
       ua[mlen] = '\0';
 
       if(strncmp(ua, "Mozilla", 7) == 0) {
@@ -342,34 +350,38 @@ static void check_content_type_and_change_protocol(struct ndpi_detection_module_
     }
 
     NDPI_LOG_DBG2(ndpi_struct, "User Agent Type line found %.*s\n",
-	     packet->user_agent_line.len, packet->user_agent_line.ptr);
+	     packet->lines->user_agent_line.len, packet->lines->user_agent_line.ptr);
   }
 
   /* check for host line */
-  if(packet->host_line.ptr != NULL) {
+  if(packet->lines->host_line.ptr != NULL) {
     u_int len;
 
     NDPI_LOG_DBG2(ndpi_struct, "HOST line found %.*s\n",
-	     packet->host_line.len, packet->host_line.ptr);
+	     packet->lines->host_line.len, packet->lines->host_line.ptr);
 
     /* call ndpi_match_host_subprotocol to see if there is a match with known-host HTTP subprotocol */
     if((ndpi_struct->http_dont_dissect_response) || flow->http_detected)
       ndpi_match_host_subprotocol(ndpi_struct, flow,
-				  (char*)packet->host_line.ptr,
-				  packet->host_line.len,
+				  (char*)packet->lines->host_line.ptr,
+				  packet->lines->host_line.len,
 				  NDPI_PROTOCOL_HTTP);
 
     /* Copy result for nDPI apps */
-    len = ndpi_min(packet->host_line.len, sizeof(flow->host_server_name)-1);
-    strncpy((char*)flow->host_server_name, (char*)packet->host_line.ptr, len);
-    flow->host_server_name[len] = '\0', flow->server_id = flow->dst;
-
-    if(packet->forwarded_line.ptr) {
-        len = ndpi_min(packet->forwarded_line.len, sizeof(flow->protos.http.nat_ip)-1);
-        strncpy((char*)flow->protos.http.nat_ip, (char*)packet->forwarded_line.ptr, len);
-        flow->protos.http.nat_ip[len] = '\0';
+    if(ndpi_flow_cold(flow)) {
+      len = ndpi_min(packet->lines->host_line.len, sizeof(flow->cold->host_server_name)-1);
+      strncpy((char*)flow->cold->host_server_name, (char*)packet->lines->host_line.ptr, len);
+      flow->cold->host_server_name[len] = '\0';
+
+      if(packet->lines->forwarded_line.ptr) {
+        len = ndpi_min(packet->lines->forwarded_line.len, sizeof(flow->cold->protos.http.nat_ip)-1);
+        strncpy((char*)flow->cold->protos.http.nat_ip, (char*)packet->lines->forwarded_line.ptr, len);
+        flow->cold->protos.http.nat_ip[len] = '\0';
+      }
     }
 
+    flow->server_id = flow->dst;
+
     if(ndpi_struct->http_dont_dissect_response)
       parseHttpSubprotocol(ndpi_struct, flow);
 
@@ -393,10 +405,10 @@ static void check_content_type_and_change_protocol(struct ndpi_detection_module_
 
     if((flow->detected_protocol_stack[0] == NDPI_PROTOCOL_UNKNOWN)
        && ((ndpi_struct->http_dont_dissect_response) || flow->http_detected)
-       && (packet->http_origin.len > 0))
+       && (packet->lines->http_origin.len > 0))
       ndpi_match_host_subprotocol(ndpi_struct, flow,
-				  (char *)packet->http_origin.ptr,
-				  packet->http_origin.len,
+				  (char *)packet->lines->http_origin.ptr,
+				  packet->lines->http_origin.len,
 				  NDPI_PROTOCOL_HTTP);
 
     if(flow->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN) {
@@ -416,9 +428,9 @@ static void check_content_type_and_change_protocol(struct ndpi_detection_module_
     flow->guessed_protocol_id = NDPI_PROTOCOL_HTTP;
 
   /* check for accept line */
-  if(packet->accept_line.ptr != NULL) {
+  if(packet->lines->accept_line.ptr != NULL) {
     NDPI_LOG_DBG2(ndpi_struct, "Accept line found %.*s\n",
-	     packet->accept_line.len, packet->accept_line.ptr);
+	     packet->lines->accept_line.len, packet->lines->accept_line.ptr);
 #ifdef NDPI_PROTOCOL_RTSP
     if(NDPI_COMPARE_PROTOCOL_TO_BITMASK(ndpi_struct->detection_bitmask, NDPI_PROTOCOL_RTSP) != 0) {
       rtsp_parse_packet_acceptline(ndpi_struct, flow);
@@ -428,8 +440,8 @@ static void check_content_type_and_change_protocol(struct ndpi_detection_module_
 
   /* search for line startin with "Icy-MetaData" */
 #ifdef NDPI_CONTENT_MPEG
-  for (a = 0; a < packet->parsed_lines; a++) {
-    if(packet->line[a].len > 11 && memcmp(packet->line[a].ptr, "Icy-MetaData", 12) == 0) {
+  for (a = 0; a < packet->lines->parsed_lines; a++) {
+    if(packet->lines->line[a].len > 11 && memcmp(packet->lines->line[a].ptr, "Icy-MetaData", 12) == 0) {
       NDPI_LOG_INFO(ndpi_struct, "found MPEG: Icy-MetaData\n");
       ndpi_int_http_add_connection(ndpi_struct, flow, NDPI_CONTENT_MPEG);
       return;
@@ -439,13 +451,13 @@ static void check_content_type_and_change_protocol(struct ndpi_detection_module_
 #endif
 #endif
 
-  if(packet->content_line.ptr != NULL && packet->content_line.len != 0) {
+  if(packet->lines->content_line.ptr != NULL && packet->lines->content_line.len != 0) {
     NDPI_LOG_DBG2(ndpi_struct, "Content Type line found %.*s\n",
-	     packet->content_line.len, packet->content_line.ptr);
+	     packet->lines->content_line.len, packet->lines->content_line.ptr);
 
     if((ndpi_struct->http_dont_dissect_response) || flow->http_detected)
       ndpi_match_content_subprotocol(ndpi_struct, flow,
-				     (char*)packet->content_line.ptr, packet->content_line.len,
+				     (char*)packet->lines->content_line.ptr, packet->lines->content_line.len,
 				     NDPI_PROTOCOL_HTTP);
   }
 }
@@ -556,7 +568,7 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
   struct ndpi_packet_struct *packet = &flow->packet;
   u_int16_t filename_start; /* the filename in the request method line, e.g., "GET filename_start..."*/
 
-  packet->packet_lines_parsed_complete = 0;
+  packet->lines->packet_lines_parsed_complete = 0;
 
   /* Check if we so far detected the protocol in the request or not. */
   if(flow->l4.tcp.http_stage == 0) {
@@ -623,12 +635,12 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
 
     ndpi_parse_packet_line_info(ndpi_struct, flow);
 
-    if(packet->parsed_lines <= 1) {
+    if(packet->lines->parsed_lines <= 1) {
       NDPI_LOG_DBG2(ndpi_struct,
 	       "Found just one line, we will look further for the next packet...\n");
 
-      packet->http_method.ptr = packet->line[0].ptr;
-      packet->http_method.len = filename_start - 1;
+      packet->lines->http_method.ptr = packet->lines->line[0].ptr;
+      packet->lines->http_method.len = filename_start - 1;
 
       /* Encode the direction of the packet in the stage, so we will know when we need to look for the response packet. */
       flow->l4.tcp.http_stage = packet->packet_direction + 1; // packet_direction 0: stage 1, packet_direction 1: stage 2
@@ -638,35 +650,38 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
     NDPI_LOG_DBG2(ndpi_struct,
 	     "Found more than one line, we look further for the next packet...\n");
 
-    if(packet->line[0].len >= (9 + filename_start)
-        && memcmp(&packet->line[0].ptr[packet->line[0].len - 9], " HTTP/1.", 8) == 0) { /* Request line complete. Ex. "GET / HTTP/1.1" */
+    if(packet->lines->line[0].len >= (9 + filename_start)
+        && memcmp(&packet->lines->line[0].ptr[packet->lines->line[0].len - 9], " HTTP/1.", 8) == 0) { /* Request line complete. Ex. "GET / HTTP/1.1" */
 
-      packet->http_url_name.ptr = &packet->payload[filename_start];
-      packet->http_url_name.len = packet->line[0].len - (filename_start + 9);
+      packet->lines->http_url_name.ptr = &packet->payload[filename_start];
+      packet->lines->http_url_name.len = packet->lines->line[0].len - (filename_start + 9);
 
-      packet->http_method.ptr = packet->line[0].ptr;
-      packet->http_method.len = filename_start - 1;
+      packet->lines->http_method.ptr = packet->lines->line[0].ptr;
+      packet->lines->http_method.len = filename_start - 1;
 
       // Set the HTTP requested version: 0=HTTP/1.0 and 1=HTTP/1.1
-      if(memcmp(&packet->line[0].ptr[packet->line[0].len - 1], "1", 1) == 0)
-          flow->http.request_version = 1;
-      else
-          flow->http.request_version = 0;
-
-      /* Set the first found headers in request */
-      flow->http.num_request_headers = packet->http_num_headers;
+      if(ndpi_flow_cold(flow)) {
+        if(memcmp(&packet->lines->line[0].ptr[packet->lines->line[0].len - 1], "1", 1) == 0)
+          flow->cold->http.request_version = 1;
+        else
+          flow->cold->http.request_version = 0;
+
+        /* Set the first found headers in request */
+        flow->cold->http.num_request_headers = packet->lines->http_num_headers;
+      }
 
 
       /* Check for Ookla */
-      if((packet->referer_line.len > 0)
-	      && ndpi_strnstr((const char *)packet->referer_line.ptr, "www.speedtest.net", packet->referer_line.len)) {
+      if((packet->lines->referer_line.len > 0)
+	      && ndpi_strnstr((const char *)packet->lines->referer_line.ptr, "www.speedtest.net", packet->lines->referer_line.len)) {
 	    ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_OOKLA, NDPI_PROTOCOL_HTTP);
 	    return;
       }
 
       /* Check for additional field introduced by Steam */
       int x = 1;
-      if((memcmp(packet->line[x].ptr, "x-steam-sid", 11)) == 0) {
+      if((packet->lines->parsed_lines > x) && (packet->lines->line[x].len >= 11)
+	 && (memcmp(packet->lines->line[x].ptr, "x-steam-sid", 11)) == 0) {
 	    NDPI_LOG_INFO(ndpi_struct, "found STEAM\n");
 	    ndpi_int_http_add_connection(ndpi_struct, flow, NDPI_PROTOCOL_STEAM);
 	    check_content_type_and_change_protocol(ndpi_struct, flow);
@@ -675,8 +690,8 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
 
       /* Check for additional field introduced by Facebook */
       x = 1;
-      while(packet->line[x].len != 0) {
-	    if(packet->line[x].len >= 12 && (memcmp(packet->line[x].ptr, "X-FB-SIM-HNI", 12)) == 0) {
+      while((x < packet->lines->parsed_lines) && (packet->lines->line[x].len != 0)) {
+	    if(packet->lines->line[x].len >= 12 && (memcmp(packet->lines->line[x].ptr, "X-FB-SIM-HNI", 12)) == 0) {
 	      NDPI_LOG_INFO(ndpi_struct, "found FACEBOOK\n");
 	      ndpi_int_http_add_connection(ndpi_struct, flow, NDPI_PROTOCOL_FACEBOOK);
 	      check_content_type_and_change_protocol(ndpi_struct, flow);
@@ -700,10 +715,11 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
 
       // additional field in http payload
       x = 1;
-      while((packet->line[x].len >= 4) && (packet->line[x+1].len >= 5) && (packet->line[x+2].len >= 10)) {
-	if(packet->line[x].ptr && ((memcmp(packet->line[x].ptr, "qyid", 4)) == 0)
-	   && packet->line[x+1].ptr && ((memcmp(packet->line[x+1].ptr, "qypid", 5)) == 0)
-	   && packet->line[x+2].ptr && ((memcmp(packet->line[x+2].ptr, "qyplatform", 10)) == 0)
+      while((x + 2 < packet->lines->parsed_lines)
+	    && (packet->lines->line[x].len >= 4) && (packet->lines->line[x+1].len >= 5) && (packet->lines->line[x+2].len >= 10)) {
+	if(packet->lines->line[x].ptr && ((memcmp(packet->lines->line[x].ptr, "qyid", 4)) == 0)
+	   && packet->lines->line[x+1].ptr && ((memcmp(packet->lines->line[x+1].ptr, "qypid", 5)) == 0)
+	   && packet->lines->line[x+2].ptr && ((memcmp(packet->lines->line[x+2].ptr, "qyplatform", 10)) == 0)
 	   ) {
 	  flow->l4.tcp.ppstream_stage++;
 	  flow->iqiyi_counter++;
@@ -717,9 +733,9 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
 #if defined(NDPI_PROTOCOL_1KXUN) || defined(NDPI_PROTOCOL_IQIYI)
       /* Check for 1kxun packet */
       int a;
-      for (a = 0; a < packet->parsed_lines; a++) {
-	if(packet->line[a].len >= 14 && (memcmp(packet->line[a].ptr, "Client-Source:", 14)) == 0) {
-	  if((memcmp(packet->line[a].ptr+15, "1kxun", 5)) == 0) {
+      for (a = 0; a < packet->lines->parsed_lines; a++) {
+	if(packet->lines->line[a].len >= 14 && (memcmp(packet->lines->line[a].ptr, "Client-Source:", 14)) == 0) {
+	  if((memcmp(packet->lines->line[a].ptr+15, "1kxun", 5)) == 0) {
 	    flow->kxun_counter++;
 	    check_content_type_and_change_protocol(ndpi_struct, flow);
 	    return;
@@ -728,8 +744,8 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
       }
 #endif
       
-      if((packet->http_url_name.len > 7)
-          && (!strncmp((const char*) packet->http_url_name.ptr, "http://", 7))) {
+      if((packet->lines->http_url_name.len > 7)
+          && (!strncmp((const char*) packet->lines->http_url_name.ptr, "http://", 7))) {
         NDPI_LOG_INFO(ndpi_struct, "found HTTP_PROXY\n");
         ndpi_int_http_add_connection(ndpi_struct, flow, NDPI_PROTOCOL_HTTP_PROXY);
         check_content_type_and_change_protocol(ndpi_struct, flow);
@@ -745,7 +761,7 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
       NDPI_LOG_DBG2(ndpi_struct,
           "HTTP START Found, we will look for sub-protocols (content and host)...\n");
 
-      if(packet->host_line.ptr != NULL) {
+      if(packet->lines->host_line.ptr != NULL) {
         /**
            nDPI is pretty scrupulous about HTTP so it waits until the
            HTTP response is received just to check that it conforms
@@ -805,9 +821,10 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
       ndpi_parse_packet_line_info(ndpi_struct, flow);
 
       // Add more found HTTP request headers.
-      flow->http.num_request_headers+=packet->http_num_headers;
+      if((packet->lines->http_num_headers > 0) && ndpi_flow_cold(flow))
+        flow->cold->http.num_request_headers+=packet->lines->http_num_headers;
 
-      if(packet->parsed_lines <= 1) {
+      if(packet->lines->parsed_lines <= 1) {
         /* wait some packets in case request is split over more than 2 packets */
         if(flow->packet_counter < 5) {
           NDPI_LOG_DBG2(ndpi_struct, "line still not finished, search next packet\n");
@@ -821,8 +838,8 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
         }
       }
       // http://www.slideshare.net/DSPIP/rtsp-analysis-wireshark
-      if(packet->line[0].len >= 9
-          && memcmp(&packet->line[0].ptr[packet->line[0].len - 9], " HTTP/1.", 8) == 0) {
+      if(packet->lines->line[0].len >= 9
+          && memcmp(&packet->lines->line[0].ptr[packet->lines->line[0].len - 9], " HTTP/1.", 8) == 0) {
 
         NDPI_LOG_INFO(ndpi_struct, "found HTTP\n");
         ndpi_int_http_add_connection(ndpi_struct, flow, NDPI_PROTOCOL_HTTP);
@@ -844,7 +861,7 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
     /* response without headers
      * TODO: Shouldn't it be below  ndpi_parse_packet_line_info, line ~825 ?
      */
-    if((packet->parsed_lines == 1) && (packet->packet_direction == 1 /* server -> client */)) {
+    if((packet->lines->parsed_lines == 1) && (packet->packet_direction == 1 /* server -> client */)) {
       /* In Apache if you do "GET /\n\n" the response comes without any header */
       NDPI_LOG_INFO(ndpi_struct, "found HTTP. (apache)\n");
       ndpi_int_http_add_connection(ndpi_struct, flow, NDPI_PROTOCOL_HTTP);
@@ -862,11 +879,12 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
     ndpi_parse_packet_line_info(ndpi_struct, flow);
     check_content_type_and_change_protocol(ndpi_struct, flow);
 
-    if(packet->packet_direction == 1 /* server -> client */){
-        flow->http.num_response_headers += packet->http_num_headers; /* flow structs are initialized with zeros */
+    if((packet->packet_direction == 1 /* server -> client */)
+       && (packet->lines->http_num_headers > 0) && ndpi_flow_cold(flow)){
+        flow->cold->http.num_response_headers += packet->lines->http_num_headers; /* flow structs are initialized with zeros */
     }
 
-    if(packet->empty_line_position_set != 0 || flow->l4.tcp.http_empty_line_seen == 1) {
+    if(packet->lines->empty_line_position_set != 0 || flow->l4.tcp.http_empty_line_seen == 1) {
       NDPI_LOG_DBG2(ndpi_struct, "empty line. check_http_payload\n");
       check_http_payload(ndpi_struct, flow);
     }
@@ -876,9 +894,48 @@ static void ndpi_check_http_tcp(struct ndpi_detection_module_struct *ndpi_struct
   }
 }
 
+/*
+  Request headers split across segments: with TCP reassembly enabled
+  (ndpi_set_tcp_reassembly()) the segments are buffered until the empty
+  line. Returns -1 while waiting, 1 if the packet payload has been
+  replaced with the headers (to be restored before returning) and 0 when
+  the packet has to be parsed as is.
+*/
+static int http_reassemble_request(struct ndpi_detection_module_struct *ndpi_struct,
+				   struct ndpi_flow_struct *flow) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+  u_int32_t avail = ndpi_tcp_stream_len(flow, NDPI_PROTOCOL_HTTP);
+  const u_int8_t *data;
+
+  if(flow->l4.tcp.http_stage != 0)
+    return(0);
+
+  if(avail == 0) {
+    if((packet->payload_packet_len == 0) || (http_request_url_offset(ndpi_struct, flow) == 0))
+      return(0);
+
+    data = packet->payload, avail = packet->payload_packet_len;
+  } else
+    data = ndpi_tcp_stream_get(ndpi_struct, flow, NDPI_PROTOCOL_HTTP, avail);
+
+  if((ndpi_strnstr((const char *)data, "\r\n\r\n", avail) == NULL)
+     && (ndpi_tcp_stream_get(ndpi_struct, flow, NDPI_PROTOCOL_HTTP, avail + 1) == NULL)
+     && ndpi_tcp_stream_pending(flow, NDPI_PROTOCOL_HTTP))
+    return(-1);
+
+  if(ndpi_tcp_stream_swap_payload(ndpi_struct, flow, NDPI_PROTOCOL_HTTP))
+    return(1);
+
+  ndpi_tcp_stream_stop(flow, NDPI_PROTOCOL_HTTP);
+  return(0);
+}
+
+/* ********************************* */
+
 void ndpi_search_http_tcp(struct ndpi_detection_module_struct *ndpi_struct,
 			  struct ndpi_flow_struct *flow) {
   struct ndpi_packet_struct *packet = &flow->packet;
+  int reassembled;
 
   /* Break after 20 packets. */
   if(flow->packet_counter > 20) {
@@ -892,37 +949,48 @@ void ndpi_search_http_tcp(struct ndpi_detection_module_struct *ndpi_struct,
    }
 
   NDPI_LOG_DBG(ndpi_struct, "search HTTP\n");
+
+  if((reassembled = http_reassemble_request(ndpi_struct, flow)) == -1) {
+    NDPI_LOG_DBG2(ndpi_struct, "HTTP request headers split across segments\n");
+    return;
+  }
+
   ndpi_check_http_tcp(ndpi_struct, flow);
+
+  if(reassembled) {
+    ndpi_tcp_stream_restore_payload(flow);
+    ndpi_tcp_stream_stop(flow, NDPI_PROTOCOL_HTTP);
+  }
 }
 
 /* ********************************* */
 
 ndpi_http_method ndpi_get_http_method(struct ndpi_detection_module_struct *ndpi_mod,
 				      struct ndpi_flow_struct *flow) {
-  if(!flow)
+  if((!flow) || (!flow->cold))
     return(HTTP_METHOD_UNKNOWN);
   else
-    return(flow->http.method);
+    return(flow->cold->http.method);
 }
 
 /* ********************************* */
 
 char* ndpi_get_http_url(struct ndpi_detection_module_struct *ndpi_mod,
 			struct ndpi_flow_struct *flow) {
-  if((!flow) || (!flow->http.url))
+  if((!flow) || (!flow->cold) || (!flow->cold->http.url))
     return("");
   else
-    return(flow->http.url);
+    return(flow->cold->http.url);
 }
 
 /* ********************************* */
 
 char* ndpi_get_http_content_type(struct ndpi_detection_module_struct *ndpi_mod,
 			       struct ndpi_flow_struct *flow) {
-  if((!flow) || (!flow->http.content_type))
+  if((!flow) || (!flow->cold) || (!flow->cold->http.content_type))
     return("");
   else
-    return(flow->http.content_type);
+    return(flow->cold->http.content_type);
 }
 
 
@@ -46,17 +46,17 @@ void ndpi_search_icecast_tcp(struct ndpi_detection_module_struct *ndpi_struct, s
        packet->payload_packet_len >= 7 && memcmp(packet->payload, "SOURCE ", 7) == 0)
       || flow->l4.tcp.icecast_stage) {
     ndpi_parse_packet_line_info_any(ndpi_struct, flow);
-    NDPI_LOG_DBG2(ndpi_struct, "Icecast lines=%d\n", packet->parsed_lines);
-    for (i = 0; i < packet->parsed_lines; i++) {
-      if (packet->line[i].ptr != NULL && packet->line[i].len > 4
-	  && memcmp(packet->line[i].ptr, "ice-", 4) == 0) {
+    NDPI_LOG_DBG2(ndpi_struct, "Icecast lines=%d\n", packet->lines->parsed_lines);
+    for (i = 0; i < packet->lines->parsed_lines; i++) {
+      if (packet->lines->line[i].ptr != NULL && packet->lines->line[i].len > 4
+	  && memcmp(packet->lines->line[i].ptr, "ice-", 4) == 0) {
 	NDPI_LOG_INFO(ndpi_struct, "found Icecast\n");
 	ndpi_int_icecast_add_connection(ndpi_struct, flow);
 	return;
       }
     }
 
-    if (packet->parsed_lines < 1 && !flow->l4.tcp.icecast_stage) {
+    if (packet->lines->parsed_lines < 1 && !flow->l4.tcp.icecast_stage) {
       flow->l4.tcp.icecast_stage = 1;
       return;
     }
@@ -76,8 +76,8 @@ void ndpi_search_icecast_tcp(struct ndpi_detection_module_struct *ndpi_struct, s
 
     ndpi_parse_packet_line_info(ndpi_struct, flow);
 
-    if (packet->server_line.ptr != NULL && packet->server_line.len > NDPI_STATICSTRING_LEN("Icecast") &&
-	memcmp(packet->server_line.ptr, "Icecast", NDPI_STATICSTRING_LEN("Icecast")) == 0) {
+    if (packet->lines->server_line.ptr != NULL && packet->lines->server_line.len > NDPI_STATICSTRING_LEN("Icecast") &&
+	memcmp(packet->lines->server_line.ptr, "Icecast", NDPI_STATICSTRING_LEN("Icecast")) == 0) {
       /* TODO maybe store the previous protocol type as subtype?
        *      e.g. ogg or mpeg
        */
@@ -101,8 +101,8 @@ void ndpi_search_ipp(struct ndpi_detection_module_struct *ndpi_struct, struct nd
 
 	if (packet->payload_packet_len > 3 && memcmp(packet->payload, "POST", 4) == 0) {
 		ndpi_parse_packet_line_info(ndpi_struct, flow);
-		if (packet->content_line.ptr != NULL && packet->content_line.len > 14
-			&& memcmp(packet->content_line.ptr, "application/ipp", 15) == 0) {
+		if (packet->lines->content_line.ptr != NULL && packet->lines->content_line.len > 14
+			&& memcmp(packet->lines->content_line.ptr, "application/ipp", 15) == 0) {
 			NDPI_LOG_INFO(ndpi_struct, "found ipp via POST ... application/ipp\n");
 			ndpi_int_ipp_add_connection(ndpi_struct, flow);
 			return;
@@ -495,8 +495,8 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
 	} else {
 	  flow->l4.tcp.irc_3a_counter++;
 	}
-	for (i = 0; i < packet->parsed_lines; i++) {
-	  if (packet->line[i].ptr[0] == ':') {
+	for (i = 0; i < packet->lines->parsed_lines; i++) {
+	  if (packet->lines->line[i].ptr[0] == ':') {
 	    flow->l4.tcp.irc_3a_counter++;
 	    if (flow->l4.tcp.irc_3a_counter == 7) {	/* ':' == 0x3a */
 	      NDPI_LOG_INFO(ndpi_struct, "found irc. 0x3a. seven times.");
@@ -540,11 +540,11 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
 	if (packet->payload[packet->payload_packet_len - 2] == 0x0d
 	    && packet->payload[packet->payload_packet_len - 1] == 0x0a) {
 	  ndpi_parse_packet_line_info(ndpi_struct, flow);
-	  if (packet->parsed_lines > 1) {
+	  if (packet->lines->parsed_lines > 1) {
 	    NDPI_LOG_DBG2(ndpi_struct, "packet contains more than one line");
-	    for (c = 1; c < packet->parsed_lines; c++) {
-	      if (packet->line[c].len > 4 && (memcmp(packet->line[c].ptr, "NICK ", 5) == 0
-					      || memcmp(packet->line[c].ptr, "USER ", 5) == 0)) {
+	    for (c = 1; c < packet->lines->parsed_lines; c++) {
+	      if (packet->lines->line[c].len > 4 && (memcmp(packet->lines->line[c].ptr, "NICK ", 5) == 0
+					      || memcmp(packet->lines->line[c].ptr, "USER ", 5) == 0)) {
 		NDPI_LOG_INFO(ndpi_struct, "found IRC: two icq signal words in the same packet");
 		ndpi_int_irc_add_connection(ndpi_struct, flow);
 		flow->l4.tcp.irc_stage = 3;
@@ -555,11 +555,11 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
 
 	} else if (packet->payload[packet->payload_packet_len - 1] == 0x0a) {
 	  ndpi_parse_packet_line_info_any(ndpi_struct, flow);
-	  if (packet->parsed_lines > 1) {
+	  if (packet->lines->parsed_lines > 1) {
 	    NDPI_LOG_DBG2(ndpi_struct, "packet contains more than one line");
-	    for (c = 1; c < packet->parsed_lines; c++) {
-	      if (packet->line[c].len > 4 && (memcmp(packet->line[c].ptr, "NICK ", 5) == 0
-						   || memcmp(packet->line[c].ptr, "USER ",
+	    for (c = 1; c < packet->lines->parsed_lines; c++) {
+	      if (packet->lines->line[c].len > 4 && (memcmp(packet->lines->line[c].ptr, "NICK ", 5) == 0
+						   || memcmp(packet->lines->line[c].ptr, "USER ",
 							     5) == 0)) {
 		NDPI_LOG_INFO(ndpi_struct, "found IRC: two icq signal words in the same packet");
 		ndpi_int_irc_add_connection(ndpi_struct, flow);
@@ -583,16 +583,16 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
     //HTTP POST Method being employed
     if (memcmp(packet->payload, "POST ", 5) == 0) {
       ndpi_parse_packet_line_info(ndpi_struct, flow);
-      if (packet->parsed_lines) {
-		  u_int16_t http_header_len = (u_int16_t)((packet->line[packet->parsed_lines - 1].ptr - packet->payload) + 2);
+      if (packet->lines->parsed_lines) {
+		  u_int16_t http_header_len = (u_int16_t)((packet->lines->line[packet->lines->parsed_lines - 1].ptr - packet->payload) + 2);
 	if (packet->payload_packet_len > http_header_len) {
 	  http_content_ptr_len = packet->payload_packet_len - http_header_len;
 	}
-	if ((ndpi_check_for_IRC_traces(packet->line[0].ptr, packet->line[0].len))
-	    || ((packet->http_url_name.ptr)
-		&& (ndpi_check_for_IRC_traces(packet->http_url_name.ptr, packet->http_url_name.len)))
-	    || ((packet->referer_line.ptr)
-		&& (ndpi_check_for_IRC_traces(packet->referer_line.ptr, packet->referer_line.len)))) {
+	if ((ndpi_check_for_IRC_traces(packet->lines->line[0].ptr, packet->lines->line[0].len))
+	    || ((packet->lines->http_url_name.ptr)
+		&& (ndpi_check_for_IRC_traces(packet->lines->http_url_name.ptr, packet->lines->http_url_name.len)))
+	    || ((packet->lines->referer_line.ptr)
+		&& (ndpi_check_for_IRC_traces(packet->lines->referer_line.ptr, packet->lines->referer_line.len)))) {
 	  NDPI_LOG_DBG2(ndpi_struct,
 		   "IRC detected from the Http URL/ Referer header ");
 	  flow->l4.tcp.irc_stage = 1;
@@ -633,13 +633,13 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
     } else {
       return;
     }
-    for (i = 0; i < packet->parsed_lines; i++) {
-      if (packet->line[i].len > 6 && memcmp(packet->line[i].ptr, "NOTICE ", 7) == 0) {
+    for (i = 0; i < packet->lines->parsed_lines; i++) {
+      if (packet->lines->line[i].len > 6 && memcmp(packet->lines->line[i].ptr, "NOTICE ", 7) == 0) {
 	NDPI_LOG_DBG2(ndpi_struct, "NOTICE");
-	for (j = 7; j < packet->line[i].len - 8; j++) {
-	  if (packet->line[i].ptr[j] == ':') {
-	    if (memcmp(&packet->line[i].ptr[j + 1], "DCC SEND ", 9) == 0
-		|| memcmp(&packet->line[i].ptr[j + 1], "DCC CHAT ", 9) == 0) {
+	for (j = 7; j < packet->lines->line[i].len - 8; j++) {
+	  if (packet->lines->line[i].ptr[j] == ':') {
+	    if (memcmp(&packet->lines->line[i].ptr[j + 1], "DCC SEND ", 9) == 0
+		|| memcmp(&packet->lines->line[i].ptr[j + 1], "DCC CHAT ", 9) == 0) {
 	      NDPI_LOG_INFO(ndpi_struct,
 		       "found NOTICE and DCC CHAT or DCC SEND.");
 	    }
@@ -648,13 +648,13 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
       }
       if (packet->payload_packet_len > 0 && packet->payload[0] == 0x3a /* 0x3a = ':' */ ) {
 	NDPI_LOG_DBG2(ndpi_struct, "3a");
-	for (j = 1; j < packet->line[i].len - 9; j++) {
-	  if (packet->line[i].ptr[j] == ' ') {
+	for (j = 1; j < packet->lines->line[i].len - 9; j++) {
+	  if (packet->lines->line[i].ptr[j] == ' ') {
 	    j++;
-	    if (packet->line[i].ptr[j] == 'P') {
+	    if (packet->lines->line[i].ptr[j] == 'P') {
 	      NDPI_LOG_DBG2(ndpi_struct, "P");
 	      j++;
-	      if (memcmp(&packet->line[i].ptr[j], "RIVMSG ", 7) == 0)
+	      if (memcmp(&packet->lines->line[i].ptr[j], "RIVMSG ", 7) == 0)
 		NDPI_LOG_DBG2(ndpi_struct, "RIVMSG");
 	      h = j + 7;
 	      goto read_privmsg;
@@ -662,36 +662,36 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
 	  }
 	}
       }
-      if (packet->line[i].len > 7 && (memcmp(packet->line[i].ptr, "PRIVMSG ", 8) == 0)) {
+      if (packet->lines->line[i].len > 7 && (memcmp(packet->lines->line[i].ptr, "PRIVMSG ", 8) == 0)) {
 	NDPI_LOG_DBG2(ndpi_struct, "PRIVMSG	");
 	h = 7;
       read_privmsg:
-	for (j = h; j < packet->line[i].len - 9; j++) {
-	  if (packet->line[i].ptr[j] == ':') {
-	    if (memcmp(&packet->line[i].ptr[j + 1], "xdcc ", 5) == 0) {
+	for (j = h; j < packet->lines->line[i].len - 9; j++) {
+	  if (packet->lines->line[i].ptr[j] == ':') {
+	    if (memcmp(&packet->lines->line[i].ptr[j + 1], "xdcc ", 5) == 0) {
 	      NDPI_LOG_DBG2(ndpi_struct, "xdcc should match.");
 	    }
 	    j += 2;
-	    if (memcmp(&packet->line[i].ptr[j], "DCC ", 4) == 0) {
+	    if (memcmp(&packet->lines->line[i].ptr[j], "DCC ", 4) == 0) {
 	      j += 4;
 	      NDPI_LOG_DBG2(ndpi_struct, "found DCC.");
-	      if (memcmp(&packet->line[i].ptr[j], "SEND ", 5) == 0
-		  || (memcmp(&packet->line[i].ptr[j], "CHAT", 4) == 0)
-		  || (memcmp(&packet->line[i].ptr[j], "chat", 4) == 0)
-		  || (memcmp(&packet->line[i].ptr[j], "sslchat", 7) == 0)
-		  || (memcmp(&packet->line[i].ptr[j], "TSEND", 5) == 0)) {
+	      if (memcmp(&packet->lines->line[i].ptr[j], "SEND ", 5) == 0
+		  || (memcmp(&packet->lines->line[i].ptr[j], "CHAT", 4) == 0)
+		  || (memcmp(&packet->lines->line[i].ptr[j], "chat", 4) == 0)
+		  || (memcmp(&packet->lines->line[i].ptr[j], "sslchat", 7) == 0)
+		  || (memcmp(&packet->lines->line[i].ptr[j], "TSEND", 5) == 0)) {
 		NDPI_LOG_DBG2(ndpi_struct, "found CHAT,chat,sslchat,TSEND.");
 		j += 4;
 
-		while (packet->line[i].len > j &&
-		       ((packet->line[i].ptr[j] >= 'a' && packet->line[i].ptr[j] <= 'z')
-			|| (packet->line[i].ptr[j] >= 'A' && packet->line[i].ptr[j] <= 'Z')
-			|| (packet->line[i].ptr[j] >= '0' && packet->line[i].ptr[j] <= '9')
-			|| (packet->line[i].ptr[j] >= ' ')
-			|| (packet->line[i].ptr[j] >= '.')
-			|| (packet->line[i].ptr[j] >= '-'))) {
+		while (packet->lines->line[i].len > j &&
+		       ((packet->lines->line[i].ptr[j] >= 'a' && packet->lines->line[i].ptr[j] <= 'z')
+			|| (packet->lines->line[i].ptr[j] >= 'A' && packet->lines->line[i].ptr[j] <= 'Z')
+			|| (packet->lines->line[i].ptr[j] >= '0' && packet->lines->line[i].ptr[j] <= '9')
+			|| (packet->lines->line[i].ptr[j] >= ' ')
+			|| (packet->lines->line[i].ptr[j] >= '.')
+			|| (packet->lines->line[i].ptr[j] >= '-'))) {
 
-		  if (packet->line[i].ptr[j] == ' ') {
+		  if (packet->lines->line[i].ptr[j] == ' ') {
 		    space++;
 		    NDPI_LOG_DBG2(ndpi_struct, "space %u.", space);
 		  }
@@ -702,7 +702,7 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
 		      k = j;
 		      port =
 			ntohs_ndpi_bytestream_to_number
-			(&packet->line[i].ptr[j], packet->payload_packet_len - j, &j);
+			(&packet->lines->line[i].ptr[j], packet->payload_packet_len - j, &j);
 		      NDPI_LOG_DBG2(ndpi_struct, "port %u.",
 			       port);
 		      j = k;
@@ -733,7 +733,7 @@ void ndpi_search_irc_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
 		    }
 		    if (dst != NULL) {
 		      port = ntohs_ndpi_bytestream_to_number
-			(&packet->line[i].ptr[j], packet->payload_packet_len - j, &j);
+			(&packet->lines->line[i].ptr[j], packet->payload_packet_len - j, &j);
 		      NDPI_LOG_DBG2(ndpi_struct, "port %u.", port);
 		      // hier das gleiche wie oben.
 		      /* hier werden NDPI_PROTOCOL_IRC_MAXPORT ports pro irc flows mitgespeichert. könnte man denn nicht ein-
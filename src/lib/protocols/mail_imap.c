@@ -36,7 +36,7 @@ static void ndpi_int_mail_imap_add_connection(struct ndpi_detection_module_struc
   ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_MAIL_IMAP, NDPI_PROTOCOL_UNKNOWN);
 }
 
-void ndpi_search_mail_imap_tcp(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow)
+static void ndpi_check_mail_imap_tcp(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow)
 {
   struct ndpi_packet_struct *packet = &flow->packet;       
   u_int16_t i = 0;
@@ -308,6 +308,28 @@ void ndpi_search_mail_imap_tcp(struct ndpi_detection_module_struct *ndpi_struct,
   NDPI_EXCLUDE_PROTO(ndpi_struct, flow);
 }
 
+void ndpi_search_mail_imap_tcp(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow)
+{
+  struct ndpi_packet_struct *packet = &flow->packet;
+  u_int8_t reassembled = 0;
+
+  /* Lines split across segments (see ndpi_set_tcp_reassembly()), once the flow looks like IMAP */
+  if (ndpi_tcp_stream_len(flow, NDPI_PROTOCOL_MAIL_IMAP) != 0 || flow->l4.tcp.mail_imap_stage >= 1
+      || (packet->payload_packet_len >= 4 && memcmp(packet->payload, "* OK", 4) == 0)) {
+    reassembled = ndpi_tcp_stream_lines(ndpi_struct, flow, NDPI_PROTOCOL_MAIL_IMAP);
+
+    if (!reassembled && ndpi_tcp_stream_pending(flow, NDPI_PROTOCOL_MAIL_IMAP)) {
+      NDPI_LOG_DBG2(ndpi_struct, "imap line split across segments, need next packet\n");
+      return;
+    }
+  }
+
+  ndpi_check_mail_imap_tcp(ndpi_struct, flow);
+
+  if (reassembled)
+    ndpi_tcp_stream_lines_done(flow, NDPI_PROTOCOL_MAIL_IMAP);
+}
+
 
 void init_mail_imap_dissector(struct ndpi_detection_module_struct *ndpi_struct, u_int32_t *id, NDPI_PROTOCOL_BITMASK *detection_bitmask)
 {
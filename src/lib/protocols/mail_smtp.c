@@ -53,8 +53,8 @@ static void ndpi_int_mail_smtp_add_connection(struct ndpi_detection_module_struc
   ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_MAIL_SMTP, NDPI_PROTOCOL_UNKNOWN);
 }
 
-void ndpi_search_mail_smtp_tcp(struct ndpi_detection_module_struct
-			       *ndpi_struct, struct ndpi_flow_struct *flow)
+static void ndpi_check_mail_smtp_tcp(struct ndpi_detection_module_struct
+				     *ndpi_struct, struct ndpi_flow_struct *flow)
 {
   struct ndpi_packet_struct *packet = &flow->packet;
 	
@@ -65,81 +65,81 @@ void ndpi_search_mail_smtp_tcp(struct ndpi_detection_module_struct
     u_int8_t bit_count = 0;
 
     NDPI_PARSE_PACKET_LINE_INFO(ndpi_struct, flow,packet);
-    for (a = 0; a < packet->parsed_lines; a++) {
+    for (a = 0; a < packet->lines->parsed_lines; a++) {
 
       // expected server responses
-      if (packet->line[a].len >= 3) {
-	if (memcmp(packet->line[a].ptr, "220", 3) == 0) {
+      if (packet->lines->line[a].len >= 3) {
+	if (memcmp(packet->lines->line[a].ptr, "220", 3) == 0) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_220;
-	} else if (memcmp(packet->line[a].ptr, "250", 3) == 0) {
+	} else if (memcmp(packet->lines->line[a].ptr, "250", 3) == 0) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_250;
-	} else if (memcmp(packet->line[a].ptr, "235", 3) == 0) {
+	} else if (memcmp(packet->lines->line[a].ptr, "235", 3) == 0) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_235;
-	} else if (memcmp(packet->line[a].ptr, "334", 3) == 0) {
+	} else if (memcmp(packet->lines->line[a].ptr, "334", 3) == 0) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_334;
-	} else if (memcmp(packet->line[a].ptr, "354", 3) == 0) {
+	} else if (memcmp(packet->lines->line[a].ptr, "354", 3) == 0) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_354;
 	}
       }
       // expected client requests
-      if (packet->line[a].len >= 5) {
-	if ((((packet->line[a].ptr[0] == 'H' || packet->line[a].ptr[0] == 'h')
-	      && (packet->line[a].ptr[1] == 'E' || packet->line[a].ptr[1] == 'e'))
-	     || ((packet->line[a].ptr[0] == 'E' || packet->line[a].ptr[0] == 'e')
-		 && (packet->line[a].ptr[1] == 'H' || packet->line[a].ptr[1] == 'h')))
-	    && (packet->line[a].ptr[2] == 'L' || packet->line[a].ptr[2] == 'l')
-	    && (packet->line[a].ptr[3] == 'O' || packet->line[a].ptr[3] == 'o')
-	    && packet->line[a].ptr[4] == ' ') {
+      if (packet->lines->line[a].len >= 5) {
+	if ((((packet->lines->line[a].ptr[0] == 'H' || packet->lines->line[a].ptr[0] == 'h')
+	      && (packet->lines->line[a].ptr[1] == 'E' || packet->lines->line[a].ptr[1] == 'e'))
+	     || ((packet->lines->line[a].ptr[0] == 'E' || packet->lines->line[a].ptr[0] == 'e')
+		 && (packet->lines->line[a].ptr[1] == 'H' || packet->lines->line[a].ptr[1] == 'h')))
+	    && (packet->lines->line[a].ptr[2] == 'L' || packet->lines->line[a].ptr[2] == 'l')
+	    && (packet->lines->line[a].ptr[3] == 'O' || packet->lines->line[a].ptr[3] == 'o')
+	    && packet->lines->line[a].ptr[4] == ' ') {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_HELO_EHLO;
-	} else if ((packet->line[a].ptr[0] == 'M' || packet->line[a].ptr[0] == 'm')
-		   && (packet->line[a].ptr[1] == 'A' || packet->line[a].ptr[1] == 'a')
-		   && (packet->line[a].ptr[2] == 'I' || packet->line[a].ptr[2] == 'i')
-		   && (packet->line[a].ptr[3] == 'L' || packet->line[a].ptr[3] == 'l')
-		   && packet->line[a].ptr[4] == ' ') {
+	} else if ((packet->lines->line[a].ptr[0] == 'M' || packet->lines->line[a].ptr[0] == 'm')
+		   && (packet->lines->line[a].ptr[1] == 'A' || packet->lines->line[a].ptr[1] == 'a')
+		   && (packet->lines->line[a].ptr[2] == 'I' || packet->lines->line[a].ptr[2] == 'i')
+		   && (packet->lines->line[a].ptr[3] == 'L' || packet->lines->line[a].ptr[3] == 'l')
+		   && packet->lines->line[a].ptr[4] == ' ') {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_MAIL;
-	} else if ((packet->line[a].ptr[0] == 'R' || packet->line[a].ptr[0] == 'r')
-		   && (packet->line[a].ptr[1] == 'C' || packet->line[a].ptr[1] == 'c')
-		   && (packet->line[a].ptr[2] == 'P' || packet->line[a].ptr[2] == 'p')
-		   && (packet->line[a].ptr[3] == 'T' || packet->line[a].ptr[3] == 't')
-		   && packet->line[a].ptr[4] == ' ') {
+	} else if ((packet->lines->line[a].ptr[0] == 'R' || packet->lines->line[a].ptr[0] == 'r')
+		   && (packet->lines->line[a].ptr[1] == 'C' || packet->lines->line[a].ptr[1] == 'c')
+		   && (packet->lines->line[a].ptr[2] == 'P' || packet->lines->line[a].ptr[2] == 'p')
+		   && (packet->lines->line[a].ptr[3] == 'T' || packet->lines->line[a].ptr[3] == 't')
+		   && packet->lines->line[a].ptr[4] == ' ') {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_RCPT;
-	} else if ((packet->line[a].ptr[0] == 'A' || packet->line[a].ptr[0] == 'a')
-		   && (packet->line[a].ptr[1] == 'U' || packet->line[a].ptr[1] == 'u')
-		   && (packet->line[a].ptr[2] == 'T' || packet->line[a].ptr[2] == 't')
-		   && (packet->line[a].ptr[3] == 'H' || packet->line[a].ptr[3] == 'h')
-		   && packet->line[a].ptr[4] == ' ') {
+	} else if ((packet->lines->line[a].ptr[0] == 'A' || packet->lines->line[a].ptr[0] == 'a')
+		   && (packet->lines->line[a].ptr[1] == 'U' || packet->lines->line[a].ptr[1] == 'u')
+		   && (packet->lines->line[a].ptr[2] == 'T' || packet->lines->line[a].ptr[2] == 't')
+		   && (packet->lines->line[a].ptr[3] == 'H' || packet->lines->line[a].ptr[3] == 'h')
+		   && packet->lines->line[a].ptr[4] == ' ') {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_AUTH;
 	}
       }
 
-      if (packet->line[a].len >= 8) {
-	if ((packet->line[a].ptr[0] == 'S' || packet->line[a].ptr[0] == 's')
-	    && (packet->line[a].ptr[1] == 'T' || packet->line[a].ptr[1] == 't')
-	    && (packet->line[a].ptr[2] == 'A' || packet->line[a].ptr[2] == 'a')
-	    && (packet->line[a].ptr[3] == 'R' || packet->line[a].ptr[3] == 'r')
-	    && (packet->line[a].ptr[4] == 'T' || packet->line[a].ptr[4] == 't')
-	    && (packet->line[a].ptr[5] == 'T' || packet->line[a].ptr[5] == 't')
-	    && (packet->line[a].ptr[6] == 'L' || packet->line[a].ptr[6] == 'l')
-	    && (packet->line[a].ptr[7] == 'S' || packet->line[a].ptr[7] == 's')) {
+      if (packet->lines->line[a].len >= 8) {
+	if ((packet->lines->line[a].ptr[0] == 'S' || packet->lines->line[a].ptr[0] == 's')
+	    && (packet->lines->line[a].ptr[1] == 'T' || packet->lines->line[a].ptr[1] == 't')
+	    && (packet->lines->line[a].ptr[2] == 'A' || packet->lines->line[a].ptr[2] == 'a')
+	    && (packet->lines->line[a].ptr[3] == 'R' || packet->lines->line[a].ptr[3] == 'r')
+	    && (packet->lines->line[a].ptr[4] == 'T' || packet->lines->line[a].ptr[4] == 't')
+	    && (packet->lines->line[a].ptr[5] == 'T' || packet->lines->line[a].ptr[5] == 't')
+	    && (packet->lines->line[a].ptr[6] == 'L' || packet->lines->line[a].ptr[6] == 'l')
+	    && (packet->lines->line[a].ptr[7] == 'S' || packet->lines->line[a].ptr[7] == 's')) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_STARTTLS;
 	}
       }
 
-      if (packet->line[a].len >= 4) {
-	if ((packet->line[a].ptr[0] == 'D' || packet->line[a].ptr[0] == 'd')
-	    && (packet->line[a].ptr[1] == 'A' || packet->line[a].ptr[1] == 'a')
-	    && (packet->line[a].ptr[2] == 'T' || packet->line[a].ptr[2] == 't')
-	    && (packet->line[a].ptr[3] == 'A' || packet->line[a].ptr[3] == 'a')) {
+      if (packet->lines->line[a].len >= 4) {
+	if ((packet->lines->line[a].ptr[0] == 'D' || packet->lines->line[a].ptr[0] == 'd')
+	    && (packet->lines->line[a].ptr[1] == 'A' || packet->lines->line[a].ptr[1] == 'a')
+	    && (packet->lines->line[a].ptr[2] == 'T' || packet->lines->line[a].ptr[2] == 't')
+	    && (packet->lines->line[a].ptr[3] == 'A' || packet->lines->line[a].ptr[3] == 'a')) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_DATA;
-	} else if ((packet->line[a].ptr[0] == 'N' || packet->line[a].ptr[0] == 'n')
-		   && (packet->line[a].ptr[1] == 'O' || packet->line[a].ptr[1] == 'o')
-		   && (packet->line[a].ptr[2] == 'O' || packet->line[a].ptr[2] == 'o')
-		   && (packet->line[a].ptr[3] == 'P' || packet->line[a].ptr[3] == 'p')) {
+	} else if ((packet->lines->line[a].ptr[0] == 'N' || packet->lines->line[a].ptr[0] == 'n')
+		   && (packet->lines->line[a].ptr[1] == 'O' || packet->lines->line[a].ptr[1] == 'o')
+		   && (packet->lines->line[a].ptr[2] == 'O' || packet->lines->line[a].ptr[2] == 'o')
+		   && (packet->lines->line[a].ptr[3] == 'P' || packet->lines->line[a].ptr[3] == 'p')) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_NOOP;
-	} else if ((packet->line[a].ptr[0] == 'R' || packet->line[a].ptr[0] == 'r')
-		   && (packet->line[a].ptr[1] == 'S' || packet->line[a].ptr[1] == 's')
-		   && (packet->line[a].ptr[2] == 'E' || packet->line[a].ptr[2] == 'e')
-		   && (packet->line[a].ptr[3] == 'T' || packet->line[a].ptr[3] == 't')) {
+	} else if ((packet->lines->line[a].ptr[0] == 'R' || packet->lines->line[a].ptr[0] == 'r')
+		   && (packet->lines->line[a].ptr[1] == 'S' || packet->lines->line[a].ptr[1] == 's')
+		   && (packet->lines->line[a].ptr[2] == 'E' || packet->lines->line[a].ptr[2] == 'e')
+		   && (packet->lines->line[a].ptr[3] == 'T' || packet->lines->line[a].ptr[3] == 't')) {
 	  flow->l4.tcp.smtp_command_bitmask |= SMTP_BIT_RSET;
 	}
       }
@@ -177,6 +177,30 @@ void ndpi_search_mail_smtp_tcp(struct ndpi_detection_module_struct
 
 }
 
+void ndpi_search_mail_smtp_tcp(struct ndpi_detection_module_struct
+			       *ndpi_struct, struct ndpi_flow_struct *flow)
+{
+  struct ndpi_packet_struct *packet = &flow->packet;
+  u_int8_t reassembled = 0;
+
+  /* Lines split across segments (see ndpi_set_tcp_reassembly()), once the flow looks like SMTP */
+  if (ndpi_tcp_stream_len(flow, NDPI_PROTOCOL_MAIL_SMTP) != 0 || flow->l4.tcp.smtp_command_bitmask != 0
+      || (packet->payload_packet_len >= 4 && flow->packet_counter <= 4
+	  && (memcmp(packet->payload, "220", 3) == 0 || memcmp(packet->payload, "EHLO", 4) == 0))) {
+    reassembled = ndpi_tcp_stream_lines(ndpi_struct, flow, NDPI_PROTOCOL_MAIL_SMTP);
+
+    if (!reassembled && ndpi_tcp_stream_pending(flow, NDPI_PROTOCOL_MAIL_SMTP)) {
+      NDPI_LOG_DBG2(ndpi_struct, "smtp line split across segments, need next packet\n");
+      return;
+    }
+  }
+
+  ndpi_check_mail_smtp_tcp(ndpi_struct, flow);
+
+  if (reassembled)
+    ndpi_tcp_stream_lines_done(flow, NDPI_PROTOCOL_MAIL_SMTP);
+}
+
 void init_mail_smtp_dissector(struct ndpi_detection_module_struct *ndpi_struct, u_int32_t *id, NDPI_PROTOCOL_BITMASK *detection_bitmask)
 {
   ndpi_set_bitmask_protocol_detection("MAIL_SMTP", ndpi_struct, detection_bitmask, *id,
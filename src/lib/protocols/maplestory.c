@@ -57,21 +57,21 @@ void ndpi_search_maplestory(struct ndpi_detection_module_struct *ndpi_struct, st
 		/* Maplestory update */
 		if (packet->payload_packet_len > NDPI_STATICSTRING_LEN("GET /maple/patch")
 			&& packet->payload[NDPI_STATICSTRING_LEN("GET /maple")] == '/') {
-			if (packet->user_agent_line.ptr != NULL && packet->host_line.ptr != NULL
-				&& packet->user_agent_line.len == NDPI_STATICSTRING_LEN("Patcher")
-				&& packet->host_line.len > NDPI_STATICSTRING_LEN("patch.")
+			if (packet->lines->user_agent_line.ptr != NULL && packet->lines->host_line.ptr != NULL
+				&& packet->lines->user_agent_line.len == NDPI_STATICSTRING_LEN("Patcher")
+				&& packet->lines->host_line.len > NDPI_STATICSTRING_LEN("patch.")
 				&& memcmp(&packet->payload[NDPI_STATICSTRING_LEN("GET /maple/")], "patch",
 						  NDPI_STATICSTRING_LEN("patch")) == 0
-				&& memcmp(packet->user_agent_line.ptr, "Patcher", NDPI_STATICSTRING_LEN("Patcher")) == 0
-				&& memcmp(packet->host_line.ptr, "patch.", NDPI_STATICSTRING_LEN("patch.")) == 0) {
+				&& memcmp(packet->lines->user_agent_line.ptr, "Patcher", NDPI_STATICSTRING_LEN("Patcher")) == 0
+				&& memcmp(packet->lines->host_line.ptr, "patch.", NDPI_STATICSTRING_LEN("patch.")) == 0) {
 				NDPI_LOG_INFO(ndpi_struct, "found maplestory update\n");
 				ndpi_int_maplestory_add_connection(ndpi_struct, flow);
 				return;
 			}
-		} else if (packet->user_agent_line.ptr != NULL && packet->user_agent_line.len == NDPI_STATICSTRING_LEN("AspINet")
+		} else if (packet->lines->user_agent_line.ptr != NULL && packet->lines->user_agent_line.len == NDPI_STATICSTRING_LEN("AspINet")
 				   && memcmp(&packet->payload[NDPI_STATICSTRING_LEN("GET /maple")], "story/",
 							 NDPI_STATICSTRING_LEN("story/")) == 0
-				   && memcmp(packet->user_agent_line.ptr, "AspINet", NDPI_STATICSTRING_LEN("AspINet")) == 0) {
+				   && memcmp(packet->lines->user_agent_line.ptr, "AspINet", NDPI_STATICSTRING_LEN("AspINet")) == 0) {
 			NDPI_LOG_INFO(ndpi_struct, "found maplestory update\n");
 			ndpi_int_maplestory_add_connection(ndpi_struct, flow);
 			return;
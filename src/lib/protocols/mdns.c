@@ -86,9 +86,11 @@ static int ndpi_int_check_mdns_payload(struct ndpi_detection_module_struct
 
     /* printf("==> [%d] %s\n", j, answer);  */
 
-    len = ndpi_min(sizeof(flow->protos.mdns.answer)-1, j);
-    strncpy(flow->protos.mdns.answer, (const char *)answer, len);
-    flow->protos.mdns.answer[len] = '\0';
+    if(ndpi_flow_cold(flow)) {
+      len = ndpi_min(sizeof(flow->cold->protos.mdns.answer)-1, j);
+      strncpy(flow->cold->protos.mdns.answer, (const char *)answer, len);
+      flow->cold->protos.mdns.answer[len] = '\0';
+    }
 
     NDPI_LOG_INFO(ndpi_struct, "found MDNS with answer query\n");
     return 1;
@@ -42,11 +42,11 @@ static u_int8_t ndpi_int_find_xmsn(struct ndpi_detection_module_struct *ndpi_str
 {
   struct ndpi_packet_struct *packet = &flow->packet;
 
-  if(packet->parsed_lines > 3) {
+  if(packet->lines->parsed_lines > 3) {
     u_int16_t i;
-    for(i = 2; i < packet->parsed_lines; i++) {
-      if(packet->line[i].ptr != NULL && packet->line[i].len > NDPI_STATICSTRING_LEN("X-MSN") &&
-	 memcmp(packet->line[i].ptr, "X-MSN", NDPI_STATICSTRING_LEN("X-MSN")) == 0) {
+    for(i = 2; i < packet->lines->parsed_lines; i++) {
+      if(packet->lines->line[i].ptr != NULL && packet->lines->line[i].len > NDPI_STATICSTRING_LEN("X-MSN") &&
+	 memcmp(packet->lines->line[i].ptr, "X-MSN", NDPI_STATICSTRING_LEN("X-MSN")) == 0) {
 	return 1;
       }
     }
@@ -152,9 +152,9 @@ static void ndpi_search_msn_tcp(struct ndpi_detection_module_struct *ndpi_struct
        ndpi_match_strprefix(packet->payload, packet->payload_packet_len, "GET ") ||
        ndpi_match_strprefix(packet->payload, packet->payload_packet_len, "POST ")) {
       ndpi_parse_packet_line_info(ndpi_struct, flow);
-      if (packet->user_agent_line.ptr != NULL &&
-	  packet->user_agent_line.len > NDPI_STATICSTRING_LEN("Messenger/") &&
-	  memcmp(packet->user_agent_line.ptr, "Messenger/", NDPI_STATICSTRING_LEN("Messenger/")) == 0) {
+      if (packet->lines->user_agent_line.ptr != NULL &&
+	  packet->lines->user_agent_line.len > NDPI_STATICSTRING_LEN("Messenger/") &&
+	  memcmp(packet->lines->user_agent_line.ptr, "Messenger/", NDPI_STATICSTRING_LEN("Messenger/")) == 0) {
 	NDPI_LOG_INFO(ndpi_struct, "found MSN Messenger/\n");
 	ndpi_int_msn_add_connection(ndpi_struct, flow);
 	return;
@@ -176,12 +176,12 @@ static void ndpi_search_msn_tcp(struct ndpi_detection_module_struct *ndpi_struct
 	/* scan packet if not already done... */
 	ndpi_parse_packet_line_info(ndpi_struct, flow);
 	
-	if(packet->content_line.ptr != NULL &&
-	   ((packet->content_line.len == NDPI_STATICSTRING_LEN("application/x-msn-messenger") &&
-	     memcmp(packet->content_line.ptr, "application/x-msn-messenger",
+	if(packet->lines->content_line.ptr != NULL &&
+	   ((packet->lines->content_line.len == NDPI_STATICSTRING_LEN("application/x-msn-messenger") &&
+	     memcmp(packet->lines->content_line.ptr, "application/x-msn-messenger",
 		    NDPI_STATICSTRING_LEN("application/x-msn-messenger")) == 0) ||
-	    (packet->content_line.len >= NDPI_STATICSTRING_LEN("text/x-msnmsgr") &&
-	     memcmp(packet->content_line.ptr, "text/x-msnmsgr",
+	    (packet->lines->content_line.len >= NDPI_STATICSTRING_LEN("text/x-msnmsgr") &&
+	     memcmp(packet->lines->content_line.ptr, "text/x-msnmsgr",
 		    NDPI_STATICSTRING_LEN("text/x-msnmsgr")) == 0))) {
 	  NDPI_LOG_INFO(ndpi_struct, "found MSN POST application/x-msn-messenger\n");
 	  ndpi_int_msn_add_connection(ndpi_struct, flow);
@@ -223,14 +223,14 @@ static void ndpi_search_msn_tcp(struct ndpi_detection_module_struct *ndpi_struct
 	
 	ndpi_parse_packet_line_info(ndpi_struct, flow);
 
-	if(packet->content_line.ptr != NULL && ((packet->content_line.len == 23
-						 && memcmp(packet->content_line.ptr, "text/xml; charset=utf-8", 23) == 0)
+	if(packet->lines->content_line.ptr != NULL && ((packet->lines->content_line.len == 23
+						 && memcmp(packet->lines->content_line.ptr, "text/xml; charset=utf-8", 23) == 0)
 						||
-						(packet->content_line.len == 24
-						 && memcmp(packet->content_line.ptr, "text/html; charset=utf-8", 24) == 0)
+						(packet->lines->content_line.len == 24
+						 && memcmp(packet->lines->content_line.ptr, "text/html; charset=utf-8", 24) == 0)
 						||
-						(packet->content_line.len == 33
-						 && memcmp(packet->content_line.ptr, "application/x-www-form-urlencoded", 33) == 0))) {
+						(packet->lines->content_line.len == 33
+						 && memcmp(packet->lines->content_line.ptr, "application/x-www-form-urlencoded", 33) == 0))) {
 	  
 	  if ((src != NULL && NDPI_COMPARE_PROTOCOL_TO_BITMASK(src->detected_protocol_bitmask, NDPI_PROTOCOL_MSN) != 0)
 	      || (dst != NULL && NDPI_COMPARE_PROTOCOL_TO_BITMASK(dst->detected_protocol_bitmask, NDPI_PROTOCOL_MSN) != 0)) {
@@ -239,10 +239,10 @@ static void ndpi_search_msn_tcp(struct ndpi_detection_module_struct *ndpi_struct
 	    ndpi_int_msn_add_connection(ndpi_struct, flow);
 	    return;
 	  }
-	  for(a = 0; a < packet->parsed_lines; a++) {
-	    if(packet->line[a].len >= 4 && (memcmp(packet->line[a].ptr, "CVR ", 4) == 0
-					    || memcmp(packet->line[a].ptr, "VER ", 4) == 0 ||
-					    memcmp(packet->line[a].ptr, "ANS ", 4) == 0)) {
+	  for(a = 0; a < packet->lines->parsed_lines; a++) {
+	    if(packet->lines->line[a].len >= 4 && (memcmp(packet->lines->line[a].ptr, "CVR ", 4) == 0
+					    || memcmp(packet->lines->line[a].ptr, "VER ", 4) == 0 ||
+					    memcmp(packet->lines->line[a].ptr, "ANS ", 4) == 0)) {
 	      
 	      NDPI_LOG_DBG2(ndpi_struct, "found MSN with pattern text/sml; charset0utf-8\n");
 	      NDPI_LOG_INFO(ndpi_struct, "found MSN xml CVS / VER / ANS found\n");
@@ -268,11 +268,11 @@ static void ndpi_search_msn_tcp(struct ndpi_detection_module_struct *ndpi_struct
 	
 	ndpi_parse_packet_line_info(ndpi_struct, flow);
 
-	if(packet->content_line.ptr != NULL &&
-	    ((packet->content_line.len == NDPI_STATICSTRING_LEN("application/x-msn-messenger") &&
-	      memcmp(packet->content_line.ptr, "application/x-msn-messenger", NDPI_STATICSTRING_LEN("application/x-msn-messenger")) == 0) ||
-	     (packet->content_line.len >= NDPI_STATICSTRING_LEN("text/x-msnmsgr") &&
-	      memcmp(packet->content_line.ptr, "text/x-msnmsgr", NDPI_STATICSTRING_LEN("text/x-msnmsgr")) == 0))) {
+	if(packet->lines->content_line.ptr != NULL &&
+	    ((packet->lines->content_line.len == NDPI_STATICSTRING_LEN("application/x-msn-messenger") &&
+	      memcmp(packet->lines->content_line.ptr, "application/x-msn-messenger", NDPI_STATICSTRING_LEN("application/x-msn-messenger")) == 0) ||
+	     (packet->lines->content_line.len >= NDPI_STATICSTRING_LEN("text/x-msnmsgr") &&
+	      memcmp(packet->lines->content_line.ptr, "text/x-msnmsgr", NDPI_STATICSTRING_LEN("text/x-msnmsgr")) == 0))) {
 	  
 	  NDPI_LOG_INFO(ndpi_struct,
 		   "found MSN  application/x-msn-messenger.\n");
@@ -350,11 +350,11 @@ static void ndpi_search_msn_tcp(struct ndpi_detection_module_struct *ndpi_struct
       
       ndpi_parse_packet_line_info(ndpi_struct, flow);
       
-      if(packet->content_line.ptr != NULL && ((packet->content_line.len == NDPI_STATICSTRING_LEN("application/x-msn-messenger") &&
-					       memcmp(packet->content_line.ptr, "application/x-msn-messenger",
+      if(packet->lines->content_line.ptr != NULL && ((packet->lines->content_line.len == NDPI_STATICSTRING_LEN("application/x-msn-messenger") &&
+					       memcmp(packet->lines->content_line.ptr, "application/x-msn-messenger",
 						      NDPI_STATICSTRING_LEN("application/x-msn-messenger")) == 0) ||
-					      (packet->content_line.len >= NDPI_STATICSTRING_LEN("text/x-msnmsgr") &&
-					       memcmp(packet->content_line.ptr, "text/x-msnmsgr", NDPI_STATICSTRING_LEN("text/x-msnmsgr")) == 0))) {
+					      (packet->lines->content_line.len >= NDPI_STATICSTRING_LEN("text/x-msnmsgr") &&
+					       memcmp(packet->lines->content_line.ptr, "text/x-msnmsgr", NDPI_STATICSTRING_LEN("text/x-msnmsgr")) == 0))) {
 	
 	NDPI_LOG_INFO(ndpi_struct, "found MSN application/x-msn-messenger\n");
 	ndpi_int_msn_add_connection(ndpi_struct, flow);
@@ -119,8 +119,8 @@ void ndpi_search_netbios(struct ndpi_detection_module_struct *ndpi_struct, struc
 
 	NDPI_LOG_INFO(ndpi_struct, "found netbios with questions = 1 and answers = 0, authority = 0 and broadcast \n");
 	
-	if(ndpi_netbios_name_interpret((char*)&packet->payload[12], name, sizeof(name)) > 0)
-	  snprintf((char*)flow->host_server_name, sizeof(flow->host_server_name)-1, "%s", name);
+	if((ndpi_netbios_name_interpret((char*)&packet->payload[12], name, sizeof(name)) > 0) && ndpi_flow_cold(flow))
+	  snprintf((char*)flow->cold->host_server_name, sizeof(flow->cold->host_server_name)-1, "%s", name);
 
 	ndpi_int_netbios_add_connection(ndpi_struct, flow);
 	return;
@@ -336,8 +336,8 @@ void ndpi_search_netbios(struct ndpi_detection_module_struct *ndpi_struct, struc
 	if(ntohl(get_u_int32_t(packet->payload, 4)) == ntohl(packet->iph->saddr)) {
 	  NDPI_LOG_INFO(ndpi_struct, "found netbios with checked ip-address\n");
 
-	  if(ndpi_netbios_name_interpret((char*)&packet->payload[12], name, sizeof(name)) > 0)
-	    snprintf((char*)flow->host_server_name, sizeof(flow->host_server_name)-1, "%s", name);
+	  if((ndpi_netbios_name_interpret((char*)&packet->payload[12], name, sizeof(name)) > 0) && ndpi_flow_cold(flow))
+	    snprintf((char*)flow->cold->host_server_name, sizeof(flow->cold->host_server_name)-1, "%s", name);
 
 	  ndpi_int_netbios_add_connection(ndpi_struct, flow);
 	  return;
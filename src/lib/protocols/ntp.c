@@ -49,10 +49,12 @@ void ndpi_search_ntp_udp(struct ndpi_detection_module_struct *ndpi_struct, struc
     if ((((packet->payload[0] & 0x38) >> 3) <= 4)) {
     
       // 38 in binary representation is 00111000 
-      flow->protos.ntp.version = (packet->payload[0] & 0x38) >> 3;
-    
-      if (flow->protos.ntp.version == 2) {
-        flow->protos.ntp.request_code = packet->payload[3];
+      if (ndpi_flow_cold(flow)) {
+        flow->cold->protos.ntp.version = (packet->payload[0] & 0x38) >> 3;
+
+        if (flow->cold->protos.ntp.version == 2) {
+          flow->cold->protos.ntp.request_code = packet->payload[3];
+        }
       }
     
       NDPI_LOG_INFO(ndpi_struct, "found NTP\n");
@@ -44,8 +44,8 @@ void ndpi_search_openft_tcp(struct ndpi_detection_module_struct
 	if (packet->payload_packet_len > 5 && memcmp(packet->payload, "GET /", 5) == 0) {
 		NDPI_LOG_DBG2(ndpi_struct, "HTTP packet detected\n");
 		ndpi_parse_packet_line_info(ndpi_struct, flow);
-		if (packet->parsed_lines >= 2
-			&& packet->line[1].len > 13 && memcmp(packet->line[1].ptr, "X-OpenftAlias:", 14) == 0) {
+		if (packet->lines->parsed_lines >= 2
+			&& packet->lines->line[1].len > 13 && memcmp(packet->lines->line[1].ptr, "X-OpenftAlias:", 14) == 0) {
 			NDPI_LOG_INFO(ndpi_struct, "found OpenFT\n");
 			ndpi_int_openft_add_connection(ndpi_struct, flow);
 			return;
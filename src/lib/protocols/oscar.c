@@ -629,8 +629,8 @@ static void ndpi_search_oscar_tcp_connect(struct ndpi_detection_module_struct
   if (packet->payload_packet_len >= 18) {
     if ((packet->payload[0] == 'P') && (memcmp(packet->payload, "POST /photo/upload", 18) == 0)) {
       NDPI_PARSE_PACKET_LINE_INFO(ndpi_struct, flow, packet);
-      if (packet->host_line.len >= 18 && packet->host_line.ptr != NULL) {
-	if (memcmp(packet->host_line.ptr, "lifestream.aol.com", 18) == 0) {
+      if (packet->lines->host_line.len >= 18 && packet->lines->host_line.ptr != NULL) {
+	if (memcmp(packet->lines->host_line.ptr, "lifestream.aol.com", 18) == 0) {
 	  NDPI_LOG_INFO(ndpi_struct,
 		   "found OSCAR over HTTP, POST method\n");
 	  ndpi_int_oscar_add_connection(ndpi_struct, flow);
@@ -653,26 +653,26 @@ static void ndpi_search_oscar_tcp_connect(struct ndpi_detection_module_struct
 
       if ((memcmp(&packet->payload[5], "aim", 3) == 0) || (memcmp(&packet->payload[5], "im", 2) == 0)) {
 	NDPI_PARSE_PACKET_LINE_INFO(ndpi_struct, flow, packet);
-	if (packet->user_agent_line.len > 15 && packet->user_agent_line.ptr != NULL &&
-	    ((memcmp(packet->user_agent_line.ptr, "mobileAIM/", 10) == 0) ||
-	     (memcmp(packet->user_agent_line.ptr, "ICQ/", 4) == 0) ||
-	     (memcmp(packet->user_agent_line.ptr, "mobileICQ/", 10) == 0) ||
-	     (memcmp(packet->user_agent_line.ptr, "AIM%20Free/", NDPI_STATICSTRING_LEN("AIM%20Free/")) == 0) ||
-	     (memcmp(packet->user_agent_line.ptr, "AIM/", 4) == 0))) {
+	if (packet->lines->user_agent_line.len > 15 && packet->lines->user_agent_line.ptr != NULL &&
+	    ((memcmp(packet->lines->user_agent_line.ptr, "mobileAIM/", 10) == 0) ||
+	     (memcmp(packet->lines->user_agent_line.ptr, "ICQ/", 4) == 0) ||
+	     (memcmp(packet->lines->user_agent_line.ptr, "mobileICQ/", 10) == 0) ||
+	     (memcmp(packet->lines->user_agent_line.ptr, "AIM%20Free/", NDPI_STATICSTRING_LEN("AIM%20Free/")) == 0) ||
+	     (memcmp(packet->lines->user_agent_line.ptr, "AIM/", 4) == 0))) {
 	  NDPI_LOG_INFO(ndpi_struct, "found OSCAR over HTTP\n");
 	  ndpi_int_oscar_add_connection(ndpi_struct, flow);
 	  return;
 	}
       }
       NDPI_PARSE_PACKET_LINE_INFO(ndpi_struct, flow, packet);
-      if (packet->referer_line.ptr != NULL && packet->referer_line.len >= 22) {
+      if (packet->lines->referer_line.ptr != NULL && packet->lines->referer_line.len >= 22) {
 
-	if (memcmp(&packet->referer_line.ptr[packet->referer_line.len - NDPI_STATICSTRING_LEN("WidgetMain.swf")],
+	if (memcmp(&packet->lines->referer_line.ptr[packet->lines->referer_line.len - NDPI_STATICSTRING_LEN("WidgetMain.swf")],
 		   "WidgetMain.swf", NDPI_STATICSTRING_LEN("WidgetMain.swf")) == 0) {
 	  u_int16_t i;
-	  for (i = 0; i < (packet->referer_line.len - 22); i++) {
-	    if (packet->referer_line.ptr[i] == 'a') {
-	      if (memcmp(&packet->referer_line.ptr[i + 1], "im/gromit/aim_express", 21) == 0) {
+	  for (i = 0; i < (packet->lines->referer_line.len - 22); i++) {
+	    if (packet->lines->referer_line.ptr[i] == 'a') {
+	      if (memcmp(&packet->lines->referer_line.ptr[i + 1], "im/gromit/aim_express", 21) == 0) {
 		NDPI_LOG_INFO(ndpi_struct,
 			 "found OSCAR over HTTP : aim/gromit/aim_express\n");
 		ndpi_int_oscar_add_connection(ndpi_struct, flow);
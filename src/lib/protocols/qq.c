@@ -581,22 +581,22 @@ void ndpi_search_qq_tcp(struct ndpi_detection_module_struct *ndpi_struct, struct
     }
     ndpi_parse_packet_line_info(ndpi_struct, flow);
 
-    if (packet->user_agent_line.ptr != NULL
-	&& (packet->user_agent_line.len > 7 && memcmp(packet->user_agent_line.ptr, "QQClient", 8) == 0)) {
+    if (packet->lines->user_agent_line.ptr != NULL
+	&& (packet->lines->user_agent_line.len > 7 && memcmp(packet->lines->user_agent_line.ptr, "QQClient", 8) == 0)) {
       NDPI_LOG_INFO(ndpi_struct, "found qq over tcp GET...QQClient\n");
       ndpi_int_qq_add_connection(ndpi_struct, flow);
       return;
     }
-    for (i = 0; i < packet->parsed_lines; i++) {
-      if (packet->line[i].len > 3 && memcmp(packet->line[i].ptr, "QQ: ", 4) == 0) {
+    for (i = 0; i < packet->lines->parsed_lines; i++) {
+      if (packet->lines->line[i].len > 3 && memcmp(packet->lines->line[i].ptr, "QQ: ", 4) == 0) {
 	NDPI_LOG_INFO(ndpi_struct, "found qq over tcp GET...QQ: \n");
 	ndpi_int_qq_add_connection(ndpi_struct, flow);
 	return;
       }
     }
-    if (packet->host_line.ptr != NULL) {
+    if (packet->lines->host_line.ptr != NULL) {
       NDPI_LOG_DBG2(ndpi_struct, "host line ptr\n");
-      if (packet->host_line.len > 11 && memcmp(&packet->host_line.ptr[0], "www.qq.co.za", 12) == 0) {
+      if (packet->lines->host_line.len > 11 && memcmp(&packet->lines->host_line.ptr[0], "www.qq.co.za", 12) == 0) {
 	NDPI_LOG_INFO(ndpi_struct, "found qq over tcp Host: www.qq.co.za\n");
 	ndpi_int_qq_add_connection(ndpi_struct, flow);
 	return;
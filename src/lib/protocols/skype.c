@@ -33,7 +33,7 @@ static void ndpi_check_skype(struct ndpi_detection_module_struct *ndpi_struct, s
   u_int32_t payload_len = packet->payload_packet_len;
 
 
-  if(flow->host_server_name[0] != '\0')
+  if(flow->cold && (flow->cold->host_server_name[0] != '\0'))
     return;
 
   // UDP check
@@ -54,10 +54,12 @@ void ndpi_search_ssh_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
   if (flow->l4.tcp.ssh_stage == 0) {
     if (packet->payload_packet_len > 7 && packet->payload_packet_len < 100
 	&& memcmp(packet->payload, "SSH-", 4) == 0) {
-      int len = ndpi_min(sizeof(flow->protos.ssh.client_signature)-1, packet->payload_packet_len);
-      strncpy(flow->protos.ssh.client_signature, (const char *)packet->payload, len);
-      flow->protos.ssh.client_signature[len] = '\0';
-      ndpi_ssh_zap_cr(flow->protos.ssh.client_signature, len);
+      if(ndpi_flow_cold(flow)) {
+	int len = ndpi_min(sizeof(flow->cold->protos.ssh.client_signature)-1, packet->payload_packet_len);
+	strncpy(flow->cold->protos.ssh.client_signature, (const char *)packet->payload, len);
+	flow->cold->protos.ssh.client_signature[len] = '\0';
+	ndpi_ssh_zap_cr(flow->cold->protos.ssh.client_signature, len);
+      }
       NDPI_LOG_DBG2(ndpi_struct, "ssh stage 0 passed\n");
       flow->l4.tcp.ssh_stage = 1 + packet->packet_direction;
       return;
@@ -65,10 +67,12 @@ void ndpi_search_ssh_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
   } else if (flow->l4.tcp.ssh_stage == (2 - packet->packet_direction)) {
     if (packet->payload_packet_len > 7 && packet->payload_packet_len < 100
 	&& memcmp(packet->payload, "SSH-", 4) == 0) {
-      int len = ndpi_min(sizeof(flow->protos.ssh.server_signature)-1, packet->payload_packet_len);
-      strncpy(flow->protos.ssh.server_signature, (const char *)packet->payload, len);
-      flow->protos.ssh.server_signature[len] = '\0';
-      ndpi_ssh_zap_cr(flow->protos.ssh.server_signature, len);
+      if(ndpi_flow_cold(flow)) {
+	int len = ndpi_min(sizeof(flow->cold->protos.ssh.server_signature)-1, packet->payload_packet_len);
+	strncpy(flow->cold->protos.ssh.server_signature, (const char *)packet->payload, len);
+	flow->cold->protos.ssh.server_signature[len] = '\0';
+	ndpi_ssh_zap_cr(flow->cold->protos.ssh.server_signature, len);
+      }
       NDPI_LOG_INFO(ndpi_struct, "found ssh\n");
       
       ndpi_int_ssh_add_connection(ndpi_struct, flow);
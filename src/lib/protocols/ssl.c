@@ -42,9 +42,10 @@ static u_int32_t ndpi_ssl_refine_master_protocol(struct ndpi_detection_module_st
 {
   struct ndpi_packet_struct *packet = &flow->packet;
 
-  if((flow->protos.ssl.client_certificate[0] != '\0')
-     || (flow->protos.ssl.server_certificate[0] != '\0')
-     || (flow->host_server_name[0] != '\0'))
+  if(flow->cold
+     && ((flow->cold->protos.ssl.client_certificate[0] != '\0')
+	 || (flow->cold->protos.ssl.server_certificate[0] != '\0')
+	 || (flow->cold->host_server_name[0] != '\0')))
     protocol = NDPI_PROTOCOL_SSL;
   else
     protocol =  NDPI_PROTOCOL_SSL_NO_CERT;
@@ -90,68 +91,247 @@ static void ndpi_int_ssl_add_connection(struct ndpi_detection_module_struct *ndp
   }
 }
 
+/*
+  TLS handshake parser: the records and the handshake messages are walked
+  by their lengths, up to the bytes available in the packet, so that only
+  the ClientHello extensions and the first certificate of the Certificate
+  message are read.
+*/
+
+#define SSL_HANDSHAKE_CLIENT_HELLO  0x01
+#define SSL_HANDSHAKE_SERVER_HELLO  0x02
+#define SSL_HANDSHAKE_CERTIFICATE   0x0b
+
 /* Can't call libc functions from kernel space, define some stub instead */
 
 #define ndpi_isalpha(ch) (((ch) >= 'a' && (ch) <= 'z') || ((ch) >= 'A' && (ch) <= 'Z'))
 #define ndpi_isdigit(ch) ((ch) >= '0' && (ch) <= '9')
-#define ndpi_isspace(ch) (((ch) >= '\t' && (ch) <= '\r') || ((ch) == ' '))
-#define ndpi_isprint(ch) ((ch) >= 0x20 && (ch) <= 0x7e)
-#define ndpi_ispunct(ch) (((ch) >= '!' && (ch) <= '/') ||	\
-			  ((ch) >= ':' && (ch) <= '@') ||	\
-			  ((ch) >= '[' && (ch) <= '`') ||	\
-			  ((ch) >= '{' && (ch) <= '~'))
-
-static void stripCertificateTrailer(char *buffer, int buffer_len) {
-
-  int i, is_puny;
-
-  //  printf("->%s<-\n", buffer);
-
-  for(i = 0; i < buffer_len; i++) {
-    // printf("%c [%d]\n", buffer[i], buffer[i]);
-
-    if((buffer[i] != '.')
-       && (buffer[i] != '-')
-       && (buffer[i] != '_')
-       && (buffer[i] != '*')
-       && (!ndpi_isalpha(buffer[i]))
-       && (!ndpi_isdigit(buffer[i]))) {
-      buffer[i] = '\0';
-      buffer_len = i;
-      break;
+#define ndpi_ishostchar(ch) (ndpi_isalpha(ch) || ndpi_isdigit(ch)			\
+			     || ((ch) == '.') || ((ch) == '-') || ((ch) == '_') || ((ch) == '*'))
+
+/* Copies the host name, truncated at the first character not allowed in host names */
+static int ssl_copy_name(char *buffer, int buffer_len, const u_int8_t *name, u_int32_t name_len) {
+  int len = 0;
+
+  while((len < buffer_len - 1) && (len < (int)name_len) && ndpi_ishostchar(name[len])) {
+    buffer[len] = name[len];
+    len++;
+  }
+
+  buffer[len] = '\0';
+  return(len);
+}
+
+/* ************************************ */
+
+/*
+  DER element at data[*offset], within end: on return *offset is the
+  first byte of the content, of *len bytes (possibly beyond end). Returns
+  the tag, or 0 when the element header is not available.
+*/
+static u_int8_t ssl_der_element(const u_int8_t *data, u_int32_t end, u_int32_t *offset, u_int32_t *len) {
+  u_int32_t o = *offset, num_bytes;
+  u_int8_t tag;
+
+  if(o + 2 > end)
+    return(0);
+
+  tag = data[o++], *len = data[o++];
+
+  if(*len & 0x80) {
+    num_bytes = *len & 0x7F;
+
+    if((num_bytes == 0) || (num_bytes > 3) || (o + num_bytes > end))
+      return(0);
+
+    for(*len = 0; num_bytes > 0; num_bytes--)
+      *len = (*len << 8) | data[o++];
+  }
+
+  *offset = o;
+  return(tag);
+}
+
+/* Skips a DER element, provided that it is complete */
+static int ssl_der_skip(const u_int8_t *data, u_int32_t end, u_int32_t *offset, u_int8_t tag) {
+  u_int32_t o = *offset, len;
+
+  if((ssl_der_element(data, end, &o, &len) != tag) || (o + len > end))
+    return(-1);
+
+  *offset = o + len;
+  return(0);
+}
+
+/* ************************************ */
+
+/* Looks for the commonName attribute (2.5.4.3) of a X.509 Name */
+static int ssl_cert_common_name(const u_int8_t *data, u_int32_t offset, u_int32_t end,
+				const u_int8_t **name, u_int32_t *name_len) {
+  u_int32_t set_end, len, oid_len;
+
+  while(ssl_der_element(data, end, &offset, &len) == 0x31 /* SET */) {
+    set_end = ndpi_min(offset + len, end);
+
+    if((ssl_der_element(data, set_end, &offset, &len) == 0x30 /* SEQUENCE */)
+       && (ssl_der_element(data, set_end, &offset, &oid_len) == 0x06 /* OID */)
+       && (oid_len == 3) && (offset + 3 <= set_end)
+       && (data[offset] == 0x55) && (data[offset+1] == 0x04) && (data[offset+2] == 0x03)) {
+      offset += 3;
+
+      if(ssl_der_element(data, set_end, &offset, &len) != 0) {
+	*name = &data[offset], *name_len = ndpi_min(len, set_end - offset);
+	return(1);
+      }
     }
+
+    offset = set_end;
   }
 
-  /* check for punycode encoding */
-  is_puny = check_punycode_string(buffer, buffer_len);
+  return(0);
+}
 
-  // not a punycode string - need more checks
-  if(is_puny == 0) {
+/* Looks for the first dNSName of the subjectAltName extension (2.5.29.17) */
+static int ssl_cert_alt_name(const u_int8_t *data, u_int32_t offset, u_int32_t end,
+			     const u_int8_t **name, u_int32_t *name_len) {
+  u_int32_t ext_end, len, oid_len;
+  u_int8_t tag;
 
-    if(i > 0) i--;
+  while(ssl_der_element(data, end, &offset, &len) == 0x30 /* Extension */) {
+    ext_end = ndpi_min(offset + len, end);
 
-    while(i > 0) {
-      if(!ndpi_isalpha(buffer[i])) {
-	buffer[i] = '\0';
-	buffer_len = i;
-	i--;
-      } else
-	break;
+    if((ssl_der_element(data, ext_end, &offset, &oid_len) == 0x06 /* OID */)
+       && (oid_len == 3) && (offset + 3 <= ext_end)
+       && (data[offset] == 0x55) && (data[offset+1] == 0x1d) && (data[offset+2] == 0x11)) {
+      offset += 3;
+
+      if((offset < ext_end) && (data[offset] == 0x01 /* critical */)
+	 && (ssl_der_skip(data, ext_end, &offset, 0x01) != 0))
+	return(0);
+
+      if((ssl_der_element(data, ext_end, &offset, &len) != 0x04 /* OCTET STRING */)
+	 || (ssl_der_element(data, ext_end, &offset, &len) != 0x30 /* GeneralNames */))
+	return(0);
+
+      while((tag = ssl_der_element(data, ext_end, &offset, &len)) != 0) {
+	if(tag == 0x82 /* dNSName */) {
+	  *name = &data[offset], *name_len = ndpi_min(len, ext_end - offset);
+	  return(1);
+	}
+
+	offset += len;
+      }
+
+      return(0);
     }
 
-    for(i = buffer_len; i > 0; i--) {
-      if(buffer[i] == '.') break;
-      else if(ndpi_isdigit(buffer[i]))
-	buffer[i] = '\0', buffer_len = i;
+    offset = ext_end;
+  }
+
+  return(0);
+}
+
+/*
+  Server name of a X.509 certificate: the subject commonName when it looks
+  like a host name, the first subjectAltName dNSName otherwise
+*/
+static int ssl_cert_server_name(const u_int8_t *data, u_int32_t offset, u_int32_t end,
+				char *buffer, int buffer_len) {
+  const u_int8_t *cn = NULL, *alt_name;
+  u_int32_t len, cn_len = 0, alt_name_len;
+
+  if((ssl_der_element(data, end, &offset, &len) != 0x30 /* Certificate */)
+     || (ssl_der_element(data, end, &offset, &len) != 0x30 /* TBSCertificate */))
+    return(0);
+
+  if((offset < end) && (data[offset] == 0xA0 /* version */) && (ssl_der_skip(data, end, &offset, 0xA0) != 0))
+    return(0);
+
+  if((ssl_der_skip(data, end, &offset, 0x02 /* serialNumber */) != 0)
+     || (ssl_der_skip(data, end, &offset, 0x30 /* signature */) != 0)
+     || (ssl_der_skip(data, end, &offset, 0x30 /* issuer */) != 0)
+     || (ssl_der_skip(data, end, &offset, 0x30 /* validity */) != 0)
+     || (ssl_der_element(data, end, &offset, &len) != 0x30 /* subject */))
+    return(0);
+
+  if(ssl_cert_common_name(data, offset, ndpi_min(offset + len, end), &cn, &cn_len)
+     && (ssl_copy_name(buffer, buffer_len, cn, cn_len) == cn_len) && (strchr(buffer, '.') != NULL))
+    return(1);
+
+  /* subjectPublicKeyInfo, then the optional issuerUniqueID and subjectUniqueID */
+  offset += len;
+  if(ssl_der_skip(data, end, &offset, 0x30) != 0)
+    return(0);
+
+  if((offset < end) && (data[offset] == 0x81) && (ssl_der_skip(data, end, &offset, 0x81) != 0))
+    return(0);
+  if((offset < end) && (data[offset] == 0x82) && (ssl_der_skip(data, end, &offset, 0x82) != 0))
+    return(0);
+
+  if((ssl_der_element(data, end, &offset, &len) == 0xA3 /* extensions */)
+     && (ssl_der_element(data, end, &offset, &len) == 0x30)
+     && ssl_cert_alt_name(data, offset, ndpi_min(offset + len, end), &alt_name, &alt_name_len)
+     && (ssl_copy_name(buffer, buffer_len, alt_name, alt_name_len) > 0))
+    return(1);
+
+  /* Not a host name, better than nothing */
+  return(cn_len && (ssl_copy_name(buffer, buffer_len, cn, cn_len) > 0));
+}
+
+/* ************************************ */
+
+/* Server name extension of a ClientHello (message body at data[offset]) */
+static int ssl_client_hello_server_name(struct ndpi_flow_struct *flow,
+					const u_int8_t *data, u_int32_t offset, u_int32_t end,
+					char *buffer, int buffer_len) {
+  u_int32_t extensions_end;
+
+  /* client_version, random, session_id */
+  offset += 2 + 32;
+  if(offset + 1 > end) return(0);
+  offset += 1 + data[offset];
+
+  flow->l4.tcp.ssl_seen_client_cert = 1;
+
+  /* cipher_suites, compression_methods */
+  if(offset + 2 > end) return(0);
+  offset += 2 + ntohs(get_u_int16_t(data, offset));
+  if(offset + 1 > end) return(0);
+  offset += 1 + data[offset];
+
+  if(offset + 2 > end) return(0);
+  extensions_end = ndpi_min(offset + 2 + ntohs(get_u_int16_t(data, offset)), end);
+  offset += 2;
+
+  while(offset + 4 <= extensions_end) {
+    u_int16_t extension_id = ntohs(get_u_int16_t(data, offset));
+    u_int16_t extension_len = ntohs(get_u_int16_t(data, offset + 2));
+
+    offset += 4;
+
+    if(extension_id == 0 /* server_name */) {
+      /* server_name_list length, name_type (host_name) and length */
+      if((offset + 5 > extensions_end) || (data[offset + 2] != 0))
+	return(0);
+
+      return(ssl_copy_name(buffer, buffer_len, &data[offset + 5],
+			   ndpi_min(ntohs(get_u_int16_t(data, offset + 3)), extensions_end - (offset + 5))) > 0);
     }
+
+    offset += extension_len;
   }
+
+  return(0);
 }
 
-/* Code fixes courtesy of Alexsandro Brahm <alex@digistar.com.br> */
+/* ************************************ */
+
 int getSSLcertificate(struct ndpi_detection_module_struct *ndpi_struct,
 		      struct ndpi_flow_struct *flow,
 		      char *buffer, int buffer_len) {
   struct ndpi_packet_struct *packet = &flow->packet;
+  const u_int8_t *data = packet->payload;
+  u_int32_t avail = packet->payload_packet_len, record = 0;
 
 #ifdef CERTIFICATE_DEBUG
   {
@@ -161,156 +341,95 @@ int getSSLcertificate(struct ndpi_detection_module_struct *ndpi_struct,
   }
 #endif
 
-  /*
-    Nothing matched so far: let's decode the certificate with some heuristics
-    Patches courtesy of Denys Fedoryshchenko <nuclearcat@nuclearcat.com>
-  */
-  if(packet->payload[0] == 0x16 /* Handshake */) {
-    u_int16_t total_len  = (packet->payload[3] << 8) + packet->payload[4] + 5 /* SSL Header */;
-    u_int8_t handshake_protocol = packet->payload[5]; /* handshake protocol a bit misleading, it is message type according TLS specs */
+  memset(buffer, 0, buffer_len);
 
-    memset(buffer, 0, buffer_len);
+  /* Handshake records, each holding one or more handshake messages */
+  while((record + 5 < avail) && (data[record] == 0x16 /* Handshake */)) {
+    u_int32_t record_end = record + 5 + ntohs(get_u_int16_t(data, record + 3));
+    u_int32_t message = record + 5, end = ndpi_min(record_end, avail);
 
-    /* Truncate total len, search at least in incomplete packet */
-    if(total_len > packet->payload_packet_len)
-      total_len = packet->payload_packet_len;
+    while(message + 4 <= end) {
+      u_int32_t message_end = message + 4 + ((data[message + 1] << 16) | ntohs(get_u_int16_t(data, message + 2)));
 
-    /* At least "magic" 3 bytes, null for string end, otherwise no need to waste cpu cycles */
-    if(total_len > 4) {
-      int i;
+      switch(data[message]) {
+      case SSL_HANDSHAKE_CLIENT_HELLO:
+	if(ssl_client_hello_server_name(flow, data, message + 4, ndpi_min(message_end, end), buffer, buffer_len)) {
+	  if(ndpi_flow_cold(flow))
+	    snprintf(flow->cold->protos.ssl.client_certificate,
+		     sizeof(flow->cold->protos.ssl.client_certificate), "%s", buffer);
+	  return(2 /* Client Certificate */);
+	}
+	return(0);
 
-      if(handshake_protocol == 0x02 || handshake_protocol == 0xb /* Server Hello and Certificate message types are interesting for us */) {
-	u_int num_found = 0;
+      case SSL_HANDSHAKE_SERVER_HELLO:
+	flow->l4.tcp.ssl_seen_server_cert = 1;
+	break;
 
+      case SSL_HANDSHAKE_CERTIFICATE:
 	flow->l4.tcp.ssl_seen_server_cert = 1;
 
-	/* Check after handshake protocol header (5 bytes) and message header (4 bytes) */
-	for(i = 9; i < packet->payload_packet_len-3; i++) {
-	  if(((packet->payload[i] == 0x04) && (packet->payload[i+1] == 0x03) && (packet->payload[i+2] == 0x0c))
-	     || ((packet->payload[i] == 0x04) && (packet->payload[i+1] == 0x03) && (packet->payload[i+2] == 0x13))
-	     || ((packet->payload[i] == 0x55) && (packet->payload[i+1] == 0x04) && (packet->payload[i+2] == 0x03))) {
-	    u_int8_t server_len = packet->payload[i+3];
-
-	    if(packet->payload[i] == 0x55) {
-	      num_found++;
-
-	      if(num_found != 2) continue;
-	    }
-
-	    if(server_len+i+3 < packet->payload_packet_len) {
-	      char *server_name = (char*)&packet->payload[i+4];
-	      u_int8_t begin = 0, len, j, num_dots;
-
-	      while(begin < server_len) {
-		if(!ndpi_isprint(server_name[begin]))
-		  begin++;
-		else
-		  break;
-	      }
-
-	      // len = ndpi_min(server_len-begin, buffer_len-1);
-	      len = buffer_len-1;
-	      strncpy(buffer, &server_name[begin], len);
-	      buffer[len] = '\0';
-
-	      /* We now have to check if this looks like an IP address or host name */
-	      for(j=0, num_dots = 0; j<len; j++) {
-		if(!ndpi_isprint((buffer[j]))) {
-		  num_dots = 0; /* This is not what we look for */
-		  break;
-		} else if(buffer[j] == '.') {
-		  num_dots++;
-		  if(num_dots >=2) break;
-		}
-	      }
-
-	      if(num_dots >= 2) {
-		stripCertificateTrailer(buffer, buffer_len);
-		snprintf(flow->protos.ssl.server_certificate,
-			 sizeof(flow->protos.ssl.server_certificate), "%s", buffer);
-		return(1 /* Server Certificate */);
-	      }
-	    }
-	  }
+	/* certificate_list length, then the length of the first (server) certificate */
+	if(ssl_cert_server_name(data, message + 4 + 3 + 3, ndpi_min(message_end, end), buffer, buffer_len)) {
+	  if(ndpi_flow_cold(flow))
+	    snprintf(flow->cold->protos.ssl.server_certificate,
+		     sizeof(flow->cold->protos.ssl.server_certificate), "%s", buffer);
+	  return(1 /* Server Certificate */);
 	}
-      } else if(handshake_protocol == 0x01 /* Client Hello */) {
-	u_int offset, base_offset = 43;
-	if (base_offset + 2 <= packet->payload_packet_len)
-	  {
-	    u_int16_t session_id_len = packet->payload[base_offset];
-
-	    if((session_id_len+base_offset+2) <= total_len) {
-	      u_int16_t cypher_len =  packet->payload[session_id_len+base_offset+2] + (packet->payload[session_id_len+base_offset+1] << 8);
-	      offset = base_offset + session_id_len + cypher_len + 2;
-
-	      flow->l4.tcp.ssl_seen_client_cert = 1;
-
-	      if(offset < total_len) {
-		u_int16_t compression_len;
-		u_int16_t extensions_len;
-
-		compression_len = packet->payload[offset+1];
-		offset += compression_len + 3;
-
-		if(offset < total_len) {
-		  extensions_len = packet->payload[offset];
-
-		  if((extensions_len+offset) < total_len) {
-		    /* Move to the first extension
-		       Type is u_int to avoid possible overflow on extension_len addition */
-		    u_int extension_offset = 1;
-
-		    while(extension_offset < extensions_len) {
-		      u_int16_t extension_id, extension_len;
-
-		      memcpy(&extension_id, &packet->payload[offset+extension_offset], 2);
-		      extension_offset += 2;
-
-		      memcpy(&extension_len, &packet->payload[offset+extension_offset], 2);
-		      extension_offset += 2;
-
-		      extension_id = ntohs(extension_id), extension_len = ntohs(extension_len);
-
-		      if(extension_id == 0) {
-			u_int begin = 0,len;
-			char *server_name = (char*)&packet->payload[offset+extension_offset];
-
-			while(begin < extension_len) {
-			  if((!ndpi_isprint(server_name[begin]))
-			     || ndpi_ispunct(server_name[begin])
-			     || ndpi_isspace(server_name[begin]))
-			    begin++;
-			  else
-			    break;
-			}
-
-			len = (u_int)ndpi_min(extension_len-begin, buffer_len-1);
-			strncpy(buffer, &server_name[begin], len);
-			buffer[len] = '\0';
-			stripCertificateTrailer(buffer, buffer_len);
-
-			snprintf(flow->protos.ssl.client_certificate,
-				 sizeof(flow->protos.ssl.client_certificate), "%s", buffer);
-
-			/* We're happy now */
-			return(2 /* Client Certificate */);
-		      }
-
-		      extension_offset += extension_len;
-		    }
-		  }
-		}
-	      }
-	    }
-	  }
+	return(0);
       }
+
+      message = message_end;
     }
+
+    record = record_end;
   }
 
   return(0); /* Not found */
 }
 
-int sslTryAndRetrieveServerCertificate(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow) {
+/*
+  Handshake records split across segments: with TCP reassembly enabled
+  (ndpi_set_tcp_reassembly()) the segments are buffered until the last
+  record is complete. Returns 1 if the packet payload has been replaced
+  with the records, 0 when the packet has to be parsed as is and -1
+  while waiting: the payload is then replaced with the records received
+  so far. The payload is restored with ndpi_tcp_stream_restore_payload().
+*/
+static int ssl_reassemble_handshake(struct ndpi_detection_module_struct *ndpi_struct,
+				    struct ndpi_flow_struct *flow) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+  u_int32_t avail = ndpi_tcp_stream_len(flow, NDPI_PROTOCOL_SSL), end = 0;
+  const u_int8_t *data = avail ? ndpi_tcp_stream_get(ndpi_struct, flow, NDPI_PROTOCOL_SSL, avail) : packet->payload;
+
+  if(avail == 0)
+    avail = packet->payload_packet_len;
+
+  if((avail == 0) || (data[0] != 0x16 /* Handshake */))
+    return(0);
+
+  while((end + 5 <= avail) && (data[end] == 0x16))
+    end += 5 + ntohs(get_u_int16_t(data, end + 3));
+
+  if((end < avail) && (end + 5 > avail))
+    end += 5; /* Truncated record header */
+
+  if((end > avail)
+     && (ndpi_tcp_stream_get(ndpi_struct, flow, NDPI_PROTOCOL_SSL, end) == NULL)
+     && ndpi_tcp_stream_pending(flow, NDPI_PROTOCOL_SSL)) {
+    ndpi_tcp_stream_swap_payload(ndpi_struct, flow, NDPI_PROTOCOL_SSL);
+    return(-1);
+  }
+
+  if(ndpi_tcp_stream_swap_payload(ndpi_struct, flow, NDPI_PROTOCOL_SSL))
+    return(1);
+
+  ndpi_tcp_stream_stop(flow, NDPI_PROTOCOL_SSL);
+  return(0);
+}
+
+/* ************************************ */
+
+static int ssl_retrieve_server_certificate(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow) {
   struct ndpi_packet_struct *packet = &flow->packet;
 
   /* consider only specific SSL packets (handshake) */
@@ -322,7 +441,7 @@ int sslTryAndRetrieveServerCertificate(struct ndpi_detection_module_struct *ndpi
     packet->ssl_certificate_num_checks++;
     if (rc > 0) {
       packet->ssl_certificate_detected++;
-      if (flow->protos.ssl.server_certificate[0] != '\0')
+      if (flow->cold && (flow->cold->protos.ssl.server_certificate[0] != '\0'))
         /* 0 means we're done processing extra packets (since we found what we wanted) */
         return 0;
     }
@@ -340,6 +459,26 @@ int sslTryAndRetrieveServerCertificate(struct ndpi_detection_module_struct *ndpi
   return 1;
 }
 
+int sslTryAndRetrieveServerCertificate(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow) {
+  struct ndpi_packet_struct *packet = &flow->packet;
+  u_int8_t num_checks = packet->ssl_certificate_num_checks;
+  int reassembled = ssl_reassemble_handshake(ndpi_struct, flow);
+  int rc = ssl_retrieve_server_certificate(ndpi_struct, flow);
+
+  ndpi_tcp_stream_restore_payload(flow);
+
+  if((reassembled == -1) && (rc == 1)) {
+    /* Incomplete records: wait for the rest of them */
+    packet->ssl_certificate_num_checks = num_checks;
+    return 1;
+  }
+
+  if(reassembled)
+    ndpi_tcp_stream_stop(flow, NDPI_PROTOCOL_SSL);
+
+  return rc;
+}
+
 void sslInitExtraPacketProcessing(int caseNum, struct ndpi_flow_struct *flow) {
   flow->check_extra_packets = 1;
   /* 0 is the case for waiting for the server certificate */
@@ -375,7 +514,8 @@ int sslDetectProtocolFromCertificate(struct ndpi_detection_module_struct *ndpi_s
     /* If we've detected the subprotocol from client certificate but haven't had a chance
       * to see the server certificate yet, set up extra packet processing to wait
       * a few more packets. */
-    if((flow->protos.ssl.client_certificate[0] != '\0') && (flow->protos.ssl.server_certificate[0] == '\0')) {
+    if(flow->cold && (flow->cold->protos.ssl.client_certificate[0] != '\0')
+       && (flow->cold->protos.ssl.server_certificate[0] == '\0')) {
       sslInitExtraPacketProcessing(0, flow);
     }
     ndpi_set_detected_protocol(ndpi_struct, flow, subproto,
@@ -392,8 +532,8 @@ int sslDetectProtocolFromCertificate(struct ndpi_detection_module_struct *ndpi_s
 	  && flow->l4.tcp.seen_syn
 	  && flow->l4.tcp.seen_syn_ack
 	  && flow->l4.tcp.seen_ack /* We have seen the 3-way handshake */)
-	 || (flow->protos.ssl.server_certificate[0] != '\0')
-	 /* || (flow->protos.ssl.client_certificate[0] != '\0') */
+	 || (flow->cold && (flow->cold->protos.ssl.server_certificate[0] != '\0'))
+	 /* || (flow->cold->protos.ssl.client_certificate[0] != '\0') */
 	 ) {
 	ndpi_int_ssl_add_connection(ndpi_struct, flow, NDPI_PROTOCOL_SSL);
      }
@@ -599,7 +739,7 @@ static u_int8_t ndpi_search_sslv3_direction1(struct ndpi_detection_module_struct
   return 0;
 }
 
-void ndpi_search_ssl_tcp(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow)
+static void ndpi_check_ssl_tcp(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow)
 {
   struct ndpi_packet_struct *packet = &flow->packet;
   u_int8_t ret;
@@ -710,6 +850,35 @@ void ndpi_search_ssl_tcp(struct ndpi_detection_module_struct *ndpi_struct, struc
   return;
 }
 
+void ndpi_search_ssl_tcp(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow)
+{
+  struct ndpi_packet_struct *packet = &flow->packet;
+  int reassembled = 0;
+
+  if((packet->detected_protocol_stack[0] != NDPI_PROTOCOL_SSL)
+     && ((reassembled = ssl_reassemble_handshake(ndpi_struct, flow)) == -1)) {
+    u_int8_t num_checks = packet->ssl_certificate_num_checks;
+
+    NDPI_LOG_DBG2(ndpi_struct, "ssl handshake split across segments\n");
+
+    /* Meanwhile look for the certificates in the records received so far */
+    sslDetectProtocolFromCertificate(ndpi_struct, flow);
+    packet->ssl_certificate_num_checks = num_checks;
+    ndpi_tcp_stream_restore_payload(flow);
+
+    if(packet->detected_protocol_stack[0] != NDPI_PROTOCOL_UNKNOWN)
+      ndpi_tcp_stream_stop(flow, NDPI_PROTOCOL_SSL);
+    return;
+  }
+
+  ndpi_check_ssl_tcp(ndpi_struct, flow);
+
+  if(reassembled) {
+    ndpi_tcp_stream_restore_payload(flow);
+    ndpi_tcp_stream_stop(flow, NDPI_PROTOCOL_SSL);
+  }
+}
+
 
 void init_ssl_dissector(struct ndpi_detection_module_struct *ndpi_struct, u_int32_t *id, NDPI_PROTOCOL_BITMASK *detection_bitmask)
 {
@@ -39,9 +39,9 @@ static void ndpi_check_steam_http(struct ndpi_detection_module_struct *ndpi_stru
   struct ndpi_packet_struct *packet = &flow->packet;
 	
   NDPI_PARSE_PACKET_LINE_INFO(ndpi_struct, flow, packet);
-  if (packet->user_agent_line.ptr != NULL 
-      && packet->user_agent_line.len >= 23 
-      && memcmp(packet->user_agent_line.ptr, "Valve/Steam HTTP Client", 23) == 0) {
+  if (packet->lines->user_agent_line.ptr != NULL 
+      && packet->lines->user_agent_line.len >= 23 
+      && memcmp(packet->lines->user_agent_line.ptr, "Valve/Steam HTTP Client", 23) == 0) {
     NDPI_LOG_INFO(ndpi_struct, "found STEAM\n");
     ndpi_int_steam_add_connection(ndpi_struct, flow);
   }
@@ -57,7 +57,7 @@ void ndpi_search_tcp_or_udp(struct ndpi_detection_module_struct *ndpi_struct, st
   u_int proto;
   struct ndpi_packet_struct *packet = &flow->packet;
 
-  if(flow->host_server_name[0] != '\0')
+  if(flow->cold && (flow->cold->host_server_name[0] != '\0'))
     return;
 
   if(ndpi_is_tor_flow(ndpi_struct, flow)) {
@@ -69,7 +69,12 @@ void ndpi_search_tcp_or_udp(struct ndpi_detection_module_struct *ndpi_struct, st
   else if(packet->tcp) sport = ntohs(packet->tcp->source), dport = ntohs(packet->tcp->dest);
   else sport = dport = 0;
   
-  if(packet->iph /* IPv4 Only: we need to support packet->iphv6 at some point */) {
+  if(packet->iph
+#ifdef NDPI_DETECTION_SUPPORT_IPV6
+     || packet->iphv6
+#endif
+     ) {
+    /* The addresses are only looked up without a flow: they are ignored for IPv6 */
     proto = ndpi_search_tcp_or_udp_raw(ndpi_struct,
 				       flow,
 				       flow->packet.iph ? flow->packet.iph->protocol :
@@ -78,8 +83,8 @@ void ndpi_search_tcp_or_udp(struct ndpi_detection_module_struct *ndpi_struct, st
 #else
 				       0,
 #endif
-				       ntohl(packet->iph->saddr), 
-				       ntohl(packet->iph->daddr),
+				       packet->iph ? ntohl(packet->iph->saddr) : 0,
+				       packet->iph ? ntohl(packet->iph->daddr) : 0,
 				       sport, dport);
 
     if(proto != NDPI_PROTOCOL_UNKNOWN)
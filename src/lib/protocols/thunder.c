@@ -113,18 +113,18 @@ void ndpi_int_search_thunder_tcp(struct ndpi_detection_module_struct
 
     NDPI_LOG_DBG2(ndpi_struct,
 	     "maybe thunder http POST packet detected, parsed packet lines: %u, empty line set %u (at: %u)\n",
-	     packet->parsed_lines, packet->empty_line_position_set, packet->empty_line_position);
-
-    if (packet->empty_line_position_set != 0 &&
-	packet->content_line.ptr != NULL &&
-	packet->content_line.len == 24 &&
-	memcmp(packet->content_line.ptr, "application/octet-stream",
-	       24) == 0 && packet->empty_line_position_set < (packet->payload_packet_len - 8)
-	&& packet->payload[packet->empty_line_position + 2] >= 0x30
-	&& packet->payload[packet->empty_line_position + 2] < 0x40
-	&& packet->payload[packet->empty_line_position + 3] == 0x00
-	&& packet->payload[packet->empty_line_position + 4] == 0x00
-	&& packet->payload[packet->empty_line_position + 5] == 0x00) {
+	     packet->lines->parsed_lines, packet->lines->empty_line_position_set, packet->lines->empty_line_position);
+
+    if (packet->lines->empty_line_position_set != 0 &&
+	packet->lines->content_line.ptr != NULL &&
+	packet->lines->content_line.len == 24 &&
+	memcmp(packet->lines->content_line.ptr, "application/octet-stream",
+	       24) == 0 && packet->lines->empty_line_position_set < (packet->payload_packet_len - 8)
+	&& packet->payload[packet->lines->empty_line_position + 2] >= 0x30
+	&& packet->payload[packet->lines->empty_line_position + 2] < 0x40
+	&& packet->payload[packet->lines->empty_line_position + 3] == 0x00
+	&& packet->payload[packet->lines->empty_line_position + 4] == 0x00
+	&& packet->payload[packet->lines->empty_line_position + 5] == 0x00) {
       NDPI_LOG_INFO(ndpi_struct,
 	       "found thunder http POST packet application does match\n");
       ndpi_int_thunder_add_connection(ndpi_struct, flow);
@@ -171,21 +171,21 @@ void ndpi_int_search_thunder_http(struct ndpi_detection_module_struct
     NDPI_LOG_DBG2(ndpi_struct, "HTTP packet detected\n");
     ndpi_parse_packet_line_info(ndpi_struct, flow);
 
-    if (packet->parsed_lines > 7
-	&& packet->parsed_lines < 11
-	&& packet->line[1].len > 10
-	&& memcmp(packet->line[1].ptr, "Accept: */*", 11) == 0
-	&& packet->line[2].len > 22
-	&& memcmp(packet->line[2].ptr, "Cache-Control: no-cache",
-		  23) == 0 && packet->line[3].len > 16
-	&& memcmp(packet->line[3].ptr, "Connection: close", 17) == 0
-	&& packet->line[4].len > 6
-	&& memcmp(packet->line[4].ptr, "Host: ", 6) == 0
-	&& packet->line[5].len > 15
-	&& memcmp(packet->line[5].ptr, "Pragma: no-cache", 16) == 0
-	&& packet->user_agent_line.ptr != NULL
-	&& packet->user_agent_line.len > 49
-	&& memcmp(packet->user_agent_line.ptr,
+    if (packet->lines->parsed_lines > 7
+	&& packet->lines->parsed_lines < 11
+	&& packet->lines->line[1].len > 10
+	&& memcmp(packet->lines->line[1].ptr, "Accept: */*", 11) == 0
+	&& packet->lines->line[2].len > 22
+	&& memcmp(packet->lines->line[2].ptr, "Cache-Control: no-cache",
+		  23) == 0 && packet->lines->line[3].len > 16
+	&& memcmp(packet->lines->line[3].ptr, "Connection: close", 17) == 0
+	&& packet->lines->line[4].len > 6
+	&& memcmp(packet->lines->line[4].ptr, "Host: ", 6) == 0
+	&& packet->lines->line[5].len > 15
+	&& memcmp(packet->lines->line[5].ptr, "Pragma: no-cache", 16) == 0
+	&& packet->lines->user_agent_line.ptr != NULL
+	&& packet->lines->user_agent_line.len > 49
+	&& memcmp(packet->lines->user_agent_line.ptr,
 		  "Mozilla/4.0 (compatible; MSIE 6.0; Windows NT 5.0)", 50) == 0) {
       NDPI_LOG_INFO(ndpi_struct,
 	       "found thunder HTTP download detected\n");
@@ -58,8 +58,8 @@ void ndpi_search_tvuplayer(struct ndpi_detection_module_struct *ndpi_struct, str
 
       if (memcmp(packet->payload, "POST", 4) || memcmp(packet->payload, "GET", 3)) {
 	NDPI_PARSE_PACKET_LINE_INFO(ndpi_struct, flow, packet);
-	if (packet->user_agent_line.ptr != NULL &&
-	    packet->user_agent_line.len >= 8 && (memcmp(packet->user_agent_line.ptr, "MacTVUP", 7) == 0)) {
+	if (packet->lines->user_agent_line.ptr != NULL &&
+	    packet->lines->user_agent_line.len >= 8 && (memcmp(packet->lines->user_agent_line.ptr, "MacTVUP", 7) == 0)) {
 	  NDPI_LOG_INFO(ndpi_struct, "Found user agent as MacTVUP\n");
 	  ndpi_int_tvuplayer_add_connection(ndpi_struct, flow);
 	  return;
@@ -39,20 +39,24 @@ void ndpi_search_whois_das(struct ndpi_detection_module_struct *ndpi_struct, str
 
       if(packet->payload_packet_len > 0) {
 	
-	u_int max_len = sizeof(flow->host_server_name) - 1;
-	u_int i, j;
-	
-	for(i=strlen((const char *)flow->host_server_name), j=0; (i<max_len) && (j<packet->payload_packet_len); i++, j++) {
+	if(ndpi_flow_cold(flow)) {
+	  u_char *host_server_name = flow->cold->host_server_name;
+	  u_int max_len = sizeof(flow->cold->host_server_name) - 1;
+	  u_int i, j;
+
+	  for(i=strlen((const char *)host_server_name), j=0; (i<max_len) && (j<packet->payload_packet_len); i++, j++) {
+
+	    if((packet->payload[j] == '\n') || (packet->payload[j] == '\r')) break;
+
+	    host_server_name[i] = packet->payload[j];
+	  }
 
-	  if((packet->payload[j] == '\n') || (packet->payload[j] == '\r')) break;
-	  
-	  flow->host_server_name[i] = packet->payload[j];
+	  host_server_name[i] = '\0';
+	  NDPI_LOG_INFO(ndpi_struct, "[WHOIS/DAS] %s\n", host_server_name);
 	}
-	
-	flow->host_server_name[i] = '\0';
+
 	flow->server_id = ((sport == 43) || (sport == 4343)) ? flow->src : flow->dst;
-	
-	NDPI_LOG_INFO(ndpi_struct, "[WHOIS/DAS] %s\n", flow->host_server_name);
+
 	ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_WHOIS_DAS, NDPI_PROTOCOL_UNKNOWN);
 	return;
       }
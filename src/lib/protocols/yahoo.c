@@ -152,50 +152,50 @@ static void ndpi_search_yahoo_tcp(struct ndpi_detection_module_struct *ndpi_stru
 	  u_int16_t a;
 	  ndpi_parse_packet_line_info(ndpi_struct, flow);
 
-	  if ((packet->user_agent_line.len >= 21)
-	      && (memcmp(packet->user_agent_line.ptr, "YahooMobileMessenger/", 21) == 0)) {
+	  if ((packet->lines->user_agent_line.len >= 21)
+	      && (memcmp(packet->lines->user_agent_line.ptr, "YahooMobileMessenger/", 21) == 0)) {
 	    NDPI_LOG_INFO(ndpi_struct, "found YAHOO(Mobile)");
 	    ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
 	    return;
 	  }
 	  
 	  if (NDPI_SRC_OR_DST_HAS_PROTOCOL(src, dst, NDPI_PROTOCOL_YAHOO)
-	      && packet->parsed_lines > 5
+	      && packet->lines->parsed_lines > 5
 	      && memcmp(&packet->payload[5], "/Messenger.", 11) == 0
-	      && packet->line[1].len >= 17
-	      && memcmp(packet->line[1].ptr, "Connection: Close",
-			17) == 0 && packet->line[2].len >= 6
-	      && memcmp(packet->line[2].ptr, "Host: ", 6) == 0
-	      && packet->line[3].len >= 16
-	      && memcmp(packet->line[3].ptr, "Content-Length: ",
-			16) == 0 && packet->line[4].len >= 23
-	      && memcmp(packet->line[4].ptr, "User-Agent: Mozilla/5.0",
-			23) == 0 && packet->line[5].len >= 23
-	      && memcmp(packet->line[5].ptr, "Cache-Control: no-cache", 23) == 0) {
+	      && packet->lines->line[1].len >= 17
+	      && memcmp(packet->lines->line[1].ptr, "Connection: Close",
+			17) == 0 && packet->lines->line[2].len >= 6
+	      && memcmp(packet->lines->line[2].ptr, "Host: ", 6) == 0
+	      && packet->lines->line[3].len >= 16
+	      && memcmp(packet->lines->line[3].ptr, "Content-Length: ",
+			16) == 0 && packet->lines->line[4].len >= 23
+	      && memcmp(packet->lines->line[4].ptr, "User-Agent: Mozilla/5.0",
+			23) == 0 && packet->lines->line[5].len >= 23
+	      && memcmp(packet->lines->line[5].ptr, "Cache-Control: no-cache", 23) == 0) {
 	    NDPI_LOG_INFO(ndpi_struct, "found YAHOO HTTP POST P2P FILETRANSFER\n");
 	    ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
 	    return;
 	  }
 
-	  if (packet->host_line.ptr != NULL && packet->host_line.len >= 26 &&
-	      memcmp(packet->host_line.ptr, "filetransfer.msg.yahoo.com", 26) == 0) {
+	  if (packet->lines->host_line.ptr != NULL && packet->lines->host_line.len >= 26 &&
+	      memcmp(packet->lines->host_line.ptr, "filetransfer.msg.yahoo.com", 26) == 0) {
 	    NDPI_LOG_INFO(ndpi_struct, "found YAHOO HTTP POST FILETRANSFER\n");
 	    ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
 	    return;
 	  }
 	  /* now check every line */
-	  for (a = 0; a < packet->parsed_lines; a++) {
-	    if (packet->line[a].len >= 4 && memcmp(packet->line[a].ptr, "YMSG", 4) == 0) {
+	  for (a = 0; a < packet->lines->parsed_lines; a++) {
+	    if (packet->lines->line[a].len >= 4 && memcmp(packet->lines->line[a].ptr, "YMSG", 4) == 0) {
 	      NDPI_LOG_DBG(ndpi_struct,
-		       "YAHOO HTTP POST FOUND, line is: %.*s\n", packet->line[a].len, packet->line[a].ptr);
+		       "YAHOO HTTP POST FOUND, line is: %.*s\n", packet->lines->line[a].len, packet->lines->line[a].ptr);
 	      NDPI_LOG_INFO(ndpi_struct, "found YAHOO");
 	      ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
 	      return;
 	    }
 	  }
-	  if (packet->parsed_lines > 8 && packet->line[8].len > 250 && packet->line[8].ptr != NULL) {
-	    if (memcmp(packet->line[8].ptr, "<Session ", 9) == 0) {
-	      if (ndpi_check_for_YmsgCommand(packet->line[8].len, packet->line[8].ptr)) {
+	  if (packet->lines->parsed_lines > 8 && packet->lines->line[8].len > 250 && packet->lines->line[8].ptr != NULL) {
+	    if (memcmp(packet->lines->line[8].ptr, "<Session ", 9) == 0) {
+	      if (ndpi_check_for_YmsgCommand(packet->lines->line[8].len, packet->lines->line[8].ptr)) {
 		NDPI_LOG_INFO(ndpi_struct,
 			 "found YAHOO HTTP Proxy Yahoo Chat <Ymsg Command= pattern  \n");
 		ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
@@ -216,16 +216,16 @@ static void ndpi_search_yahoo_tcp(struct ndpi_detection_module_struct *ndpi_stru
 
 	if((memcmp(packet->payload, "GET /", 5) == 0)) {
 	  ndpi_parse_packet_line_info(ndpi_struct, flow);
-	  if((packet->user_agent_line.ptr != NULL && packet->user_agent_line.len >= NDPI_STATICSTRING_LEN("YahooMobileMessenger/")
-	      && memcmp(packet->user_agent_line.ptr, "YahooMobileMessenger/", NDPI_STATICSTRING_LEN("YahooMobileMessenger/")) == 0)
-	     || (packet->user_agent_line.len >= 15 && (memcmp(packet->user_agent_line.ptr, "Y!%20Messenger/", 15) == 0))) {
+	  if((packet->lines->user_agent_line.ptr != NULL && packet->lines->user_agent_line.len >= NDPI_STATICSTRING_LEN("YahooMobileMessenger/")
+	      && memcmp(packet->lines->user_agent_line.ptr, "YahooMobileMessenger/", NDPI_STATICSTRING_LEN("YahooMobileMessenger/")) == 0)
+	     || (packet->lines->user_agent_line.len >= 15 && (memcmp(packet->lines->user_agent_line.ptr, "Y!%20Messenger/", 15) == 0))) {
 	    
 	    NDPI_LOG_INFO(ndpi_struct, "found YAHOO(Mobile)");
 	    ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
 	    return;
 	  }
-	  if(packet->host_line.ptr != NULL && packet->host_line.len >= NDPI_STATICSTRING_LEN("msg.yahoo.com") &&
-	     memcmp(&packet->host_line.ptr[packet->host_line.len - NDPI_STATICSTRING_LEN("msg.yahoo.com")], "msg.yahoo.com", NDPI_STATICSTRING_LEN("msg.yahoo.com")) == 0) {
+	  if(packet->lines->host_line.ptr != NULL && packet->lines->host_line.len >= NDPI_STATICSTRING_LEN("msg.yahoo.com") &&
+	     memcmp(&packet->lines->host_line.ptr[packet->lines->host_line.len - NDPI_STATICSTRING_LEN("msg.yahoo.com")], "msg.yahoo.com", NDPI_STATICSTRING_LEN("msg.yahoo.com")) == 0) {
 	    NDPI_LOG_INFO(ndpi_struct, "found YAHOO");
 	    ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
 	    return;
@@ -238,10 +238,10 @@ static void ndpi_search_yahoo_tcp(struct ndpi_detection_module_struct *ndpi_stru
 
 	ndpi_parse_packet_line_info(ndpi_struct, flow);
 	
-	if (packet->parsed_lines > 2 && packet->line[1].len == 0) {
+	if (packet->lines->parsed_lines > 2 && packet->lines->line[1].len == 0) {
 	  
 	  NDPI_LOG_DBG(ndpi_struct, "first line is empty\n");
-	  if (packet->line[2].len > 13 && memcmp(packet->line[2].ptr, "<Ymsg Command=", 14) == 0) {
+	  if (packet->lines->line[2].len > 13 && memcmp(packet->lines->line[2].ptr, "<Ymsg Command=", 14) == 0) {
 
 	    NDPI_LOG_INFO(ndpi_struct, "YAHOO web chat found\n");
 	    ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
@@ -339,12 +339,12 @@ static void ndpi_search_yahoo_tcp(struct ndpi_detection_module_struct *ndpi_stru
 
 	    ndpi_parse_packet_line_info_any(ndpi_struct, flow);
 
-	    if (packet->parsed_lines >= 9) {
+	    if (packet->lines->parsed_lines >= 9) {
 
-	      if (packet->line[4].ptr != NULL && packet->line[4].len >= 9 &&
-		  packet->line[8].ptr != NULL && packet->line[8].len >= 6 &&
-		  memcmp(packet->line[4].ptr, "<Session ", 9) == 0 &&
-		  memcmp(packet->line[8].ptr, "<Ymsg ", 6) == 0) {
+	      if (packet->lines->line[4].ptr != NULL && packet->lines->line[4].len >= 9 &&
+		  packet->lines->line[8].ptr != NULL && packet->lines->line[8].len >= 6 &&
+		  memcmp(packet->lines->line[4].ptr, "<Session ", 9) == 0 &&
+		  memcmp(packet->lines->line[8].ptr, "<Ymsg ", 6) == 0) {
 
 		NDPI_LOG_INFO(ndpi_struct, "found YAHOO over HTTP proxy");
 		ndpi_set_detected_protocol(ndpi_struct, flow, NDPI_PROTOCOL_YAHOO, NDPI_PROTOCOL_UNKNOWN);
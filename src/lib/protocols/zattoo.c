@@ -37,8 +37,8 @@ __forceinline static
 #endif
 u_int8_t ndpi_int_zattoo_user_agent_set(struct ndpi_detection_module_struct *ndpi_struct, struct ndpi_flow_struct *flow)
 {
-  if(flow->packet.user_agent_line.ptr != NULL && flow->packet.user_agent_line.len == 111) {
-    if(memcmp(flow->packet.user_agent_line.ptr + flow->packet.user_agent_line.len - 25, "Zattoo/4", sizeof("Zattoo/4") - 1) == 0) {
+  if(flow->packet.lines->user_agent_line.ptr != NULL && flow->packet.lines->user_agent_line.len == 111) {
+    if(memcmp(flow->packet.lines->user_agent_line.ptr + flow->packet.lines->user_agent_line.len - 25, "Zattoo/4", sizeof("Zattoo/4") - 1) == 0) {
       NDPI_LOG_DBG(ndpi_struct, "found zattoo useragent\n");
       return 1;
     }
@@ -90,8 +90,8 @@ void ndpi_search_zattoo(struct ndpi_detection_module_struct *ndpi_struct, struct
       
       ndpi_parse_packet_line_info(ndpi_struct, flow);
       
-      for(i = 0; i < packet->parsed_lines; i++) {
-	if(packet->line[i].len >= 18 && (memcmp(packet->line[i].ptr, "User-Agent: Zattoo", 18) == 0)) {
+      for(i = 0; i < packet->lines->parsed_lines; i++) {
+	if(packet->lines->line[i].len >= 18 && (memcmp(packet->lines->line[i].ptr, "User-Agent: Zattoo", 18) == 0)) {
 	  
 	  NDPI_LOG_INFO(ndpi_struct, "found zattoo. add connection over tcp with pattern POST /channelserver/player/channel/update HTTP/1.1\n");
 	  ZATTOO_DETECTED;
@@ -114,7 +114,7 @@ void ndpi_search_zattoo(struct ndpi_detection_module_struct *ndpi_struct, struct
       ndpi_parse_packet_line_info(ndpi_struct, flow);
 
       // test for unique character of the zattoo header
-      if(packet->parsed_lines == 4 && packet->host_line.ptr != NULL) {
+      if(packet->lines->parsed_lines == 4 && packet->lines->host_line.ptr != NULL) {
 	u_int32_t ip;
 	u_int16_t bytes_read = 0;
 
@@ -122,18 +122,18 @@ void ndpi_search_zattoo(struct ndpi_detection_module_struct *ndpi_struct, struct
 	
 	// and now test the firt 5 bytes of the payload for zattoo pattern
 	if(ip == packet->iph->daddr
-	   && packet->empty_line_position_set != 0
-	   && ((packet->payload_packet_len - packet->empty_line_position) > 10)
-	   && packet->payload[packet->empty_line_position + 2] ==
+	   && packet->lines->empty_line_position_set != 0
+	   && ((packet->payload_packet_len - packet->lines->empty_line_position) > 10)
+	   && packet->payload[packet->lines->empty_line_position + 2] ==
 	   0x03
-	   && packet->payload[packet->empty_line_position + 3] ==
+	   && packet->payload[packet->lines->empty_line_position + 3] ==
 	   0x04
-	   && packet->payload[packet->empty_line_position + 4] ==
+	   && packet->payload[packet->lines->empty_line_position + 4] ==
 	   0x00
-	   && packet->payload[packet->empty_line_position + 5] ==
+	   && packet->payload[packet->lines->empty_line_position + 5] ==
 	   0x04
-	   && packet->payload[packet->empty_line_position + 6] ==
-	   0x0a && packet->payload[packet->empty_line_position + 7] == 0x00) {
+	   && packet->payload[packet->lines->empty_line_position + 6] ==
+	   0x0a && packet->payload[packet->lines->empty_line_position + 7] == 0x00) {
 	  
 	  NDPI_LOG_INFO(ndpi_struct, "found zattoo. add connection over tcp with pattern POST http://\n");
 	  ZATTOO_DETECTED;
@@ -23,6 +23,52 @@
 
 #include "node.h"
 
+/* Compiled automata.
+ * ac_automata_finalize() packs the trie into a single memory block: input
+ * bytes are mapped to alphabet classes (bytes not used by any pattern share
+ * class 0), states are numbered in breadth-first order and the shallowest
+ * AC_DFA_DENSE_STATES ones get a full transition row with failure links
+ * already resolved. Deeper states keep a sparse row that also contains the
+ * edges inherited through failure links, plus the dense state to use when
+ * none matches. Each input byte thus costs exactly one transition.
+ * ac_automata_save() writes the compiled automata as a position independent
+ * image that ac_automata_load() uses in place (e.g. from a read-only
+ * mapping of a file) without rebuilding the trie. */
+#define AC_DFA_DENSE_STATES 1024
+
+typedef struct
+{
+  unsigned int patterns; /* Offset of the accepted patterns in AC_DFA_t.patterns */
+  unsigned int match_num; /* Number of accepted patterns; 0 if not final */
+  unsigned int failure; /* Sparse states: dense state used if no edge matches */
+  unsigned int edges; /* Sparse states: offset of the row in AC_DFA_t.edges */
+  unsigned int edges_num; /* Sparse states: number of edges in the row */
+  unsigned int depth; /* Distance from the root */
+} AC_DFA_STATE_t;
+
+typedef struct
+{
+  unsigned int alpha; /* Alphabet class */
+  unsigned int next; /* Target state */
+} AC_DFA_EDGE_t;
+
+typedef struct
+{
+  unsigned short alpha_map[256]; /* Input byte to alphabet class */
+  unsigned int alpha_num; /* Number of alphabet classes */
+  unsigned int states_num; /* Number of states (root is 0) */
+  unsigned int dense_num; /* States below dense_num have a full row */
+  unsigned int edges_num; /* Number of sparse edges */
+  unsigned int patterns_num; /* Number of accepted patterns (of all states) */
+  unsigned int strings_len; /* Size of strings */
+  AC_PATTERN_t * patterns;
+  AC_DFA_STATE_t * states;
+  AC_DFA_EDGE_t * edges;
+  unsigned int * dense; /* dense_num rows of alpha_num target states */
+  AC_ALPHABET_t * strings; /* Paths of the final states: the patterns point
+			      here, so the compiled automata owns its strings */
+} AC_DFA_t;
+
 typedef struct
 {
   /* The root of the Aho-Corasick trie */
@@ -51,19 +97,46 @@ typedef struct
   AC_NODE_t * current_node; /* Pointer to current node while searching */
   unsigned long base_position; /* Represents the position of current chunk
 				  related to whole input text */
+  unsigned int current_state; /* Same as current_node for the compiled automata */
+
+  /* Compiled automata, built when the automata is finalized (NULL if the
+   * allocation failed: the trie is used instead). An automata returned by
+   * ac_automata_load() has no trie (root is NULL) */
+  AC_DFA_t * dfa;
 
   /* Statistic Variables */
   unsigned long total_patterns; /* Total patterns in the automata */
 
 } AC_AUTOMATA_t;
 
+/* Searching state kept by the caller (usually on its stack) so that a
+ * finalized automata is never written while searching and can be shared by
+ * several threads. see ac_automata_search_r() */
+typedef struct
+{
+  AC_NODE_t * current_node; /* Pointer to current node while searching */
+  unsigned long base_position; /* Represents the position of current chunk
+				  related to whole input text */
+  unsigned int current_state; /* Same as current_node for the compiled automata */
+  AC_MATCH_t match; /* Any match is reported with this */
+  MATCH_CALBACK_f match_callback; /* Defaults to the automata call-back */
+  /* The call-back can set this to the length of the best match found so far:
+   * the compiled automata stops searching as soon as no longer match can end
+   * in the remaining text. 0 means search the whole text */
+  unsigned int stop_length;
+} AC_SEARCH_t;
+
 
 AC_AUTOMATA_t * ac_automata_init     (MATCH_CALBACK_f mc);
 AC_ERROR_t      ac_automata_add      (AC_AUTOMATA_t * thiz, AC_PATTERN_t * str);
 void            ac_automata_finalize (AC_AUTOMATA_t * thiz);
 int             ac_automata_search   (AC_AUTOMATA_t * thiz, AC_TEXT_t * str, void * param);
+void            ac_automata_search_init (AC_AUTOMATA_t * thiz, AC_SEARCH_t * state);
+int             ac_automata_search_r (AC_AUTOMATA_t * thiz, AC_SEARCH_t * state, AC_TEXT_t * str, void * param);
 void            ac_automata_reset    (AC_AUTOMATA_t * thiz);
 void            ac_automata_release  (AC_AUTOMATA_t * thiz);
 void            ac_automata_display  (AC_AUTOMATA_t * thiz, char repcast);
+size_t          ac_automata_save     (AC_AUTOMATA_t * thiz, void * image, size_t len);
+AC_AUTOMATA_t * ac_automata_load     (const void * image, size_t len, MATCH_CALBACK_f mc);
 
 #endif
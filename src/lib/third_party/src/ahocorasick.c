@@ -38,6 +38,10 @@ static void ac_automata_set_failure
 (AC_AUTOMATA_t * thiz, AC_NODE_t * node, AC_ALPHABET_t * alphas);
 static void ac_automata_traverse_setfailure
 (AC_AUTOMATA_t * thiz, AC_NODE_t * node, AC_ALPHABET_t * alphas);
+static void ac_automata_compile
+(AC_AUTOMATA_t * thiz);
+static int ac_automata_search_dfa
+(AC_AUTOMATA_t * thiz, AC_SEARCH_t * state, AC_TEXT_t * txt, void * param);
 
 
 /******************************************************************************
@@ -129,6 +133,9 @@ void ac_automata_finalize (AC_AUTOMATA_t * thiz)
   AC_ALPHABET_t *alphas;
   AC_NODE_t * node;
 
+  if(!thiz->automata_open)
+    return;
+
   if((alphas = ndpi_malloc(AC_PATTRN_MAX_LENGTH)) != NULL) {
     ac_automata_traverse_setfailure (thiz, thiz->root, alphas);
 
@@ -140,6 +147,8 @@ void ac_automata_finalize (AC_AUTOMATA_t * thiz)
       }
     thiz->automata_open = 0; /* do not accept patterns any more */
     ndpi_free(alphas);
+
+    ac_automata_compile (thiz);
   }
 }
 
@@ -149,6 +158,8 @@ void ac_automata_finalize (AC_AUTOMATA_t * thiz)
  * call the call-back function. and the call-back function in turn after doing
  * its job, will return an integer value to ac_automata_search(). 0 value means
  * continue search, and non-0 value means stop search and return to the caller.
+ * The searching state is kept inside the automata: use ac_automata_search_r()
+ * when the automata is shared.
  * PARAMS:
  * AC_AUTOMATA_t * thiz: the pointer to the automata
  * AC_TEXT_t * txt: the input text that must be searched
@@ -160,6 +171,62 @@ void ac_automata_finalize (AC_AUTOMATA_t * thiz)
  *  1: success; stop searching; call-back sent me a non-0 value
  ******************************************************************************/
 int ac_automata_search (AC_AUTOMATA_t * thiz, AC_TEXT_t * txt, void * param)
+{
+  AC_SEARCH_t state;
+  int rc;
+
+  state.current_node = thiz->current_node;
+  state.current_state = thiz->current_state;
+  state.base_position = thiz->base_position;
+  state.match = thiz->match;
+  state.match_callback = thiz->match_callback;
+  state.stop_length = 0;
+
+  rc = ac_automata_search_r (thiz, &state, txt, param);
+
+  thiz->match = state.match;
+  if (rc == 0)
+    {
+      thiz->current_node = state.current_node;
+      thiz->current_state = state.current_state;
+      thiz->base_position = state.base_position;
+    }
+
+  return rc;
+}
+
+/******************************************************************************
+ * FUNCTION: ac_automata_search_init
+ * Make the searching state ready for doing a new search on a new text.
+ * PARAMS:
+ * AC_AUTOMATA_t * thiz: the pointer to the automata
+ * AC_SEARCH_t * state: the searching state to initialize
+ ******************************************************************************/
+void ac_automata_search_init (AC_AUTOMATA_t * thiz, AC_SEARCH_t * state)
+{
+  state->current_node = thiz->root;
+  state->current_state = 0;
+  state->base_position = 0;
+  memset (&state->match, 0, sizeof(state->match));
+  state->match_callback = thiz->match_callback;
+  state->stop_length = 0;
+}
+
+/******************************************************************************
+ * FUNCTION: ac_automata_search_r
+ * Reentrant version of ac_automata_search(): the automata is only read and
+ * the searching state lives in 'state', initialized by
+ * ac_automata_search_init(). chunks searched with the same state are
+ * considered related.
+ * PARAMS:
+ * AC_AUTOMATA_t * thiz: the pointer to the (finalized) automata
+ * AC_SEARCH_t * state: the caller searching state
+ * AC_TEXT_t * txt: the input text that must be searched
+ * void * param: this parameter will be send to call-back function
+ * RETURN VALUE: same as ac_automata_search()
+ ******************************************************************************/
+int ac_automata_search_r (AC_AUTOMATA_t * thiz, AC_SEARCH_t * state,
+			  AC_TEXT_t * txt, void * param)
 {
   unsigned long position;
   AC_NODE_t *curr;
@@ -169,8 +236,11 @@ int ac_automata_search (AC_AUTOMATA_t * thiz, AC_TEXT_t * txt, void * param)
     /* you must call ac_automata_locate_failure() first */
     return -1;
 
+  if(thiz->dfa)
+    return ac_automata_search_dfa (thiz, state, txt, param);
+
   position = 0;
-  curr = thiz->current_node;
+  curr = state->current_node;
 
   /* This is the main search loop.
    * it must be keep as lightweight as possible. */
@@ -194,18 +264,18 @@ int ac_automata_search (AC_AUTOMATA_t * thiz, AC_TEXT_t * txt, void * param)
 	 * transition or due to a fail. in second case we should not report
 	 * matching because it was reported in previous node */
 	{
-	  thiz->match.position = position + thiz->base_position;
-	  thiz->match.match_num = curr->matched_patterns_num;
-	  thiz->match.patterns = curr->matched_patterns;
+	  state->match.position = position + state->base_position;
+	  state->match.match_num = curr->matched_patterns_num;
+	  state->match.patterns = curr->matched_patterns;
 	  /* we found a match! do call-back */
-	  if (thiz->match_callback(&thiz->match, param))
+	  if (state->match_callback(&state->match, param))
 	    return 1;
 	}
     }
 
   /* save status variables */
-  thiz->current_node = curr;
-  thiz->base_position += position;
+  state->current_node = curr;
+  state->base_position += position;
   return 0;
 }
 
@@ -220,6 +290,7 @@ int ac_automata_search (AC_AUTOMATA_t * thiz, AC_TEXT_t * txt, void * param)
 void ac_automata_reset (AC_AUTOMATA_t * thiz)
 {
   thiz->current_node = thiz->root;
+  thiz->current_state = 0;
   thiz->base_position = 0;
 }
 
@@ -239,7 +310,10 @@ void ac_automata_release (AC_AUTOMATA_t * thiz)
       n = thiz->all_nodes[i];
       node_release(n);
     }
-  ndpi_free(thiz->all_nodes);
+  if(thiz->all_nodes)
+    ndpi_free(thiz->all_nodes);
+  if(thiz->dfa)
+    ndpi_free(thiz->dfa);
   ndpi_free(thiz);
 }
 
@@ -297,6 +371,191 @@ void ac_automata_display (AC_AUTOMATA_t * thiz, char repcast)
     }
 }
 
+/* Image of a compiled automata, followed by the states, the edges and the
+ * dense rows as they are in AC_DFA_t, then by the AC_DFA_IMAGE_PATTERN_t
+ * (8 bytes aligned) and the strings. Only offsets are stored. */
+typedef struct
+{
+  unsigned int alpha_num, states_num, dense_num, edges_num;
+  unsigned int patterns_num, strings_len;
+  unsigned long long total_patterns;
+  unsigned short alpha_map[256];
+} AC_DFA_IMAGE_t;
+
+typedef struct
+{
+  unsigned int astring; /* Offset in the strings */
+  unsigned int length;
+  unsigned long long number; /* rep.number: rep.stringy is not saved */
+} AC_DFA_IMAGE_PATTERN_t;
+
+#define AC_IMAGE_ALIGN(x) (((x) + 7) & ~((size_t)7))
+
+/******************************************************************************
+ * FUNCTION: ac_automata_image_layout
+ * Offsets of the image sections for the given header, returns the image size.
+ ******************************************************************************/
+static size_t ac_automata_image_layout
+(const AC_DFA_IMAGE_t * hdr, size_t * states, size_t * edges, size_t * dense,
+ size_t * patterns, size_t * strings)
+{
+  *states = sizeof(AC_DFA_IMAGE_t);
+  *edges = *states + (size_t)hdr->states_num * sizeof(AC_DFA_STATE_t);
+  *dense = *edges + (size_t)hdr->edges_num * sizeof(AC_DFA_EDGE_t);
+  *patterns = AC_IMAGE_ALIGN(*dense + (size_t)hdr->dense_num * hdr->alpha_num * sizeof(unsigned int));
+  *strings = *patterns + (size_t)hdr->patterns_num * sizeof(AC_DFA_IMAGE_PATTERN_t);
+  return AC_IMAGE_ALIGN(*strings + hdr->strings_len);
+}
+
+/******************************************************************************
+ * FUNCTION: ac_automata_save
+ * Write the image of the compiled automata.
+ * PARAMS:
+ * AC_AUTOMATA_t * thiz: the pointer to the (finalized) automata
+ * void * image: where to write the image (8 bytes aligned), or NULL
+ * size_t len: size of image
+ * RETURN VALUE: the size of the image (the image is written only if it fits
+ * in len bytes), 0 if the automata is not compiled
+ ******************************************************************************/
+size_t ac_automata_save (AC_AUTOMATA_t * thiz, void * image, size_t len)
+{
+  const AC_DFA_t * dfa = thiz->dfa;
+  AC_DFA_IMAGE_t hdr;
+  AC_DFA_IMAGE_PATTERN_t * p;
+  size_t states, edges, dense, patterns, strings, size;
+  unsigned int i;
+
+  if (dfa == NULL)
+    return 0;
+
+  memset (&hdr, 0, sizeof(hdr));
+  hdr.alpha_num = dfa->alpha_num, hdr.states_num = dfa->states_num;
+  hdr.dense_num = dfa->dense_num, hdr.edges_num = dfa->edges_num;
+  hdr.patterns_num = dfa->patterns_num, hdr.strings_len = dfa->strings_len;
+  hdr.total_patterns = thiz->total_patterns;
+  memcpy (hdr.alpha_map, dfa->alpha_map, sizeof(hdr.alpha_map));
+
+  size = ac_automata_image_layout (&hdr, &states, &edges, &dense, &patterns, &strings);
+  if (image == NULL || len < size)
+    return size;
+
+  memset (image, 0, size);
+  memcpy (image, &hdr, sizeof(hdr));
+  memcpy ((char *) image + states, dfa->states, (size_t)dfa->states_num * sizeof(AC_DFA_STATE_t));
+  memcpy ((char *) image + edges, dfa->edges, (size_t)dfa->edges_num * sizeof(AC_DFA_EDGE_t));
+  memcpy ((char *) image + dense, dfa->dense, (size_t)dfa->dense_num * dfa->alpha_num * sizeof(unsigned int));
+  memcpy ((char *) image + strings, dfa->strings, dfa->strings_len);
+
+  p = (AC_DFA_IMAGE_PATTERN_t *) ((char *) image + patterns);
+  for (i=0; i < dfa->patterns_num; i++)
+    {
+      p[i].astring = dfa->patterns[i].astring - dfa->strings;
+      p[i].length = dfa->patterns[i].length;
+      p[i].number = dfa->patterns[i].rep.number;
+    }
+
+  return size;
+}
+
+/******************************************************************************
+ * FUNCTION: ac_automata_load
+ * Create a finalized automata from an image written by ac_automata_save().
+ * The states, the edges and the strings are used in place: the image must
+ * stay unchanged (it is never written) until the automata is released.
+ * PARAMS:
+ * const void * image: the image (8 bytes aligned)
+ * size_t len: size of image
+ * MATCH_CALBACK_f mc: call-back function
+ * RETURN VALUE: the automata, NULL if the image is not valid
+ ******************************************************************************/
+AC_AUTOMATA_t * ac_automata_load (const void * image, size_t len, MATCH_CALBACK_f mc)
+{
+  const AC_DFA_IMAGE_t * hdr = (const AC_DFA_IMAGE_t *) image;
+  const AC_DFA_IMAGE_PATTERN_t * p;
+  const AC_DFA_STATE_t * st;
+  const AC_DFA_EDGE_t * e;
+  const unsigned int * dense;
+  AC_AUTOMATA_t * thiz;
+  AC_DFA_t * dfa;
+  size_t states, edges, dense_off, patterns, strings;
+  unsigned int i;
+
+  if (((size_t) image & 7) || len < sizeof(AC_DFA_IMAGE_t))
+    return NULL;
+
+  /* Nothing in the image is trusted before being checked */
+  if (hdr->alpha_num == 0 || hdr->alpha_num > 257
+      || hdr->states_num == 0 || hdr->states_num > (1U << 30)
+      || hdr->dense_num == 0 || hdr->dense_num > hdr->states_num
+      || hdr->edges_num > (1U << 30) || hdr->patterns_num > (1U << 30))
+    return NULL;
+
+  if (ac_automata_image_layout (hdr, &states, &edges, &dense_off, &patterns, &strings) > len)
+    return NULL;
+
+  for (i=0; i < 256; i++)
+    if (hdr->alpha_map[i] >= hdr->alpha_num)
+      return NULL;
+
+  st = (const AC_DFA_STATE_t *) ((const char *) image + states);
+  e = (const AC_DFA_EDGE_t *) ((const char *) image + edges);
+  dense = (const unsigned int *) ((const char *) image + dense_off);
+  p = (const AC_DFA_IMAGE_PATTERN_t *) ((const char *) image + patterns);
+
+  for (i=0; i < hdr->states_num; i++)
+    if ((i >= hdr->dense_num && st[i].failure >= hdr->dense_num)
+	|| st[i].edges > hdr->edges_num || st[i].edges_num > hdr->edges_num - st[i].edges
+	|| st[i].patterns > hdr->patterns_num || st[i].match_num > hdr->patterns_num - st[i].patterns)
+      return NULL;
+
+  for (i=0; i < hdr->edges_num; i++)
+    if (e[i].alpha >= hdr->alpha_num || e[i].next >= hdr->states_num)
+      return NULL;
+
+  for (i=0; i < hdr->dense_num * hdr->alpha_num; i++)
+    if (dense[i] >= hdr->states_num)
+      return NULL;
+
+  for (i=0; i < hdr->patterns_num; i++)
+    if (p[i].astring > hdr->strings_len || p[i].length > hdr->strings_len - p[i].astring)
+      return NULL;
+
+  thiz = (AC_AUTOMATA_t *) ndpi_malloc (sizeof(AC_AUTOMATA_t));
+  dfa = (AC_DFA_t *) ndpi_malloc (sizeof(AC_DFA_t) + (size_t)hdr->patterns_num * sizeof(AC_PATTERN_t));
+  if (thiz == NULL || dfa == NULL)
+    {
+      if (thiz) ndpi_free (thiz);
+      if (dfa) ndpi_free (dfa);
+      return NULL;
+    }
+
+  memset (dfa, 0, sizeof(AC_DFA_t));
+  memcpy (dfa->alpha_map, hdr->alpha_map, sizeof(dfa->alpha_map));
+  dfa->alpha_num = hdr->alpha_num, dfa->states_num = hdr->states_num;
+  dfa->dense_num = hdr->dense_num, dfa->edges_num = hdr->edges_num;
+  dfa->patterns_num = hdr->patterns_num, dfa->strings_len = hdr->strings_len;
+  dfa->patterns = (AC_PATTERN_t *) &dfa[1];
+  dfa->states = (AC_DFA_STATE_t *) st;
+  dfa->edges = (AC_DFA_EDGE_t *) e;
+  dfa->dense = (unsigned int *) dense;
+  dfa->strings = (AC_ALPHABET_t *) image + strings;
+
+  for (i=0; i < dfa->patterns_num; i++)
+    {
+      dfa->patterns[i].astring = &dfa->strings[p[i].astring];
+      dfa->patterns[i].length = p[i].length;
+      dfa->patterns[i].rep.number = p[i].number;
+    }
+
+  memset (thiz, 0, sizeof(AC_AUTOMATA_t));
+  thiz->match_callback = mc;
+  thiz->total_patterns = hdr->total_patterns;
+  thiz->dfa = dfa;
+  ac_automata_reset (thiz);
+
+  return thiz;
+}
+
 /******************************************************************************
  * FUNCTION: ac_automata_register_nodeptr
  * Adds the node pointer to all_nodes.
@@ -385,3 +644,233 @@ static void ac_automata_traverse_setfailure
       ac_automata_traverse_setfailure (thiz, next, alphas);
     }
 }
+
+/******************************************************************************
+ * FUNCTION: ac_automata_merge_row
+ * Collect the edges of a sparse state: its own edges plus the ones inherited
+ * from the sparse states of its failure chain (own edges take precedence).
+ * Returns the number of edges and sets the dense state ending the chain.
+ ******************************************************************************/
+static unsigned int ac_automata_merge_row
+(AC_DFA_t * dfa, AC_NODE_t * node, unsigned int * stamp, unsigned int mark,
+ AC_DFA_EDGE_t * row, unsigned int * failure)
+{
+  unsigned int i, num = 0, alpha;
+  AC_NODE_t * n;
+
+  for (n = node; n->dfa_state >= dfa->dense_num; n = n->failure_node)
+    {
+      for (i=0; i < n->outgoing_degree; i++)
+	{
+	  alpha = dfa->alpha_map[(unsigned char)n->outgoing[i].alpha];
+	  if (stamp[alpha] != mark)
+	    {
+	      stamp[alpha] = mark;
+	      if (row)
+		{
+		  row[num].alpha = alpha;
+		  row[num].next = n->outgoing[i].next->dfa_state;
+		}
+	      num++;
+	    }
+	}
+    }
+
+  *failure = n->dfa_state;
+  return num;
+}
+
+/******************************************************************************
+ * FUNCTION: ac_automata_compile
+ * Build the compiled automata (see AC_DFA_t) of a finalized automata. On
+ * allocation failure thiz->dfa stays NULL and searches use the trie.
+ ******************************************************************************/
+static void ac_automata_compile (AC_AUTOMATA_t * thiz)
+{
+  AC_DFA_t hdr, * dfa;
+  AC_NODE_t ** queue, * n;
+  AC_PATTERN_t * p;
+  AC_ALPHABET_t * alphas = NULL, * path;
+  unsigned int * stamp, * parent = NULL;
+  unsigned int head, tail, i, j, k, failure, edges_num;
+  unsigned char used[256];
+  size_t len;
+
+  if (thiz->dfa)
+    return;
+
+  queue = (AC_NODE_t **) ndpi_malloc (thiz->all_nodes_num * sizeof(AC_NODE_t *));
+  stamp = (unsigned int *) ndpi_malloc (257 * sizeof(unsigned int));
+  if (queue == NULL || stamp == NULL)
+    goto out;
+
+  parent = (unsigned int *) ndpi_malloc (thiz->all_nodes_num * sizeof(unsigned int));
+  alphas = (AC_ALPHABET_t *) ndpi_malloc (thiz->all_nodes_num * sizeof(AC_ALPHABET_t));
+  if (parent == NULL || alphas == NULL)
+    goto out;
+
+  /* Breadth-first numbering: a failure node always precedes its node */
+  queue[0] = thiz->root, thiz->root->dfa_state = 0;
+  for (head = 0, tail = 1; head < tail; head++)
+    {
+      n = queue[head];
+      for (i=0; i < n->outgoing_degree; i++)
+	{
+	  n->outgoing[i].next->dfa_state = tail;
+	  parent[tail] = head, alphas[tail] = n->outgoing[i].alpha;
+	  queue[tail++] = n->outgoing[i].next;
+	}
+    }
+
+  memset (&hdr, 0, sizeof(hdr));
+  memset (used, 0, sizeof(used));
+  for (i=0; i < tail; i++)
+    {
+      for (j=0; j < queue[i]->outgoing_degree; j++)
+	used[(unsigned char)queue[i]->outgoing[j].alpha] = 1;
+
+      if (queue[i]->final)
+	{
+	  hdr.patterns_num += queue[i]->matched_patterns_num;
+	  hdr.strings_len += queue[i]->depth;
+	}
+    }
+
+  hdr.alpha_num = 1;
+  for (i=0; i < 256; i++)
+    hdr.alpha_map[i] = used[i] ? hdr.alpha_num++ : 0;
+
+  hdr.states_num = tail;
+  hdr.dense_num = (tail < AC_DFA_DENSE_STATES) ? tail : AC_DFA_DENSE_STATES;
+
+  memset (stamp, 0, 257 * sizeof(unsigned int));
+  for (i = hdr.dense_num, edges_num = 0; i < hdr.states_num; i++)
+    edges_num += ac_automata_merge_row (&hdr, queue[i], stamp, i, NULL, &failure);
+  hdr.edges_num = edges_num;
+
+  len = sizeof(AC_DFA_t)
+    + hdr.patterns_num * sizeof(AC_PATTERN_t)
+    + hdr.states_num * sizeof(AC_DFA_STATE_t)
+    + edges_num * sizeof(AC_DFA_EDGE_t)
+    + (size_t)hdr.dense_num * hdr.alpha_num * sizeof(unsigned int)
+    + hdr.strings_len;
+
+  if ((dfa = (AC_DFA_t *) ndpi_malloc (len)) == NULL)
+    goto out;
+
+  *dfa = hdr;
+  dfa->patterns = (AC_PATTERN_t *) &dfa[1];
+  dfa->states = (AC_DFA_STATE_t *) &dfa->patterns[dfa->patterns_num];
+  dfa->edges = (AC_DFA_EDGE_t *) &dfa->states[dfa->states_num];
+  dfa->dense = (unsigned int *) &dfa->edges[edges_num];
+  dfa->strings = (AC_ALPHABET_t *) &dfa->dense[dfa->dense_num * dfa->alpha_num];
+
+  /* Every accepted pattern is a suffix of the path of its state */
+  p = dfa->patterns, path = dfa->strings;
+  for (i=0; i < dfa->states_num; i++)
+    {
+      n = queue[i];
+      dfa->states[i].patterns = p - dfa->patterns;
+      dfa->states[i].match_num = n->final ? n->matched_patterns_num : 0;
+      dfa->states[i].failure = dfa->states[i].edges = dfa->states[i].edges_num = 0;
+      dfa->states[i].depth = n->depth;
+
+      if (!n->final)
+	continue;
+
+      for (j = i, k = n->depth; k > 0; j = parent[j])
+	path[--k] = alphas[j];
+
+      for (j=0; j < n->matched_patterns_num; j++, p++)
+	{
+	  *p = n->matched_patterns[j];
+	  p->astring = &path[n->depth - p->length];
+	}
+      path += n->depth;
+    }
+
+  /* Dense rows: start from the row of the failure state */
+  memset (dfa->dense, 0, dfa->alpha_num * sizeof(unsigned int));
+  for (i=0; i < dfa->dense_num; i++)
+    {
+      unsigned int * row = &dfa->dense[i * dfa->alpha_num];
+
+      n = queue[i];
+      if (i > 0)
+	memcpy (row, &dfa->dense[n->failure_node->dfa_state * dfa->alpha_num],
+		dfa->alpha_num * sizeof(unsigned int));
+      for (j=0; j < n->outgoing_degree; j++)
+	row[dfa->alpha_map[(unsigned char)n->outgoing[j].alpha]] = n->outgoing[j].next->dfa_state;
+    }
+
+  /* Sparse rows */
+  memset (stamp, 0, 257 * sizeof(unsigned int));
+  for (i = dfa->dense_num, edges_num = 0; i < dfa->states_num; i++)
+    {
+      dfa->states[i].edges = edges_num;
+      dfa->states[i].edges_num = ac_automata_merge_row (dfa, queue[i], stamp, i,
+							 &dfa->edges[edges_num],
+							 &dfa->states[i].failure);
+      edges_num += dfa->states[i].edges_num;
+    }
+
+  thiz->dfa = dfa;
+
+ out:
+  if (queue) ndpi_free (queue);
+  if (stamp) ndpi_free (stamp);
+  if (parent) ndpi_free (parent);
+  if (alphas) ndpi_free (alphas);
+}
+
+/******************************************************************************
+ * FUNCTION: ac_automata_search_dfa
+ * ac_automata_search_r() on the compiled automata.
+ ******************************************************************************/
+static int ac_automata_search_dfa
+(AC_AUTOMATA_t * thiz, AC_SEARCH_t * state, AC_TEXT_t * txt, void * param)
+{
+  const AC_DFA_t * dfa = thiz->dfa;
+  const unsigned char * text = (const unsigned char *) txt->astring;
+  const AC_DFA_STATE_t * st;
+  const AC_DFA_EDGE_t * e, * end;
+  unsigned int curr = state->current_state, alpha;
+  unsigned long position;
+
+  for (position = 0; position < txt->length; position++)
+    {
+      alpha = dfa->alpha_map[text[position]];
+
+      if (curr < dfa->dense_num)
+	curr = dfa->dense[curr * dfa->alpha_num + alpha];
+      else
+	{
+	  st = &dfa->states[curr];
+	  for (e = &dfa->edges[st->edges], end = e + st->edges_num; e < end; e++)
+	    if (e->alpha == alpha)
+	      break;
+	  curr = (e < end) ? e->next : dfa->dense[st->failure * dfa->alpha_num + alpha];
+	}
+
+      st = &dfa->states[curr];
+      if (st->match_num)
+	{
+	  state->match.position = position + 1 + state->base_position;
+	  state->match.match_num = st->match_num;
+	  state->match.patterns = &dfa->patterns[st->patterns];
+	  /* we found a match! do call-back */
+	  if (state->match_callback(&state->match, param))
+	    return 1;
+	}
+
+      /* A match ending later starts within the current state depth */
+      if (state->stop_length
+	  && txt->length - (position + 1) + st->depth <= state->stop_length)
+	return 1;
+    }
+
+  /* save status variables */
+  state->current_state = curr;
+  state->base_position += position;
+  return 0;
+}
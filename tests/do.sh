@@ -3,18 +3,26 @@ READER="../example/ndpiReader -p ../example/protos.txt"
 RC=0
 PCAPS=`cd pcap; /bin/ls *.pcap`
 
+# Options of the pcaps testing a non default configuration
+reader_options() {
+    case "$1" in
+	host_match_most_specific.pcap) echo "-M";;
+	ssl_split_certificate.pcap) echo "-R 65535";;
+    esac
+}
+
 build_results() {
     for f in $PCAPS; do 
 	#echo $f
 	# create result files if not present
-	[ ! -f result/$f.out ] && $READER -q -i pcap/$f -w result/$f.out -v 1
+	[ ! -f result/$f.out ] && $READER `reader_options $f` -q -i pcap/$f -w result/$f.out -v 1
     done
 }
 
 check_results() {
     for f in $PCAPS; do 
 	if [ -f result/$f.out ]; then
-	    CMD="$READER -q -i pcap/$f -w /tmp/reader.out -v 1"
+	    CMD="$READER `reader_options $f` -q -i pcap/$f -w /tmp/reader.out -v 1"
 	    $CMD
 	    NUM_DIFF=`diff result/$f.out /tmp/reader.out | wc -l`
 	    
@@ -32,7 +40,35 @@ check_results() {
     done
 }
 
+# The detections must not change when the detection module is loaded from a
+# snapshot: the first run saves it, the next ones load it
+check_snapshot() {
+    SNAPSHOT=/tmp/reader.snapshot
+
+    /bin/rm -f $SNAPSHOT
+    for f in $PCAPS; do 
+	if [ -f result/$f.out ]; then
+	    CMD="$READER -S $SNAPSHOT `reader_options $f` -q -i pcap/$f -w /tmp/reader.out -v 1"
+	    $CMD
+	    NUM_DIFF=`diff result/$f.out /tmp/reader.out | wc -l`
+	    
+	    if [ $NUM_DIFF -eq 0 ]; then
+		printf "%-32s\tOK\n" "$f (snapshot)"
+	    else
+		printf "%-32s\tERROR\n" "$f (snapshot)"
+		echo "$CMD"
+		diff result/$f.out /tmp/reader.out
+		RC=1
+	    fi
+
+	    /bin/rm /tmp/reader.out
+	fi
+    done
+    /bin/rm -f $SNAPSHOT
+}
+
 build_results
 check_results
+check_snapshot
 
 exit $RC